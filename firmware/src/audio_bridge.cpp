@@ -0,0 +1,918 @@
+#include "audio_bridge.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "esp_timer.h"
+#include "esp_cpu.h"
+
+static const char *const pipe_state_names[] = { "Idle", "Priming", "Streaming", "Draining" };
+static const char *const producer_path_names[] = { "no sink", "suspended", "queued" };
+
+// Returns the peak magnitude of a block of 16-bit samples.
+static int32_t block_peak(const int16_t *samples, size_t count) {
+    int32_t peak = 0;
+    for (size_t i = 0; i < count; ++i) {
+        int32_t v = samples[i];
+        if (v < 0) v = -v;
+        if (v > peak) peak = v;
+    }
+    return peak;
+}
+
+const char *AudioBridge::state_name(pipeline_state_t state) {
+    return pipe_state_names[state];
+}
+
+bool AudioBridge::init(media_ctrl_fn media_ctrl, feedback_fn feedback) {
+    // Byte buffer: xRingbufferReceiveUpTo() and the fill level only work on this type.
+    ring = xRingbufferCreateStatic(RINGBUF_SIZE, RINGBUF_TYPE_BYTEBUF, ring_storage, &ring_struct);
+    this->media_ctrl = media_ctrl;
+    started_us = esp_timer_get_time();
+    consumer.loudness.init(AUDIO_SAMPLE_RATE);
+    channel_mix_init(&consumer.mix, AUDIO_SAMPLE_RATE);
+    consumer.cues.init(AUDIO_SAMPLE_RATE);
+    consumer.splice.init();
+    consumer.rate_feedback.init(AUDIO_SAMPLE_RATE);
+    host_clock.init(AUDIO_SAMPLE_RATE);
+    consumer.jitter.init(AUDIO_SAMPLE_RATE);
+    this->feedback = feedback;
+    if (feedback) feedback(consumer.rate_feedback.value_16_16());
+    return ring != nullptr;
+}
+
+// Drop everything currently queued in the audio ring buffer.
+void AudioBridge::flush_ring() {
+    size_t len;
+    void *item;
+    while ((item = xRingbufferReceiveUpTo(ring, &len, 0, RINGBUF_SIZE)) != NULL) {
+        vRingbufferReturnItem(ring, item);
+    }
+}
+
+// Number of bytes currently queued in the audio ring buffer.
+size_t AudioBridge::ring_fill_bytes() const {
+    return RINGBUF_SIZE - xRingbufferGetCurFreeSize(ring);
+}
+
+// Moves the pipeline from `from` to `to`. Returns false if another context changed it first.
+bool AudioBridge::set_pipe_state(pipeline_state_t from, pipeline_state_t to) {
+    if (!pipe_state.compare_exchange_strong(from, to)) {
+        return false;
+    }
+    printf("Pipeline: %s -> %s\n", pipe_state_names[from], pipe_state_names[to]);
+    return true;
+}
+
+// Host (re)started streaming: drop anything stale and start priming.
+void AudioBridge::usb_stream_started() {
+    pipeline_state_t state = pipe_state.load();
+    if ((state == PIPE_IDLE || state == PIPE_DRAINING) && set_pipe_state(state, PIPE_PRIMING)) {
+        flush_ring();
+        producer.host_starts++;
+    }
+}
+
+// Host stopped streaming: play out what is left in the ring, then go idle.
+void AudioBridge::usb_stream_stopped() {
+    pipeline_state_t state = pipe_state.load();
+    if ((state == PIPE_PRIMING || state == PIPE_STREAMING) && set_pipe_state(state, PIPE_DRAINING)) {
+        host_stops++;
+    }
+}
+
+// UAC streaming interface alt-setting change. Alt 0 means the host closed the stream.
+void AudioBridge::on_alt_setting(uint8_t alt) {
+    if (alt == 0) {
+        usb_stream_stopped();
+    } else {
+        // Opening counts as activity, so the first packet is not taken for a resume after a gap.
+        producer.last_packet_us = esp_timer_get_time();
+        usb_stream_started();
+    }
+}
+
+void AudioBridge::on_sof(uint32_t frame_count) {
+    host_clock.on_sof(frame_count, esp_timer_get_time());
+}
+
+// Suspends the A2DP media stream so the encoder and radio go idle.
+void AudioBridge::suspend_stream(const char *reason) {
+    stream_state_t expected = STREAM_ACTIVE;
+    if (!stream_state.compare_exchange_strong(expected, STREAM_SUSPENDED)) {
+        return;
+    }
+    printf("%s, suspending A2DP stream\n", reason);
+    suspends++;
+    suspend_start_us = esp_timer_get_time();
+    if (media_ctrl) media_ctrl(false);
+    flush_ring();
+}
+
+// Restarts the A2DP media, unless a call's SCO link is pulling the stream: then
+// set_sco_active() restarts it when the call ends.
+void AudioBridge::start_media() {
+    if (media_ctrl && consumer_link.load() == LINK_A2DP) media_ctrl(true);
+}
+
+void AudioBridge::set_sco_active(bool active) {
+    bt_link_t link = active ? LINK_SCO : LINK_A2DP;
+    if (consumer_link.exchange(link) == link) {
+        return;
+    }
+    printf("Stream moved to the %s link\n", active ? "SCO" : "A2DP");
+    if (media_ctrl && stream_state.load() == STREAM_ACTIVE) media_ctrl(!active);
+}
+
+void AudioBridge::close_suspend_interval() {
+    if (suspend_start_us != 0) {
+        suspended_us += esp_timer_get_time() - suspend_start_us;
+        suspend_start_us = 0;
+    }
+}
+
+// Silence detector / suspend-resume state machine, run once per USB packet.
+// Returns false if the packet should not be queued (stream is suspended and the packet is silent).
+bool AudioBridge::update_stream_state(const uint8_t *buf, size_t len) {
+    bool silent = block_peak((const int16_t*) buf, len / 2) < SILENCE_THRESHOLD;
+    producer.silent_frames = silent ? producer.silent_frames + len / AUDIO_FRAME_BYTES : 0;
+
+    switch (stream_state.load()) {
+        case STREAM_ACTIVE:
+            if (producer.silent_frames >= (uint32_t)SILENCE_HOLD_MS * AUDIO_SAMPLE_RATE / 1000) {
+                suspend_stream("Host silent");
+                return false;
+            }
+            return true;
+        case STREAM_SUSPENDED:
+        default:
+            if (silent) {
+                return false;
+            }
+            // First real audio: queue it and restart the stream. The consumer holds
+            // output back until STREAM_PRIME_MS is buffered so the onset is not clipped.
+            printf("Host audio resumed, restarting A2DP stream\n");
+            set_pipe_state(PIPE_STREAMING, PIPE_PRIMING);
+            stream_state = STREAM_ACTIVE;
+            start_media();
+            return true;
+    }
+}
+
+void AudioBridge::account_producer(producer_path_t path, uint32_t start_cycles, size_t len) {
+    producer.cost[path].packets++;
+    producer.cost[path].cycles += (uint32_t)(esp_cpu_get_cycle_count() - start_cycles);
+    producer.usb_profile.stop(start_cycles, len / AUDIO_FRAME_BYTES);
+    trace_end(TRACE_USB_PACKET);
+}
+
+// A2DP audio state: closes the suspend accounting once the stream is running again.
+void AudioBridge::on_audio_state(esp_a2d_audio_state_t state) {
+    if (state == ESP_A2D_AUDIO_STATE_STARTED) {
+        close_suspend_interval();
+    }
+}
+
+// A2DP connection state. Audio queued while the sink was away is stale, so the ring is
+// flushed on both edges, and on connect the pipeline pre-rolls to the jitter depth before
+// read() releases real samples.
+void AudioBridge::on_connection_state(esp_a2d_connection_state_t state) {
+    if (state == ESP_A2D_CONNECTION_STATE_CONNECTED) {
+        bt_connects++;
+        flush_ring();
+        if (!set_pipe_state(PIPE_STREAMING, PIPE_PRIMING)) {
+            set_pipe_state(PIPE_DRAINING, PIPE_IDLE);
+        }
+        if (pipe_state.load() == PIPE_PRIMING) {
+            bt_connect_us = esp_timer_get_time();
+        }
+        bt_connected = true;
+        consumer.cues.trigger(CUE_CONNECTED);
+        printf("A2DP sink connected\n");
+    } else if (state == ESP_A2D_CONNECTION_STATE_DISCONNECTED) {
+        bt_connected = false;
+        bt_connect_us = 0;
+        flush_ring();
+        set_pipe_state(PIPE_STREAMING, PIPE_PRIMING);
+        // The library restarts media on reconnect; close any open suspend interval.
+        close_suspend_interval();
+        stream_state = STREAM_ACTIVE;
+        producer.silent_frames = 0;
+        printf("A2DP sink disconnected, audio ring flushed\n");
+    }
+}
+
+// Control setters: may be called from any context, the audio path picks them up at the next block.
+void AudioBridge::set_mute(bool mute) {
+    params.update([&](control_params_t &p) { p.mute = mute; });
+}
+
+bool AudioBridge::toggle_mute() {
+    bool muted = false;
+    params.update([&](control_params_t &p) { p.mute = !p.mute; muted = p.mute; });
+    return muted;
+}
+
+// Linear gain target from host volume and boost.
+static void update_gain(control_params_t &p) {
+    // We interpret volume as 0-100; anything above (other host ranges) is left at unity.
+    float volume_gain = p.volume < 100 ? p.volume / 100.0f : 1.0f;
+    p.gain = volume_gain * powf(10.0f, p.boost_db / 20.0f);
+}
+
+void AudioBridge::set_volume(uint32_t volume) {
+    params.update([&](control_params_t &p) {
+        p.volume = volume;
+        update_gain(p);
+    });
+}
+
+void AudioBridge::set_boost_db(float boost_db) {
+    if (boost_db < 0.0f) boost_db = 0.0f;
+    if (boost_db > MAX_BOOST_DB) boost_db = MAX_BOOST_DB;
+    params.update([&](control_params_t &p) {
+        p.boost_db = boost_db;
+        update_gain(p);
+    });
+}
+
+void AudioBridge::set_limiter(bool enabled, float ceiling_db, uint16_t release_ms) {
+    if (ceiling_db > 0.0f) ceiling_db = 0.0f;
+    float ceiling = powf(10.0f, ceiling_db / 20.0f);
+    params.update([&](control_params_t &p) {
+        p.limiter = enabled;
+        p.limiter_ceiling = ceiling;
+        if (release_ms > 0) p.limiter_release_ms = release_ms;    // keep it for boost when switched off
+    });
+}
+
+bool AudioBridge::set_eq_band(uint8_t index, const eq_band_t &band) {
+    if (index >= EQ_MAX_BANDS || !eq_band_valid(band, AUDIO_SAMPLE_RATE)) {
+        return false;
+    }
+    // Design outside the writer lock; only the finished set is published.
+    eq_params_t eq = params.read().eq;
+    eq.bands[index] = band;
+    if (index >= eq.band_count) {
+        eq.band_count = index + 1;
+    }
+    eq_update_coeffs(&eq, AUDIO_SAMPLE_RATE);
+    params.update([&](control_params_t &p) { p.eq = eq; });
+    return true;
+}
+
+void AudioBridge::clear_eq() {
+    eq_params_t eq = params.read().eq;
+    eq.band_count = 0;
+    eq_update_coeffs(&eq, AUDIO_SAMPLE_RATE);
+    params.update([&](control_params_t &p) { p.eq = eq; });
+}
+
+void AudioBridge::get_eq(sink_eq_t *rec) const {
+    const eq_params_t eq = params.read().eq;
+    *rec = {};
+    rec->band_count = eq.band_count;
+    memcpy(rec->bands, eq.bands, eq.band_count * sizeof(rec->bands[0]));
+}
+
+void AudioBridge::restore_eq(const sink_eq_t *rec) {
+    eq_params_t eq = params.read().eq;
+    eq.band_count = 0;
+    if (rec != nullptr && rec->band_count <= EQ_MAX_BANDS) {
+        bool valid = true;
+        for (int i = 0; i < rec->band_count; ++i) {
+            valid = valid && eq_band_valid(rec->bands[i], AUDIO_SAMPLE_RATE);
+        }
+        if (valid) {
+            eq.band_count = rec->band_count;
+            memcpy(eq.bands, rec->bands, rec->band_count * sizeof(eq.bands[0]));
+        }
+    }
+    eq_update_coeffs(&eq, AUDIO_SAMPLE_RATE);
+    params.update([&](control_params_t &p) { p.eq = eq; });
+}
+
+bool AudioBridge::set_channel_mode(channel_mode_t mode) {
+    if (mode >= CHANNEL_MODE_COUNT) {
+        return false;
+    }
+    params.update([&](control_params_t &p) { p.channel_mode = mode; });
+    return true;
+}
+
+void AudioBridge::set_loudness_norm(bool enabled, float target_lufs) {
+    params.update([&](control_params_t &p) {
+        p.loudness_norm = enabled;
+        p.loudness_target_lufs = target_lufs;
+    });
+}
+
+// Moves the auto-gain one meter block toward the loudness target.
+void AudioBridge::update_auto_gain(const control_params_t &p) {
+    float lufs = consumer.loudness.short_term_lufs();
+    if (lufs < LOUDNESS_GATE_LUFS || lufs < p.loudness_target_lufs - AGC_HOLD_LU) {
+        return;     // silence or a quiet passage: don't pump it up
+    }
+    float wanted = p.loudness_target_lufs - lufs;
+    if (wanted > AGC_MAX_BOOST_DB) wanted = AGC_MAX_BOOST_DB;
+    if (wanted < -AGC_MAX_CUT_DB) wanted = -AGC_MAX_CUT_DB;
+    float up = AGC_BOOST_DB_PER_S * LOUDNESS_BLOCK_MS / 1000.0f;
+    float down = AGC_CUT_DB_PER_S * LOUDNESS_BLOCK_MS / 1000.0f;
+    float delta = wanted - consumer.auto_gain_db;
+    if (delta > up) delta = up;
+    if (delta < -down) delta = -down;
+    consumer.auto_gain_db += delta;
+    consumer.auto_gain = powf(10.0f, consumer.auto_gain_db / 20.0f);
+}
+
+// Applies the block's gain target, ramping from the current gain so changes don't click.
+// The limiter stays in the path whatever the setting, so its delay never comes or goes
+// mid-stream; when it is off and the gain is at or below unity it only delays. Boosted
+// gain is always limited to the ceiling.
+void AudioBridge::apply_gain(int16_t *samples, size_t frames, const control_params_t &p) {
+    float target = p.mute ? 0.0f : p.gain * consumer.auto_gain;
+    float gain = consumer.gain;
+    bool limit = p.limiter || target > 1.0f || gain > 1.0f;
+    float ceiling = limit ? p.limiter_ceiling : LIMITER_TRANSPARENT_CEILING;
+    float step = 1.0f / ((p.ramp_ms ? p.ramp_ms : 1) * (AUDIO_SAMPLE_RATE / 1000));
+    if (target < gain) step = -step;
+    float *chunk = consumer.scratch;
+    while (frames > 0) {
+        size_t n = frames < GAIN_CHUNK_FRAMES ? frames : GAIN_CHUNK_FRAMES;
+        uint32_t start_cycles = StageProfile::start();
+        for (size_t i = 0; i < n; ++i) {
+            if (gain != target) {
+                gain += step;
+                if ((step > 0 && gain > target) || (step < 0 && gain < target)) gain = target;
+            }
+            for (int c = 0; c < AUDIO_CHANNELS; ++c) {
+                chunk[i * AUDIO_CHANNELS + c] = samples[i * AUDIO_CHANNELS + c] * gain;
+            }
+        }
+        consumer.profile[PROFILE_GAIN].stop(start_cycles, n);
+        start_cycles = StageProfile::start();
+        consumer.limiter.process(chunk, n, ceiling, p.limiter_release_ms, AUDIO_SAMPLE_RATE);
+        consumer.profile[PROFILE_LIMITER].stop(start_cycles, n);
+        start_cycles = StageProfile::start();
+        for (size_t i = 0; i < n * AUDIO_CHANNELS; ++i) {
+            float v = chunk[i];
+            // Clip to 16-bit range in case the limiter is transparent
+            samples[i] = (int16_t)(v > 32767.0f ? 32767.0f : (v < -32768.0f ? -32768.0f : v));
+        }
+        consumer.profile[PROFILE_CONVERT].stop(start_cycles, n);
+        samples += n * AUDIO_CHANNELS;
+        frames -= n;
+    }
+    consumer.gain = gain;
+}
+
+// USB producer: called for every packet the host sends.
+void AudioBridge::on_usb_packet(const uint8_t *buf, size_t len) {
+    if (producer.reset_stats.load(std::memory_order_relaxed)) {
+        reset_producer_stats();
+    }
+    uint32_t start_cycles = esp_cpu_get_cycle_count();
+    // Copy the received audio samples into the ring buffer for the Bluetooth task to consume.
+    if (ring != NULL && buf != NULL && len > 0) {
+        trace_begin(TRACE_USB_PACKET);     // ended in account_producer()
+        timing_log(TIMING_USB_PACKET, len / AUDIO_FRAME_BYTES);
+        // Track packet cadence: a long gap means the host paused without changing alt setting.
+        int64_t now = esp_timer_get_time();
+        int64_t gap = now - producer.last_packet_us.exchange(now);
+        if (gap > (int64_t)USB_STREAM_TIMEOUT_MS * 1000) {
+            usb_stream_stopped();
+            host_clock.reset_packets();
+        } else if (gap > producer.max_packet_gap_us) {
+            producer.max_packet_gap_us = (uint32_t) gap;
+        }
+        usb_stream_started();
+        host_clock.on_packet(len / AUDIO_FRAME_BYTES, now);
+        // No sink connected: nobody will consume the ring, so skip the copy (and the overflow
+        // path it would end in) and just count the packet.
+        if (!bt_connected.load(std::memory_order_relaxed)) {
+            producer.packets_no_sink++;
+#if LEVEL_METER_WITHOUT_SINK
+            int32_t peak = block_peak((const int16_t*) buf, len / 2);
+            if (peak > producer.no_sink_peak) producer.no_sink_peak = peak;
+#endif
+            account_producer(PRODUCER_NO_SINK, start_cycles, len);
+            return;
+        }
+        if (!update_stream_state(buf, len)) {
+            account_producer(PRODUCER_SUSPENDED, start_cycles, len);
+            return;  // suspended on silence, nothing to queue
+        }
+        BaseType_t ok = xRingbufferSend(ring, buf, len, 0);
+        if (!ok) {
+            // Ring buffer overflow: not enough space.
+            producer.overflows++;
+            trace_instant(TRACE_OVERFLOW);
+            timing_log(TIMING_OVERFLOW, 0);
+            // Drop the oldest audio data to make room (to avoid stalling the USB host).
+            size_t recv_len;
+            uint8_t *recv_buf = (uint8_t*) xRingbufferReceiveUpTo(ring, &recv_len, 0, len);
+            if (recv_buf != NULL) {
+                vRingbufferReturnItem(ring, recv_buf);
+            }
+            // Try again to push new data after freeing some space
+            xRingbufferSend(ring, buf, len, 0);
+        }
+        account_producer(PRODUCER_QUEUED, start_cycles, len);
+    }
+}
+
+// Bluetooth consumer: fills `data` with `len` bytes of PCM for the A2DP encoder.
+void AudioBridge::play_cue(cue_id_t cue, bool resume_stream) {
+    consumer.cues.trigger(cue);
+    stream_state_t expected = STREAM_SUSPENDED;
+    if (resume_stream && bt_connected.load() && stream_state.compare_exchange_strong(expected, STREAM_ACTIVE)) {
+        printf("Restarting A2DP stream for %s prompt\n", CueMixer::cue_name(cue));
+        consumer.cue_resumed = true;
+        start_media();
+    }
+}
+
+// Bluetooth consumer: the USB stream with any active cue mixed on top. The consumer state is
+// single-context, so only the owning link gets through, and during a handoff a caller that
+// finds the other one still inside gets silence rather than sharing it.
+int32_t AudioBridge::read(uint8_t *data, int32_t len, bt_link_t link) {
+    if (!data || len <= 0) {
+        return 0;
+    }
+    if (link != consumer_link.load(std::memory_order_acquire) ||
+        consumer_busy.exchange(true, std::memory_order_acquire)) {
+        memset(data, 0, len);
+        return len;
+    }
+    if (consumer.reset_stats.load(std::memory_order_relaxed)) {
+        reset_consumer_stats();
+    }
+    trace_begin(TRACE_BT_READ);
+    timing_log(TIMING_BT_REQUEST, len > 0 ? len / AUDIO_FRAME_BYTES : 0);
+    uint32_t start_cycles = StageProfile::start();
+    int32_t bytes = read_stream(data, len);
+    if (consumer.cues.active()) {
+        uint32_t cue_cycles = StageProfile::start();
+        consumer.cues.mix((int16_t*) data, bytes / AUDIO_FRAME_BYTES);
+        consumer.profile[PROFILE_CUE_MIX].stop(cue_cycles, bytes / AUDIO_FRAME_BYTES);
+    } else if (consumer.cue_resumed.load(std::memory_order_relaxed)) {
+        consumer.cue_resumed = false;
+        if (pipe_state.load() == PIPE_IDLE) {
+            suspend_stream("Cue played");
+        }
+    }
+    consumer.profile[PROFILE_BT_READ].stop(start_cycles, len / AUDIO_FRAME_BYTES);
+    trace_end(TRACE_BT_READ);
+    consumer_busy.store(false, std::memory_order_release);
+    return bytes;
+}
+
+int32_t AudioBridge::read_stream(uint8_t *data, int32_t len) {
+    if (!data || len <= 0) {
+        return 0;
+    }
+    apply_priors();
+    // Tell "host stopped" apart from "USB underrun" by packet cadence.
+    pipeline_state_t state = pipe_state.load();
+    if ((state == PIPE_PRIMING || state == PIPE_STREAMING) &&
+        esp_timer_get_time() - producer.last_packet_us.load() > (int64_t)USB_STREAM_TIMEOUT_MS * 1000) {
+        usb_stream_stopped();
+        state = pipe_state.load();
+    }
+    switch (state) {
+        case PIPE_IDLE:
+            return pad_block(data, len);
+        case PIPE_PRIMING:
+            // Hold back output until the ring is primed so the onset isn't clipped.
+            consumer.depth_frames = jitter_depth_frames();
+            if (ring_fill_bytes() < consumer.depth_frames * AUDIO_FRAME_BYTES) {
+                return pad_block(data, len);
+            }
+            set_pipe_state(PIPE_PRIMING, PIPE_STREAMING);
+            if (bt_connect_us.load() != 0) {
+                int64_t now = esp_timer_get_time();
+                consumer.first_audio_ms = (uint32_t)((now - bt_connect_us.exchange(0)) / 1000);
+                // esp_timer counts from boot, so the first one is also time-to-audio from power-on.
+                if (consumer.boot_to_audio_ms == 0) consumer.boot_to_audio_ms = (uint32_t)(now / 1000);
+                printf("A2DP time to first audio: %u ms (%u ms since power-on)\n",
+                       (unsigned) consumer.first_audio_ms, (unsigned)(now / 1000));
+            }
+            break;
+        case PIPE_DRAINING:
+            if (ring_fill_bytes() == 0 && !consumer.stretch.active()) {
+                // Host is gone and the tail has been played: flush and let the radio rest.
+                if (set_pipe_state(PIPE_DRAINING, PIPE_IDLE)) {
+                    flush_ring();
+                    suspend_stream("Host stopped streaming");
+                }
+                return pad_block(data, len);
+            }
+            break;
+        default:
+            break;
+    }
+    // One lock-free snapshot of the control parameters per block.
+    const control_params_t p = params.read();
+    // Fetch audio from the ring, through the time-stretcher while it is catching up.
+    size_t bytes_read = len;
+    int32_t error = fill_error();
+    update_stretch(state, error);
+    if (consumer.stretch.active()) {
+        uint32_t start_cycles = StageProfile::start();
+        consumer.read_state = state;
+        size_t frames = len / AUDIO_FRAME_BYTES;
+        consumer.stretch.read((int16_t*) data, frames, stretch_pull, this);
+        memset(data + frames * AUDIO_FRAME_BYTES, 0, len - frames * AUDIO_FRAME_BYTES);
+        consumer.profile[PROFILE_STRETCH].stop(start_cycles, frames);
+    } else {
+        ring_read(data, len, state);
+    }
+    update_feedback(state, len / AUDIO_FRAME_BYTES, error);
+    trace_counter(TRACE_RING_FILL, error + (int32_t) consumer.depth_frames);
+    trace_counter(TRACE_FEEDBACK_PPM, (int32_t)((consumer.rate_feedback.frames_per_ms() * 1000.0 / AUDIO_SAMPLE_RATE - 1.0) * 1e6));
+    trace_counter(TRACE_STRETCH_PPM, (int32_t)((consumer.stretch.rate() - 1.0f) * 1e6f));
+    // The sink's burst lead, for the jitter depth.
+    if (state == PIPE_STREAMING) {
+        consumer.jitter.update(len / AUDIO_FRAME_BYTES, esp_timer_get_time());
+    } else {
+        consumer.jitter.restart();
+    }
+    size_t frames = bytes_read / AUDIO_FRAME_BYTES;
+    trace_begin(TRACE_DSP);
+    // Channel mode (swap, downmix, crossfeed). Stereo has no kernel and costs nothing.
+    if (p.channel_mode != consumer.channel_mode) {
+        channel_mix_init(&consumer.mix, AUDIO_SAMPLE_RATE);
+        consumer.channel_mode = p.channel_mode;
+    }
+    channel_kernel_fn mix = channel_kernel(p.channel_mode);
+    if (mix != nullptr) {
+        uint32_t start_cycles = StageProfile::start();
+        mix((int16_t*) data, frames, &consumer.mix);
+        consumer.profile[PROFILE_CHANNEL_MIX].stop(start_cycles, frames);
+    }
+    // Parametric EQ.
+    if (p.eq.band_count > 0 || p.eq.version != 0) {
+        uint32_t start_cycles = StageProfile::start();
+        consumer.eq.process((int16_t*) data, frames, p.eq);
+        consumer.profile[PROFILE_EQ].stop(start_cycles, frames);
+    }
+    // Loudness is measured ahead of the gain stage, so the auto-gain has no feedback loop.
+    if (p.loudness_norm) {
+        uint32_t start_cycles = StageProfile::start();
+        if (consumer.loudness.process((const int16_t*) data, frames)) {
+            update_auto_gain(p);
+        }
+        consumer.profile[PROFILE_LOUDNESS].stop(start_cycles, frames);
+    } else if (consumer.auto_gain_db != 0.0f) {
+        consumer.auto_gain_db = 0.0f;   // the gain ramp takes it back to unity
+        consumer.auto_gain = 1.0f;
+    }
+    // Apply volume / mute. Muted audio is still consumed so unmuting resumes with live audio.
+    apply_gain((int16_t*) data, frames, p);
+    trace_end(TRACE_DSP);
+    return bytes_read;
+}
+
+// Copies `len` bytes out of the ring, padding with silence (and counting an underrun while
+// streaming) if it runs dry.
+void AudioBridge::ring_read(uint8_t *dst, size_t len, pipeline_state_t state) {
+    uint32_t start_cycles = StageProfile::start();
+    // The producer dropped the oldest audio since the last read: the gap is right here.
+    uint32_t overflows = producer.overflows.load(std::memory_order_relaxed);
+    if (overflows != consumer.overflows_seen) {
+        consumer.overflows_seen = overflows;
+        consumer.splice.discontinuity();
+    }
+    size_t bytes_read = 0;
+    while (bytes_read < len) {
+        size_t chunk_len;
+        uint8_t *chunk = (uint8_t*) xRingbufferReceiveUpTo(ring, &chunk_len, 0, len - bytes_read);
+        if (chunk == NULL) {
+            // No audio available (buffer underrun). If host is still streaming, this could indicate a timing mismatch.
+            // Fill remaining buffer with silence to avoid pops. While draining this is just the end of the stream.
+            if (state == PIPE_STREAMING) {
+                consumer.underruns++;
+                trace_instant(TRACE_UNDERRUN);
+                timing_log(TIMING_UNDERRUN, 0);
+                int64_t now = esp_timer_get_time();
+                if (LOW_BUFFER_CUE_INTERVAL_MS > 0 &&
+                    now - consumer.low_buffer_cue_us > (int64_t)LOW_BUFFER_CUE_INTERVAL_MS * 1000) {
+                    consumer.low_buffer_cue_us = now;
+                    consumer.cues.trigger(CUE_LOW_BUFFER);
+                }
+            }
+            consumer.splice.pad((int16_t*)(dst + bytes_read), (len - bytes_read) / AUDIO_FRAME_BYTES);
+            break;
+        }
+        // Copy the chunk into the output buffer
+        memcpy(dst + bytes_read, chunk, chunk_len);
+        consumer.splice.audio((int16_t*)(dst + bytes_read), chunk_len / AUDIO_FRAME_BYTES);
+        bytes_read += chunk_len;
+        // Return the chunk memory to the ring buffer
+        vRingbufferReturnItem(ring, chunk);
+    }
+    consumer.profile[PROFILE_RING_COPY].stop(start_cycles, len / AUDIO_FRAME_BYTES);
+}
+
+// Output while there is nothing to play: silence, with the last audio faded out so the cut
+// doesn't click. It still goes through the gain stage, so a muted stream stays muted and
+// the limiter's delay line plays out instead of coming back later.
+int32_t AudioBridge::pad_block(uint8_t *data, int32_t len) {
+    size_t frames = len / AUDIO_FRAME_BYTES;
+    memset(data + frames * AUDIO_FRAME_BYTES, 0, len - frames * AUDIO_FRAME_BYTES);
+    consumer.splice.pad((int16_t*) data, frames);
+    apply_gain((int16_t*) data, frames, params.read());
+    return len;
+}
+
+void AudioBridge::stretch_pull(void *ctx, int16_t *dst, size_t frames) {
+    AudioBridge *bridge = (AudioBridge*) ctx;
+    bridge->ring_read((uint8_t*) dst, frames * AUDIO_FRAME_BYTES, bridge->consumer.read_state);
+}
+
+// Frames queued (ring plus time-stretcher) above the jitter depth.
+int32_t AudioBridge::fill_error() const {
+    int32_t fill = (int32_t)(ring_fill_bytes() / AUDIO_FRAME_BYTES + consumer.stretch.buffered_frames());
+    return fill - (int32_t) consumer.depth_frames;
+}
+
+// Jitter depth for the next priming: from the measured burst lead once there is enough of
+// it, otherwise whatever was restored (or the default).
+uint32_t AudioBridge::jitter_depth_frames() const {
+    if (!consumer.jitter.valid()) {
+        return consumer.depth_frames;
+    }
+    uint32_t ms = (consumer.jitter.percentile_us(JITTER_PERCENTILE) + 999) / 1000 + JITTER_MARGIN_MS;
+    ms = ms < JITTER_DEPTH_MIN_MS ? JITTER_DEPTH_MIN_MS : (ms > JITTER_DEPTH_MAX_MS ? JITTER_DEPTH_MAX_MS : ms);
+    return ms * (AUDIO_SAMPLE_RATE / 1000);
+}
+
+// Engages, steers and releases the time-stretcher from the fill error, once per block.
+void AudioBridge::update_stretch(pipeline_state_t state, int32_t error) {
+    TimeStretch &stretch = consumer.stretch;
+    if (state != PIPE_STREAMING) {
+        if (state == PIPE_DRAINING) {
+            stretch.stop();     // play out what it holds, unmodified
+        } else {
+            stretch.reset();    // re-priming: whatever it held is stale
+        }
+        return;
+    }
+    const int32_t frames_per_ms = AUDIO_SAMPLE_RATE / 1000;
+    int32_t magnitude = error < 0 ? -error : error;
+    if (!stretch.active() || stretch.rate() == 1.0f) {
+        // The host follows the feedback; only step in once it can't keep up.
+        bool feedback_coping = feedback != nullptr && !consumer.rate_feedback.saturated();
+        if (magnitude < STRETCH_ENGAGE_MS * frames_per_ms || feedback_coping) {
+            return;
+        }
+    } else if (magnitude < STRETCH_RELEASE_MS * frames_per_ms) {
+        stretch.stop();
+        return;
+    }
+    float amount = (float) error / (STRETCH_FULL_MS * frames_per_ms);
+    if (amount > 1.0f) amount = 1.0f;
+    if (amount < -1.0f) amount = -1.0f;
+    stretch.set_rate(1.0f + amount * WSOLA_MAX_RATE);
+}
+
+// Feeds the consumption of this block into the asynchronous feedback.
+void AudioBridge::update_feedback(pipeline_state_t state, size_t frames, int32_t error) {
+    if (feedback == nullptr) {
+        return;
+    }
+    if (state != PIPE_STREAMING) {
+        consumer.rate_feedback.pause();
+        return;
+    }
+    if (host_clock.host_locked()) {
+        consumer.rate_feedback.set_host_frame_us(host_clock.host_frame_us());
+    }
+    if (consumer.rate_feedback.update(frames, esp_timer_get_time(), error)) {
+        feedback(consumer.rate_feedback.value_16_16());
+    }
+}
+
+void AudioBridge::restore_sink(const sink_learned_t *rec) {
+    priors.update([&](learned_priors_t &p) {
+        p.sink_seq++;
+        p.sink_known = rec != nullptr;
+        if (rec) p.sink = *rec;
+    });
+}
+
+void AudioBridge::restore_host(const host_learned_t &rec) {
+    priors.update([&](learned_priors_t &p) {
+        p.host_seq++;
+        p.host = rec;
+    });
+}
+
+// Consumer: takes over restored state at the start of a block. A new sink also drops what
+// was measured on the previous one.
+void AudioBridge::apply_priors() {
+    uint32_t version = priors.version();
+    if (version == consumer.priors_version.load(std::memory_order_relaxed)) {
+        return;
+    }
+    consumer.priors_version.store(version, std::memory_order_relaxed);
+    const learned_priors_t p = priors.read();
+    RateFeedback &fb = consumer.rate_feedback;
+    if (p.host_seq != consumer.host_seq) {
+        consumer.host_seq = p.host_seq;
+        if (!host_clock.host_locked()) {
+            fb.set_host_frame_us(1000.0 / (1.0 + p.host.host_ppm * 1e-6));
+        }
+        printf("Learned host clock restored: %+.1f ppm\n", p.host.host_ppm);
+    }
+    if (p.sink_seq != consumer.sink_seq) {
+        consumer.sink_seq = p.sink_seq;
+        consumer.jitter.init(AUDIO_SAMPLE_RATE);
+        if (p.sink_known) {
+            fb.seed_consumer(p.sink.consumer_ppm);
+            uint32_t ms = p.sink.depth_ms;
+            ms = ms < JITTER_DEPTH_MIN_MS ? JITTER_DEPTH_MIN_MS : (ms > JITTER_DEPTH_MAX_MS ? JITTER_DEPTH_MAX_MS : ms);
+            consumer.depth_frames = ms * (AUDIO_SAMPLE_RATE / 1000);
+            printf("Learned sink state restored: %+.1f ppm, jitter %u us, depth %u ms\n",
+                   p.sink.consumer_ppm, (unsigned) p.sink.jitter_us, (unsigned) p.sink.depth_ms);
+        } else {
+            fb.forget_consumer();
+            consumer.depth_frames = STREAM_PRIME_MS * (AUDIO_SAMPLE_RATE / 1000);
+        }
+    }
+    if (feedback) feedback(fb.value_16_16());
+}
+
+bool AudioBridge::learned_sink(sink_learned_t *rec) const {
+    bool rate_known = feedback == nullptr || consumer.rate_feedback.consumer_known();
+    // Until the consumer has taken up a restore, what it measured belongs to the previous sink.
+    bool restore_pending = priors.version() != consumer.priors_version.load(std::memory_order_relaxed);
+    if (!consumer.jitter.valid() || !rate_known || restore_pending) {
+        return false;
+    }
+    *rec = {};
+    rec->depth_ms = (uint8_t)(jitter_depth_frames() / (AUDIO_SAMPLE_RATE / 1000));
+    uint32_t jitter_us = consumer.jitter.percentile_us(JITTER_PERCENTILE);
+    rec->jitter_us = (uint16_t)(jitter_us < 65535 ? jitter_us : 65535);
+    rec->consumer_ppm = feedback ? consumer.rate_feedback.consumer_ppm() : 0.0f;
+    return true;
+}
+
+bool AudioBridge::learned_host(host_learned_t *rec) const {
+    if (!host_clock.host_locked()) {
+        return false;
+    }
+    *rec = {};
+    rec->host_ppm = host_clock.host_ppm();
+    return true;
+}
+
+// Producer: restarts the windowed counters when the stats log has asked.
+void AudioBridge::reset_producer_stats() {
+    producer.max_packet_gap_us = 0;
+    producer.no_sink_peak = 0;
+    memset(producer.cost, 0, sizeof(producer.cost));
+    producer.usb_profile.reset();
+    producer.reset_stats.store(false, std::memory_order_release);
+}
+
+// Consumer: the same for its counters.
+void AudioBridge::reset_consumer_stats() {
+    for (int i = 0; i < PROFILE_STAGE_COUNT; ++i) {
+        consumer.profile[i].reset();
+    }
+    consumer.stretch.hops = 0;
+    consumer.stretch.frames_gained = 0;
+    consumer.limiter.reset_max_reduction();
+    consumer.reset_stats.store(false, std::memory_order_release);
+}
+
+// Windowed counters whose reset the owner has not got to yet (no packets or blocks since
+// the last log) belong to the previous window and read as zero.
+void AudioBridge::get_stats(audio_stats_t *stats) const {
+    int64_t now = esp_timer_get_time();
+    bool producer_stale = producer.reset_stats.load(std::memory_order_acquire);
+    bool consumer_stale = consumer.reset_stats.load(std::memory_order_acquire);
+    stats->state = pipe_state.load();
+    stats->bt_connected = bt_connected.load();
+    stats->underruns = consumer.underruns;
+    stats->overflows = producer.overflows;
+    stats->splices = consumer.splice.splices;
+    stats->suspends = suspends;
+    stats->host_starts = producer.host_starts;
+    stats->host_stops = host_stops;
+    stats->max_packet_gap_us = producer_stale ? 0 : producer.max_packet_gap_us;
+    stats->bt_connects = bt_connects;
+    stats->first_audio_ms = consumer.first_audio_ms;
+    stats->boot_to_audio_ms = consumer.boot_to_audio_ms;
+    stats->packets_no_sink = producer.packets_no_sink;
+    stats->no_sink_peak = producer_stale ? 0 : producer.no_sink_peak;
+    stats->suspended_us = suspended_us + (suspend_start_us != 0 ? now - suspend_start_us : 0);
+    stats->uptime_us = now - started_us;
+    const control_params_t p = params.read();
+    stats->channel_mode = p.channel_mode;
+    stats->mix_cycles_per_frame = consumer_stale ? 0 : consumer.profile[PROFILE_CHANNEL_MIX].cycles_per_frame();
+    stats->eq_bands = p.eq.band_count;
+    stats->eq_cycles_per_frame = consumer_stale ? 0 : consumer.profile[PROFILE_EQ].cycles_per_frame();
+    stats->limiter_reduction_db = consumer_stale ? 0.0f : consumer.limiter.max_reduction_db();
+    stats->ring_latency_us = (uint32_t)((uint64_t)ring_fill_bytes() / AUDIO_FRAME_BYTES * 1000000 / AUDIO_SAMPLE_RATE);
+    stats->dsp_latency_us = PeakLimiter::latency_frames() * 1000000 / AUDIO_SAMPLE_RATE;
+    stats->stretch_rate = consumer.stretch.rate();
+    stats->stretch_hops = consumer_stale ? 0 : consumer.stretch.hops;
+    stats->stretch_frames = consumer_stale ? 0 : consumer.stretch.frames_gained;
+    stats->stretch_cycles_per_frame = consumer_stale ? 0 : consumer.profile[PROFILE_STRETCH].cycles_per_frame();
+    stats->feedback_enabled = feedback != nullptr;
+    stats->feedback_frames_per_ms = consumer.rate_feedback.frames_per_ms();
+    stats->consumer_ppm = consumer.rate_feedback.consumer_ppm();
+    stats->feedback_saturated = consumer.rate_feedback.saturated();
+    stats->host_clock_ppm = host_clock.host_ppm();
+    stats->host_clock_error_ppm = host_clock.host_ppm_error();
+    stats->host_clock_locked = host_clock.host_locked();
+    stats->host_stream_ppm = host_clock.stream_ppm();
+    stats->host_stream_error_ppm = host_clock.stream_ppm_error();
+    stats->host_stream_locked = host_clock.stream_locked();
+    stats->depth_ms = consumer.depth_frames / (AUDIO_SAMPLE_RATE / 1000);
+    stats->jitter_us = consumer.jitter.valid() ? consumer.jitter.percentile_us(JITTER_PERCENTILE) : 0;
+    stats->loudness_norm = p.loudness_norm;
+    stats->loudness_lufs = consumer.loudness.short_term_lufs();
+    stats->auto_gain_db = consumer.auto_gain_db;
+    stats->loudness_cycles_per_frame = consumer_stale ? 0 : consumer.profile[PROFILE_LOUDNESS].cycles_per_frame();
+    for (int i = 0; i < PROFILE_STAGE_COUNT; ++i) {
+        if (i == PROFILE_USB_PACKET ? producer_stale : consumer_stale) {
+            stats->stages[i] = {};
+        } else {
+            stage_profile((profile_stage_t) i).summarize(&stats->stages[i]);
+        }
+    }
+}
+
+const StageProfile &AudioBridge::stage_profile(profile_stage_t stage) const {
+    return stage == PROFILE_USB_PACKET ? producer.usb_profile : consumer.profile[stage];
+}
+
+// Logs the pipeline counters, including the airtime and encoder work saved by silence suspend.
+// Runs in the timer task: the windowed counters are only read here, and their owners reset
+// them on request.
+void AudioBridge::print_stats() {
+    audio_stats_t s;
+    get_stats(&s);
+    bool producer_stale = producer.reset_stats.load(std::memory_order_acquire);
+    uint32_t sbc_frames_skipped = (uint32_t)(s.suspended_us * AUDIO_SAMPLE_RATE / 1000000 / SBC_FRAME_SAMPLES);
+    printf("Audio: %s, underruns %u, overflows %u, splices %u, suspends %u, suspended %lld ms (%u%% airtime saved, %u SBC frames not encoded)\n",
+           pipe_state_names[s.state], (unsigned) s.underruns, (unsigned) s.overflows, (unsigned) s.splices,
+           (unsigned) s.suspends, (long long)(s.suspended_us / 1000),
+           (unsigned)(s.uptime_us > 0 ? s.suspended_us * 100 / s.uptime_us : 0), (unsigned) sbc_frames_skipped);
+    printf("USB: starts %u, stops %u, max packet gap %u us\n",
+           (unsigned) s.host_starts, (unsigned) s.host_stops, (unsigned) s.max_packet_gap_us);
+    printf("BT: %s, connects %u, time to first audio %u ms (from power-on %u ms), packets without sink %u (peak %d)\n",
+           s.bt_connected ? "connected" : "disconnected", (unsigned) s.bt_connects, (unsigned) s.first_audio_ms,
+           (unsigned) s.boot_to_audio_ms, (unsigned) s.packets_no_sink, (int) s.no_sink_peak);
+    if (s.eq_bands > 0) {
+        printf("EQ: %u bands, %u cycles/frame (%u per band)\n", (unsigned) s.eq_bands,
+               (unsigned) s.eq_cycles_per_frame, (unsigned)(s.eq_cycles_per_frame / s.eq_bands));
+    }
+    printf("Latency: ring %u us, DSP %u us, limiter max reduction %.1f dB\n",
+           (unsigned) s.ring_latency_us, (unsigned) s.dsp_latency_us, s.limiter_reduction_db);
+    if (s.channel_mode != CHANNEL_STEREO) {
+        printf("Channels: %s, %u cycles/frame\n", channel_mode_name(s.channel_mode), (unsigned) s.mix_cycles_per_frame);
+    }
+    if (s.feedback_enabled) {
+        printf("Feedback: %.4f frames/ms (%+.0f ppm)%s, consumer %+.1f ppm\n", s.feedback_frames_per_ms,
+               (s.feedback_frames_per_ms * 1000.0 / AUDIO_SAMPLE_RATE - 1.0) * 1e6,
+               s.feedback_saturated ? " saturated" : "", s.consumer_ppm);
+    }
+    printf("Host clock: SOF %+.2f +/- %.2f ppm%s, stream %+.2f +/- %.2f ppm%s\n",
+           s.host_clock_ppm, s.host_clock_error_ppm, s.host_clock_locked ? " (locked)" : "",
+           s.host_stream_ppm, s.host_stream_error_ppm, s.host_stream_locked ? " (locked)" : "");
+    printf("Jitter: depth %u ms, burst lead %u us\n", (unsigned) s.depth_ms, (unsigned) s.jitter_us);
+    if (s.stretch_hops > 0) {
+        printf("Time-stretch: rate %.3f, %u hops, %+d frames caught up, %u cycles/frame\n", s.stretch_rate,
+               (unsigned) s.stretch_hops, (int) s.stretch_frames, (unsigned) s.stretch_cycles_per_frame);
+    }
+    if (s.loudness_norm) {
+        printf("Loudness: short-term %.1f LUFS, auto gain %+.1f dB, %u cycles/frame\n",
+               s.loudness_lufs, s.auto_gain_db, (unsigned) s.loudness_cycles_per_frame);
+    }
+    for (int i = 0; i < PRODUCER_PATH_COUNT && !producer_stale; ++i) {
+        uint32_t packets = producer.cost[i].packets;
+        if (packets > 0) {
+            printf("USB producer (%s): %u packets, %u cycles/packet\n", producer_path_names[i],
+                   (unsigned) packets, (unsigned)(producer.cost[i].cycles / packets));
+        }
+    }
+#if AUDIO_PROFILE
+    // Stage costs in cycles, with the log2 histogram of the span lengths.
+    for (int i = 0; i < PROFILE_STAGE_COUNT; ++i) {
+        const stage_stats_t &st = s.stages[i];
+        if (st.count == 0) {
+            continue;
+        }
+        printf("Stage %s: %u spans, %u cycles/frame, avg %u, p99 <= %u, max %u cycles\n",
+               profile_stage_name((profile_stage_t) i), (unsigned) st.count, (unsigned) st.cycles_per_frame,
+               (unsigned) st.avg_cycles, (unsigned) st.p99_cycles, (unsigned) st.max_cycles);
+        stage_profile((profile_stage_t) i).print_histogram();
+    }
+#endif
+    producer.reset_stats.store(true, std::memory_order_relaxed);
+    consumer.reset_stats.store(true, std::memory_order_relaxed);
+}
@@ -0,0 +1,327 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "freertos/FreeRTOS.h"
+#include "freertos/ringbuf.h"
+#include "esp_a2dp_api.h"
+#include "control_params.h"
+#include "peak_limiter.h"
+#include "loudness.h"
+#include "cue_mixer.h"
+#include "time_stretch.h"
+#include "splice.h"
+#include "rate_feedback.h"
+#include "clock_estimator.h"
+#include "jitter_meter.h"
+#include "learned_store.h"
+#include "trace.h"
+#include "profile.h"
+#include "timing_log.h"
+
+// Configuration constants. The buffering and time-stretch settings can be overridden on the
+// command line, which is how tools/pipeline_sim.py builds the bridge with other values.
+#define AUDIO_SAMPLE_RATE   48000   // 48 kHz sample rate
+#define AUDIO_CHANNELS      2       // stereo
+#define AUDIO_BITS_PER_SAMPLE 16    // 16-bit PCM
+#ifndef RINGBUF_SIZE
+#define RINGBUF_SIZE        (12 * 1024) // 12 KB ring buffer for audio data (64 ms), see tools/buffer_sizing.py
+#endif
+#define AUDIO_FRAME_BYTES   (AUDIO_CHANNELS * AUDIO_BITS_PER_SAMPLE / 8)
+#define SBC_FRAME_SAMPLES   128     // 16 blocks x 8 subbands per SBC frame
+#define CACHE_LINE_SIZE     64      // keeps producer- and consumer-written fields apart
+#define GAIN_CHUNK_FRAMES   128     // frames taken through the float gain/limiter stage at a time
+#define MAX_BOOST_DB        12.0f   // volume boost above 100%
+
+// Loudness normalization: the auto-gain follows the short-term loudness slowly, cutting
+// faster than it boosts so a loud application never blasts for long.
+#define AGC_MAX_BOOST_DB    12.0f
+#define AGC_MAX_CUT_DB      20.0f
+#define AGC_BOOST_DB_PER_S  1.0f
+#define AGC_CUT_DB_PER_S    3.0f
+#define AGC_HOLD_LU         20.0f   // hold the gain while more than this below target (pauses, fades)
+
+// Silence detection: if the host sends nothing above SILENCE_THRESHOLD for SILENCE_HOLD_MS,
+// the A2DP stream is suspended so the radio and SBC encoder go idle.
+#define SILENCE_THRESHOLD   16      // peak sample magnitude treated as silence (about -66 dBFS)
+#define SILENCE_HOLD_MS     2000    // continuous silence before suspending
+
+// USB stream tracking: the host is considered stopped (not underrunning) once no packet
+// has arrived for USB_STREAM_TIMEOUT_MS, or when it selects alt setting 0.
+#ifndef USB_STREAM_TIMEOUT_MS
+#define USB_STREAM_TIMEOUT_MS 30    // several 1 ms packet intervals plus host scheduling slack
+#endif
+#define LEVEL_METER_WITHOUT_SINK 1 // keep a peak meter on the USB stream while no sink is connected
+#ifndef STREAM_PRIME_MS
+#define STREAM_PRIME_MS     20      // target jitter depth buffered before output starts (stream start, resume, BT connect)
+#endif
+// The jitter depth follows the sink once its burst lead has been measured (or restored
+// from flash): the lead at JITTER_PERCENTILE plus a margin for the USB side, within limits.
+#define JITTER_PERCENTILE   0.999f
+#define JITTER_MARGIN_MS    4
+#ifndef JITTER_DEPTH_MIN_MS
+#define JITTER_DEPTH_MIN_MS 10
+#endif
+#ifndef JITTER_DEPTH_MAX_MS
+#define JITTER_DEPTH_MAX_MS 32      // leaves half the ring as headroom for sink stalls
+#endif
+#define LOW_BUFFER_CUE_INTERVAL_MS 30000 // at most one low-buffer prompt per interval, 0 = never
+
+// Time-stretch catch-up: once the fill level strays this far from STREAM_PRIME_MS, WSOLA
+// plays up to WSOLA_MAX_RATE faster or slower (no pitch change) until it is back within
+// STRETCH_RELEASE_MS, instead of the ring overflowing or running dry. With asynchronous
+// feedback it only engages while the feedback is saturated.
+#ifndef STRETCH_ENGAGE_MS
+#define STRETCH_ENGAGE_MS   10
+#endif
+#ifndef STRETCH_RELEASE_MS
+#define STRETCH_RELEASE_MS  2
+#endif
+#ifndef STRETCH_FULL_MS
+#define STRETCH_FULL_MS     20      // fill error at which the full WSOLA_MAX_RATE is used
+#endif
+
+// Pipeline state as seen from the USB side.
+enum pipeline_state_t {
+    PIPE_IDLE,          // host not streaming, ring empty, output is silence
+    PIPE_PRIMING,       // host (re)started, buffering STREAM_PRIME_MS before releasing audio
+    PIPE_STREAMING,     // steady state, an empty ring is a real underrun
+    PIPE_DRAINING,      // host stopped, playing out what is left in the ring
+};
+
+// A2DP streaming state driven by the silence detector.
+enum stream_state_t {
+    STREAM_ACTIVE,      // encoding and transmitting
+    STREAM_SUSPENDED,   // host is silent or stopped, media suspended
+};
+
+// The Bluetooth link that pulls the stream through read(): the A2DP media, or the HFP SCO
+// downlink while a call's audio link is up. Only one of them consumes at a time.
+enum bt_link_t { LINK_A2DP, LINK_SCO };
+
+// Producer paths, for the per-packet cost counters.
+enum producer_path_t { PRODUCER_NO_SINK, PRODUCER_SUSPENDED, PRODUCER_QUEUED, PRODUCER_PATH_COUNT };
+
+// Snapshot of the pipeline counters.
+struct audio_stats_t {
+    pipeline_state_t state;
+    bool bt_connected;
+    uint32_t underruns;         // BT requests padded with silence
+    uint32_t overflows;         // USB packets that forced old audio out of the ring
+    uint32_t splices;           // drops and pads smoothed with a crossfade
+    uint32_t suspends;          // number of silence suspends
+    uint32_t host_starts;       // USB stream starts (alt setting opened or packets resumed)
+    uint32_t host_stops;        // USB stream stops (alt setting closed or packets ceased)
+    uint32_t max_packet_gap_us; // longest gap between USB packets since the last log
+    uint32_t bt_connects;       // A2DP connections established
+    uint32_t first_audio_ms;    // time from the last A2DP connect to the first real audio block
+    uint32_t boot_to_audio_ms;  // time from power-on to the first real audio block, 0 until then
+    uint32_t packets_no_sink;   // USB packets skipped because no sink was connected
+    int32_t no_sink_peak;       // peak level seen while no sink was connected, since the last log
+    int64_t suspended_us;       // total time spent suspended
+    int64_t uptime_us;          // time since init()
+    channel_mode_t channel_mode;
+    uint32_t mix_cycles_per_frame; // channel mode cost since the last log
+    uint8_t eq_bands;           // active EQ bands per channel
+    uint32_t eq_cycles_per_frame; // EQ cost since the last log
+    float limiter_reduction_db; // deepest limiter gain reduction since the last log
+    uint32_t ring_latency_us;   // audio currently queued in the ring
+    uint32_t dsp_latency_us;    // processing delay (limiter look-ahead)
+    float stretch_rate;         // current time-stretch rate, 1.0 when off
+    uint32_t stretch_hops;      // stretched hops since the last log
+    int32_t stretch_frames;     // frames caught up (+) or padded (-) by stretching since the last log
+    uint32_t stretch_cycles_per_frame; // time-stretch cost since the last log
+    bool feedback_enabled;      // UAC2 asynchronous feedback in use
+    double feedback_frames_per_ms; // current feedback value
+    float consumer_ppm;         // measured Bluetooth consumer rate against nominal
+    bool feedback_saturated;    // feedback at its limit: time-stretch may take over
+    float host_clock_ppm;       // host USB frame clock against ours, from SOF timestamps
+    float host_clock_error_ppm; // its standard error
+    bool host_clock_locked;
+    float host_stream_ppm;      // host sample rate against nominal, from packet arrivals
+    float host_stream_error_ppm;
+    bool host_stream_locked;
+    bool loudness_norm;
+    float loudness_lufs;        // short-term loudness of the input
+    float auto_gain_db;         // loudness normalization gain currently applied
+    uint32_t loudness_cycles_per_frame; // meter cost since the last log
+    uint32_t depth_ms;          // jitter depth the ring primes to
+    uint32_t jitter_us;         // consumer burst lead at JITTER_PERCENTILE, 0 until measured
+    stage_stats_t stages[PROFILE_STAGE_COUNT]; // per-stage cost since the last log, zero with AUDIO_PROFILE 0
+};
+
+// Learned state handed to the consumer, which applies it at its next block.
+struct learned_priors_t {
+    uint32_t sink_seq = 0;
+    bool sink_known = false;        // false: a sink never seen before
+    sink_learned_t sink = {};
+    uint32_t host_seq = 0;
+    host_learned_t host = {};
+};
+
+// One USB -> Bluetooth audio path: the ring between uac_output_cb and get_bt_audio_data plus
+// all of its control state. Storage is sized at compile time, so a bridge can be a static
+// object and nothing is allocated once init() has run. The USB callbacks get the bridge
+// through uac_device_config_t::cb_ctx.
+class AudioBridge {
+public:
+    // Starts or suspends the A2DP media stream; nullptr for a bridge without a radio.
+    typedef void (*media_ctrl_fn)(bool start);
+    // Hands the UAC2 asynchronous feedback value (frames per USB frame, 16.16) to the USB
+    // stack; nullptr when the OUT endpoint is not asynchronous.
+    typedef void (*feedback_fn)(uint32_t value_16_16);
+
+    bool init(media_ctrl_fn media_ctrl = nullptr, feedback_fn feedback = nullptr);
+
+    // USB side (producer). on_usb_packet() runs in the UAC output callback.
+    void on_usb_packet(const uint8_t *buf, size_t len);
+    void on_alt_setting(uint8_t alt);
+    // USB start-of-frame, from tud_sof_cb(): timestamps the host frame clock.
+    void on_sof(uint32_t frame_count);
+    void set_mute(bool mute);
+    bool toggle_mute();
+    void set_volume(uint32_t volume);
+    // EQ for whichever sink is connected. Coefficients are designed here, in the caller's
+    // context. Returns false for a band outside the limits in parametric_eq.h.
+    bool set_eq_band(uint8_t index, const eq_band_t &band);
+    void clear_eq();
+    // The band set as a record for LearnedStore, and back: the caller keeps one per sink and
+    // restores it on connect. restore_eq(nullptr), or a record with a band outside the limits,
+    // is flat.
+    void get_eq(sink_eq_t *rec) const;
+    void restore_eq(const sink_eq_t *rec);
+    // Gain above 100% volume and the limiter that makes it safe.
+    void set_boost_db(float boost_db);
+    void set_limiter(bool enabled, float ceiling_db, uint16_t release_ms);
+    void set_loudness_norm(bool enabled, float target_lufs);
+    bool set_channel_mode(channel_mode_t mode);
+
+    // Status prompts mixed over the stream. With `resume_stream`, a suspended A2DP stream is
+    // restarted for the prompt and suspended again once it has played.
+    void play_cue(cue_id_t cue, bool resume_stream = true);
+
+    // Bluetooth side (consumer). read() runs in the A2DP data callback, or in the HFP
+    // outgoing data callback for LINK_SCO; a link that does not own the stream gets silence.
+    int32_t read(uint8_t *data, int32_t len, bt_link_t link = LINK_A2DP);
+    // The SCO audio link came up or went down: the stream moves to it and the A2DP media is
+    // suspended for the call, then restarted afterwards.
+    void set_sco_active(bool active);
+    void on_connection_state(esp_a2d_connection_state_t state);
+    void on_audio_state(esp_a2d_audio_state_t state);
+
+    void get_stats(audio_stats_t *stats) const;
+    void print_stats();
+
+    // Learned clock and jitter state, persisted by the caller (see LearnedStore) so a boot or
+    // reconnect starts where the last session converged. Restores may come from any context
+    // and are taken up by the consumer at its next block. restore_sink(nullptr) is a sink
+    // never seen before: back to the defaults.
+    void restore_sink(const sink_learned_t *rec);
+    void restore_host(const host_learned_t &rec);
+    // False while there is nothing converged worth saving, or a restore is not taken up yet.
+    bool learned_sink(sink_learned_t *rec) const;
+    bool learned_host(host_learned_t *rec) const;
+
+    static const char *state_name(pipeline_state_t state);
+
+private:
+    void flush_ring();
+    size_t ring_fill_bytes() const;
+    bool set_pipe_state(pipeline_state_t from, pipeline_state_t to);
+    void usb_stream_started();
+    void usb_stream_stopped();
+    void suspend_stream(const char *reason);
+    void close_suspend_interval();
+    void start_media();
+    bool update_stream_state(const uint8_t *buf, size_t len);
+    void account_producer(producer_path_t path, uint32_t start_cycles, size_t len);
+    // The counters kept "since the last log", each reset by the context that owns them.
+    void reset_producer_stats();
+    void reset_consumer_stats();
+    const StageProfile &stage_profile(profile_stage_t stage) const;
+    int32_t read_stream(uint8_t *data, int32_t len);
+    void ring_read(uint8_t *dst, size_t len, pipeline_state_t state);
+    int32_t pad_block(uint8_t *data, int32_t len);
+    static void stretch_pull(void *ctx, int16_t *dst, size_t frames);
+    int32_t fill_error() const;
+    void update_stretch(pipeline_state_t state, int32_t error);
+    void update_feedback(pipeline_state_t state, size_t frames, int32_t error);
+    void apply_priors();
+    uint32_t jitter_depth_frames() const;
+    void apply_gain(int16_t *samples, size_t frames, const control_params_t &p);
+    void update_auto_gain(const control_params_t &p);
+
+    // Shared control state, written rarely from USB control, AVRCP and connection callbacks.
+    RingbufHandle_t ring = nullptr;
+    media_ctrl_fn media_ctrl = nullptr;
+    feedback_fn feedback = nullptr;
+    std::atomic<pipeline_state_t> pipe_state{PIPE_IDLE};
+    std::atomic<stream_state_t> stream_state{STREAM_ACTIVE};
+    std::atomic<bool> bt_connected{false};
+    std::atomic<bt_link_t> consumer_link{LINK_A2DP};
+    std::atomic<bool> consumer_busy{false};     // a read() is running; a second caller gets silence
+    std::atomic<int64_t> bt_connect_us{0};      // connect time while waiting for the first audio, else 0
+    SeqLock<control_params_t> params;           // gain/mute/ramp, snapshotted once per block
+    SeqLock<learned_priors_t> priors;           // restored state, applied by the consumer
+    uint32_t suspends = 0;
+    uint32_t host_stops = 0;
+    uint32_t bt_connects = 0;
+    int64_t suspended_us = 0;
+    int64_t suspend_start_us = 0;               // start of the current suspend, 0 if streaming
+    int64_t started_us = 0;
+
+    // Producer-hot: touched on every USB packet.
+    struct alignas(CACHE_LINE_SIZE) {
+        std::atomic<int64_t> last_packet_us{0}; // arrival time of the last packet
+        uint32_t silent_frames = 0;             // consecutive silent frames
+        std::atomic<uint32_t> overflows{0};     // also watched by the consumer to splice the gap
+        uint32_t host_starts = 0;
+        uint32_t max_packet_gap_us = 0;
+        uint32_t packets_no_sink = 0;
+        int32_t no_sink_peak = 0;
+        struct {
+            uint32_t packets;
+            uint64_t cycles;
+        } cost[PRODUCER_PATH_COUNT] = {};
+        StageProfile usb_profile;
+        std::atomic<bool> reset_stats{false};   // the stats log asks for the counters above to restart
+    } producer;
+
+    // Consumer-hot: touched on every Bluetooth request.
+    struct alignas(CACHE_LINE_SIZE) {
+        uint32_t underruns = 0;
+        uint32_t first_audio_ms = 0;
+        uint32_t boot_to_audio_ms = 0;
+        float gain = 1.0f;                      // gain currently applied, ramps toward the target
+        channel_mode_t channel_mode = CHANNEL_STEREO;   // mode the mix state belongs to
+        channel_mix_state_t mix;
+        ParametricEq eq;
+        PeakLimiter limiter;
+        float scratch[GAIN_CHUNK_FRAMES * AUDIO_CHANNELS];
+        LoudnessMeter loudness;
+        float auto_gain_db = 0.0f;              // loudness normalization, moves once per meter block
+        float auto_gain = 1.0f;
+        CueMixer cues;
+        std::atomic<bool> cue_resumed{false};   // stream was restarted just for a cue
+        int64_t low_buffer_cue_us = 0;          // last low-buffer prompt
+        TimeStretch stretch;
+        Splicer splice;                         // crossfades over drops and pads
+        uint32_t overflows_seen = 0;            // producer overflows already spliced
+        RateFeedback rate_feedback;
+        pipeline_state_t read_state = PIPE_IDLE; // state for the ring reads of the current block
+        JitterMeter jitter;
+        uint32_t depth_frames = STREAM_PRIME_MS * (AUDIO_SAMPLE_RATE / 1000); // current jitter depth
+        std::atomic<uint32_t> priors_version{0};    // priors already applied
+        uint32_t sink_seq = 0;
+        uint32_t host_seq = 0;
+        StageProfile profile[PROFILE_STAGE_COUNT]; // by stage, reset on each log (USB packet is the producer's)
+        std::atomic<bool> reset_stats{false};   // as for the producer: profiles, stretch counters, limiter
+    } consumer;
+
+    // Host clock recovery, fed from the USB task (SOFs and packets) and read by the consumer.
+    ClockEstimator host_clock;
+
+    StaticRingbuffer_t ring_struct;
+    alignas(CACHE_LINE_SIZE) uint8_t ring_storage[RINGBUF_SIZE];
+};
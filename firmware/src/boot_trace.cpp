@@ -0,0 +1,63 @@
+#include "boot_trace.h"
+
+#include <stdio.h>
+#include <atomic>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+struct boot_entry_t {
+    const char *name;
+    const char *task;
+    int64_t start_us;
+    std::atomic<int64_t> end_us;    // -1 while running, equal to start_us for a milestone
+};
+
+static boot_entry_t entries[BOOT_TRACE_MAX];
+static std::atomic<int> entry_count{0};
+
+static int record(const char *name, bool instant) {
+    int i = entry_count.fetch_add(1);
+    if (i >= BOOT_TRACE_MAX) {
+        entry_count.store(BOOT_TRACE_MAX);
+        return -1;
+    }
+    int64_t now = esp_timer_get_time();
+    entries[i].name = name;
+    entries[i].task = pcTaskGetName(nullptr);
+    entries[i].start_us = now;
+    entries[i].end_us.store(instant ? now : -1, std::memory_order_release);
+    return i;
+}
+
+int boot_phase_begin(const char *name) {
+    return record(name, false);
+}
+
+void boot_phase_end(int phase) {
+    if (phase >= 0) {
+        entries[phase].end_us.store(esp_timer_get_time(), std::memory_order_release);
+    }
+}
+
+void boot_milestone(const char *name) {
+    record(name, true);
+}
+
+// One line per entry, in the order they started: start from power-on, duration, task.
+void boot_trace_print() {
+    int count = entry_count.load();
+    printf("Boot trace (%d entries):\n", count);
+    for (int i = 0; i < count; ++i) {
+        const boot_entry_t &e = entries[i];
+        int64_t end = e.end_us.load(std::memory_order_acquire);
+        if (end == e.start_us) {
+            printf("  %8lld us  %-24s  milestone    [%s]\n", (long long) e.start_us, e.name, e.task);
+        } else if (end < 0) {
+            printf("  %8lld us  %-24s  running      [%s]\n", (long long) e.start_us, e.name, e.task);
+        } else {
+            printf("  %8lld us  %-24s  %8lld us  [%s]\n", (long long) e.start_us, e.name,
+                   (long long)(end - e.start_us), e.task);
+        }
+    }
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+#define BOOT_TRACE_MAX      16      // phases and milestones recorded per boot
+
+// Boot-time trace: when each bring-up phase started and how long it took, against
+// esp_timer (which counts from power-on). Phases may run concurrently in different tasks;
+// recording is lock-free and stops silently once the table is full.
+int boot_phase_begin(const char *name);    // returns a handle for boot_phase_end()
+void boot_phase_end(int phase);
+void boot_milestone(const char *name);     // an instant, e.g. "usb enumerated"
+void boot_trace_print();
@@ -0,0 +1,65 @@
+#include "channel_mix.h"
+
+#include <math.h>
+
+// One kernel per mode, specialized at compile time so each inner loop is straight-line
+// code; the mode is picked once per block through the table below.
+template <channel_mode_t Mode>
+static void mix_kernel(int16_t *samples, size_t frames, channel_mix_state_t *state) {
+    if (Mode == CHANNEL_CROSSFEED) {
+        float lp_l = state->lp[0], lp_r = state->lp[1];
+        const float k = state->lp_coeff, feed = state->feed, norm = state->norm;
+        for (size_t i = 0; i < frames; ++i) {
+            float l = samples[2 * i], r = samples[2 * i + 1];
+            lp_l += k * (l - lp_l);
+            lp_r += k * (r - lp_r);
+            // |norm * (x + feed * x)| <= |x|, so the result always fits in 16 bits.
+            samples[2 * i] = (int16_t)((l + feed * lp_r) * norm);
+            samples[2 * i + 1] = (int16_t)((r + feed * lp_l) * norm);
+        }
+        state->lp[0] = lp_l;
+        state->lp[1] = lp_r;
+        return;
+    }
+    for (size_t i = 0; i < frames; ++i) {
+        int16_t l = samples[2 * i], r = samples[2 * i + 1];
+        int16_t out_l, out_r;
+        switch (Mode) {
+            case CHANNEL_SWAP:  out_l = r; out_r = l; break;
+            case CHANNEL_MONO:  out_l = out_r = (int16_t)((l + r) >> 1); break;
+            case CHANNEL_LEFT:  out_l = out_r = l; break;
+            case CHANNEL_RIGHT: out_l = out_r = r; break;
+            default:            out_l = l; out_r = r; break;
+        }
+        samples[2 * i] = out_l;
+        samples[2 * i + 1] = out_r;
+    }
+}
+
+static const channel_kernel_fn kernels[CHANNEL_MODE_COUNT] = {
+    nullptr,
+    mix_kernel<CHANNEL_SWAP>,
+    mix_kernel<CHANNEL_MONO>,
+    mix_kernel<CHANNEL_LEFT>,
+    mix_kernel<CHANNEL_RIGHT>,
+    mix_kernel<CHANNEL_CROSSFEED>,
+};
+
+static const char *mode_names[CHANNEL_MODE_COUNT] = {
+    "stereo", "swap", "mono", "left", "right", "crossfeed",
+};
+
+channel_kernel_fn channel_kernel(channel_mode_t mode) {
+    return mode < CHANNEL_MODE_COUNT ? kernels[mode] : nullptr;
+}
+
+void channel_mix_init(channel_mix_state_t *state, float sample_rate) {
+    state->lp[0] = state->lp[1] = 0.0f;
+    state->lp_coeff = 1.0f - expf(-2.0f * (float)M_PI * CROSSFEED_CUTOFF_HZ / sample_rate);
+    state->feed = powf(10.0f, CROSSFEED_LEVEL_DB / 20.0f);
+    state->norm = 1.0f / (1.0f + state->feed);
+}
+
+const char *channel_mode_name(channel_mode_t mode) {
+    return mode < CHANNEL_MODE_COUNT ? mode_names[mode] : "?";
+}
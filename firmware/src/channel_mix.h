@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CROSSFEED_CUTOFF_HZ 700.0f  // the opposite ear mostly hears low frequencies (head shadow)
+#define CROSSFEED_LEVEL_DB  -4.5f   // crossfed level relative to the direct signal
+
+enum channel_mode_t : uint8_t {
+    CHANNEL_STEREO,     // pass through
+    CHANNEL_SWAP,
+    CHANNEL_MONO,       // (L + R) / 2 on both sides, for single-earbud use
+    CHANNEL_LEFT,       // left on both sides
+    CHANNEL_RIGHT,      // right on both sides
+    CHANNEL_CROSSFEED,  // Bauer-style: low-passed opposite channel mixed into each side
+    CHANNEL_MODE_COUNT,
+};
+
+// State carried between blocks (crossfeed only).
+struct channel_mix_state_t {
+    float lp[2];            // one-pole low-pass of the left and right input
+    float lp_coeff;
+    float feed;             // crossfeed gain
+    float norm;             // keeps a centered full-scale signal from clipping
+};
+
+// Block kernel over interleaved stereo 16-bit PCM, in place.
+typedef void (*channel_kernel_fn)(int16_t *samples, size_t frames, channel_mix_state_t *state);
+
+// Kernel for `mode`, nullptr for stereo (nothing to do).
+channel_kernel_fn channel_kernel(channel_mode_t mode);
+
+void channel_mix_init(channel_mix_state_t *state, float sample_rate);
+const char *channel_mode_name(channel_mode_t mode);
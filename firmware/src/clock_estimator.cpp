@@ -0,0 +1,106 @@
+#include "clock_estimator.h"
+
+#include <math.h>
+
+bool ClockFit::add(uint64_t count, int64_t time_us) {
+    if (pending == 0) {
+        base_count = count;
+        base_time = time_us;
+        sum_count = sum_time = 0.0;
+    }
+    sum_count += (double)(count - base_count);
+    sum_time += (double)(time_us - base_time);
+    if (++pending < CLOCK_FIT_AVERAGE) {
+        return false;
+    }
+    counts[next] = (double)base_count + sum_count / pending;
+    times[next] = (double)base_time + sum_time / pending;
+    pending = 0;
+    next = (next + 1) % CLOCK_FIT_POINTS;
+    if (points < CLOCK_FIT_POINTS) points++;
+    return true;
+}
+
+bool ClockFit::slope(double *us_per_count, double *stderr_us) const {
+    if (points < 3) {
+        return false;
+    }
+    // Relative to the oldest point, so doubles keep full precision.
+    int oldest = points == CLOCK_FIT_POINTS ? next : 0;
+    double c0 = counts[oldest], t0 = times[oldest];
+    double mean_c = 0.0, mean_t = 0.0;
+    for (int i = 0; i < points; ++i) {
+        mean_c += counts[i] - c0;
+        mean_t += times[i] - t0;
+    }
+    mean_c /= points;
+    mean_t /= points;
+    double scc = 0.0, sct = 0.0;
+    for (int i = 0; i < points; ++i) {
+        double c = counts[i] - c0 - mean_c, t = times[i] - t0 - mean_t;
+        scc += c * c;
+        sct += c * t;
+    }
+    if (scc <= 0.0) {
+        return false;
+    }
+    double k = sct / scc;
+    double residual = 0.0;
+    for (int i = 0; i < points; ++i) {
+        double c = counts[i] - c0 - mean_c, t = times[i] - t0 - mean_t;
+        double r = t - k * c;
+        residual += r * r;
+    }
+    *us_per_count = k;
+    *stderr_us = sqrt(residual / (points - 2) / scc);
+    return true;
+}
+
+void ClockEstimator::init(uint32_t sample_rate) {
+    this->sample_rate = sample_rate;
+    sof_fit.reset();
+    sof_started = false;
+    sofs = 0;
+    reset_packets();
+}
+
+void ClockEstimator::on_sof(uint32_t frame_count, int64_t now_us) {
+    // The frame number is 11 bits; count SOFs ourselves so missed callbacks don't matter.
+    if (!sof_started) {
+        last_frame = frame_count;
+        sof_started = true;
+    }
+    sofs += (frame_count - last_frame) & 0x7FF;
+    last_frame = frame_count;
+    double period, error;
+    if (!sof_fit.add(sofs, now_us)) {
+        return;
+    }
+    if (sof_fit.slope(&period, &error)) {
+        sof_ppm.store((float)((1000.0 / period - 1.0) * 1e6), std::memory_order_relaxed);
+        sof_error.store((float)(error / period * 1e6), std::memory_order_relaxed);
+        sof_locked.store(sof_fit.settled() && error / period * 1e6 < CLOCK_LOCK_PPM, std::memory_order_relaxed);
+    }
+}
+
+void ClockEstimator::on_packet(uint32_t frames, int64_t now_us) {
+    // The timestamp marks the end of the packet, so count its frames first.
+    frames_in += frames;
+    double period, error;
+    if (!packet_fit.add(frames_in, now_us)) {
+        return;
+    }
+    if (packet_fit.slope(&period, &error)) {
+        double nominal = 1e6 / sample_rate;
+        packet_ppm.store((float)((nominal / period - 1.0) * 1e6), std::memory_order_relaxed);
+        packet_error.store((float)(error / period * 1e6), std::memory_order_relaxed);
+        packet_locked.store(packet_fit.settled() && error / period * 1e6 < CLOCK_LOCK_PPM, std::memory_order_relaxed);
+    }
+}
+
+// Stream (re)started: the packet count restarts, the host clock estimate carries on.
+void ClockEstimator::reset_packets() {
+    packet_fit.reset();
+    frames_in = 0;
+    packet_locked.store(false, std::memory_order_relaxed);
+}
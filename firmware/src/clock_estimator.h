@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+#define CLOCK_FIT_POINTS    128     // points in the least-squares window
+#define CLOCK_FIT_AVERAGE   64      // events averaged into each point (64 ms per point, ~8 s window)
+#define CLOCK_LOCK_PPM      1.0f    // standard error below which an estimate counts as locked
+
+// Least-squares line through (count, time) events over a sliding window: the slope is the
+// period of whatever is being counted. Events are first averaged CLOCK_FIT_AVERAGE at a time
+// (the low-pass), which takes most of the callback latency jitter out before the fit sees
+// it; the residuals of the fit give the standard error. No ESP-IDF dependencies.
+class ClockFit {
+public:
+    void reset() { points = 0; next = 0; pending = 0; }
+    // Returns true when a new point went into the window.
+    bool add(uint64_t count, int64_t time_us);
+    // Enough of the window filled for the standard error to mean something (2 s).
+    bool settled() const { return points >= CLOCK_FIT_POINTS / 4; }
+    // Microseconds per count and its standard error; false until three points are in.
+    bool slope(double *us_per_count, double *stderr_us) const;
+
+private:
+    double counts[CLOCK_FIT_POINTS];
+    double times[CLOCK_FIT_POINTS];
+    int points = 0;
+    int next = 0;
+    int pending = 0;                // events in the point being averaged
+    uint64_t base_count = 0;        // first event of that point
+    int64_t base_time = 0;
+    double sum_count = 0.0, sum_time = 0.0;
+};
+
+// Host clock recovery from USB start-of-frame events and OUT packet arrivals, both
+// timestamped against the device clock.
+//  - SOF: the host's 1 ms frame clock, so its offset in ppm against ours.
+//  - Packets: the rate the host actually sends samples at, however the frame sizes vary
+//    (44/45 at 44.1 kHz, or whatever the feedback asks for).
+class ClockEstimator {
+public:
+    void init(uint32_t sample_rate);
+    // USB task: every SOF and every OUT packet.
+    void on_sof(uint32_t frame_count, int64_t now_us);
+    void on_packet(uint32_t frames, int64_t now_us);
+    void reset_packets();
+
+    // Any context. ppm > 0: the host runs fast against the device.
+    float host_ppm() const { return sof_ppm.load(std::memory_order_relaxed); }
+    float host_ppm_error() const { return sof_error.load(std::memory_order_relaxed); }
+    bool host_locked() const { return sof_locked.load(std::memory_order_relaxed); }
+    // Host SOF period in device microseconds (1000 when unknown).
+    double host_frame_us() const { return 1000.0 / (1.0 + host_ppm() * 1e-6); }
+    // Host sample rate against nominal, from the packets.
+    float stream_ppm() const { return packet_ppm.load(std::memory_order_relaxed); }
+    float stream_ppm_error() const { return packet_error.load(std::memory_order_relaxed); }
+    bool stream_locked() const { return packet_locked.load(std::memory_order_relaxed); }
+
+private:
+    uint32_t sample_rate = 48000;
+    ClockFit sof_fit, packet_fit;
+    bool sof_started = false;
+    uint64_t sofs = 0;              // SOFs seen, extended past the 11-bit frame number
+    uint32_t last_frame = 0;
+    uint64_t frames_in = 0;         // frames received
+    std::atomic<float> sof_ppm{0.0f}, sof_error{0.0f};
+    std::atomic<bool> sof_locked{false};
+    std::atomic<float> packet_ppm{0.0f}, packet_error{0.0f};
+    std::atomic<bool> packet_locked{false};
+};
@@ -0,0 +1,127 @@
+#include "connection_manager.h"
+
+#include <string.h>
+
+static const char *conn_state_names[] = { "idle", "paging", "discovering", "connected" };
+
+const char *ConnectionManager::state_name(conn_state_t state) {
+    return conn_state_names[state];
+}
+
+void ConnectionManager::init(const sink_list_t *list, const char *discovery_name) {
+    sinks = {};
+    if (list != nullptr && list->count <= CONN_MAX_SINKS) {
+        sinks = *list;
+    }
+    strncpy(this->discovery_name, discovery_name, CONN_NAME_LEN - 1);
+    conn_state = CONN_IDLE;
+}
+
+int ConnectionManager::find(const uint8_t bda[6]) const {
+    for (int i = 0; i < sinks.count; ++i) {
+        if (memcmp(sinks.sinks[i].bda, bda, 6) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+conn_action_t ConnectionManager::page(int index, uint32_t now_ms) {
+    conn_action_t action = { CONN_ACT_PAGE, {} };
+    memcpy(action.bda, sinks.sinks[index].bda, 6);
+    conn_state = CONN_PAGING;
+    paging = index;
+    deadline_ms = now_ms + CONN_PAGE_TIMEOUT_MS;
+    return action;
+}
+
+conn_action_t ConnectionManager::start(uint32_t now_ms) {
+    if (sinks.count > 0) {
+        return page(0, now_ms);
+    }
+    conn_state = CONN_DISCOVERING;
+    deadline_ms = now_ms + CONN_DISCOVERY_MS;
+    return { CONN_ACT_DISCOVER, {} };
+}
+
+// The current attempt failed: page the next known sink, or fall back to an inquiry once
+// all of them have been tried.
+conn_action_t ConnectionManager::next_attempt(uint32_t now_ms) {
+    if (conn_state == CONN_PAGING && paging >= 0) {
+        sinks.sinks[paging].page_failures++;     // persisted with the next connect, not now
+        if (paging + 1 < sinks.count && paging + 1 < CONN_PAGE_MAX) {
+            return page(paging + 1, now_ms);
+        }
+    }
+    if (conn_state == CONN_DISCOVERING) {
+        return start(now_ms);   // inquiry found nothing: go round the known sinks again
+    }
+    conn_state = CONN_DISCOVERING;
+    deadline_ms = now_ms + CONN_DISCOVERY_MS;
+    return { CONN_ACT_DISCOVER, {} };
+}
+
+conn_action_t ConnectionManager::tick(uint32_t now_ms) {
+    if ((conn_state == CONN_PAGING || conn_state == CONN_DISCOVERING) && (int32_t)(now_ms - deadline_ms) >= 0) {
+        return next_attempt(now_ms);
+    }
+    return { CONN_ACT_NONE, {} };
+}
+
+bool ConnectionManager::on_discovered(const char *name, const uint8_t bda[6], uint32_t now_ms) {
+    if (conn_state != CONN_DISCOVERING) {
+        return false;
+    }
+    bool known = find(bda) >= 0;
+    if (!known && (name == nullptr || strcmp(name, discovery_name) != 0)) {
+        return false;
+    }
+    // The stack connects to it; treat that like a page of our own.
+    memcpy(pending_bda, bda, 6);
+    strncpy(pending_name, name != nullptr ? name : "", CONN_NAME_LEN - 1);
+    conn_state = CONN_PAGING;
+    paging = -1;
+    deadline_ms = now_ms + CONN_PAGE_TIMEOUT_MS;
+    return true;
+}
+
+// Whatever connected goes to the front of the list, new sinks push the oldest out.
+conn_action_t ConnectionManager::on_connected(const uint8_t bda[6], uint32_t now_ms) {
+    int index = find(bda);
+    sink_entry_t entry = {};
+    if (index >= 0) {
+        entry = sinks.sinks[index];
+    } else {
+        memcpy(entry.bda, bda, 6);
+        index = sinks.count < CONN_MAX_SINKS ? sinks.count++ : CONN_MAX_SINKS - 1;
+    }
+    if (memcmp(bda, pending_bda, 6) == 0 && pending_name[0] != '\0') {
+        memcpy(entry.name, pending_name, CONN_NAME_LEN);
+    }
+    entry.connects++;
+    memmove(&sinks.sinks[1], &sinks.sinks[0], index * sizeof(sink_entry_t));
+    sinks.sinks[0] = entry;
+    changed = true;
+    conn_state = CONN_CONNECTED;
+    paging = -1;
+    return { CONN_ACT_NONE, {} };
+}
+
+// A failed page also ends in a disconnect; a dropped link starts over from the top of the
+// list, which is the sink that was just lost.
+conn_action_t ConnectionManager::on_disconnected(uint32_t now_ms) {
+    switch (conn_state) {
+        case CONN_PAGING:
+            return next_attempt(now_ms);
+        case CONN_CONNECTED:
+            return start(now_ms);
+        default:
+            return { CONN_ACT_NONE, {} };
+    }
+}
+
+bool ConnectionManager::take_list_changed() {
+    bool was = changed;
+    changed = false;
+    return was;
+}
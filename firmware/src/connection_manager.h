@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CONN_MAX_SINKS      8       // remembered sinks, most recently used first
+#define CONN_NAME_LEN       32
+#define CONN_PAGE_MAX       2       // known sinks paged before falling back to inquiry (which
+                                    // still connects to any known sink it finds)
+#define CONN_PAGE_TIMEOUT_SLOTS 0x1400  // controller page timeout, 0.625 ms slots (3.2 s, default 5.12 s);
+                                    // covers a sink scanning every 1.28 s with room to spare
+#define CONN_PAGE_TIMEOUT_MS 4000   // backstop in case the stack never reports the failure
+#define CONN_DISCOVERY_MS   20000   // inquiry this long before paging the known sinks again
+
+// A sink that has connected before: paged directly by address on the next boot.
+struct sink_entry_t {
+    uint8_t bda[6];
+    char name[CONN_NAME_LEN];       // as seen in discovery, empty if it never was
+    uint16_t connects;
+    uint16_t page_failures;
+};
+
+// Priority-ordered list of known sinks, persisted as one blob.
+struct sink_list_t {
+    uint8_t version;
+    uint8_t count;
+    sink_entry_t sinks[CONN_MAX_SINKS];
+};
+
+enum conn_state_t {
+    CONN_IDLE,          // not started, or waiting for the next attempt
+    CONN_PAGING,        // connecting to one known sink
+    CONN_DISCOVERING,   // inquiry, looking for the configured name or any known sink
+    CONN_CONNECTED,
+};
+
+// What the caller has to do with the Bluetooth stack after an event.
+enum conn_action_type_t {
+    CONN_ACT_NONE,
+    CONN_ACT_PAGE,              // stop any inquiry and connect to `bda`
+    CONN_ACT_DISCOVER,          // start an inquiry
+};
+
+struct conn_action_t {
+    conn_action_type_t type;
+    uint8_t bda[6];
+};
+
+// Sink selection. On start, and whenever the link drops, the known sinks are paged
+// directly in priority order, and only if none of them answers does it fall back to an
+// inquiry for the configured name, which takes seconds. Any sink that connects moves to the
+// front of the list. The manager only decides: events go in, actions come out, so it is
+// plain logic that can be locked cheaply and run off target. No ESP-IDF dependencies.
+class ConnectionManager {
+public:
+    void init(const sink_list_t *list, const char *discovery_name);
+
+    conn_action_t start(uint32_t now_ms);
+    conn_action_t tick(uint32_t now_ms);
+    conn_action_t on_connected(const uint8_t bda[6], uint32_t now_ms);
+    conn_action_t on_disconnected(uint32_t now_ms);
+    // Inquiry result: true if it is wanted and the stack should connect to it.
+    bool on_discovered(const char *name, const uint8_t bda[6], uint32_t now_ms);
+
+    conn_state_t state() const { return conn_state; }
+    static const char *state_name(conn_state_t state);
+    const sink_list_t &list() const { return sinks; }
+    // True once after every change worth persisting.
+    bool take_list_changed();
+
+private:
+    int find(const uint8_t bda[6]) const;
+    conn_action_t page(int index, uint32_t now_ms);
+    conn_action_t next_attempt(uint32_t now_ms);
+
+    sink_list_t sinks = {};
+    char discovery_name[CONN_NAME_LEN] = {};
+    conn_state_t conn_state = CONN_IDLE;
+    int paging = -1;                // index being paged, -1 for a discovered sink
+    uint32_t deadline_ms = 0;
+    uint8_t pending_bda[6] = {};    // discovered sink being connected
+    char pending_name[CONN_NAME_LEN] = {};
+    bool changed = false;
+};
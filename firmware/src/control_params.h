@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+#include "freertos/FreeRTOS.h"
+#include "parametric_eq.h"
+#include "channel_mix.h"
+
+// Sequence lock for a small POD: any number of writers (serialized by a spinlock critical
+// section) and lock-free readers that retry only if a write raced their copy. The audio
+// path takes one snapshot per block, so a parameter change never lands mid-block.
+// The value is held as atomic words rather than a plain T: a reader copying while a writer
+// stores is then not a data race, only a torn copy that the sequence check throws away.
+// Word stores are release and word loads acquire, which keeps them between the sequence
+// updates without standalone fences.
+template <typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock copies T word by word");
+
+public:
+    SeqLock() { store(T{}); }
+
+    // Writer side: runs `fn(T&)` on a copy and publishes the result.
+    template <typename Fn>
+    void update(Fn fn) {
+        portENTER_CRITICAL(&writer_lock);
+        T value;
+        load(&value);       // only writers store, and they hold the lock
+        fn(value);
+        uint32_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);  // odd: write in progress
+        store(value);
+        sequence.store(seq + 2, std::memory_order_release);
+        portEXIT_CRITICAL(&writer_lock);
+    }
+
+    // Reader side: returns a consistent copy without taking a lock.
+    T read() const {
+        T copy;
+        uint32_t before, after;
+        do {
+            before = sequence.load(std::memory_order_acquire);
+            load(&copy);
+            after = sequence.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+        return copy;
+    }
+
+    // Bumped on every write; lets readers skip work when nothing changed.
+    uint32_t version() const {
+        return sequence.load(std::memory_order_acquire);
+    }
+
+private:
+    static constexpr size_t WORDS = (sizeof(T) + 3) / 4;
+
+    void load(T *out) const {
+        uint8_t *dst = (uint8_t*) out;
+        for (size_t i = 0; i < WORDS; ++i) {
+            uint32_t w = words[i].load(std::memory_order_acquire);
+            memcpy(dst + i * 4, &w, i + 1 < WORDS ? 4 : sizeof(T) - i * 4);
+        }
+    }
+
+    void store(const T &value) {
+        const uint8_t *src = (const uint8_t*) &value;
+        for (size_t i = 0; i < WORDS; ++i) {
+            uint32_t w = 0;
+            memcpy(&w, src + i * 4, i + 1 < WORDS ? 4 : sizeof(T) - i * 4);
+            words[i].store(w, std::memory_order_release);
+        }
+    }
+
+    std::atomic<uint32_t> sequence{0};
+    portMUX_TYPE writer_lock = portMUX_INITIALIZER_UNLOCKED;
+    std::atomic<uint32_t> words[WORDS];
+};
+
+// Control parameters written from USB control / AVRCP context and snapshotted once per
+// audio block by the Bluetooth consumer.
+struct control_params_t {
+    uint32_t volume = 100;      // host volume as received (0-100% by default)
+    bool mute = false;
+    float gain = 1.0f;          // linear gain target derived from volume and boost
+    float boost_db = 0.0f;      // extra gain above 100% volume, kept safe by the limiter
+    uint16_t ramp_ms = 10;      // time for a full-scale gain change, avoids zipper noise
+    channel_mode_t channel_mode = CHANNEL_STEREO;
+    eq_params_t eq;             // parametric EQ bands and their designed coefficients
+    bool limiter = true;        // look-ahead limiter (always on while boosting)
+    float limiter_ceiling = 0.891f; // linear output ceiling (-1 dBFS)
+    uint16_t limiter_release_ms = 100;
+    bool loudness_norm = false; // slow auto-gain toward loudness_target_lufs
+    float loudness_target_lufs = -18.0f;
+};
@@ -0,0 +1,136 @@
+#include "cue_mixer.h"
+
+#include <math.h>
+
+// One sine period plus the wrap-around point, for interpolated table lookup.
+static const int16_t sine_table[257] = {
+    0, 804, 1608, 2410, 3212, 4011, 4808, 5602, 6393, 7179, 7962, 8739,
+    9512, 10278, 11039, 11793, 12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530,
+    18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594, 23170, 23731, 24279, 24811,
+    25329, 25832, 26319, 26790, 27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+    30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971, 32137, 32285, 32412, 32521,
+    32609, 32678, 32728, 32757, 32767, 32757, 32728, 32678, 32609, 32521, 32412, 32285,
+    32137, 31971, 31785, 31580, 31356, 31113, 30852, 30571, 30273, 29956, 29621, 29268,
+    28898, 28510, 28105, 27683, 27245, 26790, 26319, 25832, 25329, 24811, 24279, 23731,
+    23170, 22594, 22005, 21403, 20787, 20159, 19519, 18868, 18204, 17530, 16846, 16151,
+    15446, 14732, 14010, 13279, 12539, 11793, 11039, 10278, 9512, 8739, 7962, 7179,
+    6393, 5602, 4808, 4011, 3212, 2410, 1608, 804, 0, -804, -1608, -2410,
+    -3212, -4011, -4808, -5602, -6393, -7179, -7962, -8739, -9512, -10278, -11039, -11793,
+    -12539, -13279, -14010, -14732, -15446, -16151, -16846, -17530, -18204, -18868, -19519, -20159,
+    -20787, -21403, -22005, -22594, -23170, -23731, -24279, -24811, -25329, -25832, -26319, -26790,
+    -27245, -27683, -28105, -28510, -28898, -29268, -29621, -29956, -30273, -30571, -30852, -31113,
+    -31356, -31580, -31785, -31971, -32137, -32285, -32412, -32521, -32609, -32678, -32728, -32757,
+    -32767, -32757, -32728, -32678, -32609, -32521, -32412, -32285, -32137, -31971, -31785, -31580,
+    -31356, -31113, -30852, -30571, -30273, -29956, -29621, -29268, -28898, -28510, -28105, -27683,
+    -27245, -26790, -26319, -25832, -25329, -24811, -24279, -23731, -23170, -22594, -22005, -21403,
+    -20787, -20159, -19519, -18868, -18204, -17530, -16846, -16151, -15446, -14732, -14010, -13279,
+    -12539, -11793, -11039, -10278, -9512, -8739, -7962, -7179, -6393, -5602, -4808, -4011,
+    -3212, -2410, -1608, -804, 0,
+};
+
+static const cue_tone_t connected_tones[] = { { 880, 90 }, { 0, 30 }, { 1320, 120 } };
+static const cue_tone_t low_buffer_tones[] = { { 440, 80 } };
+static const cue_tone_t profile_tones[] = { { 1000, 60 }, { 0, 60 }, { 1000, 60 } };
+
+#define TONES(t) nullptr, 0, t, sizeof(t) / sizeof(t[0])
+
+static const cue_t cues[CUE_COUNT] = {
+    {},
+    { TONES(connected_tones) },
+    { TONES(low_buffer_tones) },
+    { TONES(profile_tones) },
+};
+
+static const char *cue_names[CUE_COUNT] = {
+    "none", "connected", "low buffer", "profile change",
+};
+
+const char *CueMixer::cue_name(cue_id_t cue) {
+    return cue < CUE_COUNT ? cue_names[cue] : "?";
+}
+
+void CueMixer::init(uint32_t sample_rate) {
+    this->sample_rate = sample_rate;
+    fade_frames = sample_rate * CUE_FADE_MS / 1000;
+    duck_level = powf(10.0f, CUE_DUCK_DB / 20.0f);
+    duck_step = (1.0f - duck_level) / (sample_rate * CUE_DUCK_RAMP_MS / 1000);
+    level = powf(10.0f, CUE_LEVEL_DB / 20.0f);
+}
+
+void CueMixer::trigger(cue_id_t cue) {
+    if (cue > CUE_NONE && cue < CUE_COUNT) {
+        pending.store(cue, std::memory_order_relaxed);
+    }
+}
+
+// Sets up the current tone or clip; returns false when the cue is over.
+bool CueMixer::start_segment() {
+    position = 0;
+    if (playing->pcm != nullptr) {
+        length = segment == 0 ? playing->pcm_frames : 0;
+    } else if (segment < playing->tone_count) {
+        const cue_tone_t &tone = playing->tones[segment];
+        length = sample_rate * tone.ms / 1000;
+        phase = 0;
+        phase_step = (uint32_t)((uint64_t)tone.freq_hz * 65536 * 65536 / sample_rate);
+    } else {
+        length = 0;
+    }
+    return length > 0;
+}
+
+int16_t CueMixer::next_sample() {
+    if (playing->pcm != nullptr) {
+        return playing->pcm[position];
+    }
+    if (phase_step == 0) {
+        return 0;   // gap
+    }
+    uint32_t index = phase >> 24;
+    int32_t frac = (phase >> 8) & 0xFFFF;
+    int32_t a = sine_table[index], b = sine_table[index + 1];
+    phase += phase_step;
+    float s = (float)(a + (((b - a) * frac) >> 16));
+    // Linear attack and release inside each tone.
+    uint32_t edge = position < length - position ? position : length - position;
+    if (edge < fade_frames) {
+        s *= (float) edge / fade_frames;
+    }
+    return (int16_t)(s * level);
+}
+
+void CueMixer::mix(int16_t *samples, size_t frames) {
+    uint8_t cue = pending.exchange(CUE_NONE, std::memory_order_relaxed);
+    if (cue != CUE_NONE) {
+        // A new cue replaces whatever is playing.
+        playing = &cues[cue];
+        segment = 0;
+        if (!start_segment()) {
+            playing = nullptr;
+        }
+    }
+    float duck_target = playing != nullptr ? duck_level : 1.0f;
+    for (size_t i = 0; i < frames; ++i) {
+        if (duck > duck_target) {
+            duck -= duck_step;
+            if (duck < duck_target) duck = duck_target;
+        } else if (duck < duck_target) {
+            duck += duck_step;
+            if (duck > duck_target) duck = duck_target;
+        }
+        int32_t overlay = 0;
+        if (playing != nullptr) {
+            overlay = next_sample();
+            if (++position >= length) {
+                segment++;
+                if (!start_segment()) {
+                    playing = nullptr;      // the duck releases from the next block
+                }
+            }
+        }
+        for (int c = 0; c < 2; ++c) {
+            int32_t v = (int32_t)(samples[2 * i + c] * duck) + overlay;
+            samples[2 * i + c] = (int16_t)(v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+        }
+    }
+}
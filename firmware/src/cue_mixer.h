@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+#define CUE_LEVEL_DB        -12.0f  // tone peak level
+#define CUE_DUCK_DB         -15.0f  // main stream level while a cue plays
+#define CUE_DUCK_RAMP_MS    10      // duck in/out time
+#define CUE_FADE_MS         5       // attack/release of each tone, avoids clicks
+
+enum cue_id_t : uint8_t {
+    CUE_NONE,
+    CUE_CONNECTED,      // rising two-tone
+    CUE_LOW_BUFFER,     // short low beep
+    CUE_PROFILE_CHANGE, // double beep
+    CUE_COUNT,
+};
+
+// One tone of a synthesized cue; freq_hz 0 is a gap.
+struct cue_tone_t {
+    uint16_t freq_hz;
+    uint16_t ms;
+};
+
+// A cue is either a mono PCM clip at the output rate or a list of tones. Both live in
+// flash (const) and are read in place while playing.
+struct cue_t {
+    const int16_t *pcm;
+    uint32_t pcm_frames;
+    const cue_tone_t *tones;
+    uint8_t tone_count;
+};
+
+// Overlays cues on interleaved stereo 16-bit PCM and ducks the main stream under them.
+// trigger() may be called from any context; mix() runs in the audio consumer and costs
+// one flag check while nothing is playing.
+class CueMixer {
+public:
+    void init(uint32_t sample_rate);
+    void trigger(cue_id_t cue);
+    bool active() const {
+        return playing != nullptr || duck != 1.0f || pending.load(std::memory_order_relaxed) != CUE_NONE;
+    }
+    void mix(int16_t *samples, size_t frames);
+
+    static const char *cue_name(cue_id_t cue);
+
+private:
+    bool start_segment();
+    int16_t next_sample();
+
+    std::atomic<uint8_t> pending{CUE_NONE};
+    uint32_t sample_rate = 48000;
+    const cue_t *playing = nullptr;
+    uint32_t segment = 0;           // tone index, or 0 for a clip
+    uint32_t position = 0;          // frames into the current tone or clip
+    uint32_t length = 0;            // frames in the current tone or clip
+    uint32_t phase = 0, phase_step = 0;     // 32-bit phase accumulator, top 8 bits index the sine table
+    uint32_t fade_frames = 0;
+    float duck = 1.0f;              // main stream gain, ramps between 1 and duck_level
+    float duck_level, duck_step;
+    float level;
+};
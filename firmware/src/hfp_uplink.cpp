@@ -0,0 +1,284 @@
+#include "hfp_uplink.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include "esp_timer.h"
+#include "esp_bt_defs.h"
+#include "esp_hf_ag_api.h"          // Bluedroid HFP Audio Gateway (SCO audio with the headset)
+#include "spsc_ring.h"
+
+static_assert(MIC_USB_SAMPLE_RATE % 16000 == 0, "MIC_USB_SAMPLE_RATE must be 16 kHz or 48 kHz");
+static_assert(MIC_USB_CHANNELS == 1 || MIC_USB_CHANNELS == 2, "MIC_USB_CHANNELS must be 1 or 2");
+
+#define MIC_RINGBUF_SIZE    4096    // 128 ms of 16 kHz mono, plenty for SCO bursts
+#define TAPS_PER_PHASE      8       // FIR length per polyphase branch
+#define MAX_RATE_FACTOR     6       // 48 kHz <-> 8 kHz CVSD
+#define DOWNLINK_RATE       48000   // rate of the PCM delivered by downlink_cb
+#define DATA_READY_PERIOD_US 7500   // SCO packet interval for mSBC
+
+// Integer-factor polyphase FIR. Used as an interpolator (SCO -> USB mic rate)
+// and as a decimator (48 kHz downlink -> SCO rate).
+struct rate_filter_t {
+    int factor;
+    int taps;
+    int16_t coeffs[MAX_RATE_FACTOR * TAPS_PER_PHASE];
+    int16_t history[MAX_RATE_FACTOR * TAPS_PER_PHASE];
+    int pos;
+};
+
+// Mic path: decoded SCO PCM (mono 16-bit) from the headset, consumed by the USB input callback.
+static SpscRing<MIC_RINGBUF_SIZE> mic_ring;
+static std::atomic<uint32_t> sco_rate{0};
+static rate_filter_t up_msbc, up_cvsd;      // SCO -> USB mic rate
+static rate_filter_t down_msbc, down_cvsd;  // downlink -> SCO rate
+static int16_t mic_pending[MAX_RATE_FACTOR * MIC_USB_CHANNELS];  // leftover interpolated frames
+static size_t mic_pending_frames = 0;
+
+static int32_t (*downlink_source)(uint8_t *data, int32_t len) = NULL;
+static void (*profile_changed)(bool sco_up) = NULL;
+static esp_bd_addr_t hfp_peer;
+static std::atomic<bool> slc_connected{false};
+static std::atomic<bool> audio_requested{false};
+static esp_timer_handle_t data_ready_timer = NULL;
+
+static uplink_stats_t uplink_stats;
+
+// Windowed-sinc lowpass, cutoff just below the SCO Nyquist frequency, scaled by `gain`.
+static void design_rate_filter(rate_filter_t *f, int factor, float gain) {
+    memset(f, 0, sizeof(*f));
+    f->factor = factor;
+    f->taps = factor * TAPS_PER_PHASE;
+    if (factor == 1) {
+        f->coeffs[0] = 32767;
+        f->taps = 1;
+        return;
+    }
+    float cutoff = 0.45f / factor;  // normalized to the high rate
+    float center = (f->taps - 1) * 0.5f;
+    for (int i = 0; i < f->taps; ++i) {
+        float x = i - center;
+        float sinc = (x == 0.0f) ? 2.0f * cutoff : sinf(2.0f * (float)M_PI * cutoff * x) / ((float)M_PI * x);
+        float window = 0.54f - 0.46f * cosf(2.0f * (float)M_PI * i / (f->taps - 1));  // Hamming
+        f->coeffs[i] = (int16_t)lrintf(sinc * window * gain * 32767.0f);
+    }
+}
+
+// Interpolate one SCO sample into `factor` output samples.
+static void interpolate_sample(rate_filter_t *f, int16_t in, int16_t *out) {
+    memmove(f->history + 1, f->history, (TAPS_PER_PHASE - 1) * sizeof(int16_t));
+    f->history[0] = in;
+    for (int p = 0; p < f->factor; ++p) {
+        int32_t acc = 0;
+        for (int k = 0; k < TAPS_PER_PHASE; ++k) {
+            acc += (int32_t)f->coeffs[k * f->factor + p] * f->history[k];
+        }
+        acc >>= 15;
+        if (acc > 32767) acc = 32767;
+        if (acc < -32768) acc = -32768;
+        out[p] = (int16_t)acc;
+    }
+}
+
+// Push one high-rate sample; returns true and writes *out every `factor` samples.
+static bool decimate_sample(rate_filter_t *f, int16_t in, int16_t *out) {
+    f->history[f->pos] = in;
+    f->pos = (f->pos + 1) % f->taps;
+    if (f->pos % f->factor != 0) {
+        return false;
+    }
+    int32_t acc = 0;
+    for (int k = 0; k < f->taps; ++k) {
+        acc += (int32_t)f->coeffs[k] * f->history[(f->pos + k) % f->taps];
+    }
+    acc >>= 15;
+    if (acc > 32767) acc = 32767;
+    if (acc < -32768) acc = -32768;
+    *out = (int16_t)acc;
+    return true;
+}
+
+static void mic_ring_push(const uint8_t *buf, uint32_t len) {
+    size_t written = mic_ring.write(buf, len);
+    uplink_stats.frames_in += len / 2;
+    uplink_stats.frames_dropped += (len - written) / 2;
+}
+
+// HFP incoming audio: decoded mSBC/CVSD PCM from the headset microphone.
+static void hfp_incoming_data_cb(const uint8_t *buf, uint32_t len) {
+#if !UPLINK_LOOPBACK_TEST
+    mic_ring_push(buf, len);
+#endif
+}
+
+// HFP outgoing audio: SCO downlink to the headset speaker while a call is active.
+static uint32_t hfp_outgoing_data_cb(uint8_t *buf, uint32_t len) {
+    uint32_t rate = sco_rate.load(std::memory_order_relaxed);
+    if (rate == 0 || downlink_source == NULL) {
+        return 0;
+    }
+    rate_filter_t *f = (rate == 16000) ? &down_msbc : &down_cvsd;
+    int16_t *out = (int16_t*) buf;
+    size_t out_samples = len / 2;
+    size_t produced = 0;
+    int16_t block[2 * 48];  // 1 ms of 48 kHz stereo
+    while (produced < out_samples) {
+        // Only what the packet still needs: frames left over in the block would be lost.
+        size_t want = (out_samples - produced) * f->factor;
+        if (want > sizeof(block) / 4) want = sizeof(block) / 4;
+        int32_t got = downlink_source((uint8_t*) block, (int32_t)(want * 4));
+        if (got <= 0) {
+            memset(out + produced, 0, (out_samples - produced) * 2);
+            break;
+        }
+        for (int32_t i = 0; i + 1 < got / 2 && produced < out_samples; i += 2) {
+            int16_t mono = (int16_t)(((int32_t)block[i] + block[i + 1]) / 2);
+            if (decimate_sample(f, mono, &out[produced])) {
+                ++produced;
+            }
+        }
+    }
+#if UPLINK_LOOPBACK_TEST
+    // Stand-in headset: echo the downlink straight back into the mic path.
+    mic_ring_push(buf, len);
+#endif
+    return len;
+}
+
+static void data_ready_timer_cb(void *arg) {
+    esp_hf_ag_outgoing_data_ready();
+}
+
+static void hfp_event_cb(esp_hf_cb_event_t event, esp_hf_cb_param_t *param) {
+    switch (event) {
+        case ESP_HF_CONNECTION_STATE_EVT:
+            if (param->conn_stat.state == ESP_HF_CONNECTION_STATE_SLC_CONNECTED) {
+                memcpy(hfp_peer, param->conn_stat.remote_bda, sizeof(esp_bd_addr_t));
+                slc_connected = true;
+                printf("HFP: service level connection up\n");
+            } else if (param->conn_stat.state == ESP_HF_CONNECTION_STATE_DISCONNECTED) {
+                slc_connected = false;
+                audio_requested = false;
+                printf("HFP: disconnected\n");
+            }
+            break;
+        case ESP_HF_AUDIO_STATE_EVT:
+            if (param->audio_stat.state == ESP_HF_AUDIO_STATE_CONNECTED_MSBC) {
+                sco_rate = 16000;
+            } else if (param->audio_stat.state == ESP_HF_AUDIO_STATE_CONNECTED) {
+                sco_rate = 8000;
+            } else if (param->audio_stat.state == ESP_HF_AUDIO_STATE_DISCONNECTED) {
+                sco_rate = 0;
+                audio_requested = false;
+            }
+            if (sco_rate != 0) {
+                esp_timer_start_periodic(data_ready_timer, DATA_READY_PERIOD_US);
+            } else {
+                esp_timer_stop(data_ready_timer);
+            }
+            printf("HFP: audio link %s (%u Hz)\n", sco_rate ? "up" : "down", (unsigned) sco_rate.load());
+            if (profile_changed) profile_changed(sco_rate != 0);
+            break;
+        default:
+            break;
+    }
+}
+
+void hfp_uplink_init(int32_t (*downlink_cb)(uint8_t *data, int32_t len), void (*profile_cb)(bool sco_up)) {
+    downlink_source = downlink_cb;
+    profile_changed = profile_cb;
+    design_rate_filter(&up_msbc, MIC_USB_SAMPLE_RATE / 16000, (float)(MIC_USB_SAMPLE_RATE / 16000));
+    design_rate_filter(&up_cvsd, MIC_USB_SAMPLE_RATE / 8000, (float)(MIC_USB_SAMPLE_RATE / 8000));
+    design_rate_filter(&down_msbc, DOWNLINK_RATE / 16000, 1.0f);
+    design_rate_filter(&down_cvsd, DOWNLINK_RATE / 8000, 1.0f);
+    uplink_stats.latency_us_min = UINT32_MAX;
+
+    esp_timer_create_args_t timer_args = {};
+    timer_args.callback = data_ready_timer_cb;
+    timer_args.name = "hfp_data_ready";
+    if (esp_timer_create(&timer_args, &data_ready_timer) != ESP_OK) {
+        printf("Failed to create HFP data timer\n");
+        return;
+    }
+    if (esp_hf_ag_init() != ESP_OK) {
+        printf("Failed to initialize HFP Audio Gateway\n");
+        return;
+    }
+    esp_hf_ag_register_callback(hfp_event_cb);
+    esp_hf_ag_register_data_callback(hfp_incoming_data_cb, hfp_outgoing_data_cb);
+    printf("HFP Audio Gateway initialized (mic uplink at %d Hz)\n", MIC_USB_SAMPLE_RATE);
+}
+
+size_t hfp_uplink_read(uint8_t *buf, size_t len) {
+    if (buf == NULL || len == 0) {
+        return 0;
+    }
+    uint32_t rate = sco_rate.load(std::memory_order_relaxed);
+    if (rate == 0) {
+        // The host opened the mic: bring up the SCO link on demand.
+        if (slc_connected && !audio_requested.exchange(true)) {
+            esp_hf_ag_audio_connect(hfp_peer);
+        }
+        mic_ring.reset();
+        mic_pending_frames = 0;
+        memset(buf, 0, len);
+        return len;
+    }
+
+    rate_filter_t *f = (rate == 16000) ? &up_msbc : &up_cvsd;
+    const size_t frame_bytes = 2 * MIC_USB_CHANNELS;
+    size_t out_frames = len / frame_bytes;
+    int16_t *out = (int16_t*) buf;
+    size_t done = 0;
+
+    // Estimated latency: audio already queued at SCO rate plus the filter group delay.
+    uint32_t latency_us = (uint32_t)((mic_ring.available() / 2) * 1000000ull / rate)
+                        + (uint32_t)(f->taps * 500000ull / MIC_USB_SAMPLE_RATE);
+    uplink_stats.latency_us_last = latency_us;
+    if (latency_us < uplink_stats.latency_us_min) uplink_stats.latency_us_min = latency_us;
+    if (latency_us > uplink_stats.latency_us_max) uplink_stats.latency_us_max = latency_us;
+
+    // Leftover frames from the previous packet first.
+    size_t take = mic_pending_frames < out_frames ? mic_pending_frames : out_frames;
+    memcpy(out, mic_pending, take * frame_bytes);
+    memmove(mic_pending, mic_pending + take * MIC_USB_CHANNELS, (mic_pending_frames - take) * frame_bytes);
+    mic_pending_frames -= take;
+    done += take;
+
+    bool underrun = false;
+    while (done < out_frames) {
+        int16_t in = 0;
+        if (mic_ring.read((uint8_t*) &in, sizeof(in)) != sizeof(in)) {
+            underrun = true;
+        }
+        int16_t up[MAX_RATE_FACTOR];
+        interpolate_sample(f, in, up);
+        for (int p = 0; p < f->factor; ++p) {
+            int16_t *dst = (done < out_frames) ? &out[done * MIC_USB_CHANNELS]
+                                               : &mic_pending[mic_pending_frames++ * MIC_USB_CHANNELS];
+            for (int c = 0; c < MIC_USB_CHANNELS; ++c) {
+                dst[c] = up[p];
+            }
+            if (done < out_frames) ++done;
+        }
+    }
+    if (underrun) {
+        uplink_stats.underruns++;
+    }
+    return out_frames * frame_bytes;
+}
+
+void hfp_uplink_get_stats(uplink_stats_t *stats) {
+    *stats = uplink_stats;
+    stats->sco_rate = sco_rate.load(std::memory_order_relaxed);
+}
+
+void hfp_uplink_print_stats(void) {
+    uplink_stats_t s;
+    hfp_uplink_get_stats(&s);
+    printf("Uplink: %u Hz, in %u, dropped %u, underruns %u, latency %u us (min %u, max %u)\n",
+           (unsigned) s.sco_rate, (unsigned) s.frames_in, (unsigned) s.frames_dropped, (unsigned) s.underruns,
+           (unsigned) s.latency_us_last, (unsigned) (s.latency_us_min == UINT32_MAX ? 0 : s.latency_us_min),
+           (unsigned) s.latency_us_max);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// USB microphone format presented to the host. The headset side runs at the
+// HFP SCO rate (16 kHz mSBC or 8 kHz CVSD, mono) and is resampled to this rate.
+#ifndef MIC_USB_SAMPLE_RATE
+#define MIC_USB_SAMPLE_RATE 48000   // 16000 or 48000
+#endif
+#ifndef MIC_USB_CHANNELS
+#define MIC_USB_CHANNELS    1       // mono (stereo duplicates the channel)
+#endif
+// When set, the SCO downlink is echoed straight back into the mic path as if
+// a headset were looping it back. Used to measure USB round-trip latency from the host.
+#ifndef UPLINK_LOOPBACK_TEST
+#define UPLINK_LOOPBACK_TEST 0
+#endif
+
+// Uplink latency/health counters, kept separately from the A2DP downlink.
+struct uplink_stats_t {
+    uint32_t sco_rate;          // current SCO rate in Hz, 0 when no audio link
+    uint32_t frames_in;         // SCO frames received from the headset
+    uint32_t frames_dropped;    // SCO frames dropped because the mic ring was full
+    uint32_t underruns;         // USB mic packets that had to be padded with silence
+    uint32_t latency_us_last;   // estimated SCO-in to USB-out latency
+    uint32_t latency_us_min;
+    uint32_t latency_us_max;
+};
+
+// Sets up the HFP Audio Gateway and the mic ring. Must run after Bluedroid is up
+// (i.e. after a2dp_source.start()). `downlink_cb` provides 48 kHz stereo PCM for
+// the SCO downlink while a call is active. `profile_cb`, if set, is told whenever the
+// SCO audio link comes up or goes down.
+void hfp_uplink_init(int32_t (*downlink_cb)(uint8_t *data, int32_t len), void (*profile_cb)(bool sco_up) = nullptr);
+
+// Fills `buf` with up to `len` bytes of 16-bit mic PCM at MIC_USB_SAMPLE_RATE,
+// padding with silence if the headset has not delivered enough. Returns bytes written.
+size_t hfp_uplink_read(uint8_t *buf, size_t len);
+
+void hfp_uplink_get_stats(uplink_stats_t *stats);
+void hfp_uplink_print_stats(void);
@@ -0,0 +1,41 @@
+#include "jitter_meter.h"
+
+void JitterMeter::init(uint32_t sample_rate) {
+    *this = JitterMeter();
+    this->sample_rate = sample_rate;
+}
+
+void JitterMeter::update(uint32_t frames, int64_t now_us) {
+    if (start_us == 0) {
+        // Like the feedback window: the first block after a (re)start sets the schedule.
+        start_us = now_us;
+        frames_taken = 0;
+        baseline_us = 0.0f;
+        return;
+    }
+    frames_taken += frames;
+    float lead_us = (float)((double)frames_taken * 1e6 / sample_rate - (double)(now_us - start_us));
+    float elapsed_s = (float)frames * (1.0f / sample_rate);
+    baseline_us += (lead_us - baseline_us) * (elapsed_s / JITTER_BASELINE_S);
+    float jitter = lead_us - baseline_us;
+    uint32_t bin = jitter > 0.0f ? (uint32_t)(jitter / JITTER_BIN_US) : 0;
+    histogram[bin < JITTER_BINS ? bin : JITTER_BINS - 1]++;
+    if (++samples >= JITTER_AGE_SAMPLES) {
+        samples = 0;
+        for (int i = 0; i < JITTER_BINS; ++i) {
+            histogram[i] /= 2;
+            samples += histogram[i];
+        }
+    }
+}
+
+uint32_t JitterMeter::percentile_us(float fraction) const {
+    uint32_t wanted = (uint32_t)(samples * fraction), seen = 0;
+    for (int i = 0; i < JITTER_BINS; ++i) {
+        seen += histogram[i];
+        if (seen > wanted) {
+            return (i + 1) * JITTER_BIN_US;     // upper edge of the bin
+        }
+    }
+    return JITTER_BINS * JITTER_BIN_US;
+}
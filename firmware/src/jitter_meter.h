@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define JITTER_BIN_US       250     // histogram resolution
+#define JITTER_BINS         128     // covers 32 ms
+#define JITTER_BASELINE_S   10.0f   // drift is tracked out with this time constant
+#define JITTER_MIN_SAMPLES  2000    // blocks before the percentile is trusted (~5 s)
+#define JITTER_AGE_SAMPLES  65536   // histogram halves past this, so old history fades
+
+// How far ahead of a steady schedule the Bluetooth consumer pulls audio. The A2DP stack
+// takes blocks in bursts; whatever it takes early has to be in the ring already, so the
+// percentile of this lead is the depth the ring needs. The slow clock drift is tracked out
+// first so only the jitter lands in the histogram. No ESP-IDF dependencies.
+class JitterMeter {
+public:
+    // Forgets everything measured, histogram included: a new sink.
+    void init(uint32_t sample_rate);
+    // Stream (re)started: the schedule starts over, the histogram is kept.
+    void restart() { start_us = 0; }
+    // `frames` were just taken at `now_us`.
+    void update(uint32_t frames, int64_t now_us);
+
+    // Lead in microseconds below which `fraction` of the blocks fell.
+    uint32_t percentile_us(float fraction) const;
+    bool valid() const { return samples >= JITTER_MIN_SAMPLES; }
+
+private:
+    uint32_t sample_rate = 48000;
+    int64_t start_us = 0;
+    uint64_t frames_taken = 0;
+    float baseline_us = 0.0f;       // slowly tracked mean lead
+    uint32_t samples = 0;
+    uint32_t histogram[JITTER_BINS] = {};
+};
@@ -0,0 +1,166 @@
+#include "learned_store.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "nvs.h"
+#include "nvs_flash.h"
+
+bool LearnedStore::init() {
+    // Usually already done by the Bluetooth stack; harmless to repeat.
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        nvs_flash_erase();
+        err = nvs_flash_init();
+    }
+    ready = err == ESP_OK;
+    return ready;
+}
+
+// NVS keys are at most 15 characters: a letter for the record ("s" learned state, "e" EQ)
+// and the address in hex.
+void LearnedStore::sink_key(const uint8_t bda[6], char key[16], char prefix) {
+    snprintf(key, 16, "%c%02x%02x%02x%02x%02x%02x", prefix, bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
+}
+
+bool LearnedStore::load(const char *key, void *out, size_t len) {
+    nvs_handle_t handle;
+    if (!ready || nvs_open(LEARNED_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    size_t size = len;
+    esp_err_t err = nvs_get_blob(handle, key, out, &size);
+    nvs_close(handle);
+    return err == ESP_OK && size == len;
+}
+
+bool LearnedStore::save(const char *key, const void *data, size_t len) {
+    nvs_handle_t handle;
+    if (!ready || nvs_open(LEARNED_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return false;
+    }
+    esp_err_t err = nvs_set_blob(handle, key, data, len);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        printf("Learned state: writing %s failed (%d)\n", key, err);
+        return false;
+    }
+    writes++;
+    return true;
+}
+
+bool LearnedStore::load_sink(const uint8_t bda[6], sink_learned_t *out) {
+    char key[16];
+    sink_key(bda, key);
+    if (memcmp(bda, sink_bda, sizeof(sink_bda)) != 0) {
+        // The rate limit follows the sink; a reconnect of the same one doesn't reset it.
+        memcpy(sink_bda, bda, sizeof(sink_bda));
+        sink_saved_us = 0;
+    }
+    sink_known = load(key, &sink, sizeof(sink)) && sink.version == LEARNED_VERSION;
+    if (sink_known) {
+        *out = sink;
+    }
+    return sink_known;
+}
+
+bool LearnedStore::load_host(host_learned_t *out) {
+    host_known = load("host", &host, sizeof(host)) && host.version == LEARNED_VERSION;
+    if (host_known) {
+        *out = host;
+    }
+    return host_known;
+}
+
+bool LearnedStore::load_sinks(sink_list_t *out) {
+    return load("sinks", out, sizeof(*out)) && out->version == LEARNED_VERSION && out->count <= CONN_MAX_SINKS;
+}
+
+bool LearnedStore::save_sinks(const sink_list_t &list) {
+    sink_list_t out = list;
+    out.version = LEARNED_VERSION;
+    return save("sinks", &out, sizeof(out));
+}
+
+bool LearnedStore::save_sink(const uint8_t bda[6], const sink_learned_t &rec, int64_t now_us, bool force) {
+    if (memcmp(bda, sink_bda, sizeof(sink_bda)) != 0) {
+        // A different sink than the last one loaded: compare against what it has stored.
+        sink_learned_t stored;
+        load_sink(bda, &stored);
+    }
+    bool changed = !sink_known || rec.depth_ms != sink.depth_ms ||
+                   fabsf(rec.consumer_ppm - sink.consumer_ppm) > LEARNED_PPM_STEP;
+    bool due = force || sink_saved_us == 0 || now_us - sink_saved_us >= (int64_t)LEARNED_SAVE_INTERVAL_S * 1000000;
+    if (!changed || !due) {
+        return false;
+    }
+    char key[16];
+    sink_key(bda, key);
+    sink_learned_t out = rec;
+    out.version = LEARNED_VERSION;
+    if (!save(key, &out, sizeof(out))) {
+        return false;
+    }
+    sink = out;
+    sink_known = true;
+    sink_saved_us = now_us;
+    return true;
+}
+
+bool LearnedStore::load_eq(const uint8_t bda[6], sink_eq_t *out) {
+    char key[16];
+    sink_key(bda, key, 'e');
+    sink_eq_t rec;
+    if (!load(key, &rec, sizeof(rec)) || rec.version != LEARNED_VERSION || rec.band_count > EQ_MAX_BANDS) {
+        return false;
+    }
+    *out = rec;
+    return true;
+}
+
+static bool same_bands(const sink_eq_t &a, const sink_eq_t &b) {
+    if (a.band_count != b.band_count) {
+        return false;
+    }
+    for (int i = 0; i < a.band_count; ++i) {
+        const eq_band_t &x = a.bands[i], &y = b.bands[i];
+        if (x.type != y.type || x.channels != y.channels || x.freq != y.freq || x.gain_db != y.gain_db || x.q != y.q) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool LearnedStore::save_eq(const uint8_t bda[6], const sink_eq_t &rec) {
+    sink_eq_t stored;
+    if (load_eq(bda, &stored) && same_bands(stored, rec)) {
+        return false;
+    }
+    char key[16];
+    sink_key(bda, key, 'e');
+    sink_eq_t out = {};
+    out.version = LEARNED_VERSION;
+    out.band_count = rec.band_count;
+    memcpy(out.bands, rec.bands, rec.band_count * sizeof(out.bands[0]));
+    return save(key, &out, sizeof(out));
+}
+
+bool LearnedStore::save_host(const host_learned_t &rec, int64_t now_us, bool force) {
+    bool changed = !host_known || fabsf(rec.host_ppm - host.host_ppm) > LEARNED_PPM_STEP;
+    bool due = force || host_saved_us == 0 || now_us - host_saved_us >= (int64_t)LEARNED_SAVE_INTERVAL_S * 1000000;
+    if (!changed || !due) {
+        return false;
+    }
+    host_learned_t out = rec;
+    out.version = LEARNED_VERSION;
+    if (!save("host", &out, sizeof(out))) {
+        return false;
+    }
+    host = out;
+    host_known = true;
+    host_saved_us = now_us;
+    return true;
+}
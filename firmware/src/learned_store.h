@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "connection_manager.h"
+#include "parametric_eq.h"
+
+#define LEARNED_NAMESPACE   "learned"
+#define LEARNED_VERSION     1       // bump when a record layout changes; old records are ignored
+#define LEARNED_SAVE_INTERVAL_S 600 // at most one write per record this often
+#define LEARNED_PPM_STEP    0.5f    // smaller moves are not worth a flash write
+
+// What the pipeline learned about one Bluetooth sink: its clock offset and how bursty its
+// A2DP stack pulls audio. Restored on connect so the feedback starts at the right rate
+// and the ring primes to the right depth.
+struct sink_learned_t {
+    uint8_t version;
+    uint8_t depth_ms;               // jitter depth the ring was primed to
+    uint16_t jitter_us;             // the consumer's burst lead at JITTER_PERCENTILE
+    float consumer_ppm;             // sink consumption rate against nominal
+};
+
+// The EQ the user set for one sink, restored whenever that sink connects. Only the bands
+// are kept; the coefficients are designed again from them.
+struct sink_eq_t {
+    uint8_t version;
+    uint8_t band_count;
+    eq_band_t bands[EQ_MAX_BANDS];
+};
+
+// What was learned about the USB host: its frame clock against ours. The host gives no
+// identity a device could key on, so there is a single record for whichever host this is
+// plugged into.
+struct host_learned_t {
+    uint8_t version;
+    float host_ppm;
+};
+
+// Learned state in NVS, one blob per sink (keyed by address) plus one for the host. Writes
+// are rate-limited: a record is only rewritten when it moved by more than
+// LEARNED_PPM_STEP or its depth changed, and then at most every LEARNED_SAVE_INTERVAL_S.
+// Not for the audio path: reads and writes take the flash.
+class LearnedStore {
+public:
+    bool init();
+
+    bool load_sink(const uint8_t bda[6], sink_learned_t *out);
+    bool load_host(host_learned_t *out);
+    // `force` skips the interval (disconnect, shutdown) but still needs a real change.
+    // Returns true if the record was written.
+    bool save_sink(const uint8_t bda[6], const sink_learned_t &rec, int64_t now_us, bool force = false);
+    bool save_host(const host_learned_t &rec, int64_t now_us, bool force = false);
+    // Per-sink EQ. Not rate-limited here, since it only changes on a user command; the
+    // caller waits for a burst of band updates to settle. Unchanged bands are not rewritten.
+    bool load_eq(const uint8_t bda[6], sink_eq_t *out);
+    bool save_eq(const uint8_t bda[6], const sink_eq_t &rec);
+    // Known sinks for the connection manager. Only written when the list changed, which
+    // is at most once per connection.
+    bool load_sinks(sink_list_t *out);
+    bool save_sinks(const sink_list_t &list);
+
+    uint32_t writes = 0;
+
+private:
+    bool load(const char *key, void *out, size_t len);
+    bool save(const char *key, const void *data, size_t len);
+    static void sink_key(const uint8_t bda[6], char key[16], char prefix = 's');
+
+    bool ready = false;
+    // Last record written or loaded, for the rate limit. One sink is connected at a time.
+    uint8_t sink_bda[6] = {};
+    sink_learned_t sink = {};
+    bool sink_known = false;
+    int64_t sink_saved_us = 0;
+    host_learned_t host = {};
+    bool host_known = false;
+    int64_t host_saved_us = 0;
+};
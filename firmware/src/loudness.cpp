@@ -0,0 +1,71 @@
+#include "loudness.h"
+
+#include <math.h>
+
+// BS.1770 K-weighting (high shelf + RLB high-pass), designed for any rate by bilinear
+// transform of the analog prototypes; at 48 kHz this gives the coefficients in the spec.
+void LoudnessMeter::init(float sample_rate) {
+    float rate = sample_rate / LOUDNESS_DECIMATION;
+    float k = tanf((float)M_PI * 1681.974450955533f / rate);
+    float q = 0.7071752369554196f;
+    float vh = powf(10.0f, 3.999843853973347f / 20.0f);
+    float vb = powf(vh, 0.4996667741545416f);
+    float a0 = 1.0f + k / q + k * k;
+    shelf.b0 = (vh + vb * k / q + k * k) / a0;
+    shelf.b1 = 2.0f * (k * k - vh) / a0;
+    shelf.b2 = (vh - vb * k / q + k * k) / a0;
+    shelf.a1 = 2.0f * (k * k - 1.0f) / a0;
+    shelf.a2 = (1.0f - k / q + k * k) / a0;
+    k = tanf((float)M_PI * 38.13547087602444f / rate);
+    q = 0.5003270373238773f;
+    a0 = 1.0f + k / q + k * k;
+    highpass.b0 = 1.0f;
+    highpass.b1 = -2.0f;
+    highpass.b2 = 1.0f;
+    highpass.a1 = 2.0f * (k * k - 1.0f) / a0;
+    highpass.a2 = (1.0f - k / q + k * k) / a0;
+    block_len = (uint32_t)(rate * LOUDNESS_BLOCK_MS / 1000);
+}
+
+static inline float biquad(const biquad_coeffs_t &c, float *z, float x) {
+    float y = c.b0 * x + z[0];
+    z[0] = c.b1 * x - c.a1 * y + z[1];
+    z[1] = c.b2 * x - c.a2 * y;
+    return y;
+}
+
+bool LoudnessMeter::process(const int16_t *samples, size_t frames) {
+    const float scale = 1.0f / (32768.0f * LOUDNESS_DECIMATION);
+    bool completed = false;
+    for (size_t i = 0; i < frames; ++i) {
+        float l = samples[2 * i], r = samples[2 * i + 1];
+        if (!have_pending) {
+            pending[0] = l;
+            pending[1] = r;
+            have_pending = true;
+            continue;
+        }
+        have_pending = false;
+        float x[2] = { (pending[0] + l) * scale, (pending[1] + r) * scale };
+        for (int c = 0; c < 2; ++c) {
+            float y = biquad(highpass, state[1][c], biquad(shelf, state[0][c], x[c]));
+            block_sum += y * y;
+        }
+        if (++block_count < block_len) {
+            continue;
+        }
+        blocks[block_index] = block_sum / block_len;
+        block_index = (block_index + 1) % LOUDNESS_WINDOW_BLOCKS;
+        if (blocks_filled < LOUDNESS_WINDOW_BLOCKS) blocks_filled++;
+        block_sum = 0.0f;
+        block_count = 0;
+        float window = 0.0f;
+        for (int b = 0; b < blocks_filled; ++b) {
+            window += blocks[b];
+        }
+        window /= blocks_filled;
+        short_term = window > 1e-10f ? -0.691f + 10.0f * log10f(window) : -100.0f;
+        completed = true;
+    }
+    return completed;
+}
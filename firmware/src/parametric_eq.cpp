@@ -0,0 +1,173 @@
+#include "parametric_eq.h"
+
+#include <math.h>
+#include <string.h>
+
+static float clampf(float v, float lo, float hi) {
+    return v > lo ? (v < hi ? v : hi) : lo;     // NaN ends up at `lo`
+}
+
+bool eq_band_valid(const eq_band_t &band, float sample_rate) {
+    return band.type <= EQ_HIGHPASS &&
+           band.freq >= EQ_MIN_FREQ_HZ && band.freq < sample_rate / 2 &&
+           band.q >= EQ_MIN_Q && band.q <= EQ_MAX_Q &&
+           isfinite(band.gain_db);
+}
+
+void eq_design_band(const eq_band_t &band, float sample_rate, biquad_coeffs_t *out) {
+    float freq = clampf(band.freq, EQ_MIN_FREQ_HZ, 0.499f * sample_rate);
+    float q = clampf(band.q, EQ_MIN_Q, EQ_MAX_Q);
+    float gain_db = clampf(band.gain_db, -EQ_MAX_GAIN_DB, EQ_MAX_GAIN_DB);
+    float w0 = 2.0f * (float)M_PI * freq / sample_rate;
+    float cosw = cosf(w0);
+    float alpha = sinf(w0) / (2.0f * q);
+    float a = powf(10.0f, gain_db / 40.0f);
+    float b0, b1, b2, a0, a1, a2;
+    switch (band.type) {
+        case EQ_LOW_SHELF: {
+            float s = 2.0f * sqrtf(a) * alpha;
+            b0 = a * ((a + 1) - (a - 1) * cosw + s);
+            b1 = 2 * a * ((a - 1) - (a + 1) * cosw);
+            b2 = a * ((a + 1) - (a - 1) * cosw - s);
+            a0 = (a + 1) + (a - 1) * cosw + s;
+            a1 = -2 * ((a - 1) + (a + 1) * cosw);
+            a2 = (a + 1) + (a - 1) * cosw - s;
+            break;
+        }
+        case EQ_HIGH_SHELF: {
+            float s = 2.0f * sqrtf(a) * alpha;
+            b0 = a * ((a + 1) + (a - 1) * cosw + s);
+            b1 = -2 * a * ((a - 1) + (a + 1) * cosw);
+            b2 = a * ((a + 1) + (a - 1) * cosw - s);
+            a0 = (a + 1) - (a - 1) * cosw + s;
+            a1 = 2 * ((a - 1) - (a + 1) * cosw);
+            a2 = (a + 1) - (a - 1) * cosw - s;
+            break;
+        }
+        case EQ_LOWPASS:
+            b0 = (1 - cosw) / 2;
+            b1 = 1 - cosw;
+            b2 = (1 - cosw) / 2;
+            a0 = 1 + alpha;
+            a1 = -2 * cosw;
+            a2 = 1 - alpha;
+            break;
+        case EQ_HIGHPASS:
+            b0 = (1 + cosw) / 2;
+            b1 = -(1 + cosw);
+            b2 = (1 + cosw) / 2;
+            a0 = 1 + alpha;
+            a1 = -2 * cosw;
+            a2 = 1 - alpha;
+            break;
+        case EQ_PEAK:
+        default:
+            b0 = 1 + alpha * a;
+            b1 = -2 * cosw;
+            b2 = 1 - alpha * a;
+            a0 = 1 + alpha / a;
+            a1 = -2 * cosw;
+            a2 = 1 - alpha / a;
+            break;
+    }
+    out->b0 = b0 / a0;
+    out->b1 = b1 / a0;
+    out->b2 = b2 / a0;
+    out->a1 = a1 / a0;
+    out->a2 = a2 / a0;
+}
+
+void eq_update_coeffs(eq_params_t *eq, float sample_rate) {
+    static const biquad_coeffs_t identity = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < EQ_MAX_BANDS; ++i) {
+        biquad_coeffs_t c = identity;
+        if (i < eq->band_count) {
+            eq_design_band(eq->bands[i], sample_rate, &c);
+        }
+        for (int ch = 0; ch < 2; ++ch) {
+            bool applies = i < eq->band_count && (eq->bands[i].channels & (1 << ch));
+            eq->coeffs[ch][i] = applies ? c : identity;
+        }
+    }
+    eq->version++;
+}
+
+float eq_response_db(const biquad_coeffs_t *coeffs, int count, float freq, float sample_rate) {
+    // |H(e^jw)| evaluated directly from the transfer function of each section.
+    float w = 2.0f * (float)M_PI * freq / sample_rate;
+    float c1 = cosf(w), s1 = sinf(w), c2 = cosf(2 * w), s2 = sinf(2 * w);
+    float db = 0.0f;
+    for (int i = 0; i < count; ++i) {
+        const biquad_coeffs_t &k = coeffs[i];
+        float nr = k.b0 + k.b1 * c1 + k.b2 * c2, ni = -(k.b1 * s1 + k.b2 * s2);
+        float dr = 1.0f + k.a1 * c1 + k.a2 * c2, di = -(k.a1 * s1 + k.a2 * s2);
+        db += 10.0f * log10f((nr * nr + ni * ni) / (dr * dr + di * di));
+    }
+    return db;
+}
+
+// One band at a time over the whole chunk keeps the coefficients in registers and the
+// inner loop free of branches; left and right run side by side on the interleaved data.
+void ParametricEq::run_cascade(const biquad_coeffs_t (*c)[EQ_MAX_BANDS], int count, float (*z)[2][2],
+                               const float *in, float *out, size_t frames) {
+    memcpy(out, in, frames * 2 * sizeof(float));
+    for (int b = 0; b < count; ++b) {
+        const biquad_coeffs_t l = c[0][b], r = c[1][b];
+        float zl1 = z[b][0][0], zl2 = z[b][0][1];
+        float zr1 = z[b][1][0], zr2 = z[b][1][1];
+        for (size_t i = 0; i < frames; ++i) {
+            float xl = out[2 * i], xr = out[2 * i + 1];
+            float yl = l.b0 * xl + zl1;
+            float yr = r.b0 * xr + zr1;
+            zl1 = l.b1 * xl - l.a1 * yl + zl2;
+            zr1 = r.b1 * xr - r.a1 * yr + zr2;
+            zl2 = l.b2 * xl - l.a2 * yl;
+            zr2 = r.b2 * xr - r.a2 * yr;
+            out[2 * i] = yl;
+            out[2 * i + 1] = yr;
+        }
+        z[b][0][0] = zl1; z[b][0][1] = zl2;
+        z[b][1][0] = zr1; z[b][1][1] = zr2;
+    }
+}
+
+void ParametricEq::process(int16_t *samples, size_t frames, const eq_params_t &eq) {
+    bool changed = eq.version != version;
+    if (!changed && bands == 0) {
+        return;     // flat: no cost at all
+    }
+    while (frames > 0) {
+        size_t n = frames < EQ_CHUNK_FRAMES ? frames : EQ_CHUNK_FRAMES;
+        for (size_t i = 0; i < n * 2; ++i) {
+            input[i] = samples[i];
+        }
+        // The new set starts from the old state as it was before this chunk, not after it.
+        float new_state[EQ_MAX_BANDS][2][2];
+        if (changed) {
+            memcpy(new_state, state, sizeof(state));
+        }
+        run_cascade(coeffs, bands, state, input, output, n);
+        if (changed) {
+            // Run the new set from the old state and crossfade old -> new across this chunk.
+            run_cascade(eq.coeffs, eq.band_count, new_state, input, fade, n);
+            for (size_t i = 0; i < n; ++i) {
+                float t = (float)(i + 1) / n;
+                output[2 * i] += (fade[2 * i] - output[2 * i]) * t;
+                output[2 * i + 1] += (fade[2 * i + 1] - output[2 * i + 1]) * t;
+            }
+            memcpy(state, new_state, sizeof(state));
+            memcpy(coeffs, eq.coeffs, sizeof(coeffs));
+            bands = eq.band_count;
+            // Bands no longer in use start from rest if they come back later.
+            memset(state[bands], 0, (EQ_MAX_BANDS - bands) * sizeof(state[0]));
+            version = eq.version;
+            changed = false;
+        }
+        for (size_t i = 0; i < n * 2; ++i) {
+            float v = output[i];
+            samples[i] = (int16_t)(v > 32767.0f ? 32767.0f : (v < -32768.0f ? -32768.0f : v));
+        }
+        samples += n * 2;
+        frames -= n;
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define EQ_MAX_BANDS        10      // biquads per channel
+#define EQ_CHUNK_FRAMES     128     // frames converted to float and filtered at a time
+// Band limits. Past Nyquist sin(w0) turns negative and the poles leave the unit circle.
+#define EQ_MIN_FREQ_HZ      10.0f
+#define EQ_MIN_Q            0.1f
+#define EQ_MAX_Q            20.0f
+#define EQ_MAX_GAIN_DB      24.0f
+
+enum eq_band_type_t : uint8_t {
+    EQ_PEAK,
+    EQ_LOW_SHELF,
+    EQ_HIGH_SHELF,
+    EQ_LOWPASS,
+    EQ_HIGHPASS,
+};
+
+// One EQ band as configured by the user.
+struct eq_band_t {
+    eq_band_type_t type;
+    uint8_t channels;           // bit 0 = left, bit 1 = right
+    float freq;                 // center / corner frequency in Hz
+    float gain_db;              // peak and shelf bands only
+    float q;
+};
+
+// Normalized biquad (a0 = 1).
+struct biquad_coeffs_t {
+    float b0, b1, b2, a1, a2;
+};
+
+// Complete EQ configuration: the bands plus the coefficients designed from them.
+// Lives in the control parameter snapshot, so the audio path only ever sees whole sets.
+struct eq_params_t {
+    uint8_t band_count = 0;
+    eq_band_t bands[EQ_MAX_BANDS] = {};
+    biquad_coeffs_t coeffs[2][EQ_MAX_BANDS] = {};   // per channel
+    uint32_t version = 0;                           // bumped on every change
+};
+
+// True if `band` is a known type with EQ_MIN_FREQ_HZ <= freq < sample_rate / 2, Q within
+// EQ_MIN_Q..EQ_MAX_Q and a finite gain (it is clamped to +-EQ_MAX_GAIN_DB).
+bool eq_band_valid(const eq_band_t &band, float sample_rate);
+
+// RBJ audio-EQ-cookbook design for one band at `sample_rate`. Parameters outside the limits
+// above are clamped to them, so the result is always stable.
+void eq_design_band(const eq_band_t &band, float sample_rate, biquad_coeffs_t *out);
+
+// Redesigns all coefficients in `eq` from its bands and bumps the version.
+void eq_update_coeffs(eq_params_t *eq, float sample_rate);
+
+// Magnitude response of a biquad cascade at `freq`, in dB.
+float eq_response_db(const biquad_coeffs_t *coeffs, int count, float freq, float sample_rate);
+
+// Biquad cascade over interleaved stereo 16-bit PCM, transposed direct form II.
+// When the configuration changes, the old and new cascades both run for one chunk and are
+// crossfaded, so coefficient updates never click.
+class ParametricEq {
+public:
+    void process(int16_t *samples, size_t frames, const eq_params_t &eq);
+
+private:
+    void run_cascade(const biquad_coeffs_t (*coeffs)[EQ_MAX_BANDS], int bands, float (*state)[2][2],
+                     const float *in, float *out, size_t frames);
+
+    uint32_t version = 0;
+    int bands = 0;
+    biquad_coeffs_t coeffs[2][EQ_MAX_BANDS] = {};
+    float state[EQ_MAX_BANDS][2][2] = {};       // [band][channel][z1, z2]
+    float input[EQ_CHUNK_FRAMES * 2];
+    float output[EQ_CHUNK_FRAMES * 2];
+    float fade[EQ_CHUNK_FRAMES * 2];
+};
@@ -0,0 +1,48 @@
+#include "peak_limiter.h"
+
+#include <math.h>
+
+void PeakLimiter::process(float *samples, size_t frames, float ceiling, uint16_t release_ms, float sample_rate) {
+    const size_t delay_frames = 2 * LIMITER_BLOCK_FRAMES;
+    const float ceiling_abs = ceiling * 32768.0f;
+    for (size_t i = 0; i < frames; ++i) {
+        if (pos % LIMITER_BLOCK_FRAMES == 0) {
+            // A sub-block has fully entered: plan the gain for the one about to be played so
+            // that it ends at or below what the new sub-block needs (attack), or recovers
+            // toward it exponentially (release).
+            float required = block_peak > ceiling_abs ? ceiling_abs / block_peak : 1.0f;
+            float target = required < prev_required ? required : prev_required;
+            if (target > gain) {
+                float release_frames = release_ms * sample_rate / 1000.0f;
+                target = gain + (target - gain) * (1.0f - expf(-(float)LIMITER_BLOCK_FRAMES / (release_frames + 1.0f)));
+            }
+            step = (target - gain) / LIMITER_BLOCK_FRAMES;
+            prev_required = required;
+            block_peak = 0.0f;
+        }
+        float *slot = &delay[pos * 2];
+        for (int c = 0; c < 2; ++c) {
+            float x = samples[i * 2 + c];
+            float peak = fabsf(x);
+#if LIMITER_TRUE_PEAK
+            // Cubic midpoint between the two previous samples catches most inter-sample overs.
+            float *h = history[c];
+            float mid = fabsf((-h[0] + 9.0f * h[1] + 9.0f * h[2] - x) * (1.0f / 16.0f));
+            if (mid > peak) peak = mid;
+            h[0] = h[1];
+            h[1] = h[2];
+            h[2] = x;
+#endif
+            if (peak > block_peak) block_peak = peak;
+            samples[i * 2 + c] = slot[c] * gain;
+            slot[c] = x;
+        }
+        gain += step;
+        if (gain < min_gain) min_gain = gain;
+        pos = (pos + 1) % delay_frames;
+    }
+}
+
+float PeakLimiter::max_reduction_db() const {
+    return 20.0f * log10f(min_gain > 1e-6f ? min_gain : 1e-6f);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LIMITER_BLOCK_FRAMES 32     // look-ahead sub-block; also the attack time (0.67 ms at 48 kHz)
+// A ceiling no 16-bit signal at or below unity gain reaches, true-peak estimate included
+// (at most 1.25 FS): with it the limiter only delays the audio.
+#define LIMITER_TRANSPARENT_CEILING 1.25f
+#ifndef LIMITER_TRUE_PEAK
+#define LIMITER_TRUE_PEAK   1       // include an interpolated inter-sample peak estimate
+#endif
+
+// Look-ahead peak limiter for interleaved stereo float PCM (16-bit full scale = 32768).
+// The signal is delayed by two sub-blocks. The peak of each sub-block is taken once as it
+// enters, so by the time it is played the gain has already ramped down across the
+// previous sub-block. Per sample this costs a max, a multiply and a gain step.
+class PeakLimiter {
+public:
+    // `ceiling` is linear (1.0 = full scale), `release_ms` is the time constant for recovery.
+    void process(float *samples, size_t frames, float ceiling, uint16_t release_ms, float sample_rate);
+
+    static constexpr uint32_t latency_frames() { return 2 * LIMITER_BLOCK_FRAMES; }
+
+    // Deepest gain reduction since the last reset, in dB (<= 0).
+    float max_reduction_db() const;
+    void reset_max_reduction() { min_gain = gain; }
+
+private:
+    float delay[2 * LIMITER_BLOCK_FRAMES * 2] = {};
+    size_t pos = 0;                 // write position in the delay line, in frames
+    float block_peak = 0.0f;        // peak of the sub-block being written
+    float prev_required = 1.0f;     // gain the sub-block now being played needs
+    float gain = 1.0f;
+    float step = 0.0f;
+    float min_gain = 1.0f;
+#if LIMITER_TRUE_PEAK
+    float history[2][3] = {};       // last three samples per channel
+#endif
+};
@@ -0,0 +1,48 @@
+#include "profile.h"
+
+#include <stdio.h>
+
+static const char *const stage_names[PROFILE_STAGE_COUNT] = {
+    "usb packet", "ring copy", "time-stretch", "channel mix", "eq", "loudness",
+    "gain", "limiter", "convert", "cue mix", "bt read",
+};
+
+const char *profile_stage_name(profile_stage_t stage) {
+    return stage < PROFILE_STAGE_COUNT ? stage_names[stage] : "?";
+}
+
+#if AUDIO_PROFILE
+void StageProfile::summarize(stage_stats_t *out) const {
+    out->count = count;
+    out->frames = frames;
+    out->cycles_per_frame = cycles_per_frame();
+    out->avg_cycles = count ? (uint32_t)(total / count) : 0;
+    out->max_cycles = max;
+    out->p99_cycles = 0;
+    // Walk down from the top: the bin where the slowest 1% runs out.
+    uint32_t tail = count / 100;
+    uint32_t seen = 0;
+    for (int b = PROFILE_HIST_BINS - 1; b >= 0; --b) {
+        seen += hist[b];
+        if (seen > tail) {
+            out->p99_cycles = b == PROFILE_HIST_BINS - 1 ? UINT32_MAX : (2u << b) - 1;
+            break;
+        }
+    }
+}
+
+void StageProfile::print_histogram() const {
+    int lo = 0, hi = PROFILE_HIST_BINS - 1;
+    while (lo < hi && hist[lo] == 0) lo++;
+    while (hi > lo && hist[hi] == 0) hi--;
+    printf("  2^%d:", lo);
+    for (int b = lo; b <= hi; ++b) {
+        printf(" %u", (unsigned) hist[b]);
+    }
+    printf("\n");
+}
+
+void StageProfile::reset() {
+    *this = StageProfile();
+}
+#endif
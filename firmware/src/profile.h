@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#if defined(ESP_PLATFORM)
+#include "esp_cpu.h"
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+// Per-stage cost of the audio path: every probe adds one span to its stage's count, total,
+// max and log2 histogram, in CPU cycles. A probe is two cycle counter reads and a handful
+// of adds; with AUDIO_PROFILE 0 the probes and their storage compile away entirely. On the
+// device the clock is the CPU cycle counter; off target it is the TSC (rdtsc) or, failing
+// that, CLOCK_MONOTONIC nanoseconds, so the DSP modules can be profiled on a host build.
+#ifndef AUDIO_PROFILE
+#define AUDIO_PROFILE       1
+#endif
+#define PROFILE_HIST_BINS   32      // bin n counts spans of 2^n up to 2^(n+1) - 1 cycles
+
+// The stages of one USB packet and one Bluetooth block. The SBC encode itself runs inside
+// the Bluetooth stack after get_bt_audio_data() returns, so it has no probe of its own.
+enum profile_stage_t : uint8_t {
+    PROFILE_USB_PACKET,     // producer: one packet into the ring
+    PROFILE_RING_COPY,      // ring -> block, including splices and underrun padding
+    PROFILE_STRETCH,        // WSOLA rate change (includes the ring copies it pulls)
+    PROFILE_CHANNEL_MIX,
+    PROFILE_EQ,
+    PROFILE_LOUDNESS,
+    PROFILE_GAIN,           // 16-bit -> float with the gain ramp
+    PROFILE_LIMITER,
+    PROFILE_CONVERT,        // float -> 16-bit with clipping
+    PROFILE_CUE_MIX,
+    PROFILE_BT_READ,        // one whole block handed to the encoder
+    PROFILE_STAGE_COUNT,
+};
+
+// Summary of one stage, as reported with the pipeline counters.
+struct stage_stats_t {
+    uint32_t count;             // spans since the last reset
+    uint32_t frames;            // frames they processed
+    uint32_t cycles_per_frame;
+    uint32_t avg_cycles;        // per span
+    uint32_t max_cycles;
+    uint32_t p99_cycles;        // upper edge of the histogram bin holding the 99th percentile
+};
+
+static inline uint32_t profile_now() {
+#if defined(ESP_PLATFORM)
+    return esp_cpu_get_cycle_count();
+#elif defined(__x86_64__) || defined(__i386__)
+    return (uint32_t) __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000000ull + ts.tv_nsec);
+#endif
+}
+
+const char *profile_stage_name(profile_stage_t stage);
+
+// One stage. Written and reset by the context that runs the stage; the stats log only
+// reads it, and asks that context for the reset.
+class StageProfile {
+public:
+#if AUDIO_PROFILE
+    static uint32_t start() { return profile_now(); }
+    // Closes a span opened by start() that processed `frames`.
+    void stop(uint32_t start_cycles, uint32_t frames) {
+        uint32_t cycles = profile_now() - start_cycles;
+        count++;
+        this->frames += frames;
+        total += cycles;
+        if (cycles > max) max = cycles;
+        hist[31 - __builtin_clz(cycles | 1)]++;
+    }
+    void summarize(stage_stats_t *out) const;
+    // Prints the non-empty range of the histogram on one line.
+    void print_histogram() const;
+    void reset();
+    uint32_t cycles_per_frame() const { return frames ? (uint32_t)(total / frames) : 0; }
+
+private:
+    uint32_t count = 0;
+    uint32_t frames = 0;
+    uint64_t total = 0;
+    uint32_t max = 0;
+    uint32_t hist[PROFILE_HIST_BINS] = {};
+#else
+    static uint32_t start() { return 0; }
+    void stop(uint32_t, uint32_t) {}
+    void summarize(stage_stats_t *out) const { *out = {}; }
+    void print_histogram() const {}
+    void reset() {}
+    uint32_t cycles_per_frame() const { return 0; }
+#endif
+};
@@ -0,0 +1,63 @@
+#include "rate_feedback.h"
+
+void RateFeedback::init(uint32_t sample_rate) {
+    nominal = sample_rate;
+    consumer_rate = sample_rate;
+    rate_valid = false;
+    host_frame_us = 1000.0;
+    integral = 0.0;
+    value = sample_rate / 1000.0;
+    at_limit = false;
+    window_start_us = 0;
+}
+
+void RateFeedback::seed_consumer(float ppm) {
+    consumer_rate = nominal * (1.0 + ppm * 1e-6);
+    rate_valid = true;
+    integral = 0.0;
+    double limit = nominal / 1000.0 * FEEDBACK_MAX_PPM / 1e6;
+    double wanted = consumer_rate * host_frame_us / 1e6;
+    double low = nominal / 1000.0 - limit, high = nominal / 1000.0 + limit;
+    value = wanted < low ? low : (wanted > high ? high : wanted);
+}
+
+void RateFeedback::forget_consumer() {
+    consumer_rate = nominal;
+    rate_valid = false;
+    integral = 0.0;
+}
+
+bool RateFeedback::update(uint32_t frames, int64_t now_us, int32_t fill_error) {
+    if (window_start_us == 0) {
+        // The frames of the first block after a (re)start predate the window.
+        window_start_us = now_us;
+        window_frames = 0;
+        return false;
+    }
+    window_frames += frames;
+    int64_t elapsed_us = now_us - window_start_us;
+    if (elapsed_us < (int64_t)FEEDBACK_WINDOW_MS * 1000) {
+        return false;
+    }
+    // The consumer takes whole blocks, so the rate is only meaningful over a long window.
+    double measured = window_frames * 1e6 / elapsed_us;
+    consumer_rate = rate_valid ? consumer_rate + 0.25 * (measured - consumer_rate) : measured;
+    rate_valid = true;
+    window_start_us = now_us;
+    window_frames = 0;
+
+    // PI on the fill error, in frames per ms: too full asks for less, too empty for more.
+    double window_s = elapsed_us / 1e6;
+    double proportional = -fill_error / (FEEDBACK_FILL_TIME_S * 1000.0);
+    double limit = nominal / 1000.0 * FEEDBACK_MAX_PPM / 1e6;
+    double next_integral = integral - fill_error * window_s / (FEEDBACK_FILL_TIME_S * FEEDBACK_INTEGRAL_S * 1000.0);
+    double base = consumer_rate * host_frame_us / 1e6;
+    double wanted = base + proportional + next_integral;
+    double low = nominal / 1000.0 - limit, high = nominal / 1000.0 + limit;
+    at_limit = wanted < low || wanted > high;
+    if (!at_limit) {
+        integral = next_integral;   // no wind-up while clamped
+    }
+    value = wanted < low ? low : (wanted > high ? high : wanted);
+    return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FEEDBACK_WINDOW_MS  1000    // consumption is measured over windows this long
+#define FEEDBACK_FILL_TIME_S 10.0f  // a fill error is worked off over about this long
+#define FEEDBACK_INTEGRAL_S 60.0f   // integral time, removes the steady fill offset
+#define FEEDBACK_MAX_PPM    1000    // limit of the feedback around nominal
+
+// UAC2 asynchronous-mode feedback: how many frames the host should send per 1 ms USB
+// frame. The base is the measured rate of the Bluetooth consumer; a PI term on the ring
+// fill error pulls the fill back to target, absorbing the host / device clock offset.
+// Plain arithmetic, no ESP-IDF dependencies.
+class RateFeedback {
+public:
+    void init(uint32_t sample_rate);
+
+    // Consumer side: `frames` were just taken at `now_us`, leaving the fill `fill_error`
+    // frames above target. Returns true when a new feedback value is ready.
+    bool update(uint32_t frames, int64_t now_us, int32_t fill_error);
+    // Stream stopped: restart the measurement window, keep what has been learned.
+    void pause() { window_start_us = 0; }
+    // Host USB frame length in device microseconds, once the SOF clock estimate is locked.
+    // The consumer rate then converts to frames per host frame exactly, and the PI is left
+    // with only the residual instead of the whole clock offset.
+    void set_host_frame_us(double us) { host_frame_us = us; }
+    // Learned consumer rate of the connected sink (restored from flash), or forget it for a
+    // sink never seen before. Takes effect on the feedback value immediately.
+    void seed_consumer(float ppm);
+    void forget_consumer();
+    bool consumer_known() const { return rate_valid; }
+
+    // Frames per USB frame, 16.16 fixed point (what tud_audio_fb_set() takes).
+    uint32_t value_16_16() const { return (uint32_t)(value * 65536.0 + 0.5); }
+    // The same in the 10.14 format of a full-speed feedback endpoint.
+    uint32_t value_10_14() const { return (uint32_t)(value * 16384.0 + 0.5); }
+    double frames_per_ms() const { return value; }
+    // Measured consumer rate against nominal.
+    float consumer_ppm() const { return (float)((consumer_rate / nominal - 1.0) * 1e6); }
+    bool saturated() const { return at_limit; }
+
+private:
+    double nominal = 48000.0;       // frames per second
+    double consumer_rate = 48000.0; // measured, frames per second
+    double host_frame_us = 1000.0;  // host USB frame in device time
+    bool rate_valid = false;
+    double integral = 0.0;          // frames per ms
+    double value = 48.0;            // current feedback, frames per ms
+    bool at_limit = false;
+    int64_t window_start_us = 0;
+    uint64_t window_frames = 0;
+};
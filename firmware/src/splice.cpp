@@ -0,0 +1,140 @@
+#include "splice.h"
+
+#include <math.h>
+#include <string.h>
+
+static inline int16_t clamp16(float v) {
+    return (int16_t)(v > 32767.0f ? 32767.0f : (v < -32768.0f ? -32768.0f : v));
+}
+
+void Splicer::init() {
+    for (int i = 0; i < SPLICE_FRAMES; ++i) {
+        fade_in[i] = sinf((float)M_PI / 2 * (i + 0.5f) / SPLICE_FRAMES);
+    }
+    reset();
+}
+
+void Splicer::reset() {
+    memset(history, 0, sizeof(history));
+    history_pos = 0;
+    ghost_pos = SPLICE_FRAMES;
+    in_pos = SPLICE_FRAMES;
+    padding = false;
+    has_history = false;
+}
+
+// Second-order linear predictor for x[n] from x[n-1] and x[n-2] over `x` (oldest first),
+// stable or with its poles at most just outside the unit circle: fitted by least squares
+// (exact for a single tone), or by the autocorrelation method, which is always stable, when
+// that fit would grow.
+static void fit_predictor(const float *x, size_t n, float *a1, float *a2) {
+    float c11 = 0, c12 = 0, c22 = 0, c01 = 0, c02 = 0;
+    for (size_t k = 2; k < n; ++k) {
+        c11 += x[k - 1] * x[k - 1];
+        c12 += x[k - 1] * x[k - 2];
+        c22 += x[k - 2] * x[k - 2];
+        c01 += x[k] * x[k - 1];
+        c02 += x[k] * x[k - 2];
+    }
+    float det = c11 * c22 - c12 * c12;
+    if (det > 1e-6f * c11 * c22) {
+        float b1 = (c01 * c22 - c02 * c12) / det, b2 = (c02 * c11 - c01 * c12) / det;
+        // Growth of at most 0.5% a frame, which the fade-out more than covers.
+        if (-b2 <= 1.01f && fabsf(b1) <= 1.01f - b2) {
+            *a1 = b1;
+            *a2 = b2;
+            return;
+        }
+    }
+    float r0 = 0, r1 = 0, r2 = 0;
+    for (size_t k = 0; k < n; ++k) {
+        r0 += x[k] * x[k];
+        if (k >= 1) r1 += x[k] * x[k - 1];
+        if (k >= 2) r2 += x[k] * x[k - 2];
+    }
+    *a1 = *a2 = 0;
+    if (r0 > 0) {
+        r0 *= 1.0001f;     // a touch of white noise keeps the reflection coefficients below 1
+        float k1 = r1 / r0;
+        float k2 = (r2 - k1 * r1) / (r0 * (1 - k1 * k1));
+        *a1 = k1 * (1 - k2);
+        *a2 = k2;
+    }
+}
+
+// Predicts the signal to fade out by running a predictor fitted to the history on past the
+// last frame, per channel. That carries on the value, slope and pitch of the audio, where
+// repeating or mirroring the history kinks and splatters. Without any audio since the last
+// reset or pad there is nothing to fade and no splice.
+void Splicer::start_ghost() {
+    if (!has_history) {
+        ghost_pos = SPLICE_FRAMES;
+        return;
+    }
+    for (int c = 0; c < 2; ++c) {
+        float x[SPLICE_FRAMES];     // oldest first
+        for (size_t k = 0; k < SPLICE_FRAMES; ++k) {
+            x[k] = history[((history_pos + k) % SPLICE_FRAMES) * 2 + c];
+        }
+        float a1, a2;
+        fit_predictor(x, SPLICE_FRAMES, &a1, &a2);
+        float y1 = x[SPLICE_FRAMES - 1], y2 = x[SPLICE_FRAMES - 2];
+        for (size_t k = 0; k < SPLICE_FRAMES; ++k) {
+            float y = a1 * y1 + a2 * y2;
+            ghost[k * 2 + c] = y;
+            y2 = y1;
+            y1 = y;
+        }
+    }
+    ghost_pos = 0;
+    splices++;
+}
+
+void Splicer::discontinuity() {
+    start_ghost();
+    in_pos = 0;
+}
+
+void Splicer::audio(int16_t *samples, size_t frames) {
+    if (padding) {
+        padding = false;
+        in_pos = 0;     // back from padding: fade in (over whatever is left of the ghost)
+    }
+    size_t i = 0;
+    for (; i < frames && (in_pos < SPLICE_FRAMES || ghost_pos < SPLICE_FRAMES); ++i) {
+        for (int c = 0; c < 2; ++c) {
+            float v = samples[i * 2 + c];
+            if (in_pos < SPLICE_FRAMES) v *= fade_in[in_pos];
+            if (ghost_pos < SPLICE_FRAMES) v += ghost[ghost_pos * 2 + c] * fade_in[SPLICE_FRAMES - 1 - ghost_pos];
+            samples[i * 2 + c] = clamp16(v);
+        }
+        if (in_pos < SPLICE_FRAMES) in_pos++;
+        if (ghost_pos < SPLICE_FRAMES) ghost_pos++;
+    }
+    // Only the last SPLICE_FRAMES frames matter for the history.
+    if (frames > 0) has_history = true;
+    size_t first = frames > SPLICE_FRAMES ? frames - SPLICE_FRAMES : 0;
+    for (size_t f = first; f < frames; ++f) {
+        history[history_pos * 2] = samples[f * 2];
+        history[history_pos * 2 + 1] = samples[f * 2 + 1];
+        history_pos = (history_pos + 1) % SPLICE_FRAMES;
+    }
+}
+
+bool Splicer::pad(int16_t *samples, size_t frames) {
+    if (!padding) {
+        padding = true;
+        start_ghost();
+        in_pos = SPLICE_FRAMES;
+        memset(history, 0, sizeof(history));    // what follows the ghost is silence
+        has_history = false;
+    }
+    size_t i = 0;
+    for (; i < frames && ghost_pos < SPLICE_FRAMES; ++i, ++ghost_pos) {
+        float g = fade_in[SPLICE_FRAMES - 1 - ghost_pos];
+        samples[i * 2] = clamp16(ghost[ghost_pos * 2] * g);
+        samples[i * 2 + 1] = clamp16(ghost[ghost_pos * 2 + 1] * g);
+    }
+    memset(&samples[i * 2], 0, (frames - i) * 2 * sizeof(int16_t));
+    return i > 0;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SPLICE_FRAMES       64      // equal-power crossfade length (1.3 ms at 48 kHz)
+
+// Smooths the discontinuities left when audio has to be dropped or padded. It watches the
+// stereo 16-bit PCM leaving the ring and keeps the last SPLICE_FRAMES frames. At a
+// discontinuity that history is continued by linear prediction (so there is no step or
+// kink) and faded out with a cosine while whatever follows fades in with a sine.
+class Splicer {
+public:
+    void init();
+    // Real audio, in stream order. Applies any fade in progress and updates the history.
+    void audio(int16_t *samples, size_t frames);
+    // Fills `frames` frames of padding: the fading continuation of the history, then silence.
+    // Returns true if any of it was the continuation (not plain silence).
+    bool pad(int16_t *samples, size_t frames);
+    // Audio was dropped just before the next audio() call: crossfade across the gap.
+    void discontinuity();
+    void reset();
+
+    uint32_t splices = 0;           // crossfades started (drops and pads) from real audio, for the stats
+
+private:
+    void start_ghost();
+
+    float fade_in[SPLICE_FRAMES];   // sin ramp; the cos ramp is the same table read backwards
+    int16_t history[SPLICE_FRAMES * 2];
+    size_t history_pos = 0;         // next write position in `history`, in frames
+    float ghost[SPLICE_FRAMES * 2];     // predicted continuation being faded out
+    size_t ghost_pos = SPLICE_FRAMES;   // SPLICE_FRAMES: no ghost
+    size_t in_pos = SPLICE_FRAMES;      // fade-in progress of real audio, SPLICE_FRAMES: none
+    bool padding = false;           // the last thing delivered was padding
+    bool has_history = false;       // audio since the last reset or pad: something to fade out
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+// Lock-free single-producer / single-consumer byte ring with static storage.
+// One context may call write(), one other context may call read()/reset().
+// Indices run freely and are masked on access, so Size must be a power of two.
+template <size_t Size>
+class SpscRing {
+    static_assert(Size != 0 && (Size & (Size - 1)) == 0, "SpscRing size must be a power of two");
+
+public:
+    // Number of bytes that can be read right now.
+    size_t available() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    // Number of bytes that can be written right now.
+    size_t free_space() const {
+        return Size - available();
+    }
+
+    static constexpr size_t capacity() { return Size; }
+
+    // Producer side: copy up to len bytes in, returns the number of bytes written.
+    size_t write(const uint8_t *src, size_t len) {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+        size_t space = Size - (h - t);
+        if (len > space) len = space;
+        size_t pos = h & (Size - 1);
+        size_t first = Size - pos;
+        if (first > len) first = len;
+        memcpy(storage + pos, src, first);
+        memcpy(storage, src + first, len - first);
+        head.store(h + len, std::memory_order_release);
+        return len;
+    }
+
+    // Consumer side: copy up to len bytes out, returns the number of bytes read.
+    size_t read(uint8_t *dst, size_t len) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_acquire);
+        size_t avail = h - t;
+        if (len > avail) len = avail;
+        size_t pos = t & (Size - 1);
+        size_t first = Size - pos;
+        if (first > len) first = len;
+        memcpy(dst, storage + pos, first);
+        memcpy(dst + first, storage, len - first);
+        tail.store(t + len, std::memory_order_release);
+        return len;
+    }
+
+    // Consumer side: discard everything currently queued.
+    void reset() {
+        tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+private:
+    std::atomic<size_t> head{0};    // written by the producer only
+    std::atomic<size_t> tail{0};    // written by the consumer only
+    uint8_t storage[Size];
+};
@@ -0,0 +1,157 @@
+#include "time_stretch.h"
+
+#include <math.h>
+#include <string.h>
+
+void TimeStretch::set_rate(float rate) {
+    if (rate > 1.0f + WSOLA_MAX_RATE) rate = 1.0f + WSOLA_MAX_RATE;
+    if (rate < 1.0f - WSOLA_MAX_RATE) rate = 1.0f - WSOLA_MAX_RATE;
+    target_rate = rate;
+    if (mode == IDLE) {
+        mode = STARTING;
+    } else if (mode == DRAINING) {
+        // Pick up again from the raw position: same as a fresh start on what is left.
+        discard(drain_pos);
+        mode = STARTING;
+    }
+}
+
+void TimeStretch::stop() {
+    if (mode == STARTING) {
+        mode = IDLE;
+    } else if (mode == RUNNING) {
+        // The previous segment's tail plus the raw input under the rising half of the window
+        // is just the raw input, so output continues unmodified from `natural`.
+        drain_pos = natural;
+        mode = DRAINING;
+    }
+}
+
+void TimeStretch::reset() {
+    mode = IDLE;
+    in_frames = 0;
+    hop_pos = WSOLA_HOP;
+}
+
+// Tops the input buffer up to `frames` frames.
+void TimeStretch::fill(size_t frames, stretch_source_fn source, void *ctx) {
+    if (frames > in_frames) {
+        source(ctx, &in[in_frames * 2], frames - in_frames);
+        in_frames = frames;
+    }
+}
+
+void TimeStretch::discard(size_t frames) {
+    memmove(in, &in[frames * 2], (in_frames - frames) * 2 * sizeof(int16_t));
+    in_frames -= frames;
+    natural -= frames;
+    nominal -= frames;
+}
+
+// Offset around `nominal` whose start best matches the input following `natural`:
+// cross-correlation of the mid signal normalized by the candidate's energy, decimated by
+// WSOLA_CORR_STRIDE.
+size_t TimeStretch::best_offset(size_t nominal, size_t natural) const {
+    size_t best = nominal;
+    float best_score = -INFINITY;
+    for (size_t c = nominal - WSOLA_SEEK; c <= nominal + WSOLA_SEEK; ++c) {
+        float corr = 0.0f, energy = 1.0f;
+        for (size_t i = 0; i < WSOLA_CORR_FRAMES; i += WSOLA_CORR_STRIDE) {
+            float a = in[(c + i) * 2] + in[(c + i) * 2 + 1];
+            float b = in[(natural + i) * 2] + in[(natural + i) * 2 + 1];
+            corr += a * b;
+            energy += a * a;
+        }
+        float score = corr / sqrtf(energy);
+        if (score > best_score) {
+            best_score = score;
+            best = c;
+        }
+    }
+    return best;
+}
+
+// Builds the next output hop into hop_out.
+void TimeStretch::next_hop(stretch_source_fn source, void *ctx) {
+    if (!window_ready) {
+        for (int i = 0; i < WSOLA_HOP; ++i) {
+            float s = sinf((float)M_PI * i / WSOLA_WINDOW);
+            window[i] = s * s;      // rising half; the falling half is 1 - window[i]
+        }
+        window_ready = true;
+    }
+    if (mode == STARTING) {
+        // First hop: raw input, and its second half becomes the overlap tail.
+        fill(WSOLA_WINDOW, source, ctx);
+        memcpy(hop_out, in, sizeof(hop_out));
+        for (int i = 0; i < WSOLA_HOP; ++i) {
+            for (int c = 0; c < 2; ++c) {
+                tail[i * 2 + c] = in[(WSOLA_HOP + i) * 2 + c] * (1.0f - window[i]);
+            }
+        }
+        natural = WSOLA_HOP;
+        nominal = WSOLA_HOP * target_rate;
+        current_rate = target_rate;
+        mode = RUNNING;
+        return;
+    }
+    // Keep only what the search can still reach.
+    size_t keep_from = (size_t) nominal - WSOLA_SEEK;
+    if (natural < keep_from) keep_from = natural;
+    discard(keep_from);
+    size_t nom = (size_t)(nominal + 0.5f);
+    fill(nom + WSOLA_SEEK + WSOLA_WINDOW, source, ctx);
+    size_t start = best_offset(nom, natural);
+    const int16_t *seg = &in[start * 2];
+    for (int i = 0; i < WSOLA_HOP; ++i) {
+        float w = window[i];
+        for (int c = 0; c < 2; ++c) {
+            float v = tail[i * 2 + c] + seg[i * 2 + c] * w;
+            hop_out[i * 2 + c] = (int16_t)(v > 32767.0f ? 32767.0f : (v < -32768.0f ? -32768.0f : v));
+            tail[i * 2 + c] = seg[(WSOLA_HOP + i) * 2 + c] * (1.0f - w);
+        }
+    }
+    hops++;
+    frames_gained += (int32_t) start - (int32_t) natural;     // input advance minus output hop
+    natural = start + WSOLA_HOP;
+    current_rate = target_rate;
+    nominal += WSOLA_HOP * current_rate;
+}
+
+void TimeStretch::read(int16_t *out, size_t frames, stretch_source_fn source, void *ctx) {
+    while (frames > 0) {
+        if (hop_pos < WSOLA_HOP) {
+            // Finish the hop in progress first, whatever the mode.
+            size_t n = WSOLA_HOP - hop_pos;
+            if (n > frames) n = frames;
+            memcpy(out, &hop_out[hop_pos * 2], n * 2 * sizeof(int16_t));
+            hop_pos += n;
+            out += n * 2;
+            frames -= n;
+            continue;
+        }
+        if (mode == DRAINING) {
+            size_t n = in_frames - drain_pos;
+            if (n > frames) n = frames;
+            memcpy(out, &in[drain_pos * 2], n * 2 * sizeof(int16_t));
+            drain_pos += n;
+            out += n * 2;
+            frames -= n;
+            if (drain_pos == in_frames) {
+                in_frames = 0;
+                mode = IDLE;
+            }
+            if (mode == IDLE && frames > 0) {
+                source(ctx, out, frames);   // the rest comes straight from the source
+                return;
+            }
+            continue;
+        }
+        if (mode == IDLE) {
+            source(ctx, out, frames);
+            return;
+        }
+        next_hop(source, ctx);
+        hop_pos = 0;
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WSOLA_HOP           256     // output hop in frames (5.3 ms at 48 kHz)
+#define WSOLA_WINDOW        (2 * WSOLA_HOP) // Hann window, 50% overlap
+#define WSOLA_SEEK          64      // +- search around the nominal input position (1.3 ms)
+#define WSOLA_CORR_FRAMES   128     // frames compared per candidate
+#define WSOLA_CORR_STRIDE   4       // compare every 4th frame: (2*SEEK+1)*CORR/STRIDE MACs per hop
+#ifndef WSOLA_MAX_RATE
+#define WSOLA_MAX_RATE      0.04f   // at most 4% faster or slower than real time
+#endif
+// Input kept: one window plus the search range plus the largest hop advance.
+#define WSOLA_BUFFER_FRAMES (WSOLA_WINDOW + 2 * WSOLA_SEEK + 2 * WSOLA_HOP)
+
+// Pulls `frames` frames of interleaved stereo PCM; must always fill them (silence if need be).
+typedef void (*stretch_source_fn)(void *ctx, int16_t *dst, size_t frames);
+
+// WSOLA time-scale modification for interleaved stereo 16-bit PCM. Each output hop takes a
+// windowed input segment near the nominal position (advanced by rate * hop), picked within
+// +-WSOLA_SEEK so its waveform best continues the previous segment, and overlap-adds it.
+// Playback speeds up or slows down by a few percent without changing pitch. Entering and
+// leaving are seamless: the first hop passes input straight through, and on stop() the
+// output carries on from where the last segment would have continued.
+class TimeStretch {
+public:
+    // Input frames consumed per output frame, clamped to 1 +- WSOLA_MAX_RATE. Engages the
+    // stretcher if it was idle.
+    void set_rate(float rate);
+    // Leaves after the buffered input has been played out unmodified.
+    void stop();
+    // Drops all buffered input (stream restarted or flushed).
+    void reset();
+    bool active() const { return mode != IDLE; }
+    float rate() const { return mode == RUNNING ? current_rate : 1.0f; }
+    // Input frames held inside the stretcher, for the fill level.
+    size_t buffered_frames() const { return in_frames - (mode == DRAINING ? drain_pos : 0); }
+
+    // Produces `frames` output frames, pulling input through `source` as needed.
+    void read(int16_t *out, size_t frames, stretch_source_fn source, void *ctx);
+
+    uint32_t hops = 0;              // stretched hops since the last reset of the counter
+    int32_t frames_gained = 0;      // input minus output frames over those hops
+
+private:
+    enum mode_t { IDLE, STARTING, RUNNING, DRAINING };
+
+    void fill(size_t frames, stretch_source_fn source, void *ctx);
+    void next_hop(stretch_source_fn source, void *ctx);
+    size_t best_offset(size_t nominal, size_t natural) const;
+    void discard(size_t frames);
+
+    mode_t mode = IDLE;
+    float target_rate = 1.0f;
+    float current_rate = 1.0f;
+    int16_t in[WSOLA_BUFFER_FRAMES * 2];
+    size_t in_frames = 0;           // valid input frames in `in`
+    size_t natural = 0;             // where the previous segment continues, in `in`
+    float nominal = 0.0f;           // nominal input position of the next segment, in `in`
+    size_t drain_pos = 0;           // next raw frame to play out while draining
+    float tail[WSOLA_HOP * 2];      // second half of the previous windowed segment
+    int16_t hop_out[WSOLA_HOP * 2]; // finished output hop
+    size_t hop_pos = WSOLA_HOP;     // next frame of hop_out to deliver
+    float window[WSOLA_HOP];        // rising half of the Hann window
+    bool window_ready = false;
+};
@@ -0,0 +1,84 @@
+#include "timing_log.h"
+
+#include <stdio.h>
+#include "esp_timer.h"
+
+#if TIMING_LOG
+std::atomic<bool> timing_enabled{false};
+static uint32_t records[TIMING_RECORDS];
+static std::atomic<uint32_t> record_count{0};   // total recorded; the ring keeps the last TIMING_RECORDS
+// Time of the last record per side: the tool walks back from there, so dropping the
+// oldest records never shifts the rest.
+static int64_t last_us[2];
+static int64_t started_us;
+static bool freeze_on_glitch;
+static std::atomic<int64_t> freeze_at_us{0};    // 0 until a glitch arms the freeze
+static std::atomic<bool> frozen{false};
+
+static void put(uint32_t word) {
+    records[record_count.fetch_add(1, std::memory_order_relaxed) % TIMING_RECORDS] = word;
+}
+
+void timing_record(timing_kind_t kind, uint32_t frames) {
+    const uint32_t max_delta = (1u << TIMING_DELTA_BITS) - 1;
+    const uint32_t max_frames = (1u << TIMING_FRAMES_BITS) - 1;
+    int side = kind & 1;
+    int64_t now = esp_timer_get_time();
+    int64_t delta = now - last_us[side];
+    last_us[side] = now;
+    for (; delta > max_delta; delta -= max_delta) {
+        put((uint32_t) side << 30 | max_delta);
+    }
+    put((uint32_t) kind << 30 | (frames < max_frames ? frames : max_frames) << TIMING_DELTA_BITS | (uint32_t) delta);
+    if (freeze_on_glitch) {
+        int64_t freeze_at = freeze_at_us.load(std::memory_order_relaxed);
+        if (freeze_at == 0 && (kind == TIMING_OVERFLOW || kind == TIMING_UNDERRUN)) {
+            freeze_at_us.store(now + (int64_t)TIMING_POST_MS * 1000, std::memory_order_relaxed);
+        } else if (freeze_at != 0 && now >= freeze_at) {
+            timing_enabled = false;
+            frozen = true;
+        }
+    }
+}
+
+void timing_log_start(bool freeze) {
+    timing_enabled = false;
+    record_count = 0;
+    started_us = esp_timer_get_time();
+    last_us[0] = last_us[1] = started_us;
+    freeze_on_glitch = freeze;
+    freeze_at_us = 0;
+    frozen = false;
+    timing_enabled = true;
+}
+
+void timing_log_stop() {
+    timing_enabled = false;
+}
+
+bool timing_log_frozen() {
+    return frozen.load();
+}
+
+void timing_log_dump() {
+    frozen = false;
+    uint32_t count = record_count.load();
+    uint32_t kept = count < TIMING_RECORDS ? count : TIMING_RECORDS;
+    printf("--- timing begin ---\n");
+    printf("started %lld\n", (long long) started_us);
+    printf("last %lld %lld\n", (long long) last_us[0], (long long) last_us[1]);
+    printf("records %u dropped %u\n", (unsigned) kept, (unsigned)(count - kept));
+    // Raw records as 8 hex digits each, 8 per line.
+    uint32_t first = count - kept;
+    for (uint32_t n = 0; n < kept; ++n) {
+        printf("%08x", (unsigned) records[(first + n) % TIMING_RECORDS]);
+        if (n % 8 == 7 || n + 1 == kept) printf("\n");
+    }
+    printf("--- timing end ---\n");
+}
+#else
+void timing_log_start(bool) {}
+void timing_log_stop() {}
+bool timing_log_frozen() { return false; }
+void timing_log_dump() { printf("Timing log not built in (TIMING_LOG 0)\n"); }
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// Timing log of the two ends of the ring: the size and arrival time of every USB packet
+// and Bluetooth request, plus the glitches the device saw. One 32-bit word per record in a
+// ring that keeps the most recent TIMING_RECORDS, so it can run for hours and freeze just
+// after the glitch being chased. Dumped over the console as hex (timing_log_dump()) and
+// replayed against other pipeline settings by tools/timing_replay.py.
+#ifndef TIMING_LOG
+#define TIMING_LOG          1
+#endif
+#define TIMING_RECORDS      8192    // 32 KB, about 6 s of packets and requests
+#define TIMING_POST_MS      1000    // kept after the first glitch before the log freezes
+
+// Bit 0 is the side: each side has a single writer and its own time chain.
+enum timing_kind_t : uint8_t {
+    TIMING_USB_PACKET,      // frames received (0: time filler)
+    TIMING_BT_REQUEST,      // frames requested (0: time filler)
+    TIMING_OVERFLOW,        // USB side, frames 0
+    TIMING_UNDERRUN,        // Bluetooth side, frames 0
+};
+
+// Record layout: kind in bits 31-30, frames in 29-19, microseconds since the previous
+// record of the same side in 18-0. Longer gaps are bridged with zero-frame records.
+#define TIMING_FRAMES_BITS  11
+#define TIMING_DELTA_BITS   19
+
+#if TIMING_LOG
+extern std::atomic<bool> timing_enabled;
+void timing_record(timing_kind_t kind, uint32_t frames);
+
+static inline void timing_log(timing_kind_t kind, uint32_t frames) {
+    if (timing_enabled.load(std::memory_order_relaxed)) timing_record(kind, frames);
+}
+#else
+static inline void timing_log(timing_kind_t, uint32_t) {}
+#endif
+
+// Clears the log and starts recording. With `freeze_on_glitch` it stops by itself
+// TIMING_POST_MS after the first underrun or overflow; otherwise it runs until stopped.
+void timing_log_start(bool freeze_on_glitch);
+void timing_log_stop();
+// True once a glitch-triggered log has frozen and not been dumped yet.
+bool timing_log_frozen();
+// Prints the header and the records, oldest first, between "--- timing begin/end ---"
+// markers. Slow: call it from a task that can block, after the log has stopped.
+void timing_log_dump();
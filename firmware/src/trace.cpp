@@ -0,0 +1,89 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include "esp_timer.h"
+#include "esp_ipc.h"
+#include "esp_cpu.h"
+#include "esp_rom_sys.h"
+
+#if AUDIO_TRACE
+std::atomic<bool> trace_enabled{false};
+static trace_event_t events[TRACE_EVENTS];
+static std::atomic<uint32_t> event_count{0};   // total recorded; the ring keeps the last TRACE_EVENTS
+// Per-core cycle counter at a common esp_timer instant, taken when the trace stops: the
+// tool walks back from there, so however long the trace ran the stamps stay unambiguous.
+static uint32_t sync_cycles[2];
+static int64_t sync_us[2];
+
+static const struct {
+    const char *name;
+    const char *track;
+} trace_names[TRACE_ID_COUNT] = {
+    { "uac_output_cb", "usb" },
+    { "get_bt_audio_data", "bluetooth" },
+    { "dsp", "bluetooth" },
+    { "ring_fill_frames", "" },
+    { "feedback_ppm", "" },
+    { "stretch_ppm", "" },
+    { "underrun", "bluetooth" },
+    { "overflow", "usb" },
+};
+
+void trace_record(trace_id_t id, trace_kind_t kind, int32_t value) {
+    uint32_t i = event_count.fetch_add(1, std::memory_order_relaxed) % TRACE_EVENTS;
+    trace_event_t &e = events[i];
+    e.cycles = esp_cpu_get_cycle_count();
+    e.id = id;
+    e.kind = kind;
+    e.core = (uint8_t) esp_cpu_get_core_id();
+    e.value = value;
+}
+
+// The cores' cycle counters are not synchronized: sample each against esp_timer.
+static void sync_core(void *arg) {
+    int core = esp_cpu_get_core_id();
+    sync_us[core] = esp_timer_get_time();
+    sync_cycles[core] = esp_cpu_get_cycle_count();
+}
+
+void trace_start() {
+    trace_enabled = false;
+    event_count = 0;
+    trace_enabled = true;
+}
+
+void trace_stop() {
+    trace_enabled = false;
+    int core = esp_cpu_get_core_id();
+    sync_core(nullptr);
+    esp_ipc_call_blocking(!core, sync_core, nullptr);
+}
+
+void trace_dump() {
+    uint32_t count = event_count.load();
+    uint32_t kept = count < TRACE_EVENTS ? count : TRACE_EVENTS;
+    printf("--- trace begin ---\n");
+    printf("cpu_hz %u\n", (unsigned)(esp_rom_get_cpu_ticks_per_us() * 1000000u));
+    for (int c = 0; c < 2; ++c) {
+        printf("sync %d %u %lld\n", c, (unsigned) sync_cycles[c], (long long) sync_us[c]);
+    }
+    for (int i = 0; i < TRACE_ID_COUNT; ++i) {
+        printf("name %d %s %s\n", i, trace_names[i].name, trace_names[i].track[0] ? trace_names[i].track : "-");
+    }
+    printf("events %u dropped %u\n", (unsigned) kept, (unsigned)(count - kept));
+    // Raw little-endian trace_event_t records, 4 per line.
+    uint32_t first = count - kept;
+    for (uint32_t n = 0; n < kept; ++n) {
+        const uint8_t *b = (const uint8_t*) &events[(first + n) % TRACE_EVENTS];
+        for (size_t k = 0; k < sizeof(trace_event_t); ++k) {
+            printf("%02x", b[k]);
+        }
+        if (n % 4 == 3 || n + 1 == kept) printf("\n");
+    }
+    printf("--- trace end ---\n");
+}
+#else
+void trace_start() {}
+void trace_stop() {}
+void trace_dump() { printf("Tracing not built in (AUDIO_TRACE 0)\n"); }
+#endif
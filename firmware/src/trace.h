@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "esp_cpu.h"
+
+// Binary event trace of the audio path: begin/end spans, counters and instants with CPU
+// cycle timestamps, in a fixed ring that keeps the most recent TRACE_EVENTS. Recording is
+// one atomic increment and a 12-byte store; with AUDIO_TRACE 0 every call compiles away.
+// Dumped over the console as hex (trace_dump()) and turned into Chrome trace JSON by
+// tools/trace2chrome.py.
+#ifndef AUDIO_TRACE
+#define AUDIO_TRACE         1
+#endif
+#define TRACE_EVENTS        2048    // 24 KB, about a second of the audio path
+
+enum trace_kind_t : uint8_t {
+    TRACE_BEGIN,
+    TRACE_END,
+    TRACE_COUNTER,
+    TRACE_INSTANT,
+};
+
+// What is traced. Names and tracks go out with the dump, so the tool needs no copy of this.
+enum trace_id_t : uint8_t {
+    TRACE_USB_PACKET,       // uac_output_cb -> on_usb_packet
+    TRACE_BT_READ,          // get_bt_audio_data -> AudioBridge::read
+    TRACE_DSP,              // channel mode, EQ, loudness and gain of one block
+    TRACE_RING_FILL,        // counter: frames queued
+    TRACE_FEEDBACK_PPM,     // counter: async feedback against nominal
+    TRACE_STRETCH_PPM,      // counter: time-stretch rate against 1.0
+    TRACE_UNDERRUN,         // instant
+    TRACE_OVERFLOW,         // instant
+    TRACE_ID_COUNT,
+};
+
+struct trace_event_t {
+    uint32_t cycles;        // esp_cpu_get_cycle_count() of the recording core
+    trace_id_t id;
+    trace_kind_t kind;
+    uint8_t core;
+    uint8_t reserved;
+    int32_t value;          // counters only
+};
+
+#if AUDIO_TRACE
+extern std::atomic<bool> trace_enabled;
+void trace_record(trace_id_t id, trace_kind_t kind, int32_t value);
+
+static inline void trace_begin(trace_id_t id) {
+    if (trace_enabled.load(std::memory_order_relaxed)) trace_record(id, TRACE_BEGIN, 0);
+}
+static inline void trace_end(trace_id_t id) {
+    if (trace_enabled.load(std::memory_order_relaxed)) trace_record(id, TRACE_END, 0);
+}
+static inline void trace_counter(trace_id_t id, int32_t value) {
+    if (trace_enabled.load(std::memory_order_relaxed)) trace_record(id, TRACE_COUNTER, value);
+}
+static inline void trace_instant(trace_id_t id) {
+    if (trace_enabled.load(std::memory_order_relaxed)) trace_record(id, TRACE_INSTANT, 0);
+}
+#else
+static inline void trace_begin(trace_id_t) {}
+static inline void trace_end(trace_id_t) {}
+static inline void trace_counter(trace_id_t, int32_t) {}
+static inline void trace_instant(trace_id_t) {}
+#endif
+
+// Clears the ring and starts recording.
+void trace_start();
+// Stops recording and samples both cores' cycle counters against esp_timer.
+void trace_stop();
+// Prints the header and the events, oldest first, between "--- trace begin/end ---"
+// markers. Slow (tens of KB of hex): call it from a task that can block, after trace_stop().
+void trace_dump();
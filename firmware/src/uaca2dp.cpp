@@ -1,49 +1,356 @@
 #include <stdio.h>
 #include <string.h>
+#include <atomic>
 #include "freertos/FreeRTOS.h"
-#include "freertos/ringbuf.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+#include "tusb.h"
 #include "usb_device_uac.h"         // ESP USB audio device (UAC) driver
 #include "BluetoothA2DPSource.h"    // Bluetooth A2DP source library (pschatzmann's ESP32-A2DP)
+#include "esp_gap_bt_api.h"
+#include "audio_bridge.h"           // USB -> Bluetooth audio pipeline
+#include "hfp_uplink.h"             // HFP microphone uplink (headset mic -> USB host)
+#include "learned_store.h"          // learned clock/jitter state in NVS
+#include "connection_manager.h"     // known sinks paged directly, discovery as a fallback
+#include "boot_trace.h"             // per-phase bring-up timing
 
-// Configuration constants
-#define AUDIO_SAMPLE_RATE   48000   // 48 kHz sample rate
-#define AUDIO_CHANNELS      2       // stereo
-#define AUDIO_BITS_PER_SAMPLE 16    // 16-bit PCM
-#define RINGBUF_SIZE        (8 * 1024)  // 8 KB ring buffer for audio data
+// Configuration constants (audio format and buffer sizes live in audio_bridge.h)
+#define STATS_PERIOD_MS     10000   // how often the pipeline counters are logged
+#define LEARNED_POLL_MS     60000   // how often learned state is offered to the store (it rate-limits writes)
+#define MAIN_LOOP_MS        100     // connection timeouts and persistence run at this granularity
+#define EQ_SAVE_DELAY_MS    2000    // an EQ change is saved once the host has stopped sending bands this long
+// Name looked for by inquiry when no known sink answers a page (first boot, new headphones).
+#ifndef SINK_NAME
+#define SINK_NAME           "MyHeadphones"
+#endif
+#define INQUIRY_LEN         10      // inquiry duration in 1.28 s units
+// Bring-up: USB in app_main, Bluetooth in a task of its own alongside it.
+#define BT_BRINGUP_STACK    6144
+#define BT_BRINGUP_PRIORITY 3       // below the USB and Bluetooth stack tasks it waits on
+#define BOOT_TRACE_WAIT_MS  15000   // print the boot trace after this long even if USB or a sink is missing
 
-// Global state for audio control
-static RingbufHandle_t audio_ringbuf = NULL;
-static bool uac_mute_flag = false;
-static uint32_t uac_volume_level = 100;  // Volume level (0-100% by default)
+// Vendor control requests (bmRequestType: vendor, device, host-to-device) for the EQ.
+#define VENDOR_REQ_EQ_SET_BAND  0x01    // wIndex = band (0-9), data = eq_band_wire_t
+#define VENDOR_REQ_EQ_CLEAR     0x02    // no data: flat response
+#define VENDOR_REQ_SET_BOOST    0x03    // wValue = boost above 100% volume in 0.1 dB
+#define VENDOR_REQ_SET_LIMITER  0x04    // wValue = ceiling in 0.1 dB (int16), wIndex = release ms, 0 = off
+#define VENDOR_REQ_SET_LOUDNESS 0x05    // wValue = target in 0.1 LUFS (int16), wIndex = 1 on, 0 off
+#define VENDOR_REQ_SET_CHANNELS 0x06    // wValue = channel_mode_t
+#define VENDOR_REQ_TRACE        0x07    // wValue = 1 start, 0 stop and dump to the console
+#define VENDOR_REQ_TIMING_LOG   0x08    // wValue = 1 start, 2 start and freeze after a glitch, 0 stop and dump
+
+// EQ band as sent by the host tool, little-endian.
+struct __attribute__((packed)) eq_band_wire_t {
+    uint8_t type;               // eq_band_type_t
+    uint8_t channels;           // bit 0 = left, bit 1 = right
+    uint16_t freq_hz;
+    int16_t gain_cdb;           // gain in 0.01 dB
+    uint16_t q_milli;           // Q x 1000
+};
+
+// The USB -> Bluetooth audio path. Static, so all pipeline storage is laid out at link time.
+static AudioBridge audio_bridge;
 
 // Bluetooth A2DP source object (for sending audio to headphones)
 static BluetoothA2DPSource a2dp_source;
 
+// The A2DP data callback has no context pointer, so the bridge bound to the radio is kept here.
+static AudioBridge *bt_bridge = NULL;
+
+// Bring-up readiness. Callbacks that reach into a subsystem still coming up check these.
+#define BOOT_BT_READY       (1 << 0)    // Bluedroid, A2DP, HFP and the connection manager are up
+#define BOOT_USB_MOUNTED    (1 << 1)    // the host has configured the device
+#define BOOT_SINK_CONNECTED (1 << 2)    // first A2DP connection
+static StaticEventGroup_t boot_events_storage;
+static EventGroupHandle_t boot_events = NULL;
+
+static bool bt_ready() {
+    return boot_events != NULL && (xEventGroupGetBits(boot_events) & BOOT_BT_READY);
+}
+
+// Learned clock/jitter state in flash, and the sink it is currently being learned for.
+// Only the main task touches these: flash access stays out of the Bluetooth task.
+static LearnedStore learned_store;
+static uint8_t learned_sink_bda[6];
+static bool learned_sink_valid = false;
+
+// Sink connections and disconnections since the main loop last looked, from the A2DP
+// callback. The main task is woken to save the old sink's state and load the new one's.
+struct sink_events_t {
+    bool disconnected;
+    bool connected;
+    uint8_t bda[6];             // the sink that connected
+};
+static sink_events_t sink_events = {};
+static portMUX_TYPE sink_events_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t main_task = NULL;
+
+// The EQ belongs to the connected sink: set from the vendor requests, saved for that sink by
+// the main task once the changes settle, and restored whenever it connects. A change made
+// with no sink connected carries over to the next one.
+static std::atomic<int64_t> eq_changed_us{0};   // last EQ change not saved yet, 0 = none
+
+// Event trace control from the vendor request, carried out by the main loop.
+enum trace_request_t { TRACE_REQ_NONE, TRACE_REQ_START, TRACE_REQ_DUMP };
+static std::atomic<trace_request_t> trace_request{TRACE_REQ_NONE};
+static std::atomic<uint16_t> timing_request{0};     // wValue + 1, 0 = nothing pending
+
+// Which sink to connect to. Events come from the Bluetooth task and the main loop; the
+// manager is plain logic, so a spinlock around each call is enough and the resulting action
+// runs outside it.
+static ConnectionManager conn_manager;
+static portMUX_TYPE conn_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t now_ms() {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static void run_conn_action(const conn_action_t &action) {
+    switch (action.type) {
+        case CONN_ACT_PAGE: {
+            const uint8_t *b = action.bda;
+            printf("Paging known sink %02x:%02x:%02x:%02x:%02x:%02x\n", b[0], b[1], b[2], b[3], b[4], b[5]);
+            esp_bt_gap_cancel_discovery();
+            esp_bd_addr_t bda;
+            memcpy(bda, action.bda, sizeof(bda));
+            a2dp_source.connect_to(bda);
+            break;
+        }
+        case CONN_ACT_DISCOVER:
+            printf("No known sink answered, searching for \"%s\"...\n", SINK_NAME);
+            esp_bt_gap_start_discovery(ESP_BT_INQ_MODE_GENERAL_INQUIRY, INQUIRY_LEN, 0);
+            break;
+        case CONN_ACT_NONE:
+        default:
+            break;
+    }
+}
+
+// Inquiry results from the A2DP library: connect to the configured name or any known sink.
+static bool a2dp_ssid_cb(const char *name, esp_bd_addr_t bda, int rssi) {
+    portENTER_CRITICAL(&conn_lock);
+    bool wanted = conn_manager.on_discovered(name, bda, now_ms());
+    portEXIT_CRITICAL(&conn_lock);
+    if (wanted) {
+        printf("Found sink \"%s\" (RSSI %d), connecting\n", name ? name : "", rssi);
+    }
+    return wanted;
+}
+
+static void stats_timer_cb(void *arg) {
+    ((AudioBridge*) arg)->print_stats();
+    hfp_uplink_print_stats();
+}
+
+// A2DP media control used by the bridge for silence suspend/resume.
+static void a2dp_media_ctrl(bool start) {
+    esp_a2d_media_ctrl(start ? ESP_A2D_MEDIA_CTRL_START : ESP_A2D_MEDIA_CTRL_SUSPEND);
+}
+
+// A2DP audio state callback: tracks stream start/suspend for the silence detector's accounting.
+static void a2dp_audio_state_cb(esp_a2d_audio_state_t state, void *obj) {
+    ((AudioBridge*) obj)->on_audio_state(state);
+}
+
+// A2DP connection state callback: flushes stale audio and pre-rolls on (re)connect.
+// The main task restores what was learned about this sink last time (or starts it from
+// defaults), after saving what was learned about the previous one.
+static void a2dp_connection_state_cb(esp_a2d_connection_state_t state, void *obj) {
+    AudioBridge *bridge = (AudioBridge*) obj;
+    conn_action_t action = { CONN_ACT_NONE, {} };
+    if (state == ESP_A2D_CONNECTION_STATE_CONNECTED) {
+        esp_bd_addr_t *peer = a2dp_source.get_last_peer_address();
+        if (peer != nullptr) {
+            portENTER_CRITICAL(&sink_events_lock);
+            sink_events.connected = true;
+            memcpy(sink_events.bda, *peer, sizeof(sink_events.bda));
+            portEXIT_CRITICAL(&sink_events_lock);
+            if (main_task != NULL) xTaskNotifyGive(main_task);
+            portENTER_CRITICAL(&conn_lock);
+            action = conn_manager.on_connected(*peer, now_ms());
+            portEXIT_CRITICAL(&conn_lock);
+            if (!(xEventGroupGetBits(boot_events) & BOOT_SINK_CONNECTED)) {
+                xEventGroupSetBits(boot_events, BOOT_SINK_CONNECTED);
+                boot_milestone("a2dp connected");
+            }
+        }
+    } else if (state == ESP_A2D_CONNECTION_STATE_DISCONNECTED) {
+        // A connection the main loop has not taken up yet is simply dropped.
+        portENTER_CRITICAL(&sink_events_lock);
+        sink_events.disconnected = true;
+        sink_events.connected = false;
+        portEXIT_CRITICAL(&sink_events_lock);
+        if (main_task != NULL) xTaskNotifyGive(main_task);
+        portENTER_CRITICAL(&conn_lock);
+        action = conn_manager.on_disconnected(now_ms());
+        portEXIT_CRITICAL(&conn_lock);
+    }
+    bridge->on_connection_state(state);
+    run_conn_action(action);
+}
+
+// Offers the converged state to the store. Runs in the main task: flash writes stall the
+// cache, so they stay out of the USB, Bluetooth and timer tasks.
+static void save_learned(AudioBridge *bridge, bool force) {
+    int64_t now = esp_timer_get_time();
+    sink_learned_t sink;
+    if (learned_sink_valid && bridge->learned_sink(&sink) &&
+        learned_store.save_sink(learned_sink_bda, sink, now, force)) {
+        printf("Learned sink state saved: %+.1f ppm, jitter %u us, depth %u ms\n",
+               sink.consumer_ppm, (unsigned) sink.jitter_us, (unsigned) sink.depth_ms);
+    }
+    host_learned_t host;
+    if (bridge->learned_host(&host) && learned_store.save_host(host, now, force)) {
+        printf("Learned host clock saved: %+.1f ppm\n", host.host_ppm);
+    }
+}
+
+// Stores the EQ for the connected sink. Main task only, like save_learned().
+static void save_eq(AudioBridge *bridge) {
+    eq_changed_us = 0;
+    sink_eq_t eq;
+    bridge->get_eq(&eq);
+    if (learned_store.save_eq(learned_sink_bda, eq)) {
+        printf("EQ saved for this sink: %u bands\n", (unsigned) eq.band_count);
+    }
+}
+
+// UAC streaming interface alt-setting change. Alt 0 means the host closed the stream.
+// The UAC driver does not forward SET_INTERFACE itself; call this from its tud_audio_set_itf_cb /
+// tud_audio_set_itf_close_EP_cb handlers. Without it, packet cadence alone drives the state.
+extern "C" void uac_stream_alt_setting_changed(uint8_t alt) {
+    audio_bridge.on_alt_setting(alt);
+}
+
+// TinyUSB start-of-frame callback (USB task, once per 1 ms frame while enabled): the host
+// frame clock for the clock estimator.
+extern "C" void tud_sof_cb(uint32_t frame_count) {
+    audio_bridge.on_sof(frame_count);
+    // SOFs run from bus reset on, so this also catches the end of enumeration to within 1 ms.
+    if (!(xEventGroupGetBits(boot_events) & BOOT_USB_MOUNTED) && tud_mounted()) {
+        xEventGroupSetBits(boot_events, BOOT_USB_MOUNTED);
+        boot_milestone("usb enumerated");
+    }
+}
+
+// TinyUSB vendor control request handler: host-side EQ tuning without a driver.
+// The new coefficients take effect at the next audio block with a crossfade.
+extern "C" bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const *request) {
+    static eq_band_wire_t wire;
+    switch (request->bRequest) {
+        case VENDOR_REQ_EQ_SET_BAND:
+            if (request->wIndex >= EQ_MAX_BANDS || request->wLength != sizeof(wire)) {
+                return false;
+            }
+            if (stage == CONTROL_STAGE_SETUP) {
+                return tud_control_xfer(rhport, request, &wire, sizeof(wire));
+            }
+            if (stage == CONTROL_STAGE_DATA) {
+                eq_band_t band;
+                band.type = (eq_band_type_t) wire.type;
+                band.channels = wire.channels;
+                band.freq = wire.freq_hz;
+                band.gain_db = wire.gain_cdb / 100.0f;
+                band.q = wire.q_milli / 1000.0f;
+                if (!audio_bridge.set_eq_band((uint8_t) request->wIndex, band)) {
+                    printf("USB Host sent an invalid EQ band %u: type %u, %u Hz, Q %.3f\n", (unsigned) request->wIndex,
+                           (unsigned) wire.type, (unsigned) wire.freq_hz, band.q);
+                    return false;
+                }
+                printf("USB Host set EQ band %u: type %u, %u Hz, %.2f dB, Q %.2f\n", (unsigned) request->wIndex,
+                       (unsigned) wire.type, (unsigned) wire.freq_hz, band.gain_db, band.q);
+                eq_changed_us = esp_timer_get_time();
+            }
+            return true;
+        case VENDOR_REQ_EQ_CLEAR:
+            if (stage == CONTROL_STAGE_SETUP) {
+                audio_bridge.clear_eq();
+                printf("USB Host cleared EQ\n");
+                eq_changed_us = esp_timer_get_time();
+                return tud_control_status(rhport, request);
+            }
+            return true;
+        case VENDOR_REQ_SET_BOOST:
+            if (stage == CONTROL_STAGE_SETUP) {
+                audio_bridge.set_boost_db(request->wValue / 10.0f);
+                printf("USB Host set boost: %.1f dB\n", request->wValue / 10.0f);
+                return tud_control_status(rhport, request);
+            }
+            return true;
+        case VENDOR_REQ_SET_LIMITER:
+            if (stage == CONTROL_STAGE_SETUP) {
+                float ceiling_db = (int16_t) request->wValue / 10.0f;
+                audio_bridge.set_limiter(request->wIndex != 0, ceiling_db, request->wIndex);
+                printf("USB Host set limiter: %s, ceiling %.1f dB, release %u ms\n",
+                       request->wIndex ? "on" : "off", ceiling_db, (unsigned) request->wIndex);
+                return tud_control_status(rhport, request);
+            }
+            return true;
+        case VENDOR_REQ_SET_LOUDNESS:
+            if (stage == CONTROL_STAGE_SETUP) {
+                float target_lufs = (int16_t) request->wValue / 10.0f;
+                audio_bridge.set_loudness_norm(request->wIndex != 0, target_lufs);
+                printf("USB Host set loudness normalization: %s, target %.1f LUFS\n",
+                       request->wIndex ? "on" : "off", target_lufs);
+                return tud_control_status(rhport, request);
+            }
+            return true;
+        case VENDOR_REQ_SET_CHANNELS:
+            if (stage == CONTROL_STAGE_SETUP) {
+                if (!audio_bridge.set_channel_mode((channel_mode_t) request->wValue)) {
+                    return false;
+                }
+                printf("USB Host set channel mode: %s\n", channel_mode_name((channel_mode_t) request->wValue));
+                return tud_control_status(rhport, request);
+            }
+            return true;
+        case VENDOR_REQ_TRACE:
+            if (stage == CONTROL_STAGE_SETUP) {
+                // Started and dumped from the main loop: both block for a while.
+                trace_request.store(request->wValue ? TRACE_REQ_START : TRACE_REQ_DUMP);
+                return tud_control_status(rhport, request);
+            }
+            return true;
+        case VENDOR_REQ_TIMING_LOG:
+            if (stage == CONTROL_STAGE_SETUP) {
+                if (request->wValue > 2) {
+                    return false;
+                }
+                timing_request.store(request->wValue + 1);
+                return tud_control_status(rhport, request);
+            }
+            return true;
+        default:
+            return false;   // stall unknown requests
+    }
+}
+
 // Callback for USB Audio Class speaker output (host sending audio data to device).
 // This function is called whenever the host provides new PCM audio samples for output.
 static esp_err_t uac_output_cb(uint8_t *buf, size_t len, void *cb_ctx) {
     // Copy the received audio samples into the ring buffer for the Bluetooth task to consume.
-    if (audio_ringbuf != NULL && buf != NULL && len > 0) {
-        BaseType_t ok = xRingbufferSend(audio_ringbuf, buf, len, 0);
-        if (!ok) {
-            // Ring buffer overflow: not enough space.
-            // Drop the oldest audio data to make room (to avoid stalling the USB host).
-            size_t recv_len;
-            uint8_t *recv_buf = (uint8_t*) xRingbufferReceiveUpTo(audio_ringbuf, &recv_len, 0, len);
-            if (recv_buf != NULL) {
-                vRingbufferReturnItem(audio_ringbuf, recv_buf);
-            }
-            // Try again to push new data after freeing some space
-            xRingbufferSend(audio_ringbuf, buf, len, 0);
-        }
-    }
+    ((AudioBridge*) cb_ctx)->on_usb_packet(buf, len);
     return ESP_OK;  // Indicate that the data has been handled
 }
 
+// Callback for USB Audio Class microphone input (host reading audio data from device).
+// Serves the headset microphone received over HFP, resampled to the USB mic rate.
+static esp_err_t uac_input_cb(uint8_t *buf, size_t len, size_t *bytes_read, void *cb_ctx) {
+    if (!bt_ready()) {
+        // HFP not up yet (the host can open the mic while Bluetooth is still starting).
+        memset(buf, 0, len);
+        *bytes_read = len;
+        return ESP_OK;
+    }
+    *bytes_read = hfp_uplink_read(buf, len);
+    return ESP_OK;
+}
+
 // Callback for USB Audio Class mute control.
 static void uac_device_set_mute_cb(uint32_t mute, void *cb_ctx) {
-    uac_mute_flag = (mute != 0);
-    printf("USB Host set Mute: %s\n", uac_mute_flag ? "ON" : "OFF");
+    ((AudioBridge*) cb_ctx)->set_mute(mute != 0);
+    printf("USB Host set Mute: %s\n", mute ? "ON" : "OFF");
     // If mute is ON, we will drop or silence audio in the BT audio callback.
     // If OFF, we resume normal audio forwarding.
 }
@@ -53,7 +360,7 @@ static void uac_device_set_volume_cb(uint32_t volume, void *cb_ctx) {
     // `volume` is an unsigned value from the host. Typically this might be in percent (0-100)
     // or in some device-specific range (0-255 or 0-127 etc.). We'll handle common ranges.
     printf("USB Host set Volume: %u\n", volume);
-    uac_volume_level = volume;
+    ((AudioBridge*) cb_ctx)->set_volume(volume);
     // Normalize volume to 0-127 range for Bluetooth if needed:contentReference[oaicite:10]{index=10}.
     uint8_t bt_volume = 0;
     if (volume <= 100) {
@@ -73,51 +380,19 @@ static void uac_device_set_volume_cb(uint32_t volume, void *cb_ctx) {
 
 // Bluetooth A2DP data callback: provides audio data to the Bluetooth library when it needs more samples to send.
 int32_t get_bt_audio_data(uint8_t *data, int32_t len) {
-    if (!data || len <= 0) {
-        return 0;
-    }
-    // If muted, output silence.
-    if (uac_mute_flag || uac_volume_level == 0) {
-        memset(data, 0, len);
-        return len;
-    }
-    // Fetch audio from ring buffer
-    size_t bytes_to_read = len;
-    size_t bytes_read = 0;
-    while (bytes_read < len) {
-        size_t chunk_len;
-        uint8_t *chunk = (uint8_t*) xRingbufferReceiveUpTo(audio_ringbuf, &chunk_len, 0, bytes_to_read);
-        if (chunk == NULL) {
-            // No audio available (buffer underrun). If host is still streaming, this could indicate a timing mismatch.
-            // Fill remaining buffer with silence to avoid pops.
-            memset(data + bytes_read, 0, len - bytes_read);
-            bytes_read = len;
-            break;
-        }
-        // Copy the chunk into the output buffer
-        memcpy(data + bytes_read, chunk, chunk_len);
-        bytes_read += chunk_len;
-        bytes_to_read = len - bytes_read;
-        // Return the chunk memory to the ring buffer
-        vRingbufferReturnItem(audio_ringbuf, chunk);
-    }
-    // Apply volume scaling (simple linear scale based on uac_volume_level if it's 1-100).
-    if (uac_volume_level < 100 && uac_volume_level > 0 && bytes_read > 0) {
-        // Scale down the amplitude according to volume percentage.
-        // We interpret uac_volume_level as 0-100.
-        uint16_t *samples = (uint16_t*) data;
-        size_t sample_count = bytes_read / 2;  // number of 16-bit samples
-        for (size_t i = 0; i < sample_count; ++i) {
-            int32_t sample = samples[i];
-            // Apply volume percentage (simple multiplication)
-            sample = (sample * (int)uac_volume_level) / 100;
-            // Clip to 16-bit range just in case
-            if (sample > 32767) sample = 32767;
-            if (sample < -32768) sample = -32768;
-            samples[i] = (int16_t) sample;
-        }
-    }
-    return bytes_read;
+    return bt_bridge->read(data, len);
+}
+
+// HFP SCO downlink: the same stream, pulled by the call's audio link while it is up.
+static int32_t get_sco_audio_data(uint8_t *data, int32_t len) {
+    return bt_bridge->read(data, len, LINK_SCO);
+}
+
+// HFP audio link up/down. The stream moves to the link that is up, with A2DP suspended for
+// the call, and the prompt goes out on it; A2DP is only restarted for it when the call has ended.
+static void hfp_profile_cb(bool sco_up) {
+    bt_bridge->set_sco_active(sco_up);
+    bt_bridge->play_cue(CUE_PROFILE_CHANGE, !sco_up);
 }
 
 // Bluetooth AVRCP passthrough (remote control) callback.
@@ -132,8 +407,10 @@ void avrc_passthru_cb(uint8_t key, bool isReleased) {
         case 0x44: // PLAY pressed:contentReference[oaicite:12]{index=12}
         case 0x46: // PAUSE pressed
             // Toggle pause/play state (in this simple example, just mute/unmute as a "pause")
-            uac_mute_flag = !uac_mute_flag;
-            printf("Toggling pause, mute now: %s\n", uac_mute_flag ? "ON (paused)" : "OFF (playing)");
+            {
+                bool muted = bt_bridge->toggle_mute();
+                printf("Toggling pause, mute now: %s\n", muted ? "ON (paused)" : "OFF (playing)");
+            }
             break;
         case 0x4B: // FORWARD (next track)
             printf("AVRCP: Next track\n");
@@ -153,45 +430,192 @@ void avrc_passthru_cb(uint8_t key, bool isReleased) {
     }
 }
 
+// Bluetooth bring-up, in its own task so it runs alongside the USB stack: NVS, the
+// learned state and the known sinks, then Bluedroid with A2DP and HFP, then the first page.
+// The controller and Bluedroid take a good part of a second; USB enumeration doesn't wait.
+static void bt_bringup_task(void *arg) {
+    int phase = boot_phase_begin("nvs + learned state");
+    bool store_ready = learned_store.init();
+    host_learned_t host_rec;
+    if (store_ready && learned_store.load_host(&host_rec)) {
+        audio_bridge.restore_host(host_rec);
+    }
+    sink_list_t known_sinks;
+    bool have_sinks = store_ready && learned_store.load_sinks(&known_sinks);
+    conn_manager.init(have_sinks ? &known_sinks : nullptr, SINK_NAME);
+    boot_phase_end(phase);
+
+    // Initialize and start the Bluetooth A2DP source
+    // Set up the data callback that provides PCM data to the Bluetooth transmitter:contentReference[oaicite:16]{index=16}.
+    phase = boot_phase_begin("bluetooth a2dp");
+    a2dp_source.set_auto_reconnect(false); // reconnects are paged by the connection manager
+    a2dp_source.set_ssid_callback(a2dp_ssid_cb); // picks the sink when it has to fall back to inquiry
+    a2dp_source.set_stream_reader(nullptr, false); // disable any default I2S output, we handle data manually
+    a2dp_source.set_data_callback(get_bt_audio_data);
+    // Set up remote control (AVRCP) callback to handle play/pause/volume from headphone:contentReference[oaicite:17]{index=17}.
+    a2dp_source.set_avrc_passthru_command_callback(avrc_passthru_cb);
+    // Track stream start/suspend for the silence detector's accounting.
+    a2dp_source.set_on_audio_state_changed(a2dp_audio_state_cb, &audio_bridge);
+    // Flush stale audio and pre-roll on (re)connect.
+    a2dp_source.set_on_connection_state_changed(a2dp_connection_state_cb, &audio_bridge);
+
+    // Start Bluetooth, then page the known sinks directly; inquiry by name (SINK_NAME, set it
+    // to the Bluetooth name of your headset or speaker) only happens if none of them answers.
+    printf("Starting Bluetooth A2DP source, %u known sinks\n", (unsigned) conn_manager.list().count);
+    a2dp_source.start();
+    esp_bt_gap_set_page_timeout(CONN_PAGE_TIMEOUT_SLOTS);   // an absent sink fails over sooner
+    boot_phase_end(phase);
+    // Bring up the HFP Audio Gateway for the microphone uplink (needs Bluedroid, started above).
+    // During a call the SCO downlink takes over the stream from A2DP.
+    phase = boot_phase_begin("bluetooth hfp");
+    hfp_uplink_init(get_sco_audio_data, hfp_profile_cb);
+    boot_phase_end(phase);
+    // Note: The A2DP library will handle Bluetooth initialization and pairing. 
+    // Ensure the headphone is in pairing mode or already bonded.
+
+    portENTER_CRITICAL(&conn_lock);
+    conn_action_t first = conn_manager.start(now_ms());
+    portEXIT_CRITICAL(&conn_lock);
+    run_conn_action(first);
+    printf("Bluetooth A2DP source started. Waiting for headphone connection...\n");
+    xEventGroupSetBits(boot_events, BOOT_BT_READY);
+    vTaskDelete(nullptr);
+}
+
 // The main application entry point (ESP-IDF style)
 extern "C" void app_main(void) {
-    // Create the audio ring buffer to hold PCM data between USB and BT tasks
-    audio_ringbuf = xRingbufferCreate(RINGBUF_SIZE, RINGBUF_TYPE_ALLOWSPLIT);
-    if (audio_ringbuf == NULL) {
+    boot_milestone("app_main");
+    boot_events = xEventGroupCreateStatic(&boot_events_storage);
+    main_task = xTaskGetCurrentTaskHandle();
+    // Set up the audio bridge (ring buffer holding PCM data between USB and BT tasks).
+    // Its storage is static; nothing in the audio path allocates after this point.
+    int phase = boot_phase_begin("audio bridge");
+    // The UAC component's speaker endpoint is adaptive, with no feedback endpoint: no
+    // feedback callback, and the time-stretcher absorbs the clock drift.
+    bool ok = audio_bridge.init(a2dp_media_ctrl);
+    if (!ok) {
         printf("Failed to create audio ring buffer\n");
         return;
     }
+    bt_bridge = &audio_bridge;
+    boot_phase_end(phase);
+
+    // Bluetooth comes up in parallel; everything it calls back into is gated on BOOT_BT_READY
+    // or set up before it starts.
+    if (xTaskCreate(bt_bringup_task, "bt_bringup", BT_BRINGUP_STACK, nullptr, BT_BRINGUP_PRIORITY, nullptr) != pdPASS) {
+        printf("Failed to start Bluetooth bring-up\n");
+        return;
+    }
 
     // Configure the USB UAC device with callbacks:contentReference[oaicite:13]{index=13}:contentReference[oaicite:14]{index=14}.
+    phase = boot_phase_begin("usb uac device");
     uac_device_config_t uac_config = {
         .output_cb = uac_output_cb,             // Speaker output from host
-        .input_cb = NULL,                      // Microphone input not used (NULL to disable):contentReference[oaicite:15]{index=15}
+        .input_cb = uac_input_cb,               // Microphone input to host (headset mic over HFP)
         .set_mute_cb = uac_device_set_mute_cb,  // Mute control callback
         .set_volume_cb = uac_device_set_volume_cb, // Volume control callback
-        .cb_ctx = NULL
+        .cb_ctx = &audio_bridge                 // Handed back to every callback
     };
     if (uac_device_init(&uac_config) != ESP_OK) {
         printf("Failed to initialize USB UAC device\n");
         return;
     }
-    printf("USB Audio device initialized (48kHz stereo speaker)...\n");
+    printf("USB Audio device initialized (48kHz stereo speaker, %dHz microphone)...\n", MIC_USB_SAMPLE_RATE);
+    tud_sof_cb_enable(true);
+    boot_phase_end(phase);
 
-    // Initialize and start the Bluetooth A2DP source
-    // Set up the data callback that provides PCM data to the Bluetooth transmitter:contentReference[oaicite:16]{index=16}.
-    a2dp_source.set_auto_reconnect(true);  // auto-reconnect to headphones if connection drops
-    a2dp_source.set_stream_reader(nullptr, false); // disable any default I2S output, we handle data manually
-    a2dp_source.set_data_callback(get_bt_audio_data);
-    // Set up remote control (AVRCP) callback to handle play/pause/volume from headphone:contentReference[oaicite:17]{index=17}.
-    a2dp_source.set_avrc_passthru_command_callback(avrc_passthru_cb);
+    // Periodically log the pipeline counters.
+    esp_timer_create_args_t stats_timer_args = {};
+    stats_timer_args.callback = stats_timer_cb;
+    stats_timer_args.arg = &audio_bridge;
+    stats_timer_args.name = "audio_stats";
+    esp_timer_handle_t stats_timer;
+    if (esp_timer_create(&stats_timer_args, &stats_timer) == ESP_OK) {
+        esp_timer_start_periodic(stats_timer, (uint64_t)STATS_PERIOD_MS * 1000);
+    }
+    // After connection, the ESP32 will stream audio received via USB to the Bluetooth headphones.
 
-    // Start Bluetooth and attempt to connect to the headphones. 
-    // Replace "MyHeadphones" with the Bluetooth name of your headset or speaker.
-    const char *deviceName = "MyHeadphones";  
-    printf("Starting Bluetooth A2DP source, looking for device \"%s\"...\n", deviceName);
-    a2dp_source.start(deviceName);
-    // Note: The A2DP library will handle Bluetooth initialization and pairing. 
-    // Ensure the headphone is in pairing mode or already bonded.
+    // The main loop drives the connection manager and the store, both Bluetooth-side.
+    xEventGroupWaitBits(boot_events, BOOT_BT_READY, pdFALSE, pdTRUE, portMAX_DELAY);
+    bool trace_printed = false;
 
-    printf("Bluetooth A2DP source started. Waiting for headphone connection...\n");
-    // After connection, the ESP32 will stream audio received via USB to the Bluetooth headphones.
+    // Main loop: connection timeouts, and the learned state kept in flash (periodically,
+    // rate-limited by the store, and as soon as a sink connects or disconnects, which also
+    // wakes it early).
+    for (int64_t last_poll = esp_timer_get_time();;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MAIN_LOOP_MS));
+        // The boot trace, once the host has enumerated us and a sink is connected (or one of
+        // them is clearly not going to happen).
+        const EventBits_t booted = BOOT_USB_MOUNTED | BOOT_SINK_CONNECTED;
+        if (!trace_printed && ((xEventGroupGetBits(boot_events) & booted) == booted ||
+                               esp_timer_get_time() > (int64_t)BOOT_TRACE_WAIT_MS * 1000)) {
+            boot_trace_print();
+            trace_printed = true;
+        }
+        switch (trace_request.exchange(TRACE_REQ_NONE)) {
+            case TRACE_REQ_START:
+                trace_start();
+                printf("Event trace started (%d events)\n", TRACE_EVENTS);
+                break;
+            case TRACE_REQ_DUMP:
+                trace_stop();
+                trace_dump();
+                break;
+            default:
+                break;
+        }
+        uint16_t timing = timing_request.exchange(0);
+        if (timing == 1) {
+            timing_log_stop();
+            timing_log_dump();
+        } else if (timing != 0) {
+            timing_log_start(timing == 3);
+            printf("Timing log started (%d records%s)\n", TIMING_RECORDS, timing == 3 ? ", freezes after a glitch" : "");
+        } else if (timing_log_frozen()) {
+            printf("Timing log frozen %d ms after a glitch\n", TIMING_POST_MS);
+            timing_log_dump();
+        }
+        portENTER_CRITICAL(&conn_lock);
+        conn_action_t action = conn_manager.tick(now_ms());
+        bool list_changed = conn_manager.take_list_changed();
+        sink_list_t list;
+        if (list_changed) list = conn_manager.list();
+        portEXIT_CRITICAL(&conn_lock);
+        run_conn_action(action);
+        if (list_changed) {
+            learned_store.save_sinks(list);
+        }
+        // The previous sink's state is saved before the next one's is loaded.
+        portENTER_CRITICAL(&sink_events_lock);
+        sink_events_t events = sink_events;
+        sink_events = {};
+        portEXIT_CRITICAL(&sink_events_lock);
+        if (events.disconnected) {
+            save_learned(&audio_bridge, true);
+            if (learned_sink_valid && eq_changed_us != 0) {
+                save_eq(&audio_bridge);
+            }
+            learned_sink_valid = false;
+            last_poll = esp_timer_get_time();
+        }
+        if (events.connected) {
+            memcpy(learned_sink_bda, events.bda, sizeof(learned_sink_bda));
+            sink_learned_t rec;
+            audio_bridge.restore_sink(learned_store.load_sink(learned_sink_bda, &rec) ? &rec : nullptr);
+            // A change made while no sink was connected is this sink's now.
+            if (eq_changed_us == 0) {
+                sink_eq_t eq;
+                audio_bridge.restore_eq(learned_store.load_eq(learned_sink_bda, &eq) ? &eq : nullptr);
+            }
+            learned_sink_valid = true;
+        }
+        int64_t eq_changed = eq_changed_us;
+        if (learned_sink_valid && eq_changed != 0 && esp_timer_get_time() - eq_changed >= (int64_t)EQ_SAVE_DELAY_MS * 1000) {
+            save_eq(&audio_bridge);
+        }
+        if (esp_timer_get_time() - last_poll >= (int64_t)LEARNED_POLL_MS * 1000) {
+            save_learned(&audio_bridge, false);
+            last_poll = esp_timer_get_time();
+        }
+    }
 }
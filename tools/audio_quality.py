@@ -0,0 +1,263 @@
+#!/usr/bin/env python3
+"""Audio-quality regression check of the firmware's block processing.
+
+Builds tools/dsp_host.cpp against firmware/src, plays test signals through the real
+AudioBridge (USB packets in, Bluetooth requests out) for each chain below and measures:
+
+    thdn_db             THD+N of a 1 kHz tone at -3 dBFS (everything but the tone)
+    snr_db              the same tone against what is left once its harmonics are removed too
+    passband_ripple_db  spread of a 31-tone multitone's response over 20 Hz - 20 kHz
+    response_db         that response, tone by tone
+    sweep_ripple_db     spread of the 1/3-octave response of a log sweep
+    latency_frames      where an impulse comes out: the ring's jitter depth and the limiter
+                        look-ahead (under time-stretch, less what it caught up)
+
+The results are compared with tools/quality_baseline.json; anything worse than its
+tolerance is a regression and the exit status is 1. Improvements are reported, and
+--update writes the current results as the new baseline.
+
+    python3 tools/audio_quality.py [--chains flat,eq] [--update]
+
+Tones sit on exact multiples of the 5 Hz analysis bin, so every measurement is a plain
+projection over a whole number of periods; no FFT, no numpy.
+"""
+import argparse
+import array
+import json
+import math
+import os
+import random
+import re
+import subprocess
+import sys
+
+from host_build import BRIDGE_FLAGS, BRIDGE_SOURCES, build as host_build
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+BASELINE = os.path.join(HERE, "quality_baseline.json")
+
+RATE = 48000
+LEAD = 12000                # settling time before analysis (250 ms)
+N = 9600                    # analysis window: 200 ms, 5 Hz bins
+TONE_HZ = 1000
+TONE_DBFS = -3.0
+MULTITONE_DBFS = -36.0      # per tone; 31 of them stay well under the limiter ceiling
+SWEEP_S = 2.0
+SWEEP_DBFS = -12.0
+IMPULSE_AT = LEAD
+STRETCH_MARGIN = 2048       # input held in the ring and the time-stretcher beyond what has played
+
+# Chains as dsp_host arguments. The limiter is on by default, as on the device. eq_change
+# turns a treble band over mid-stream through the bridge's update path, before the analysis
+# starts: the response has to be the new band's, with nothing left of the crossfade. Under loudness the auto-gain
+# is still cutting during the analysis, and the tone's THD+N is that slow ramp.
+CHAINS = {
+    "flat": [],
+    "eq": ["--eq", "lowshelf:100:0.7:4", "--eq", "peak:1000:1.4:-6", "--eq", "highshelf:8000:0.7:3"],
+    "eq_change": ["--eq", "peak:8000:2:6", "--eq-at", f"{LEAD / 2 / RATE}:0:peak:8000:2:-6"],
+    "crossfeed": ["--mode", "crossfeed"],
+    "boost": ["--boost-db", "6"],
+    "loudness": ["--loudness", "-18"],
+    "stretch": ["--stretch", "1.02"],
+}
+
+# metric: (tolerance, +1 if higher is worse, -1 if lower is worse, 0 if any change is)
+TOLERANCES = {
+    "thdn_db": (0.5, +1),
+    "snr_db": (0.5, -1),
+    "passband_ripple_db": (0.1, +1),
+    "response_db": (0.1, 0),
+    "sweep_ripple_db": (0.2, +1),
+    "latency_frames": (0, 0),
+}
+
+
+def build():
+    """Path of dsp_host, built with the bridge (see host_build.py)."""
+    return host_build("dsp_host", BRIDGE_SOURCES, BRIDGE_FLAGS)
+
+
+def run(exe, args, left, right=None):
+    """Runs float samples (full scale 1.0) through dsp_host; returns (left, right)."""
+    right = left if right is None else right
+    pcm = array.array("h", (0,) * (2 * len(left)))
+    for i, (l, r) in enumerate(zip(left, right)):
+        pcm[2 * i] = max(-32768, min(32767, round(l * 32767)))
+        pcm[2 * i + 1] = max(-32768, min(32767, round(r * 32767)))
+    # The bridge's log on stderr is only wanted when it fails.
+    out = subprocess.run([exe] + args, input=pcm.tobytes(), stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                         check=True).stdout
+    res = array.array("h")
+    res.frombytes(out)
+    return [v / 32767 for v in res[0::2]], [v / 32767 for v in res[1::2]]
+
+
+def db(x):
+    return 10 * math.log10(max(x, 1e-30))
+
+
+def project(x, hz):
+    """Amplitude of the `hz` component of `x` (len(x) a whole number of its periods)."""
+    w = 2 * math.pi * hz / RATE
+    c = sum(v * math.cos(w * n) for n, v in enumerate(x))
+    s = sum(v * math.sin(w * n) for n, v in enumerate(x))
+    return 2 * math.hypot(c, s) / len(x)
+
+
+def input_frames(args, frames):
+    """Input that lasts for `frames` of output. Under time-stretch the chain consumes
+    `rate` input frames per output frame, so it takes more than `frames`; the rest of the
+    output would be the silence dsp_host pads with once the input runs out."""
+    rate = float(args[args.index("--stretch") + 1]) if "--stretch" in args else 1.0
+    return math.ceil(rate * frames) + STRETCH_MARGIN
+
+
+def tone(hz, dbfs, frames, phase=0.0):
+    a = 10 ** (dbfs / 20)
+    w = 2 * math.pi * hz / RATE
+    return [a * math.sin(w * n + phase) for n in range(frames)]
+
+
+def measure_tone(exe, args):
+    out, _ = run(exe, args, tone(TONE_HZ, TONE_DBFS, input_frames(args, LEAD + N)))
+    x = out[LEAD:LEAD + N]
+    mean = sum(x) / N
+    total = sum(v * v for v in x) / N - mean * mean
+    fundamental = project(x, TONE_HZ) ** 2 / 2
+    harmonics = sum(project(x, h * TONE_HZ) ** 2 / 2 for h in range(2, 11) if h * TONE_HZ < RATE / 2)
+    residual = max(total - fundamental, 0.0)
+    return {
+        "thdn_db": round(db(residual) - db(fundamental), 2),
+        "snr_db": round(db(fundamental) - db(max(residual - harmonics, 0.0)), 2),
+    }
+
+
+def multitone_freqs():
+    freqs = []
+    for k in range(31):
+        hz = 5 * round(20 * 1000 ** (k / 30) / 5)     # log-spaced 20 Hz - 20 kHz on 5 Hz bins
+        if hz not in freqs:
+            freqs.append(hz)
+    return freqs
+
+
+def measure_response(exe, args):
+    freqs = multitone_freqs()
+    rng = random.Random(1)
+    phases = [rng.uniform(0, 2 * math.pi) for _ in freqs]
+    frames = input_frames(args, LEAD + N)
+    signal = [0.0] * frames
+    for hz, ph in zip(freqs, phases):
+        for n, v in enumerate(tone(hz, MULTITONE_DBFS, frames, ph)):
+            signal[n] += v
+    out, _ = run(exe, args, signal)
+    ref = 10 ** (MULTITONE_DBFS / 20)
+    response = [round(20 * math.log10(max(project(out[LEAD:LEAD + N], hz), 1e-9) / ref), 3) for hz in freqs]
+    return {"passband_ripple_db": round(max(response) - min(response), 3), "response_db": response}
+
+
+def measure_impulse(exe, args):
+    signal = [0.0] * input_frames(args, LEAD + N)
+    signal[IMPULSE_AT] = 0.5
+    out, _ = run(exe, args, signal)
+    peak = max(range(len(out)), key=lambda n: abs(out[n]))
+    return {"latency_frames": peak - IMPULSE_AT}
+
+
+def measure_sweep(exe, args, latency):
+    f1, f2 = 20.0, 20000.0
+    frames = int(SWEEP_S * RATE)
+    k = math.log(f2 / f1)
+    a = 10 ** (SWEEP_DBFS / 20)
+    sweep = [a * math.sin(2 * math.pi * f1 * SWEEP_S / k * (math.exp(n / RATE / SWEEP_S * k) - 1))
+             for n in range(frames)]
+    signal = [0.0] * LEAD + sweep + [0.0] * LEAD
+    out, _ = run(exe, args, signal)
+    levels = []
+    for band in range(15, 43):                          # 1/3-octave bands 31.5 Hz - 16 kHz
+        fc = 1000 * 2 ** ((band - 30) / 3)
+        t0 = math.log(fc * 2 ** (-1 / 6) / f1) / k * SWEEP_S
+        t1 = math.log(fc * 2 ** (1 / 6) / f1) / k * SWEEP_S
+        n0, n1 = LEAD + int(t0 * RATE), LEAD + int(t1 * RATE)
+        e_in = sum(v * v for v in signal[n0:n1])
+        e_out = sum(v * v for v in out[n0 + latency:n1 + latency])
+        levels.append(db(e_out) - db(e_in))
+    return {"sweep_ripple_db": round(max(levels) - min(levels), 3)}
+
+
+def measure(exe, args):
+    result = {}
+    result.update(measure_tone(exe, args))
+    result.update(measure_response(exe, args))
+    result.update(measure_impulse(exe, args))
+    result.update(measure_sweep(exe, args, max(result["latency_frames"], 0)))
+    return result
+
+
+def compare(name, now, base):
+    """Returns (regressions, notes) for one chain."""
+    regressions, notes = [], []
+    for metric, (tol, direction) in TOLERANCES.items():
+        if metric not in base:
+            notes.append(f"{name}: {metric} has no baseline")
+            continue
+        if metric == "response_db":
+            worst = max((abs(a - b) for a, b in zip(now[metric], base[metric])), default=0.0)
+            if len(now[metric]) != len(base[metric]) or worst > tol:
+                regressions.append(f"{name}: response moved by up to {worst:.3f} dB (tolerance {tol})")
+            continue
+        delta = now[metric] - base[metric]
+        worse = delta * direction if direction else abs(delta)
+        line = f"{name}: {metric} {base[metric]} -> {now[metric]}"
+        if worse > tol:
+            regressions.append(line + f" (tolerance {tol})")
+        elif direction and -worse > tol:
+            notes.append(line + " (better)")
+    return regressions, notes
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("--chains", default=",".join(CHAINS), help="comma-separated, from: " + ", ".join(CHAINS))
+    ap.add_argument("--baseline", default=BASELINE)
+    ap.add_argument("--update", action="store_true", help="store the results as the baseline")
+    args = ap.parse_args()
+
+    exe = build()
+    baseline = {}
+    if os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+    results, regressions, notes = {}, [], []
+    for name in args.chains.split(","):
+        if name not in CHAINS:
+            sys.exit(f"unknown chain {name}")
+        r = measure(exe, CHAINS[name])
+        results[name] = r
+        print(f"{name:10s} THD+N {r['thdn_db']:7.2f} dB  SNR {r['snr_db']:6.2f} dB  "
+              f"ripple {r['passband_ripple_db']:6.3f} dB  sweep {r['sweep_ripple_db']:6.3f} dB  "
+              f"latency {r['latency_frames']} frames")
+        if name in baseline:
+            reg, note = compare(name, r, baseline[name])
+            regressions += reg
+            notes += note
+        else:
+            notes.append(f"{name}: no baseline")
+    if args.update:
+        baseline.update(results)
+        text = json.dumps(baseline, indent=1, sort_keys=True)
+        # One line per response list keeps the baseline diffable.
+        text = re.sub(r"\[[^\[\]{}]*\]", lambda m: " ".join(m.group(0).split()), text)
+        with open(args.baseline, "w") as f:
+            f.write(text + "\n")
+        print(f"baseline written to {os.path.relpath(args.baseline)}")
+        return
+    for line in notes:
+        print(line)
+    for line in regressions:
+        print("REGRESSION " + line)
+    sys.exit(1 if regressions else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,109 @@
+// Host simulator of the bring-up: runs the firmware's own app_main() (uaca2dp.cpp, with the
+// audio bridge, HFP uplink, learned store, connection manager and boot trace) on threads in
+// real time, against stand-ins for the parts of the boot that take time on the device:
+//
+//     uac_init_ms     uac_device_init(): the TinyUSB driver and its task
+//     enumerate_ms    the USB host, from the device appearing on the bus to it being configured
+//     bt_start_ms     BluetoothA2DPSource::start(): controller, Bluedroid, A2DP and AVRCP
+//     page_ms         the known sink (in NVS from the last boot) answering its page, to A2DP connected
+//
+// The USB host sends SOFs from the moment the device is on the bus, as a real one does
+// during enumeration. The firmware prints its boot trace once it is enumerated and the sink
+// is connected; tools/host_tests.py reads the per-phase timing from it.
+//
+//     boot_sim uac_init_ms enumerate_ms bt_start_ms page_ms
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "tusb.h"
+#include "usb_device_uac.h"
+#include "BluetoothA2DPSource.h"
+#include "connection_manager.h"
+#include "learned_store.h"
+
+#define TIMEOUT_MS          10000   // give up on the boot after this long
+#define TRACE_WAIT_MS       300     // the main loop prints the trace within MAIN_LOOP_MS (100 ms)
+
+extern "C" void app_main(void);
+
+static const uint8_t KNOWN_SINK[6] = { 0x00, 0x1b, 0x66, 0x00, 0x00, 0x01 };
+static std::atomic<bool> sink_connected{false};
+
+static void sleep_ms(int ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// Callbacks reach the firmware from the stack's tasks, which the boot trace names.
+static void as_task(const char *name) {
+    host_task_self = new host_task_t;
+    host_task_self->name = name;
+}
+
+// The last boot connected to KNOWN_SINK, so it is paged first.
+static void seed_nvs() {
+    ConnectionManager last_boot;
+    last_boot.init(nullptr, "");
+    last_boot.on_connected(KNOWN_SINK, 0);
+    LearnedStore store;
+    store.init();
+    store.save_sinks(last_boot.list());
+}
+
+static void usb_host(int enumerate_ms) {
+    as_task("TinyUSB");
+    while (!host_uac_ready) sleep_ms(1);
+    int64_t configured_us = esp_timer_get_time() + (int64_t) enumerate_ms * 1000;
+    for (uint32_t frame = 0;; frame = (frame + 1) & 0x7ff) {
+        if (!host_usb_mounted && esp_timer_get_time() >= configured_us) host_usb_mounted = true;
+        if (host_usb_sof) tud_sof_cb(frame);
+        sleep_ms(1);
+    }
+}
+
+static void sink(int page_ms) {
+    as_task("BTC_TASK");
+    while (host_a2dp_pages == 0) sleep_ms(1);
+    sleep_ms(page_ms);
+    if (memcmp(host_a2dp_paged, KNOWN_SINK, sizeof(KNOWN_SINK)) != 0) {
+        printf("paged a sink that is not the known one\n");
+        return;
+    }
+    memcpy(host_a2dp_peer, KNOWN_SINK, sizeof(KNOWN_SINK));
+    host_a2dp_connection_cb(ESP_A2D_CONNECTION_STATE_CONNECTED, host_a2dp_connection_obj);
+    sink_connected = true;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 5) {
+        fprintf(stderr, "usage: %s uac_init_ms enumerate_ms bt_start_ms page_ms\n", argv[0]);
+        return 2;
+    }
+    host_uac_init_ms = atoi(argv[1]);
+    int enumerate_ms = atoi(argv[2]);
+    host_a2dp_start_ms = atoi(argv[3]);
+    int page_ms = atoi(argv[4]);
+
+    seed_nvs();
+    host_wall_clock = true;     // power-on
+    std::thread(usb_host, enumerate_ms).detach();
+    std::thread(sink, page_ms).detach();
+    std::thread(app_main).detach();
+
+    int waited = 0;
+    while (!(host_usb_mounted && sink_connected) && waited < TIMEOUT_MS) {
+        sleep_ms(10);
+        waited += 10;
+    }
+    sleep_ms(TRACE_WAIT_MS);
+    fflush(stdout);
+    // The firmware's tasks never return: leave without running destructors under them.
+    _exit(host_usb_mounted && sink_connected ? 0 : 1);
+}
@@ -0,0 +1,181 @@
+// Host simulator of the USB -> Bluetooth pipeline: replays a timeline of USB packets and
+// Bluetooth requests through the real AudioBridge in simulated time and prints what it
+// counted as JSON. The packets carry a tone unless the timeline says they are silent.
+//
+// Events come on stdin, one per line as "t_us side frames", in time order. Sides:
+//
+//     usb         a USB packet of `frames` frames of the tone
+//     silence     a USB packet of `frames` frames of digital silence
+//     bt          a Bluetooth request for `frames` frames
+//     disconnect  the sink goes away (frames ignored)
+//     connect     it comes back (frames ignored)
+//
+// The sink starts connected. It only makes its requests while it is connected and the bridge
+// has the media stream running: the timeline's requests that fall in a silence suspend or a
+// disconnect are the encoder and radio work saved, and are counted instead of made.
+//
+// The bridge's settings are its compile-time ones; tools/pipeline_sim.py builds one
+// executable per setting it tries (-DRINGBUF_SIZE=... and so on) and drives it.
+//
+//     bridge_sim [--feedback] < events.txt
+//
+// --feedback runs the bridge with a feedback callback, as it would be with an asynchronous
+// OUT endpoint and its feedback endpoint. Nobody follows it: the packet sizes are the
+// timeline's, which already says how well the host tracks the device.
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "esp_timer.h"
+#include "audio_bridge.h"
+
+#define START_US            1000000 // the bridge's clock at the first event
+#define TONE_HZ             440
+#define TONE_LEVEL          8000
+
+static AudioBridge bridge;
+static bool media_running = true;
+static bool media_restarted = false;    // the sink reports the restart at the next event
+
+static void feedback_ignored(uint32_t) {}
+
+static void media_ctrl(bool start) {
+    media_restarted = start && !media_running;
+    media_running = start;
+}
+
+// Host CPU time spent in the bridge, per producer path or per request. A queued packet that
+// had to push old audio out is counted apart: it is what every packet would cost with
+// nobody reading the ring.
+enum { PATH_OVERFLOW = PRODUCER_PATH_COUNT, PATH_COUNT };
+
+struct cost_t {
+    uint64_t calls = 0;
+    double ns = 0;
+
+    template <typename F> void time(F f) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        calls++;
+    }
+    double mean() const { return calls ? ns / calls : 0.0; }
+};
+
+int main(int argc, char **argv) {
+    bool feedback = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--feedback") == 0) {
+            feedback = true;
+        } else {
+            fprintf(stderr, "usage: bridge_sim [--feedback] < events\n");
+            return 2;
+        }
+    }
+
+    host_time_us = START_US;
+    if (!bridge.init(media_ctrl, feedback ? feedback_ignored : nullptr)) {
+        fprintf(stderr, "bridge_sim: init failed\n");
+        return 1;
+    }
+    bool connected = true;
+    bridge.on_connection_state(ESP_A2D_CONNECTION_STATE_CONNECTED);
+
+    std::vector<int16_t> buf;
+    std::vector<uint32_t> latency_us;      // ring fill after each request while streaming
+    std::vector<double> first_audio_ms;    // connect to the first block of the stream (not a prompt)
+    long long connect_us = -1;             // timeline time of the last connect
+    bool awaiting_audio = true;
+    cost_t usb_cost[PATH_COUNT], bt_cost;
+    uint32_t overflows = 0;
+    uint64_t sent = 0, bt_skipped = 0;
+    double stretch_ms = 0;
+    long long first_us = -1, last_us = 0;
+    long long t_us;
+    char side[16];
+    unsigned frames;
+    while (scanf("%lld %15s %u", &t_us, side, &frames) == 3) {
+        if (first_us < 0) first_us = connect_us = t_us;
+        last_us = t_us;
+        host_time_us = START_US + (t_us - first_us);
+        if (media_restarted) {
+            media_restarted = false;
+            bridge.on_audio_state(ESP_A2D_AUDIO_STATE_STARTED);
+        }
+        buf.resize(frames * AUDIO_CHANNELS);
+        bool silence = strcmp(side, "silence") == 0;
+        if (silence || strcmp(side, "usb") == 0) {
+            for (unsigned i = 0; i < frames; ++i, ++sent) {
+                int16_t v = silence ? 0 : (int16_t) lrint(TONE_LEVEL * sin(2 * M_PI * TONE_HZ * (double) sent / AUDIO_SAMPLE_RATE));
+                buf[i * 2] = buf[i * 2 + 1] = v;
+            }
+            bool was_connected = connected;
+            cost_t cost;
+            cost.time([&] { bridge.on_usb_packet((const uint8_t*) buf.data(), frames * AUDIO_FRAME_BYTES); });
+            int path = !was_connected ? PRODUCER_NO_SINK : media_running ? PRODUCER_QUEUED : PRODUCER_SUSPENDED;
+            if (path == PRODUCER_QUEUED) {
+                audio_stats_t s;
+                bridge.get_stats(&s);
+                if (s.overflows != overflows) path = PATH_OVERFLOW;
+                overflows = s.overflows;
+            }
+            usb_cost[path].calls++;
+            usb_cost[path].ns += cost.ns;
+            continue;
+        }
+        if (strcmp(side, "disconnect") == 0 || strcmp(side, "connect") == 0) {
+            connected = side[0] == 'c';
+            bridge.on_connection_state(connected ? ESP_A2D_CONNECTION_STATE_CONNECTED
+                                                 : ESP_A2D_CONNECTION_STATE_DISCONNECTED);
+            connect_us = t_us;
+            awaiting_audio = connected;
+            // The library restarts the media with the connection.
+            media_running = connected;
+            continue;
+        }
+        if (!connected || !media_running) {
+            bt_skipped++;
+            continue;
+        }
+        bt_cost.time([&] { bridge.read((uint8_t*) buf.data(), frames * AUDIO_FRAME_BYTES); });
+        audio_stats_t s;
+        bridge.get_stats(&s);
+        if (awaiting_audio && s.state == PIPE_STREAMING) {
+            first_audio_ms.push_back((t_us - connect_us) / 1000.0);
+            awaiting_audio = false;
+        }
+        if (s.state == PIPE_STREAMING) {
+            latency_us.push_back(s.ring_latency_us);
+            if (s.stretch_rate != 1.0f) stretch_ms += frames * 1000.0 / AUDIO_SAMPLE_RATE;
+        }
+    }
+
+    // The bridge logs to stdout as well; the result is the last line.
+    audio_stats_t s;
+    bridge.get_stats(&s);
+    printf("{\"underruns\": %u, \"overflows\": %u, \"splices\": %u, \"host_starts\": %u, \"host_stops\": %u, "
+           "\"stretch_ms\": %.1f, \"duration_ms\": %.1f, \"suspends\": %u, \"suspended_ms\": %.1f, "
+           "\"bt_requests\": %llu, \"bt_skipped\": %llu, \"bt_read_ns\": %.1f, "
+           "\"usb_packets\": {\"no_sink\": %llu, \"suspended\": %llu, \"queued\": %llu, \"overflow\": %llu}, "
+           "\"usb_packet_ns\": {\"no_sink\": %.1f, \"suspended\": %.1f, \"queued\": %.1f, \"overflow\": %.1f}, "
+           "\"first_audio_ms\": [",
+           (unsigned) s.underruns, (unsigned) s.overflows, (unsigned) s.splices, (unsigned) s.host_starts,
+           (unsigned) s.host_stops, stretch_ms, first_us < 0 ? 0.0 : (last_us - first_us) / 1000.0,
+           (unsigned) s.suspends, s.suspended_us / 1000.0,
+           (unsigned long long) bt_cost.calls, (unsigned long long) bt_skipped, bt_cost.mean(),
+           (unsigned long long) usb_cost[PRODUCER_NO_SINK].calls, (unsigned long long) usb_cost[PRODUCER_SUSPENDED].calls,
+           (unsigned long long) usb_cost[PRODUCER_QUEUED].calls, (unsigned long long) usb_cost[PATH_OVERFLOW].calls,
+           usb_cost[PRODUCER_NO_SINK].mean(), usb_cost[PRODUCER_SUSPENDED].mean(), usb_cost[PRODUCER_QUEUED].mean(),
+           usb_cost[PATH_OVERFLOW].mean());
+    for (size_t i = 0; i < first_audio_ms.size(); ++i) {
+        printf(i ? ", %.1f" : "%.1f", first_audio_ms[i]);
+    }
+    printf("], \"latency_us\": [");
+    for (size_t i = 0; i < latency_us.size(); ++i) {
+        printf(i ? ", %u" : "%u", (unsigned) latency_us[i]);
+    }
+    printf("]}\n");
+    return 0;
+}
@@ -0,0 +1,511 @@
+// Host test of AudioBridge: drives the real pipeline in simulated time through the
+// stand-ins in tools/host, with a USB packet every millisecond while the host streams
+// and a Bluetooth block whenever the sink's clock says one is due.
+//
+// Built and run by tools/host_tests.py.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <vector>
+#include "esp_timer.h"
+#include "esp_hf_ag_api.h"
+#include "audio_bridge.h"
+#include "hfp_uplink.h"
+
+#define PACKET_FRAMES       48
+#define BLOCK_FRAMES        SBC_FRAME_SAMPLES
+#define BLOCK_US            (BLOCK_FRAMES * 1e6 / AUDIO_SAMPLE_RATE)
+#define LEVEL               1000    // every sample the host sends, well above the silence threshold
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        failures++; \
+    } \
+} while (0)
+
+// Heap allocations made from inside a bridge call; the audio path must not make any.
+static bool in_bridge = false;
+static int bridge_allocations = 0;
+
+void *operator new(size_t size) {
+    if (in_bridge) bridge_allocations++;
+    void *p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+static_assert(alignof(AudioBridge) >= CACHE_LINE_SIZE, "producer and consumer fields share a cache line");
+
+// One bridge with its host and sink.
+struct rig_t {
+    AudioBridge *bridge;
+    bool host_streaming = false;
+    int16_t level = LEVEL;
+    float tone_hz = 0;              // 0: every sample is `level`, else a sine of that amplitude
+    uint32_t sent = 0;              // frames the host has sent
+    double next_block_us = 0;
+    double block_us = BLOCK_US;     // the sink's clock
+    std::vector<int16_t> out;       // left channel of everything the sink received
+};
+
+static void connect(rig_t *rig) {
+    if (!rig->bridge->init()) {
+        printf("FAIL init\n");
+        failures++;
+    }
+    rig->bridge->on_connection_state(ESP_A2D_CONNECTION_STATE_CONNECTED);
+    rig->next_block_us = (double) host_time_us;
+}
+
+// Advances the clock by `ms`, running every rig's host and sink.
+static void run_ms(rig_t *rigs, int count, int ms) {
+    for (int t = 0; t < ms; ++t) {
+        host_time_us += 1000;
+        for (int r = 0; r < count; ++r) {
+            rig_t &rig = rigs[r];
+            if (rig.host_streaming) {
+                int16_t packet[PACKET_FRAMES * 2];
+                for (int i = 0; i < PACKET_FRAMES; ++i, ++rig.sent) {
+                    float v = rig.tone_hz == 0 ? rig.level :
+                              rig.level * sinf(2 * (float) M_PI * rig.tone_hz * rig.sent / AUDIO_SAMPLE_RATE);
+                    packet[i * 2] = packet[i * 2 + 1] = (int16_t) lrintf(v);
+                }
+                in_bridge = true;
+                rig.bridge->on_usb_packet((const uint8_t*) packet, sizeof(packet));
+                in_bridge = false;
+            }
+            while (rig.next_block_us <= host_time_us) {
+                int16_t block[BLOCK_FRAMES * 2];
+                in_bridge = true;
+                rig.bridge->read((uint8_t*) block, sizeof(block));
+                in_bridge = false;
+                for (int i = 0; i < BLOCK_FRAMES; ++i) rig.out.push_back(block[i * 2]);
+                rig.next_block_us += rig.block_us;
+            }
+        }
+    }
+}
+
+static audio_stats_t stats(const rig_t &rig) {
+    audio_stats_t s;
+    rig.bridge->get_stats(&s);
+    return s;
+}
+
+// Frames at the end of the sink's output that are exactly `value`.
+static size_t tail_at(const rig_t &rig, int16_t value) {
+    size_t n = 0;
+    while (n < rig.out.size() && rig.out[rig.out.size() - 1 - n] == value) n++;
+    return n;
+}
+
+// Positive samples in the sink's output from `from` on.
+static size_t positive_from(const rig_t &rig, size_t from) {
+    size_t n = 0;
+    for (size_t i = from; i < rig.out.size(); ++i) n += rig.out[i] > 0;
+    return n;
+}
+
+// Host opens the stream, plays, and closes it with alt setting 0.
+static void test_open_close() {
+    static AudioBridge bridge;
+    rig_t rig = { &bridge };
+    connect(&rig);
+    run_ms(&rig, 1, 500);           // the connect prompt plays over silence
+    CHECK(stats(rig).state == PIPE_IDLE, "state %s", AudioBridge::state_name(stats(rig).state));
+    CHECK(stats(rig).splices == 0, "splices %u with no audio yet", (unsigned) stats(rig).splices);
+
+    bridge.on_alt_setting(1);
+    CHECK(stats(rig).state == PIPE_PRIMING, "state %s", AudioBridge::state_name(stats(rig).state));
+    rig.host_streaming = true;
+    run_ms(&rig, 1, 10);
+    CHECK(stats(rig).state == PIPE_PRIMING, "primes before releasing audio");
+    run_ms(&rig, 1, 490);
+    audio_stats_t s = stats(rig);
+    CHECK(s.state == PIPE_STREAMING, "state %s", AudioBridge::state_name(s.state));
+    CHECK(s.host_starts == 1, "host_starts %u", (unsigned) s.host_starts);
+    CHECK(s.underruns == 0, "underruns %u", (unsigned) s.underruns);
+    CHECK(s.splices == 0, "splices %u from priming", (unsigned) s.splices);
+    CHECK(tail_at(rig, LEVEL) > 10 * BLOCK_FRAMES, "host audio reaches the sink");
+
+    bridge.on_alt_setting(0);
+    rig.host_streaming = false;
+    CHECK(stats(rig).state == PIPE_DRAINING, "state %s", AudioBridge::state_name(stats(rig).state));
+    run_ms(&rig, 1, 100);
+    s = stats(rig);
+    CHECK(s.state == PIPE_IDLE, "drained, state %s", AudioBridge::state_name(s.state));
+    CHECK(s.host_stops == 1, "host_stops %u", (unsigned) s.host_stops);
+    CHECK(s.underruns == 0, "the end of the stream is not an underrun: %u", (unsigned) s.underruns);
+    CHECK(s.ring_latency_us == 0, "ring empty, %u us left", (unsigned) s.ring_latency_us);
+    CHECK(s.splices == 1, "splices %u: only the end of the stream fades out", (unsigned) s.splices);
+    CHECK(tail_at(rig, 0) > 10 * BLOCK_FRAMES, "silence once drained");
+}
+
+// Host stops sending without closing the alt setting: the packet cadence ends the stream.
+static void test_packets_stop() {
+    static AudioBridge bridge;
+    rig_t rig = { &bridge };
+    connect(&rig);
+    run_ms(&rig, 1, 500);
+    rig.host_streaming = true;      // no alt setting change at all
+    run_ms(&rig, 1, 500);
+    CHECK(stats(rig).state == PIPE_STREAMING, "state %s", AudioBridge::state_name(stats(rig).state));
+
+    rig.host_streaming = false;
+    run_ms(&rig, 1, USB_STREAM_TIMEOUT_MS + 5);
+    audio_stats_t s = stats(rig);
+    CHECK(s.state == PIPE_DRAINING || s.state == PIPE_IDLE, "state %s", AudioBridge::state_name(s.state));
+    CHECK(s.host_stops == 1, "host_stops %u", (unsigned) s.host_stops);
+    run_ms(&rig, 1, 100);
+    s = stats(rig);
+    CHECK(s.state == PIPE_IDLE, "state %s", AudioBridge::state_name(s.state));
+    // The ring holds STREAM_PRIME_MS and the timeout is longer, so the last few blocks
+    // before the timeout do run dry; nothing after it may count.
+    uint32_t before = s.underruns;
+    run_ms(&rig, 1, 1000);
+    CHECK(stats(rig).underruns == before, "underruns kept counting while idle: %u -> %u",
+          (unsigned) before, (unsigned) stats(rig).underruns);
+
+    // The host comes back: a new stream, primed again.
+    rig.host_streaming = true;
+    run_ms(&rig, 1, 1);
+    s = stats(rig);
+    CHECK(s.state == PIPE_PRIMING, "state %s", AudioBridge::state_name(s.state));
+    CHECK(s.host_starts == 2, "host_starts %u", (unsigned) s.host_starts);
+    run_ms(&rig, 1, 300);
+    CHECK(stats(rig).state == PIPE_STREAMING, "state %s", AudioBridge::state_name(stats(rig).state));
+}
+
+// Closing and reopening before the ring has drained: the new stream starts from an empty ring.
+static void test_reopen_flushes() {
+    static AudioBridge bridge;
+    rig_t rig = { &bridge };
+    connect(&rig);
+    run_ms(&rig, 1, 500);
+    bridge.on_alt_setting(1);
+    rig.host_streaming = true;
+    run_ms(&rig, 1, 500);
+    CHECK(stats(rig).ring_latency_us > 0, "audio queued");
+
+    bridge.on_alt_setting(0);
+    rig.host_streaming = false;
+    run_ms(&rig, 1, 2);             // still draining
+    CHECK(stats(rig).state == PIPE_DRAINING, "state %s", AudioBridge::state_name(stats(rig).state));
+    bridge.on_alt_setting(1);
+    audio_stats_t s = stats(rig);
+    CHECK(s.state == PIPE_PRIMING, "state %s", AudioBridge::state_name(s.state));
+    CHECK(s.ring_latency_us == 0, "stale audio left in the ring: %u us", (unsigned) s.ring_latency_us);
+    CHECK(s.host_starts == 2, "host_starts %u", (unsigned) s.host_starts);
+
+    rig.level = -LEVEL;
+    rig.host_streaming = true;
+    run_ms(&rig, 1, 500);
+    CHECK(tail_at(rig, -LEVEL) > 10 * BLOCK_FRAMES, "new stream reaches the sink");
+    CHECK(stats(rig).underruns == 0, "underruns %u", (unsigned) stats(rig).underruns);
+    // The old stream fades out before priming; none of it may come back after the silence.
+    size_t first = rig.out.size() - tail_at(rig, -LEVEL);
+    size_t from = first > 200 ? first - 200 : 0;
+    CHECK(positive_from(rig, from) == 0, "%u frames of the old stream after the new one's priming",
+          (unsigned) positive_from(rig, from));
+}
+
+// Mute and unmute: nothing from before the mute is played after it.
+static void test_unmute_plays_no_stale_audio() {
+    static AudioBridge bridge;
+    rig_t rig = { &bridge };
+    connect(&rig);
+    bridge.on_alt_setting(1);
+    rig.host_streaming = true;
+    run_ms(&rig, 1, 500);
+    bridge.set_mute(true);
+    run_ms(&rig, 1, 100);
+    rig.level = -LEVEL;             // by the unmute the ring holds only this
+    run_ms(&rig, 1, 200);
+    size_t from = rig.out.size();
+    bridge.set_mute(false);
+    run_ms(&rig, 1, 100);
+    CHECK(positive_from(rig, from) == 0, "%u frames from before the mute played after it",
+          (unsigned) positive_from(rig, from));
+    CHECK(tail_at(rig, -LEVEL) > 10 * BLOCK_FRAMES, "unmuted");
+}
+
+// With the limiter off, boosting past unity and back must neither click nor move the audio:
+// the limiter's delay stays in the path throughout.
+static void test_gain_crosses_unity() {
+    static AudioBridge bridge;
+    rig_t rig = { &bridge };
+    rig.level = 8000;
+    rig.tone_hz = 100;
+    connect(&rig);
+    bridge.set_limiter(false, -1.0f, 0);
+    bridge.on_alt_setting(1);
+    rig.host_streaming = true;
+    run_ms(&rig, 1, 500);
+    uint32_t latency = stats(rig).dsp_latency_us;
+    size_t from = rig.out.size();
+    bridge.set_boost_db(3.0f);
+    run_ms(&rig, 1, 200);
+    CHECK(stats(rig).dsp_latency_us == latency, "DSP latency %u -> %u us", (unsigned) latency,
+          (unsigned) stats(rig).dsp_latency_us);
+    bridge.set_boost_db(0.0f);
+    run_ms(&rig, 1, 200);
+    CHECK(stats(rig).dsp_latency_us == latency, "DSP latency %u -> %u us", (unsigned) latency,
+          (unsigned) stats(rig).dsp_latency_us);
+    // A 100 Hz sine at 8000 * 1.41 moves at most ~150 per sample.
+    int worst = 0;
+    for (size_t i = from + 1; i < rig.out.size(); ++i) {
+        int step = abs(rig.out[i] - rig.out[i - 1]);
+        if (step > worst) worst = step;
+    }
+    CHECK(worst < 250, "discontinuity of %d crossing unity gain", worst);
+    CHECK(stats(rig).underruns == 0, "underruns %u", (unsigned) stats(rig).underruns);
+}
+
+// A close with nothing streaming, or repeated opens, changes nothing.
+static void test_redundant_alt_settings() {
+    static AudioBridge bridge;
+    rig_t rig = { &bridge };
+    connect(&rig);
+    bridge.on_alt_setting(0);
+    CHECK(stats(rig).state == PIPE_IDLE, "state %s", AudioBridge::state_name(stats(rig).state));
+    CHECK(stats(rig).host_stops == 0, "host_stops %u", (unsigned) stats(rig).host_stops);
+    bridge.on_alt_setting(1);
+    rig.host_streaming = true;
+    run_ms(&rig, 1, 100);
+    bridge.on_alt_setting(1);
+    CHECK(stats(rig).state == PIPE_STREAMING, "a second open restarted the stream");
+    CHECK(stats(rig).host_starts == 1, "host_starts %u", (unsigned) stats(rig).host_starts);
+}
+
+// The stats log only reads the windowed counters; each side restarts its own at its next
+// packet or block, and until then they read as zero.
+static void test_stats_window() {
+    static AudioBridge bridge;
+    rig_t rig = { &bridge };
+    connect(&rig);
+    bridge.on_alt_setting(1);
+    rig.host_streaming = true;
+    run_ms(&rig, 1, 300);
+    audio_stats_t s = stats(rig);
+    CHECK(s.max_packet_gap_us >= 1000, "max packet gap %u us", (unsigned) s.max_packet_gap_us);
+    CHECK(s.stages[PROFILE_BT_READ].count > 0 && s.stages[PROFILE_USB_PACKET].count > 0, "nothing profiled");
+
+    bridge.print_stats();
+    s = stats(rig);
+    CHECK(s.max_packet_gap_us == 0, "max packet gap %u us after the log", (unsigned) s.max_packet_gap_us);
+    CHECK(s.stages[PROFILE_BT_READ].count == 0 && s.stages[PROFILE_USB_PACKET].count == 0,
+          "%u blocks, %u packets after the log", (unsigned) s.stages[PROFILE_BT_READ].count,
+          (unsigned) s.stages[PROFILE_USB_PACKET].count);
+
+    run_ms(&rig, 1, 10);
+    s = stats(rig);
+    CHECK(s.stages[PROFILE_USB_PACKET].count == 10, "%u packets in 10 ms", (unsigned) s.stages[PROFILE_USB_PACKET].count);
+    CHECK(s.stages[PROFILE_BT_READ].count >= 3 && s.stages[PROFILE_BT_READ].count <= 4,
+          "%u blocks in 10 ms", (unsigned) s.stages[PROFILE_BT_READ].count);
+    CHECK(s.max_packet_gap_us == 1000, "max packet gap %u us", (unsigned) s.max_packet_gap_us);
+}
+
+// Bands the EQ cannot design stably are refused.
+static void test_eq_band_rejected() {
+    static AudioBridge bridge;
+    bridge.init();
+    eq_band_t band = { EQ_PEAK, 3, 1000.0f, 6.0f, 1.0f };
+    CHECK(bridge.set_eq_band(0, band), "valid band refused");
+    band.freq = 30000.0f;
+    CHECK(!bridge.set_eq_band(1, band), "band above Nyquist accepted");
+    band.freq = 1000.0f;
+    band.q = 0.0f;
+    CHECK(!bridge.set_eq_band(1, band), "band with Q 0 accepted");
+    band.q = 1.0f;
+    CHECK(!bridge.set_eq_band(EQ_MAX_BANDS, band), "band index past the end accepted");
+}
+
+// A new sink starts from its restored record, or the defaults, never from what was measured
+// on the previous one.
+static void test_new_sink_forgets_jitter() {
+    static AudioBridge bridge;
+    rig_t rig = { &bridge };
+    connect(&rig);
+    bridge.on_alt_setting(1);
+    rig.host_streaming = true;
+    run_ms(&rig, 1, 8000);          // JITTER_MIN_SAMPLES blocks and then some
+    sink_learned_t rec;
+    CHECK(bridge.learned_sink(&rec), "nothing learned after 8 s of streaming");
+
+    bridge.restore_sink(nullptr);   // a sink never seen before
+    run_ms(&rig, 1, 10);
+    CHECK(!bridge.learned_sink(&rec), "the previous sink's measurements carried over");
+    CHECK(stats(rig).jitter_us == 0, "burst lead %u us carried over", (unsigned) stats(rig).jitter_us);
+    CHECK(stats(rig).depth_ms == STREAM_PRIME_MS, "depth %u ms", (unsigned) stats(rig).depth_ms);
+
+    sink_learned_t known = { 1, 25, 20000, 0.0f };
+    bridge.restore_sink(&known);    // a sink seen before
+    run_ms(&rig, 1, 10);
+    CHECK(stats(rig).depth_ms == 25, "restored depth overridden: %u ms", (unsigned) stats(rig).depth_ms);
+    CHECK(!bridge.learned_sink(&rec), "the previous sink's measurements carried over");
+}
+
+// Several bridges in one process, each with its own host and sink: nothing may leak from
+// one to another, and none of them allocates once init() has run.
+static void test_several_bridges() {
+    static AudioBridge bridges[3];
+    rig_t rigs[3] = { { &bridges[0] }, { &bridges[1] }, { &bridges[2] } };
+    for (int r = 0; r < 3; ++r) {
+        connect(&rigs[r]);
+        rigs[r].level = (int16_t)(LEVEL * (r + 1));
+        rigs[r].block_us = BLOCK_US * (1.0 + (r - 1) * 100e-6);   // sinks at -100, 0 and +100 ppm
+        rigs[r].next_block_us += r * 700.0;
+    }
+    bridges[2].set_volume(50);
+    run_ms(rigs, 3, 500);
+    for (int r = 0; r < 3; ++r) rigs[r].host_streaming = true;
+    int allocations = bridge_allocations;
+    run_ms(rigs, 3, 2000);
+    CHECK(bridge_allocations == allocations, "%d heap allocations in the audio path", bridge_allocations - allocations);
+    for (int r = 0; r < 3; ++r) {
+        int16_t expect = r == 2 ? rigs[r].level / 2 : rigs[r].level;
+        CHECK(tail_at(rigs[r], expect) > 100 * BLOCK_FRAMES, "bridge %d: sink does not get its own host's audio", r);
+        CHECK(stats(rigs[r]).state == PIPE_STREAMING, "bridge %d: state %s", r, AudioBridge::state_name(stats(rigs[r]).state));
+    }
+
+    // One host goes away; the others carry on.
+    rigs[1].host_streaming = false;
+    run_ms(rigs, 3, 200);
+    for (int r = 0; r < 3; ++r) {
+        audio_stats_t s = stats(rigs[r]);
+        CHECK(s.state == (r == 1 ? PIPE_IDLE : PIPE_STREAMING), "bridge %d: state %s", r, AudioBridge::state_name(s.state));
+        CHECK(s.host_stops == (r == 1 ? 1u : 0u), "bridge %d: host_stops %u", r, (unsigned) s.host_stops);
+        CHECK(s.underruns == 0 || r == 1, "bridge %d: underruns %u", r, (unsigned) s.underruns);
+    }
+    CHECK(tail_at(rigs[1], 0) > 10 * BLOCK_FRAMES, "bridge 1 silent once its host stopped");
+}
+
+// A call: the headset's SCO link takes the stream over from A2DP and echoes it back into its
+// microphone. A2DP is suspended and gets nothing while the call lasts; the USB host sees its
+// own audio come back on the mic, and the round trip is what a call adds to it.
+static AudioBridge *sco_bridge;
+static bool media_running = true;
+
+static void sco_media_ctrl(bool start) {
+    media_running = start;
+}
+
+static int32_t sco_downlink(uint8_t *data, int32_t len) {
+    in_bridge = true;
+    int32_t got = sco_bridge->read(data, len, LINK_SCO);
+    in_bridge = false;
+    return got;
+}
+
+static void sco_profile_changed(bool sco_up) {
+    sco_bridge->set_sco_active(sco_up);
+    sco_bridge->play_cue(CUE_PROFILE_CHANGE, !sco_up);
+}
+
+static void headset_event(esp_hf_cb_event_t event, int state) {
+    esp_hf_cb_param_t param = {};
+    if (event == ESP_HF_CONNECTION_STATE_EVT) {
+        param.conn_stat.state = (esp_hf_connection_state_t) state;
+    } else {
+        param.audio_stat.state = (esp_hf_audio_state_t) state;
+    }
+    host_hf_event_cb(event, &param);
+}
+
+// The headset serves each data-ready tick with one mSBC packet (7.5 ms at 16 kHz) and sends
+// the same audio straight back.
+static void headset_echo() {
+    host_run_timers();
+    for (; host_hf_data_ready > 0; --host_hf_data_ready) {
+        uint8_t packet[120 * 2];
+        uint32_t got = host_hf_outgoing_cb(packet, sizeof(packet));
+        if (got) host_hf_incoming_cb(packet, got);
+    }
+}
+
+static void test_sco_loopback() {
+    static AudioBridge bridge;
+    sco_bridge = &bridge;
+    rig_t rig = { &bridge };
+    if (!bridge.init(sco_media_ctrl)) {
+        printf("FAIL init\n");
+        failures++;
+    }
+    bridge.on_connection_state(ESP_A2D_CONNECTION_STATE_CONNECTED);
+    rig.next_block_us = (double) host_time_us;
+    hfp_uplink_init(sco_downlink, sco_profile_changed);
+    rig.host_streaming = true;
+    run_ms(&rig, 1, 300);
+
+    // The host opens the mic: the SCO link comes up on demand and takes the stream.
+    int16_t mic[MIC_USB_SAMPLE_RATE / 1000 * MIC_USB_CHANNELS];
+    headset_event(ESP_HF_CONNECTION_STATE_EVT, ESP_HF_CONNECTION_STATE_SLC_CONNECTED);
+    hfp_uplink_read((uint8_t*) mic, sizeof(mic));
+    CHECK(host_hf_audio_connects == 1, "%d SCO connects requested", host_hf_audio_connects);
+    headset_event(ESP_HF_AUDIO_STATE_EVT, ESP_HF_AUDIO_STATE_CONNECTED_MSBC);
+    CHECK(!media_running, "A2DP media still running during the call");
+    audio_stats_t before = stats(rig);
+    size_t a2dp_from = rig.out.size();
+
+    // A step in the host's level, after the profile prompt has played, timed on the way back.
+    const int step_ms = 1000;
+    int echo_ms = -1;
+    for (int t = 0; t < 2000; ++t) {
+        if (t == step_ms) rig.level = 8 * LEVEL;
+        run_ms(&rig, 1, 1);     // the A2DP callbacks still arriving
+        headset_echo();
+        hfp_uplink_read((uint8_t*) mic, sizeof(mic));
+        for (size_t i = 0; i < sizeof(mic) / sizeof(mic[0]) && t >= step_ms && echo_ms < 0; ++i) {
+            if (mic[i] > 9 * LEVEL / 2) echo_ms = t;
+        }
+    }
+    int round_trip_ms = echo_ms - step_ms;
+    printf("SCO loopback: round trip %d ms\n", round_trip_ms);
+    CHECK(echo_ms >= 0, "the host's audio never came back on the mic");
+    CHECK(round_trip_ms <= STREAM_PRIME_MS + 20, "round trip %d ms", round_trip_ms);
+    audio_stats_t during = stats(rig);
+    uplink_stats_t up;
+    hfp_uplink_get_stats(&up);
+    CHECK(positive_from(rig, a2dp_from) == 0, "A2DP got audio while SCO owned the stream");
+    CHECK(during.underruns == before.underruns, "%u underruns during the call",
+          (unsigned) (during.underruns - before.underruns));
+    CHECK(up.frames_dropped == 0, "%u mic frames dropped", (unsigned) up.frames_dropped);
+
+    // The call ends: A2DP is restarted and gets the stream back.
+    headset_event(ESP_HF_AUDIO_STATE_EVT, ESP_HF_AUDIO_STATE_DISCONNECTED);
+    CHECK(media_running, "A2DP media not restarted after the call");
+    run_ms(&rig, 1, 1000);
+    CHECK(tail_at(rig, rig.level) > 100 * BLOCK_FRAMES, "A2DP did not get the stream back (%zu frames)", tail_at(rig, rig.level));
+}
+
+int main() {
+    host_time_us = 1000000;
+    test_open_close();
+    test_packets_stop();
+    test_reopen_flushes();
+    test_redundant_alt_settings();
+    test_unmute_plays_no_stale_audio();
+    test_gain_crosses_unity();
+    test_new_sink_forgets_jitter();
+    test_eq_band_rejected();
+    test_stats_window();
+    test_several_bridges();
+    test_sco_loopback();
+    printf("bridge_test: %d failures\n", failures);
+    return failures ? 1 : 0;
+}
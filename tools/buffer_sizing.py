@@ -0,0 +1,209 @@
+#!/usr/bin/env python3
+"""Monte Carlo sizing of the ring buffer and jitter depth.
+
+Each trial draws a random host/sink pairing from a profile (USB arrival jitter and
+scheduling stalls, Bluetooth burst size, burst jitter and radio stalls, clock offsets),
+generates its packet and request timeline, and runs that same timeline through the
+firmware's AudioBridge (pipeline_sim) for every ring size and depth in the grid. The table
+gives, per profile, the probability that a trial sees an underrun or an overflow and the
+ring latency it ran at, plus the setting with the lowest latency that keeps both under
+--target. A depth of "auto" leaves the jitter depth to the firmware, which starts at
+STREAM_PRIME_MS and follows the sink once it has measured it.
+
+    python3 tools/buffer_sizing.py --trials 2000 --ring-kb 8,12,16 --depth-ms auto,10,15,20,25,32
+
+See pipeline_sim for what the simulation leaves out; the timelines are only as good as
+the profiles, so check them against timing logs from real hosts and sinks
+(timing_replay.py --csv) before trusting a default.
+"""
+import argparse
+import multiprocessing
+import multiprocessing.pool
+import random
+import sys
+from dataclasses import dataclass, replace
+
+from pipeline_sim import BT, SAMPLE_RATE, USB, Config, build, simulate
+
+BT_BLOCK_FRAMES = 128       # one SBC frame's worth per request
+
+
+@dataclass
+class Profile:
+    """Ranges the trials are drawn from. Times in microseconds unless noted."""
+    usb_jitter_us: float            # sigma of the packet arrival delay
+    usb_stall_rate: float           # host scheduling stalls per second
+    usb_stall_ms: float             # mean stall length; held packets then arrive together
+    bt_burst_blocks: tuple          # requests per burst, drawn per trial
+    bt_jitter_us: float             # sigma of the burst start
+    bt_stall_rate: float            # radio stalls (retransmissions) per second
+    bt_stall_ms: float              # mean stall length; the sink then catches up
+    clock_ppm: float                # host and sink crystals within +- this
+    feedback: bool                  # host follows the async feedback
+    feedback_residual_ppm: float = 5.0  # drift left over when it does
+
+
+PROFILES = {
+    "typical": Profile(usb_jitter_us=50, usb_stall_rate=0.0, usb_stall_ms=0,
+                       bt_burst_blocks=(2, 4), bt_jitter_us=1000, bt_stall_rate=0.05, bt_stall_ms=10,
+                       clock_ppm=100, feedback=True),
+    "bursty-sink": Profile(usb_jitter_us=50, usb_stall_rate=0.0, usb_stall_ms=0,
+                           bt_burst_blocks=(4, 8), bt_jitter_us=3000, bt_stall_rate=0.2, bt_stall_ms=20,
+                           clock_ppm=100, feedback=True),
+    "busy-host": Profile(usb_jitter_us=300, usb_stall_rate=0.2, usb_stall_ms=5,
+                         bt_burst_blocks=(2, 4), bt_jitter_us=1000, bt_stall_rate=0.05, bt_stall_ms=10,
+                         clock_ppm=100, feedback=True),
+    "no-feedback": Profile(usb_jitter_us=50, usb_stall_rate=0.0, usb_stall_ms=0,
+                           bt_burst_blocks=(2, 4), bt_jitter_us=1000, bt_stall_rate=0.05, bt_stall_ms=10,
+                           clock_ppm=100, feedback=False),
+}
+
+
+def stall_times(rng, rate, mean_ms, duration_us):
+    """Random (start, end) stalls in device microseconds."""
+    stalls, t = [], 0.0
+    while rate > 0:
+        t += rng.expovariate(rate) * 1e6
+        if t >= duration_us:
+            break
+        stalls.append((t, t + rng.expovariate(1.0 / mean_ms) * 1000))
+    return stalls
+
+
+def hold(times, stalls):
+    """Delays whatever falls inside a stall to its end, keeping the order."""
+    out, i = [], 0
+    for t in times:
+        while i < len(stalls) and stalls[i][1] <= t:
+            i += 1
+        if i < len(stalls) and stalls[i][0] <= t:
+            t = stalls[i][1]
+        out.append(t)
+    return out
+
+
+def timeline(profile, duration_s, seed):
+    """One trial's USB packets and Bluetooth requests as (t_us, side, frames) in time order."""
+    rng = random.Random(seed)
+    duration_us = duration_s * 1e6
+    sink_ppm = rng.uniform(-profile.clock_ppm, profile.clock_ppm)
+    if profile.feedback:
+        drift_ppm = rng.gauss(0, profile.feedback_residual_ppm)
+    else:
+        drift_ppm = rng.uniform(-profile.clock_ppm, profile.clock_ppm) - sink_ppm
+    consumer_rate = SAMPLE_RATE * (1 + sink_ppm * 1e-6)
+    producer_rate = consumer_rate * (1 + drift_ppm * 1e-6)
+
+    # USB: a packet per host millisecond, 48 or 49 frames, arriving a little late.
+    times, frames, acc = [], [], 0.0
+    t = 0.0
+    while t < duration_us:
+        acc += producer_rate / 1000
+        n = int(acc)
+        acc -= n
+        times.append(t + abs(rng.gauss(0, profile.usb_jitter_us)))
+        frames.append(n)
+        t += 1000
+    times = hold(sorted(times), stall_times(rng, profile.usb_stall_rate, profile.usb_stall_ms, duration_us))
+    events = [(int(t), USB, n) for t, n in zip(times, frames)]
+
+    # Bluetooth: bursts of blocks on the sink's clock, jittered, with radio stalls.
+    blocks = rng.choice(profile.bt_burst_blocks)
+    period_us = blocks * BT_BLOCK_FRAMES / consumer_rate * 1e6
+    starts, t = [], period_us
+    while t < duration_us:
+        starts.append(t + abs(rng.gauss(0, profile.bt_jitter_us)))
+        t += period_us
+    starts = hold(sorted(starts), stall_times(rng, profile.bt_stall_rate, profile.bt_stall_ms, duration_us))
+    for s in starts:
+        events += [(int(s) + k * 20, BT, BT_BLOCK_FRAMES) for k in range(blocks)]
+    events.sort(key=lambda e: e[0])
+    return events
+
+
+def run_trial(job):
+    profile_name, duration_s, seed, configs = job
+    events = timeline(PROFILES[profile_name], duration_s, seed)
+    out = []
+    for cfg in configs:
+        r = simulate(events, cfg)
+        out.append((r.underruns, r.overflows, r.latency_percentile(0.5), r.latency_percentile(0.99)))
+    return out
+
+
+def percentile(values, fraction):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))] if ordered else 0.0
+
+
+def parse_list(text):
+    return [float(v) for v in text.split(",")]
+
+
+def parse_depths(text):
+    return [None if v == "auto" else int(v) for v in text.split(",")]
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("--profiles", default=",".join(PROFILES), help="comma-separated, from: " + ", ".join(PROFILES))
+    ap.add_argument("--trials", type=int, default=200)
+    ap.add_argument("--duration-s", type=float, default=10.0, help="simulated time per trial")
+    ap.add_argument("--ring-kb", type=parse_list, default=[8, 12, 16])
+    ap.add_argument("--depth-ms", type=parse_depths, default=[None, 10, 15, 20, 25, 32],
+                    help="jitter depths, or auto for the firmware's")
+    ap.add_argument("--stretch", choices=("on", "off"), default="on")
+    ap.add_argument("--target", type=float, default=0.01, help="acceptable P(underrun) and P(overflow)")
+    ap.add_argument("--seed", type=int, default=1)
+    ap.add_argument("--csv", help="also write the table here")
+    args = ap.parse_args()
+
+    names = args.profiles.split(",")
+    for name in names:
+        if name not in PROFILES:
+            sys.exit(f"unknown profile {name}")
+    grid = [Config(ring_bytes=int(kb * 1024), depth_ms=depth, stretch=args.stretch == "on")
+            for kb in args.ring_kb for depth in args.depth_ms]
+    # The bridge is built once per setting, in parallel, before the trials share it.
+    configs = {name: [replace(cfg, feedback=PROFILES[name].feedback) for cfg in grid] for name in names}
+    with multiprocessing.pool.ThreadPool() as threads:
+        threads.map(build, set(cfg for name in names for cfg in configs[name]))
+    csv = open(args.csv, "w") if args.csv else None
+    if csv:
+        csv.write("profile,ring_kb,depth_ms,p_underrun,p_overflow,underruns_per_min,latency_p50_ms,latency_p99_ms\n")
+
+    with multiprocessing.Pool() as pool:
+        for name in names:
+            jobs = [(name, args.duration_s, args.seed * 1000003 + i, configs[name]) for i in range(args.trials)]
+            trials = pool.map(run_trial, jobs, chunksize=max(1, args.trials // (4 * multiprocessing.cpu_count())))
+            print(f"\n{name}: {args.trials} trials of {args.duration_s:.0f} s, stretch {args.stretch}")
+            print(f"{'ring':>6} {'depth':>6} {'P(under)':>9} {'P(over)':>8} {'under/min':>9} {'lat p50':>8} {'p99':>6}")
+            best = None
+            for c, cfg in enumerate(configs[name]):
+                runs = [t[c] for t in trials]
+                p_under = sum(1 for r in runs if r[0] > 0) / len(runs)
+                p_over = sum(1 for r in runs if r[1] > 0) / len(runs)
+                per_min = sum(r[0] for r in runs) / (len(runs) * args.duration_s / 60)
+                p50 = percentile([r[2] for r in runs], 0.5)
+                p99 = percentile([r[3] for r in runs], 0.99)
+                kb = cfg.ring_bytes / 1024
+                depth = "auto" if cfg.depth_ms is None else f"{cfg.depth_ms}ms"
+                print(f"{kb:4.0f}KB {depth:>6} {p_under:9.3f} {p_over:8.3f} {per_min:9.2f} "
+                      f"{p50:6.1f}ms {p99:4.1f}ms")
+                if csv:
+                    csv.write(f"{name},{kb:g},{depth.rstrip('ms')},{p_under:.4f},{p_over:.4f},{per_min:.3f},{p50:.2f},{p99:.2f}\n")
+                # Lowest latency first, then the smaller ring.
+                if p_under <= args.target and p_over <= args.target:
+                    if best is None or (p50, cfg.ring_bytes) < best[:2]:
+                        best = (p50, cfg.ring_bytes, depth)
+            if best:
+                print(f"lowest latency within {args.target:g}: RINGBUF_SIZE {best[1] // 1024} KB, "
+                      f"depth {best[2]}")
+            else:
+                print(f"nothing in the grid within {args.target:g}")
+    if csv:
+        csv.close()
+
+
+if __name__ == "__main__":
+    main()
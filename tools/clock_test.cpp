@@ -0,0 +1,247 @@
+// Host test of the clock recovery: RateFeedback closing the loop with a host that follows
+// its 10.14 value, at host and sink clock offsets either side of nominal, for the fill it
+// settles at and how close the feedback gets to the sink's rate; its saturation; and the
+// 16.16 / 10.14 encodings. ClockEstimator on SOF and packet timestamps from a host clock
+// a known ppm off, with Gaussian latency jitter, missed SOFs and 44/45-frame packets: the
+// error of its estimates, whether their standard errors cover it, and how long it takes to
+// settle and lock.
+//
+// Built and run by tools/host_tests.py.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "clock_estimator.h"
+#include "rate_feedback.h"
+
+#define SAMPLE_RATE         48000
+#define BLOCK_FRAMES        128     // what the A2DP encoder takes per callback
+#define TARGET_FILL         480     // frames: the jitter depth the fill error is taken against
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        failures++; \
+    } \
+} while (0)
+
+struct loop_result_t {
+    double worst_fill_error;        // frames, over the last `settled_s`
+    double feedback_error;          // frames per host frame against the sink's rate, at the end
+    double settle_s;                // last time the fill error was outside SETTLED_FRAMES
+    bool saturated;
+};
+
+#define SETTLED_FRAMES      48      // one USB frame of audio
+
+// The host sends what the 10.14 feedback asks for every USB frame of its clock, `host_ppm`
+// off the device's; the sink takes BLOCK_FRAMES blocks at `sink_ppm` off nominal. Runs for
+// `seconds` of device time, the last `settled_s` of which count for the fill.
+static loop_result_t run_loop(double host_ppm, double sink_ppm, double seconds, double settled_s,
+                              bool host_frame_known = false) {
+    RateFeedback fb;
+    fb.init(SAMPLE_RATE);
+    double host_frame_us = 1000.0 / (1 + host_ppm * 1e-6);
+    if (host_frame_known) fb.set_host_frame_us(host_frame_us);
+    double block_us = BLOCK_FRAMES * 1e6 / (SAMPLE_RATE * (1 + sink_ppm * 1e-6));
+    double fill = TARGET_FILL, owed = 0, next_frame_us = 0, next_block_us = block_us;
+    loop_result_t r = { 0, 0, 0, false };
+    while (next_frame_us < seconds * 1e6) {
+        if (next_frame_us <= next_block_us) {
+            owed += fb.value_10_14() / 16384.0;
+            double frames = floor(owed);
+            owed -= frames;
+            fill += frames;
+            next_frame_us += host_frame_us;
+            continue;
+        }
+        fill -= BLOCK_FRAMES;
+        double error = fill - TARGET_FILL;
+        fb.update(BLOCK_FRAMES, (int64_t) next_block_us, (int32_t) lrint(error));
+        if (next_block_us > (seconds - settled_s) * 1e6) r.worst_fill_error = fmax(r.worst_fill_error, fabs(error));
+        if (fabs(error) > SETTLED_FRAMES) r.settle_s = next_block_us / 1e6;
+        next_block_us += block_us;
+    }
+    double ideal = SAMPLE_RATE * (1 + sink_ppm * 1e-6) * host_frame_us / 1e6;
+    r.feedback_error = fb.frames_per_ms() - ideal;
+    r.saturated = fb.saturated();
+    return r;
+}
+
+// Host and sink offsets within the feedback's range: the host ends up sending at the sink's
+// rate (to within about 40 ppm) and the fill holds within a USB frame of the target.
+static void test_loop() {
+    const double hosts[] = { 0, 100, -250, 300 };
+    const double sinks[] = { 0, 200, -200 };
+    for (double host : hosts) {
+        for (double sink : sinks) {
+            loop_result_t r = run_loop(host, sink, 600, 300);
+            printf("host %+4.0f ppm, sink %+4.0f ppm: fill within %.1f frames after %.0f s, "
+                   "feedback %+.5f frames/ms off\n", host, sink, r.worst_fill_error, r.settle_s, r.feedback_error);
+            CHECK(r.worst_fill_error < SETTLED_FRAMES, "host %+.0f ppm, sink %+.0f ppm: fill off by %.1f frames",
+                  host, sink, r.worst_fill_error);
+            CHECK(fabs(r.feedback_error) < 0.002, "host %+.0f ppm, sink %+.0f ppm: feedback %+.5f frames/ms off",
+                  host, sink, r.feedback_error);
+            CHECK(!r.saturated, "host %+.0f ppm, sink %+.0f ppm: saturated", host, sink);
+        }
+    }
+}
+
+// With the host's USB frame known (the SOF clock estimate locked) the rate term is exact and
+// the PI only sees the sink's block quantization: the fill settles no later than without it.
+static void test_host_frame_known() {
+    loop_result_t blind = run_loop(300, -200, 600, 300);
+    loop_result_t known = run_loop(300, -200, 600, 300, true);
+    printf("host +300 ppm, sink -200 ppm: settled after %.0f s, %.0f s with the host frame known\n",
+           blind.settle_s, known.settle_s);
+    CHECK(known.worst_fill_error < SETTLED_FRAMES, "fill off by %.1f frames", known.worst_fill_error);
+    CHECK(known.settle_s <= blind.settle_s, "%.0f s against %.0f s", known.settle_s, blind.settle_s);
+}
+
+// Beyond FEEDBACK_MAX_PPM the feedback pins at its limit and says so.
+static void test_saturation() {
+    loop_result_t r = run_loop(1500, 0, 60, 10);
+    CHECK(r.saturated, "host +1500 ppm not reported as saturated");
+    CHECK(r.feedback_error > 0.01, "feedback %+.5f frames/ms off, past its limit", r.feedback_error);
+    double limit = SAMPLE_RATE / 1000.0 * (1 - FEEDBACK_MAX_PPM * 1e-6);
+    RateFeedback fb;
+    fb.init(SAMPLE_RATE);
+    fb.seed_consumer(-5000);
+    CHECK(fabs(fb.frames_per_ms() - limit) < 1e-9, "seeded -5000 ppm: %.6f frames/ms, limit %.6f",
+          fb.frames_per_ms(), limit);
+}
+
+// 16.16 and 10.14 round to nearest, and 10.14 fits the 3-byte full-speed feedback word.
+static void test_encoding() {
+    RateFeedback fb;
+    fb.init(SAMPLE_RATE);
+    CHECK(fb.value_16_16() == 48u << 16, "nominal 16.16 0x%08x", (unsigned) fb.value_16_16());
+    CHECK(fb.value_10_14() == 48u << 14, "nominal 10.14 0x%06x", (unsigned) fb.value_10_14());
+    const float ppms[] = { 1, -1, 37.5f, 100, -250, 999, -999 };
+    for (float ppm : ppms) {
+        fb.seed_consumer(ppm);
+        double v = fb.frames_per_ms();
+        CHECK(fabs(fb.value_16_16() / 65536.0 - v) <= 0.5 / 65536, "%+.1f ppm: 16.16 0x%08x for %.8f", ppm,
+              (unsigned) fb.value_16_16(), v);
+        CHECK(fabs(fb.value_10_14() / 16384.0 - v) <= 0.5 / 16384, "%+.1f ppm: 10.14 0x%06x for %.8f", ppm,
+              (unsigned) fb.value_10_14(), v);
+        CHECK(fb.value_10_14() < 1u << 24, "%+.1f ppm: 10.14 0x%08x", ppm, (unsigned) fb.value_10_14());
+    }
+    // At 48 frames/ms a 16.16 step is 0.32 ppm and a 10.14 step 1.27 ppm.
+    fb.seed_consumer(1);
+    CHECK(fb.value_16_16() == (48u << 16) + 3, "+1 ppm: 16.16 0x%08x", (unsigned) fb.value_16_16());
+    CHECK(fb.value_10_14() == (48u << 14) + 1, "+1 ppm: 10.14 0x%06x", (unsigned) fb.value_10_14());
+    fb.seed_consumer(-100);
+    CHECK(fb.value_16_16() == (48u << 16) - 315, "-100 ppm: 16.16 0x%08x", (unsigned) fb.value_16_16());
+    CHECK(fb.value_10_14() == (48u << 14) - 79, "-100 ppm: 10.14 0x%06x", (unsigned) fb.value_10_14());
+}
+
+// Standard normal deviate (Box-Muller on rand(), so a seed repeats a run).
+static double gauss() {
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0), v = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+struct estimate_result_t {
+    double error_ppm;               // of the last estimate
+    double stderr_ppm;              // what the estimator says that error is
+    double settle_s;                // last time an estimate was outside the tolerance
+    double lock_s;                  // first time it reported lock, -1 never
+    bool locked;                    // at the end
+};
+
+#define ESTIMATE_TOLERANCE_PPM 1.0
+
+// Feeds `seconds` of a host clock `host_ppm` off the device's into a ClockEstimator: an SOF
+// every host millisecond (`missed` of them never calling back) and, for a stream at
+// `sample_rate`, a packet per millisecond with the whole frames due by then (44 or 45 at
+// 44.1 kHz). Every timestamp lands `jitter_us` (standard deviation) either side of the event
+// and is whole microseconds, as esp_timer_get_time() gives it.
+static void run_estimator(double host_ppm, double jitter_us, double missed, uint32_t sample_rate,
+                          double seconds, estimate_result_t *sof, estimate_result_t *stream) {
+    static unsigned runs = 0;
+    ClockEstimator clock;
+    clock.init(sample_rate);
+    srand(++runs);
+    *sof = { 0, 0, 0, -1, false };
+    *stream = { 0, 0, 0, -1, false };
+    double host_frame_us = 1000.0 / (1 + host_ppm * 1e-6);
+    uint64_t sent = 0;
+    for (uint32_t frame = 1; frame * host_frame_us < seconds * 1e6; ++frame) {
+        double t = frame * host_frame_us;
+        if (rand() >= missed * RAND_MAX) {
+            clock.on_sof(frame & 0x7FF, (int64_t) llrint(t + jitter_us * gauss()));
+        }
+        uint64_t due = (uint64_t) frame * sample_rate / 1000;
+        clock.on_packet((uint32_t)(due - sent), (int64_t) llrint(t + jitter_us * gauss()));
+        sent = due;
+        if (fabs(clock.host_ppm() - host_ppm) > ESTIMATE_TOLERANCE_PPM) sof->settle_s = t / 1e6;
+        if (fabs(clock.stream_ppm() - host_ppm) > ESTIMATE_TOLERANCE_PPM) stream->settle_s = t / 1e6;
+        if (sof->lock_s < 0 && clock.host_locked()) sof->lock_s = t / 1e6;
+        if (stream->lock_s < 0 && clock.stream_locked()) stream->lock_s = t / 1e6;
+    }
+    *sof = { clock.host_ppm() - host_ppm, clock.host_ppm_error(), sof->settle_s, sof->lock_s, clock.host_locked() };
+    *stream = { clock.stream_ppm() - host_ppm, clock.stream_ppm_error(), stream->settle_s, stream->lock_s,
+                clock.stream_locked() };
+}
+
+// With callback jitter up to 50 us both estimates settle within a ppm of the truth in the
+// ~8 s it takes to fill the window, lock, and have a standard error that covers the error.
+static void test_estimator() {
+    const double hosts[] = { 0, 80, -250, 500 };
+    const double jitters[] = { 5, 20, 50 };
+    const uint32_t rates[] = { 48000, 44100 };
+    for (double host : hosts) {
+        for (double jitter : jitters) {
+            for (uint32_t rate : rates) {
+                estimate_result_t sof, stream;
+                run_estimator(host, jitter, 0.01, rate, 20, &sof, &stream);
+                printf("host %+4.0f ppm, jitter %2.0f us, %u Hz: SOF %+.3f ppm (stderr %.3f) settled %.1f s "
+                       "locked %.1f s; packets %+.3f ppm (stderr %.3f) settled %.1f s locked %.1f s\n",
+                       host, jitter, (unsigned) rate, sof.error_ppm, sof.stderr_ppm, sof.settle_s, sof.lock_s,
+                       stream.error_ppm, stream.stderr_ppm, stream.settle_s, stream.lock_s);
+                const estimate_result_t *both[] = { &sof, &stream };
+                for (const estimate_result_t *r : both) {
+                    const char *what = r == &sof ? "SOF" : "packets";
+                    CHECK(fabs(r->error_ppm) < ESTIMATE_TOLERANCE_PPM, "host %+.0f ppm, jitter %.0f us, %u Hz: "
+                          "%s off by %+.3f ppm", host, jitter, (unsigned) rate, what, r->error_ppm);
+                    CHECK(fabs(r->error_ppm) < 4 * r->stderr_ppm + 0.01, "host %+.0f ppm, jitter %.0f us, %u Hz: "
+                          "%s off by %+.3f ppm, stderr %.3f", host, jitter, (unsigned) rate, what, r->error_ppm,
+                          r->stderr_ppm);
+                    CHECK(r->settle_s < 10, "host %+.0f ppm, jitter %.0f us, %u Hz: %s settled after %.1f s", host,
+                          jitter, (unsigned) rate, what, r->settle_s);
+                    CHECK(r->locked && r->lock_s < 10, "host %+.0f ppm, jitter %.0f us, %u Hz: %s locked at %.1f s",
+                          host, jitter, (unsigned) rate, what, r->lock_s);
+                }
+            }
+        }
+    }
+}
+
+// Jitter far beyond a callback's latency: the estimate may wander, but it must not claim lock
+// while it is more than a ppm out.
+static void test_estimator_noisy() {
+    estimate_result_t sof, stream;
+    run_estimator(120, 2000, 0.05, 48000, 20, &sof, &stream);
+    printf("host +120 ppm, jitter 2000 us: SOF %+.3f ppm (stderr %.3f)%s; packets %+.3f ppm (stderr %.3f)%s\n",
+           sof.error_ppm, sof.stderr_ppm, sof.locked ? " locked" : "", stream.error_ppm, stream.stderr_ppm,
+           stream.locked ? " locked" : "");
+    CHECK(!sof.locked || fabs(sof.error_ppm) < ESTIMATE_TOLERANCE_PPM, "SOF locked %+.3f ppm off", sof.error_ppm);
+    CHECK(!stream.locked || fabs(stream.error_ppm) < ESTIMATE_TOLERANCE_PPM, "packets locked %+.3f ppm off",
+          stream.error_ppm);
+}
+
+int main() {
+    test_loop();
+    test_host_frame_known();
+    test_saturation();
+    test_encoding();
+    test_estimator();
+    test_estimator_noisy();
+    printf("clock_test: %d failures\n", failures);
+    return failures ? 1 : 0;
+}
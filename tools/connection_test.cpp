@@ -0,0 +1,366 @@
+// Host test of sink selection: ConnectionManager driven by a stand-in Bluetooth stack with
+// sinks that are switched on or off. Paging the last-used sink on boot, moving on to the next
+// known one when it doesn't answer, falling back to an inquiry (for the configured name or
+// any known sink, ignoring strangers), starting over when the link drops, and the order of
+// the list as sinks connect, including a full one. The time to audio from power-on is
+// reported per phase (failed pages, inquiry, the connect that worked, media start) and
+// compared with an inquiry by name on every boot.
+//
+// Built and run by tools/host_tests.py.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "connection_manager.h"
+
+#define MAIN_LOOP_MS        100     // uaca2dp.cpp: the main loop ticks the manager this often
+#define BT_READY_MS         900     // power-on to the stack taking commands (Bluedroid, A2DP, HFP)
+#define PAGE_SCAN_MS        1280    // sinks scan for pages every 1.28 s (R1)
+#define INQUIRY_SCAN_MS     2560    // a sink answers an inquiry within two train switches
+#define NAME_REQUEST_MS     150     // remote name request after an inquiry result
+#define ACL_SETUP_MS        60      // page answered to ACL link up
+#define PROFILE_SETUP_MS    450     // SDP, AVDTP discover / get capabilities / set config / open
+#define MEDIA_START_MS      150     // AVDTP start, the first media packet
+#define PAGE_TIMEOUT_MS     (CONN_PAGE_TIMEOUT_SLOTS * 5 / 8)
+#define TRIALS              200
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        failures++; \
+    } \
+} while (0)
+
+struct sink_t {
+    uint8_t bda[6];
+    const char *name;
+    bool on;
+};
+
+static sink_t make_sink(uint8_t id, const char *name, bool on) {
+    sink_t s = { { 0x00, 0x1b, 0x66, 0x00, 0x00, id }, name, on };
+    return s;
+}
+
+// Where the time to audio went, in ms from power-on.
+struct timing_t {
+    uint32_t failed_pages_ms = 0;   // pages nobody answered, up to their timeout
+    uint32_t inquiry_ms = 0;        // inquiry until the wanted sink was found
+    uint32_t connect_ms = 0;        // from the page (or inquiry result) that worked to A2DP connected
+    uint32_t audio_ms = 0;          // power-on to the first media packet, 0 = never
+    int pages = 0;
+    int inquiries = 0;
+    uint8_t connected[6] = {};
+};
+
+// The stack's side of things: a page either connects after the sink's next page scan or
+// times out in the controller and ends in a disconnect; an inquiry reports every powered
+// sink with its name after its next inquiry scan, and connecting to a result skips the page
+// scan wait (the clock offset is known). Events are delivered as the real callbacks
+// deliver them, the timeouts through the main loop's tick.
+class StandInStack {
+public:
+    StandInStack(const std::vector<sink_t> &sinks) : sinks(sinks) {}
+
+    timing_t boot(ConnectionManager *cm, uint32_t limit_ms) {
+        timing_t t;
+        uint32_t now = BT_READY_MS;
+        act(cm->start(now), now, &t);
+        for (; now < limit_ms && t.audio_ms == 0; ++now) {
+            step(cm, now, &t);
+        }
+        return t;
+    }
+
+    // Runs the stack and the main loop's tick for 1 ms at `now`.
+    void step(ConnectionManager *cm, uint32_t now, timing_t *t) {
+        if (now % MAIN_LOOP_MS == 0) {
+            act(cm->tick(now), now, t);
+        }
+        if (connect_at && now >= connect_at) {
+            connect_at = 0;
+            t->connect_ms = now - attempt_start;
+            memcpy(t->connected, target, 6);
+            act(cm->on_connected(target, now), now, t);
+            audio_at = now + MEDIA_START_MS;
+        }
+        if (fail_at && now >= fail_at) {
+            fail_at = 0;
+            t->failed_pages_ms += now - attempt_start;
+            act(cm->on_disconnected(now), now, t);
+        }
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (inquiring && now >= results[i].first) {
+                const sink_t &s = sinks[results[i].second];
+                results.erase(results.begin() + i--);
+                if (cm->on_discovered(s.name, s.bda, now)) {
+                    inquiring = false;
+                    results.clear();
+                    t->inquiry_ms += now - inquiry_start;
+                    attempt_start = now;
+                    memcpy(target, s.bda, 6);
+                    connect_at = now + ACL_SETUP_MS + PROFILE_SETUP_MS;
+                }
+            }
+        }
+        if (audio_at && now >= audio_at) {
+            audio_at = 0;
+            t->audio_ms = now;
+        }
+    }
+
+    // The link drops (the sink was switched off or walked away).
+    void drop(ConnectionManager *cm, uint32_t now, timing_t *t) {
+        audio_at = 0;
+        act(cm->on_disconnected(now), now, t);
+    }
+
+    std::vector<sink_t> sinks;
+
+private:
+    void act(const conn_action_t &a, uint32_t now, timing_t *t) {
+        if (a.type == CONN_ACT_PAGE) {
+            if (inquiring) t->inquiry_ms += now - inquiry_start;
+            inquiring = false;
+            results.clear();
+            t->pages++;
+            attempt_start = now;
+            memcpy(target, a.bda, 6);
+            const sink_t *s = find(a.bda);
+            if (s != nullptr && s->on) {
+                connect_at = now + rand() % PAGE_SCAN_MS + ACL_SETUP_MS + PROFILE_SETUP_MS;
+            } else {
+                fail_at = now + PAGE_TIMEOUT_MS;
+            }
+        } else if (a.type == CONN_ACT_DISCOVER) {
+            if (inquiring) t->inquiry_ms += now - inquiry_start;
+            t->inquiries++;
+            inquiring = true;
+            inquiry_start = now;
+            results.clear();
+            for (size_t i = 0; i < sinks.size(); ++i) {
+                if (sinks[i].on) results.push_back({ now + rand() % INQUIRY_SCAN_MS + NAME_REQUEST_MS, i });
+            }
+        }
+    }
+
+    const sink_t *find(const uint8_t bda[6]) const {
+        for (const sink_t &s : sinks) {
+            if (memcmp(s.bda, bda, 6) == 0) return &s;
+        }
+        return nullptr;
+    }
+
+    uint32_t connect_at = 0, fail_at = 0, audio_at = 0, attempt_start = 0, inquiry_start = 0;
+    bool inquiring = false;
+    uint8_t target[6] = {};
+    std::vector<std::pair<uint32_t, size_t>> results;   // (reported at, sink)
+};
+
+// A list of known sinks, most recently used first.
+static sink_list_t known(const std::vector<sink_t> &sinks) {
+    sink_list_t list = {};
+    for (const sink_t &s : sinks) {
+        memcpy(list.sinks[list.count].bda, s.bda, 6);
+        strncpy(list.sinks[list.count].name, s.name, CONN_NAME_LEN - 1);
+        list.count++;
+    }
+    return list;
+}
+
+struct summary_t {
+    double mean[5] = {};            // failed pages, inquiry, connect, media start, audio
+    uint32_t worst_audio_ms = 0;
+    int never = 0;
+    int pages = 0, inquiries = 0;   // in the last trial
+    uint8_t connected[6] = {};      // in the last trial
+};
+
+// Boots TRIALS times with `remembered` known and `sinks` around, and reports where the time
+// to audio went.
+static summary_t boot_trials(const char *what, const std::vector<sink_t> &remembered,
+                             const std::vector<sink_t> &sinks) {
+    sink_list_t list = known(remembered);
+    summary_t sum;
+    srand(1);
+    for (int i = 0; i < TRIALS; ++i) {
+        ConnectionManager cm;
+        cm.init(&list, "MyHeadphones");
+        StandInStack stack(sinks);
+        timing_t t = stack.boot(&cm, 60000);
+        if (t.audio_ms == 0) {
+            sum.never++;
+            continue;
+        }
+        sum.mean[0] += t.failed_pages_ms;
+        sum.mean[1] += t.inquiry_ms;
+        sum.mean[2] += t.connect_ms;
+        sum.mean[3] += MEDIA_START_MS;
+        sum.mean[4] += t.audio_ms;
+        sum.worst_audio_ms = std::max(sum.worst_audio_ms, t.audio_ms);
+        sum.pages = t.pages;
+        sum.inquiries = t.inquiries;
+        memcpy(sum.connected, t.connected, 6);
+    }
+    int n = std::max(TRIALS - sum.never, 1);
+    for (double &m : sum.mean) m /= n;
+    printf("%-34s audio at %5.0f ms (worst %5u): bt up %d, failed pages %5.0f, inquiry %5.0f, "
+           "connect %4.0f, media start %3.0f\n", what, sum.mean[4], (unsigned) sum.worst_audio_ms, BT_READY_MS,
+           sum.mean[0], sum.mean[1], sum.mean[2], sum.mean[3]);
+    return sum;
+}
+
+// Time to audio from power-on in each situation, against an inquiry by name on every boot
+// (what a2dp_source.start("MyHeadphones") did).
+static void test_time_to_audio() {
+    sink_t phones = make_sink(1, "MyHeadphones", true);
+    sink_t speaker = make_sink(2, "Kitchen", true);
+    sink_t stranger = make_sink(3, "Neighbour TV", true);
+    sink_t away = make_sink(4, "Office", false);
+    sink_t phones_off = make_sink(1, "MyHeadphones", false);
+
+    summary_t by_name = boot_trials("inquiry by name every boot", {}, { stranger, phones });
+    CHECK(by_name.inquiries == 1 && by_name.pages == 0, "%d inquiries, %d pages", by_name.inquiries, by_name.pages);
+
+    summary_t direct = boot_trials("last-used sink paged", { phones, speaker }, { stranger, phones, speaker });
+    CHECK(direct.pages == 1 && direct.inquiries == 0, "%d pages, %d inquiries", direct.pages, direct.inquiries);
+    CHECK(memcmp(direct.connected, phones.bda, 6) == 0, "connected to another sink than the last used");
+    CHECK(direct.worst_audio_ms < BT_READY_MS + PAGE_SCAN_MS + ACL_SETUP_MS + PROFILE_SETUP_MS + MEDIA_START_MS + 1,
+          "worst %u ms", (unsigned) direct.worst_audio_ms);
+    CHECK(direct.mean[4] < by_name.mean[4] - 500 && direct.worst_audio_ms < by_name.worst_audio_ms,
+          "paged %.0f ms (worst %u), by name %.0f ms (worst %u)", direct.mean[4], (unsigned) direct.worst_audio_ms,
+          by_name.mean[4], (unsigned) by_name.worst_audio_ms);
+
+    summary_t second = boot_trials("last-used off, second paged", { away, speaker }, { stranger, speaker });
+    CHECK(second.pages == 2 && second.inquiries == 0, "%d pages, %d inquiries", second.pages, second.inquiries);
+    CHECK(memcmp(second.connected, speaker.bda, 6) == 0, "did not connect to the second sink");
+    CHECK(second.mean[0] == PAGE_TIMEOUT_MS, "failed pages took %.0f ms", second.mean[0]);
+
+    // Known sinks past CONN_PAGE_MAX are left to the inquiry, which takes any known sink.
+    summary_t third = boot_trials("third known sink, via inquiry", { away, phones_off, speaker },
+                                  { stranger, speaker });
+    CHECK(third.pages == CONN_PAGE_MAX && third.inquiries == 1, "%d pages, %d inquiries", third.pages,
+          third.inquiries);
+    CHECK(memcmp(third.connected, speaker.bda, 6) == 0, "did not connect to the known sink found by inquiry");
+
+    summary_t first_boot = boot_trials("first boot, inquiry by name", {}, { stranger, speaker, phones });
+    CHECK(memcmp(first_boot.connected, phones.bda, 6) == 0, "connected to a sink not named MyHeadphones");
+
+    summary_t nobody = boot_trials("nothing around", { away }, {});
+    CHECK(nobody.never == TRIALS, "connected %d times to nothing", TRIALS - nobody.never);
+}
+
+// A dropped link pages the sink that was just lost first; once it is gone for good the
+// manager goes round the list and the inquiry again and again, and takes it back when it
+// returns.
+static void test_drop_and_return() {
+    sink_t phones = make_sink(1, "MyHeadphones", true);
+    sink_t speaker = make_sink(2, "Kitchen", true);
+    sink_list_t list = known({ phones, speaker });
+    ConnectionManager cm;
+    cm.init(&list, "MyHeadphones");
+    StandInStack stack({ phones, speaker });
+    srand(2);
+    timing_t t = stack.boot(&cm, 60000);
+    CHECK(memcmp(t.connected, phones.bda, 6) == 0, "boot did not connect to the last-used sink");
+
+    // Switched off: paged once more, then the speaker, which is the next known sink.
+    uint32_t now = 30000;
+    stack.sinks[0].on = false;
+    timing_t again;
+    stack.drop(&cm, now, &again);
+    for (; now < 90000 && again.audio_ms == 0; ++now) stack.step(&cm, now, &again);
+    CHECK(memcmp(again.connected, speaker.bda, 6) == 0 && again.pages == 2,
+          "after the drop: %d pages, connected to %02x", again.pages, again.connected[5]);
+    CHECK(memcmp(cm.list().sinks[0].bda, speaker.bda, 6) == 0, "the speaker is not at the front");
+
+    // The speaker drops too, nothing is on: it keeps cycling through pages and inquiries.
+    stack.sinks[1].on = false;
+    timing_t none;
+    now += 1000;
+    uint32_t dropped = now;
+    stack.drop(&cm, now, &none);
+    for (; now < dropped + 120000; ++now) stack.step(&cm, now, &none);
+    printf("120 s with no sink: %d pages, %d inquiries\n", none.pages, none.inquiries);
+    CHECK(none.audio_ms == 0, "connected to a sink that is off");
+    CHECK(none.inquiries >= 3 && none.pages >= 2 * none.inquiries - 2, "%d pages, %d inquiries", none.pages,
+          none.inquiries);
+
+    // The headphones come back: taken on the next round.
+    stack.sinks[0].on = true;
+    timing_t back;
+    uint32_t returned = now;
+    for (; now < returned + 60000 && back.audio_ms == 0; ++now) stack.step(&cm, now, &back);
+    printf("headphones back on: audio after %u ms\n", (unsigned)(back.audio_ms - returned));
+    CHECK(back.audio_ms != 0 && memcmp(back.connected, phones.bda, 6) == 0, "the headphones were not taken back");
+    CHECK(back.audio_ms - returned < CONN_DISCOVERY_MS + 2 * PAGE_TIMEOUT_MS + 3000, "took %u ms",
+          (unsigned)(back.audio_ms - returned));
+}
+
+// Connecting moves a sink to the front; a new sink on a full list pushes the least recently
+// used one out; a name seen in the inquiry is kept.
+static void test_list_order() {
+    std::vector<sink_t> all;
+    for (int i = 0; i < CONN_MAX_SINKS + 1; ++i) all.push_back(make_sink((uint8_t)(10 + i), "", true));
+    std::vector<sink_t> first(all.begin(), all.begin() + CONN_MAX_SINKS);
+    sink_list_t list = known(first);
+    ConnectionManager cm;
+    cm.init(&list, "MyHeadphones");
+    uint32_t now = 0;
+    cm.start(now);
+
+    // A sink from the middle of the list: it goes to the front, the ones before it shift down.
+    cm.on_connected(all[5].bda, now);
+    CHECK(cm.take_list_changed(), "list change not reported");
+    const uint8_t want_mid[CONN_MAX_SINKS] = { 15, 10, 11, 12, 13, 14, 16, 17 };
+    for (int i = 0; i < CONN_MAX_SINKS; ++i) {
+        CHECK(cm.list().sinks[i].bda[5] == want_mid[i], "after the middle one: [%d] is %d, want %d", i,
+              cm.list().sinks[i].bda[5], want_mid[i]);
+    }
+    CHECK(cm.list().sinks[0].connects == 1, "%u connects", cm.list().sinks[0].connects);
+
+    // A new sink found by name on the full list: the last one is dropped.
+    cm.on_disconnected(now);                    // pages the front sink
+    for (int i = 0; i < CONN_PAGE_MAX; ++i) {
+        now += PAGE_TIMEOUT_MS;
+        cm.on_disconnected(now);                // nobody answers
+    }
+    CHECK(cm.state() == CONN_DISCOVERING, "state %s", ConnectionManager::state_name(cm.state()));
+    CHECK(!cm.on_discovered("Neighbour TV", all[8].bda, now), "a stranger was wanted");
+    CHECK(cm.on_discovered("MyHeadphones", all[8].bda, now), "the configured name was not wanted");
+    cm.on_connected(all[8].bda, now);
+    CHECK(cm.list().count == CONN_MAX_SINKS, "%d sinks", cm.list().count);
+    const uint8_t want_full[CONN_MAX_SINKS] = { 18, 15, 10, 11, 12, 13, 14, 16 };
+    for (int i = 0; i < CONN_MAX_SINKS; ++i) {
+        CHECK(cm.list().sinks[i].bda[5] == want_full[i], "after the new one: [%d] is %d, want %d", i,
+              cm.list().sinks[i].bda[5], want_full[i]);
+    }
+    CHECK(strcmp(cm.list().sinks[0].name, "MyHeadphones") == 0, "name \"%s\"", cm.list().sinks[0].name);
+    CHECK(cm.list().sinks[1].page_failures == 1 && cm.list().sinks[2].page_failures == 1,
+          "page failures %u, %u", cm.list().sinks[1].page_failures, cm.list().sinks[2].page_failures);
+
+    // A known sink answers the inquiry under any name.
+    cm.on_disconnected(now);
+    for (int i = 0; i < CONN_PAGE_MAX; ++i) {
+        now += PAGE_TIMEOUT_MS;
+        cm.on_disconnected(now);
+    }
+    CHECK(cm.on_discovered("Renamed", all[6].bda, now), "a known sink was not wanted");
+    cm.on_connected(all[6].bda, now);
+    CHECK(cm.list().sinks[0].bda[5] == 16 && cm.list().sinks[CONN_MAX_SINKS - 1].bda[5] == 14,
+          "front %d, back %d", cm.list().sinks[0].bda[5], cm.list().sinks[CONN_MAX_SINKS - 1].bda[5]);
+}
+
+int main() {
+    test_time_to_audio();
+    test_drop_and_return();
+    test_list_order();
+    printf("connection_test: %d failures\n", failures);
+    return failures ? 1 : 0;
+}
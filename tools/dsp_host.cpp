@@ -0,0 +1,257 @@
+// Host build of the firmware's audio path, for the offline tools: reads interleaved stereo
+// 16-bit PCM at 48 kHz on stdin, plays it through a real AudioBridge the way the device
+// does, and writes what the bridge hands the encoder to stdout. The input goes in as 1 ms
+// USB packets and comes out as Bluetooth requests of `--block` frames, in simulated time,
+// so it takes the ring, the time-stretch, channel mode, EQ, loudness normalization, gain
+// and limiter exactly as read_stream() runs them. The settings go in through the bridge's
+// own control setters, and --eq-at changes an EQ band mid-stream through the same path as
+// the vendor request.
+//
+// The sink connects WARMUP_MS before the input starts (the connect prompt plays out and
+// the stream primes on silence) and the output is taken from the first request after that,
+// so it is delayed by the ring's jitter depth as well as the limiter look-ahead. --stretch
+// runs the host clock fast by that ratio, which the bridge catches up on by time-stretching;
+// once the input runs out the host sends silence. With --bench it processes SECONDS of
+// generated audio instead and prints the bridge's stage profiles (from after the warm-up)
+// as JSON. The bridge logs to stderr.
+//
+//     dsp_host [--block 128] [--mode crossfeed] [--eq peak:1000:1.4:-6]... [--eq-at 0.5:0:peak:1000:1.4:-3]...
+//              [--boost-db 6] [--limiter -1 | --no-limiter] [--loudness -18] [--stretch 1.02]
+//              [--bench SECONDS] < in.raw > out.raw
+//
+// Built and driven by tools/audio_quality.py and tools/perf_gate.py.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include "esp_timer.h"
+#include "audio_bridge.h"
+
+#define MAX_BLOCK_FRAMES    4096
+#define START_US            1000000 // the bridge's clock when the sink connects
+#define WARMUP_MS           1000    // connect prompt, priming and any stretch engaging, on silence
+#define USB_PACKET_US       1000
+#define MAX_EQ_CHANGES      8
+
+struct eq_change_t {
+    size_t at_frame;                // input frame from which the host sends it
+    uint8_t index;
+    eq_band_t band;
+};
+
+static AudioBridge bridge;
+
+static bool parse_band(const char *spec, eq_band_t *band) {
+    static const char *const types[] = { "peak", "lowshelf", "highshelf", "lowpass", "highpass" };
+    char name[16];
+    *band = {};
+    if (sscanf(spec, "%15[a-z]:%f:%f:%f", name, &band->freq, &band->q, &band->gain_db) < 3) {
+        return false;
+    }
+    for (int t = 0; t < 5; ++t) {
+        if (strcmp(name, types[t]) == 0) {
+            band->type = (eq_band_type_t) t;
+            band->channels = 3;
+            return eq_band_valid(*band, AUDIO_SAMPLE_RATE);
+        }
+    }
+    return false;
+}
+
+// "SECONDS:BAND:type:freq:q[:gain_db]"
+static bool parse_change(const char *spec, eq_change_t *change) {
+    float seconds;
+    unsigned index;
+    int used = 0;
+    if (sscanf(spec, "%f:%u:%n", &seconds, &index, &used) < 2 || used == 0 || seconds < 0 || index >= EQ_MAX_BANDS) {
+        return false;
+    }
+    change->at_frame = (size_t)(seconds * AUDIO_SAMPLE_RATE);
+    change->index = (uint8_t) index;
+    return parse_band(spec + used, &change->band);
+}
+
+static void usage() {
+    fprintf(stderr, "usage: dsp_host [--block N] [--mode NAME] [--eq type:freq:q[:gain_db]]... "
+                    "[--eq-at seconds:band:type:freq:q[:gain_db]]... [--boost-db DB] "
+                    "[--limiter CEILING_DB | --no-limiter] [--loudness TARGET_LUFS] [--stretch RATE] "
+                    "[--bench SECONDS]\n");
+    exit(2);
+}
+
+static int64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+// The profile clock (TSC or nanoseconds) against CLOCK_MONOTONIC, over 50 ms: short
+// enough that 32-bit ticks do not wrap.
+static double ticks_per_ns() {
+    int64_t start_ns = now_ns(), elapsed_ns;
+    uint32_t start_ticks = profile_now();
+    while ((elapsed_ns = now_ns() - start_ns) < 50000000) {
+    }
+    return (double)(uint32_t)(profile_now() - start_ticks) / elapsed_ns;
+}
+
+// Bench input: a few tones over low-level noise, the same on every run.
+static void generate(std::vector<int16_t> *samples, float seconds) {
+    size_t frames = (size_t)(seconds * AUDIO_SAMPLE_RATE);
+    uint32_t seed = 1;
+    samples->resize(frames * 2);
+    for (size_t i = 0; i < frames; ++i) {
+        float t = (float) i / AUDIO_SAMPLE_RATE;
+        float v = 6000.0f * sinf(2 * (float) M_PI * 110.0f * t) + 3000.0f * sinf(2 * (float) M_PI * 1234.0f * t);
+        for (int c = 0; c < 2; ++c) {
+            seed = seed * 1664525u + 1013904223u;
+            (*samples)[i * 2 + c] = (int16_t)(v + (int32_t)(seed >> 22) - 512);
+        }
+    }
+}
+
+// The bridge's stage profiles as JSON, with the profile clock calibrated against CLOCK_MONOTONIC.
+static void print_bench(FILE *out, double ticks_per_ns) {
+    audio_stats_t s;
+    bridge.get_stats(&s);
+    fprintf(out, "{\"ticks_per_ns\": %.6f, \"stages\": {", ticks_per_ns);
+    bool first = true;
+    for (int i = 0; i < PROFILE_STAGE_COUNT; ++i) {
+        const stage_stats_t &st = s.stages[i];
+        if (st.count == 0) {
+            continue;
+        }
+        fprintf(out, "%s\n \"%s\": {\"count\": %u, \"frames\": %u, \"avg_cycles\": %u, \"p99_cycles\": %u, \"max_cycles\": %u}",
+                first ? "" : ",", profile_stage_name((profile_stage_t) i), (unsigned) st.count, (unsigned) st.frames,
+                (unsigned) st.avg_cycles, (unsigned) st.p99_cycles, (unsigned) st.max_cycles);
+        first = false;
+    }
+    fprintf(out, "\n}}\n");
+}
+
+int main(int argc, char **argv) {
+    // The bridge logs with printf: stdout carries only the result.
+    FILE *out = fdopen(dup(STDOUT_FILENO), "wb");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    size_t block = 128;
+    float rate = 1.0f;
+    float bench_s = 0.0f;
+    std::vector<eq_change_t> changes;
+    int bands = 0;
+    host_time_us = START_US;
+    if (!bridge.init()) {
+        fprintf(stderr, "dsp_host: bridge init failed\n");
+        return 1;
+    }
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (strcmp(arg, "--no-limiter") == 0) {
+            bridge.set_limiter(false, -1.0f, 0);
+            continue;
+        }
+        if (!val) usage();
+        ++i;
+        if (strcmp(arg, "--block") == 0) {
+            block = strtoul(val, nullptr, 0);
+            if (block == 0 || block > MAX_BLOCK_FRAMES) usage();
+        } else if (strcmp(arg, "--mode") == 0) {
+            int m = 0;
+            while (m < CHANNEL_MODE_COUNT && strcasecmp(val, channel_mode_name((channel_mode_t) m)) != 0) m++;
+            if (m == CHANNEL_MODE_COUNT) usage();
+            bridge.set_channel_mode((channel_mode_t) m);
+        } else if (strcmp(arg, "--eq") == 0) {
+            eq_band_t band;
+            if (bands == EQ_MAX_BANDS || !parse_band(val, &band) || !bridge.set_eq_band(bands, band)) usage();
+            bands++;
+        } else if (strcmp(arg, "--eq-at") == 0) {
+            eq_change_t change;
+            if (changes.size() == MAX_EQ_CHANGES || !parse_change(val, &change)) usage();
+            changes.push_back(change);
+        } else if (strcmp(arg, "--boost-db") == 0) {
+            bridge.set_boost_db(strtof(val, nullptr));
+        } else if (strcmp(arg, "--limiter") == 0) {
+            bridge.set_limiter(true, strtof(val, nullptr), 0);
+        } else if (strcmp(arg, "--loudness") == 0) {
+            bridge.set_loudness_norm(true, strtof(val, nullptr));
+        } else if (strcmp(arg, "--stretch") == 0) {
+            rate = strtof(val, nullptr);
+            if (rate <= 0.0f) usage();
+        } else if (strcmp(arg, "--bench") == 0) {
+            bench_s = strtof(val, nullptr);
+            if (bench_s <= 0.0f) usage();
+        } else {
+            usage();
+        }
+    }
+
+    std::vector<int16_t> in;
+    if (bench_s > 0.0f) {
+        generate(&in, bench_s);
+    } else {
+        int16_t buf[4096];
+        size_t n;
+        while ((n = fread(buf, 4, sizeof(buf) / 4, stdin)) > 0) {
+            in.insert(in.end(), buf, buf + n * 2);
+        }
+    }
+    const size_t total = in.size() / 2;
+
+    bridge.on_connection_state(ESP_A2D_CONNECTION_STATE_CONNECTED);
+    // Host packets carry `rate` ms of audio each, the fraction carried over; requests come
+    // every `block` frames of our clock.
+    const int64_t input_us = START_US + (int64_t) WARMUP_MS * 1000;
+    const double frames_per_packet = rate * AUDIO_SAMPLE_RATE * USB_PACKET_US / 1e6;
+    const double request_us = block * 1e6 / AUDIO_SAMPLE_RATE;
+    std::vector<int16_t> packet((size_t) frames_per_packet * 2 + 4), output(block * 2);
+    double owed = 0.0;
+    size_t sent = 0, written = 0, requests = 0, next_change = 0;
+    int64_t packet_us = START_US;
+    bool warm = false;
+    while (written < total) {
+        int64_t read_us = START_US + (int64_t)(requests * request_us);
+        if (packet_us <= read_us) {
+            host_time_us = packet_us;
+            owed += frames_per_packet;
+            size_t frames = (size_t) owed;
+            owed -= frames;
+            memset(packet.data(), 0, frames * AUDIO_FRAME_BYTES);
+            if (packet_us >= input_us) {
+                while (next_change < changes.size() && changes[next_change].at_frame <= sent) {
+                    bridge.set_eq_band(changes[next_change].index, changes[next_change].band);
+                    next_change++;
+                }
+                size_t n = sent < total ? (total - sent < frames ? total - sent : frames) : 0;
+                if (n > 0) memcpy(packet.data(), &in[sent * 2], n * AUDIO_FRAME_BYTES);
+                sent += frames;
+            }
+            bridge.on_usb_packet((const uint8_t*) packet.data(), frames * AUDIO_FRAME_BYTES);
+            packet_us += USB_PACKET_US;
+            continue;
+        }
+        host_time_us = read_us;
+        requests++;
+        if (read_us >= input_us && !warm) {
+            warm = true;
+            bridge.print_stats();   // restarts the profiles: the bench leaves out the warm-up
+        }
+        bridge.read((uint8_t*) output.data(), block * AUDIO_FRAME_BYTES);
+        if (warm) {
+            size_t frames = total - written < block ? total - written : block;
+            if (bench_s == 0.0f) {
+                fwrite(output.data(), AUDIO_FRAME_BYTES, frames, out);
+            }
+            written += frames;
+        }
+    }
+    if (bench_s > 0.0f) {
+        print_bench(out, ticks_per_ns());
+    }
+    fclose(out);
+    return 0;
+}
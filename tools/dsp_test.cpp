@@ -0,0 +1,854 @@
+// Host test of the DSP modules on their own: the EQ design against the RBJ cookbook's
+// closed-form responses, the filter as it runs against its designed response, band
+// changes mid-stream, and the band limits that keep every design stable; the limiter on
+// square waves driven far over its ceiling, and as a pure delay with the transparent
+// ceiling; the loudness meter on the EBU Tech 3341 signals and against BS.1770 at the
+// full rate; each channel mode against its definition, and what each one costs; the cue
+// mixer's tones, fades and ducking, and its cost while a cue plays; the time-stretch against
+// dropping and splicing to catch up; the splice's splatter against hard cuts.
+//
+// Built and run by tools/host_tests.py.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "channel_mix.h"
+#include "cue_mixer.h"
+#include "loudness.h"
+#include "parametric_eq.h"
+#include "peak_limiter.h"
+#include "splice.h"
+#include "time_stretch.h"
+
+#define SAMPLE_RATE         48000.0f
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        failures++; \
+    } \
+} while (0)
+
+static eq_band_t band(eq_band_type_t type, float freq, float q, float gain_db) {
+    eq_band_t b = {};
+    b.type = type;
+    b.channels = 3;
+    b.freq = freq;
+    b.q = q;
+    b.gain_db = gain_db;
+    return b;
+}
+
+static float response_db(const eq_band_t &b, float freq) {
+    biquad_coeffs_t c;
+    eq_design_band(b, SAMPLE_RATE, &c);
+    return eq_response_db(&c, 1, freq, SAMPLE_RATE);
+}
+
+// Poles inside the unit circle: the stability triangle of a normalized biquad.
+static bool stable(const biquad_coeffs_t &c) {
+    return isfinite(c.a1) && isfinite(c.a2) && fabsf(c.a2) < 1.0f && fabsf(c.a1) < 1.0f + c.a2;
+}
+
+// Values the cookbook's formulas give at DC, Nyquist and the design frequency.
+static void test_eq_analytic() {
+    static const float freqs[] = { 100.0f, 1000.0f, 10000.0f };
+    static const float qs[] = { 0.5f, 0.707f, 2.0f, 8.0f };
+    static const float gains[] = { -12.0f, -3.0f, 6.0f, 12.0f };
+    for (float f : freqs) {
+        for (float q : qs) {
+            // A 2nd-order low/highpass is 20log10(Q) at its corner and unity in its passband.
+            float lp = response_db(band(EQ_LOWPASS, f, q, 0), f);
+            CHECK(fabsf(lp - 20 * log10f(q)) < 0.05f, "lowpass %g Hz Q %g: %.3f dB at the corner", f, q, lp);
+            float hp = response_db(band(EQ_HIGHPASS, f, q, 0), f);
+            CHECK(fabsf(hp - 20 * log10f(q)) < 0.05f, "highpass %g Hz Q %g: %.3f dB at the corner", f, q, hp);
+            CHECK(fabsf(response_db(band(EQ_LOWPASS, f, q, 0), 1.0f)) < 0.05f, "lowpass %g Hz not flat at DC", f);
+            CHECK(fabsf(response_db(band(EQ_HIGHPASS, f, q, 0), 23999.0f)) < 0.05f, "highpass %g Hz not flat at Nyquist", f);
+            for (float g : gains) {
+                // Peak: the full gain at the center, flat at both ends.
+                float peak = response_db(band(EQ_PEAK, f, q, g), f);
+                CHECK(fabsf(peak - g) < 0.05f, "peak %g Hz Q %g %g dB: %.3f dB at the center", f, q, g, peak);
+                CHECK(fabsf(response_db(band(EQ_PEAK, f, q, g), 1.0f)) < 0.05f, "peak %g Hz not flat at DC", f);
+                // Shelves: the full gain on the shelf, half of it at the corner, flat on the other side.
+                float ls_dc = response_db(band(EQ_LOW_SHELF, f, q, g), 1.0f);
+                float ls_fc = response_db(band(EQ_LOW_SHELF, f, q, g), f);
+                CHECK(fabsf(ls_dc - g) < 0.05f, "low shelf %g Hz %g dB: %.3f dB at DC", f, g, ls_dc);
+                CHECK(fabsf(ls_fc - g / 2) < 0.05f, "low shelf %g Hz %g dB: %.3f dB at the corner", f, g, ls_fc);
+                float hs_ny = response_db(band(EQ_HIGH_SHELF, f, q, g), 23999.0f);
+                float hs_fc = response_db(band(EQ_HIGH_SHELF, f, q, g), f);
+                CHECK(fabsf(hs_ny - g) < 0.05f, "high shelf %g Hz %g dB: %.3f dB at Nyquist", f, g, hs_ny);
+                CHECK(fabsf(hs_fc - g / 2) < 0.05f, "high shelf %g Hz %g dB: %.3f dB at the corner", f, g, hs_fc);
+            }
+        }
+    }
+}
+
+// Gain of `frames` of output against a unit sine at `freq`, by projection on sin and cos.
+static float measured_db(const std::vector<int16_t> &out, size_t start, size_t frames, float freq, float amplitude) {
+    double s = 0, c = 0;
+    for (size_t i = 0; i < frames; ++i) {
+        double ph = 2 * M_PI * freq * (double)(start + i) / SAMPLE_RATE;
+        s += out[2 * (start + i)] * sin(ph);
+        c += out[2 * (start + i)] * cos(ph);
+    }
+    return (float)(20 * log10(2 * sqrt(s * s + c * c) / frames / amplitude));
+}
+
+// A four-band cascade run through ParametricEq in odd block sizes matches its designed response.
+static void test_eq_filter_matches_response() {
+    eq_params_t eq;
+    eq.bands[0] = band(EQ_HIGHPASS, 40.0f, 0.707f, 0);
+    eq.bands[1] = band(EQ_LOW_SHELF, 150.0f, 0.707f, 4.0f);
+    eq.bands[2] = band(EQ_PEAK, 2500.0f, 1.5f, -6.0f);
+    eq.bands[3] = band(EQ_HIGH_SHELF, 9000.0f, 0.707f, -3.0f);
+    eq.band_count = 4;
+    eq_update_coeffs(&eq, SAMPLE_RATE);
+
+    static const float freqs[] = { 30, 100, 400, 1000, 2500, 3000, 8000, 12000, 18000 };
+    const float amplitude = 6000.0f;
+    const size_t settle = 24000, window = 48000;
+    for (float f : freqs) {
+        ParametricEq filter;
+        std::vector<int16_t> buf((settle + window) * 2);
+        for (size_t i = 0; i < settle + window; ++i) {
+            buf[2 * i] = buf[2 * i + 1] = (int16_t) lrintf(amplitude * sinf(2 * (float) M_PI * f * i / SAMPLE_RATE));
+        }
+        for (size_t pos = 0, n = 1; pos < settle + window; pos += n, n = n % 300 + 37) {
+            size_t frames = pos + n > settle + window ? settle + window - pos : n;
+            filter.process(&buf[2 * pos], frames, eq);
+        }
+        float got = measured_db(buf, settle, window, f, amplitude);
+        float want = eq_response_db(eq.coeffs[0], eq.band_count, f, SAMPLE_RATE);
+        CHECK(fabsf(got - want) < 0.1f, "%g Hz: %.3f dB through the filter, %.3f dB designed", f, got, want);
+    }
+}
+
+// Runs `in` through `filter` in EQ_CHUNK_FRAMES blocks, switching from `before` to `after`
+// at frame `at` (a block boundary).
+static std::vector<int16_t> run_eq_switch(ParametricEq *filter, const std::vector<int16_t> &in,
+                                          const eq_params_t &before, const eq_params_t &after, size_t at) {
+    std::vector<int16_t> out = in;
+    for (size_t pos = 0; pos < out.size() / 2; pos += EQ_CHUNK_FRAMES) {
+        filter->process(&out[2 * pos], EQ_CHUNK_FRAMES, pos < at ? before : after);
+    }
+    return out;
+}
+
+// A band change mid-stream: the crossfade's new cascade picks up the history the old one
+// had at the start of the chunk. Re-sending the same bands changes nothing at all, and a
+// real change leaves no step: the output steps no further from one sample to the next
+// than the tone does, and right after the crossfade it is what a filter that had the new
+// bands all along puts out.
+static void test_eq_update_mid_stream() {
+    const size_t frames = 64 * EQ_CHUNK_FRAMES, at = 32 * EQ_CHUNK_FRAMES;
+    const float freq = 1000.0f, amplitude = 8000.0f;
+    std::vector<int16_t> in(frames * 2);
+    for (size_t i = 0; i < frames; ++i) {
+        in[2 * i] = in[2 * i + 1] = (int16_t) lrintf(amplitude * sinf(2 * (float) M_PI * freq * i / SAMPLE_RATE));
+    }
+    eq_params_t a;
+    a.bands[0] = band(EQ_PEAK, freq, 1.0f, 6.0f);
+    a.bands[1] = band(EQ_HIGHPASS, 80.0f, 0.707f, 0);
+    a.band_count = 2;
+    eq_update_coeffs(&a, SAMPLE_RATE);
+
+    eq_params_t same = a;
+    same.version++;
+    ParametricEq steady, resent;
+    std::vector<int16_t> want = run_eq_switch(&steady, in, a, a, at);
+    std::vector<int16_t> got = run_eq_switch(&resent, in, a, same, at);
+    size_t differ = 0;
+    for (size_t i = 0; i < got.size(); ++i) differ += got[i] != want[i];
+    CHECK(differ == 0, "re-sending the same bands changed %zu samples", differ);
+
+    eq_params_t b = a;
+    b.bands[0].gain_db = -6.0f;
+    eq_update_coeffs(&b, SAMPLE_RATE);
+    ParametricEq switched, fresh;
+    got = run_eq_switch(&switched, in, a, b, at);
+    want = run_eq_switch(&fresh, in, b, b, at);
+    float step_limit = amplitude * 2.0f * 2 * sinf((float) M_PI * freq / SAMPLE_RATE) * 1.05f + 2.0f;
+    float step = 0;
+    for (size_t i = at - EQ_CHUNK_FRAMES; i < at + 2 * EQ_CHUNK_FRAMES; ++i) {
+        float d = fabsf((float) got[2 * i] - got[2 * (i - 1)]);
+        if (d > step) step = d;
+    }
+    CHECK(step <= step_limit, "output stepped by %.0f around the change, the tone by at most %.0f", step, step_limit);
+    float off = 0;
+    for (size_t i = at + EQ_CHUNK_FRAMES; i < frames; ++i) {
+        float d = fabsf((float) got[2 * i] - want[2 * i]);
+        if (d > off) off = d;
+    }
+    CHECK(off <= 0.01f * amplitude, "%.0f away from a filter started with the new bands", off);
+}
+
+// Bands outside the limits are refused, and whatever reaches the design is stable.
+static void test_eq_limits() {
+    CHECK(eq_band_valid(band(EQ_PEAK, 1000, 1, 6), SAMPLE_RATE), "ordinary band refused");
+    CHECK(eq_band_valid(band(EQ_HIGH_SHELF, 23000, EQ_MAX_Q, EQ_MAX_GAIN_DB), SAMPLE_RATE), "band at the limits refused");
+    CHECK(!eq_band_valid(band(EQ_PEAK, 0, 1, 6), SAMPLE_RATE), "0 Hz accepted");
+    CHECK(!eq_band_valid(band(EQ_PEAK, 24000, 1, 6), SAMPLE_RATE), "Nyquist accepted");
+    CHECK(!eq_band_valid(band(EQ_PEAK, 30000, 1, 6), SAMPLE_RATE), "above Nyquist accepted");
+    CHECK(!eq_band_valid(band(EQ_PEAK, 1000, 0, 6), SAMPLE_RATE), "Q 0 accepted");
+    CHECK(!eq_band_valid(band(EQ_PEAK, 1000, -1, 6), SAMPLE_RATE), "negative Q accepted");
+    CHECK(!eq_band_valid(band(EQ_PEAK, NAN, 1, 6), SAMPLE_RATE), "NaN frequency accepted");
+    CHECK(!eq_band_valid(band(EQ_PEAK, 1000, 1, INFINITY), SAMPLE_RATE), "infinite gain accepted");
+    CHECK(!eq_band_valid(band((eq_band_type_t) 7, 1000, 1, 6), SAMPLE_RATE), "unknown type accepted");
+
+    // Out-of-range parameters straight into the design come out clamped, not unstable.
+    static const eq_band_t wild[] = {
+        band(EQ_PEAK, 30000, 1, 6), band(EQ_LOWPASS, 65535, 0.707f, 0), band(EQ_HIGHPASS, 0, 0.707f, 0),
+        band(EQ_PEAK, 1000, 0, 6), band(EQ_LOW_SHELF, 1000, -2, 6), band(EQ_PEAK, 1000, 1, 327.0f),
+        band(EQ_HIGH_SHELF, NAN, NAN, NAN),
+    };
+    for (const eq_band_t &b : wild) {
+        biquad_coeffs_t c;
+        eq_design_band(b, SAMPLE_RATE, &c);
+        CHECK(stable(c), "type %u %g Hz Q %g %g dB: a1 %g a2 %g", (unsigned) b.type, b.freq, b.q, b.gain_db, c.a1, c.a2);
+    }
+
+    // Every valid band is stable, across the whole range.
+    srand(1);
+    int unstable = 0;
+    for (int i = 0; i < 100000; ++i) {
+        float u = (float) rand() / RAND_MAX, v = (float) rand() / RAND_MAX, w = (float) rand() / RAND_MAX;
+        eq_band_t b = band((eq_band_type_t)(rand() % (EQ_HIGHPASS + 1)),
+                           EQ_MIN_FREQ_HZ * powf(0.4999f * SAMPLE_RATE / EQ_MIN_FREQ_HZ, u),
+                           EQ_MIN_Q * powf(EQ_MAX_Q / EQ_MIN_Q, v), (2 * w - 1) * EQ_MAX_GAIN_DB);
+        biquad_coeffs_t c;
+        eq_design_band(b, SAMPLE_RATE, &c);
+        if (!eq_band_valid(b, SAMPLE_RATE) || !stable(c)) {
+            if (unstable++ < 5) printf("type %u %g Hz Q %g %g dB: a1 %g a2 %g\n", (unsigned) b.type, b.freq, b.q, b.gain_db, c.a1, c.a2);
+        }
+    }
+    CHECK(unstable == 0, "%d valid bands designed unstable", unstable);
+}
+
+// Square wave at `amplitude` (linear, 1.0 = 16-bit full scale), `frames` long, both channels.
+static std::vector<float> square(size_t frames, size_t period, float amplitude) {
+    std::vector<float> v(frames * 2);
+    for (size_t i = 0; i < frames; ++i) {
+        v[2 * i] = v[2 * i + 1] = (i % period < period / 2 ? 32767.0f : -32767.0f) * amplitude;
+    }
+    return v;
+}
+
+static void run_limiter(PeakLimiter *limiter, std::vector<float> &v, float ceiling, size_t block) {
+    for (size_t pos = 0; pos < v.size() / 2; pos += block) {
+        size_t n = v.size() / 2 - pos < block ? v.size() / 2 - pos : block;
+        limiter->process(&v[2 * pos], n, ceiling, 100, SAMPLE_RATE);
+    }
+}
+
+// +12 dB of full-scale square wave, from silence, in several block sizes: not a single
+// sample over the ceiling, edges included, and a steady level just under it.
+static void test_limiter_square_wave() {
+    const float ceiling = 0.891f;   // -1 dBFS, the default
+    static const size_t periods[] = { 48, 480, 4800 };
+    static const size_t blocks[] = { 1, 31, 128 };
+    for (size_t period : periods) {
+        for (size_t block : blocks) {
+            PeakLimiter limiter;
+            std::vector<float> v = square(48000, period, 4.0f);
+            run_limiter(&limiter, v, ceiling, block);
+            float over = 0, steady = 0;
+            for (size_t i = 0; i < v.size(); ++i) {
+                float a = fabsf(v[i]) / 32768.0f;
+                if (a > over) over = a;
+                if (i >= v.size() / 2 && a > steady) steady = a;
+            }
+            CHECK(over <= ceiling * 1.0001f, "period %zu, block %zu: overshoot to %.4f over a %.4f ceiling",
+                  period, block, over, ceiling);
+            // The true-peak estimate puts square-wave edges 1.125 x over the samples.
+            CHECK(steady >= ceiling / 1.125f * 0.99f, "period %zu, block %zu: steady level %.4f", period, block, steady);
+            float want_db = 20 * log10f(ceiling / (4.0f * 32767.0f / 32768.0f * 1.125f));
+            CHECK(limiter.max_reduction_db() <= want_db + 0.1f && limiter.max_reduction_db() >= want_db - 0.5f,
+                  "period %zu, block %zu: max reduction %.2f dB, expected about %.2f", period, block,
+                  limiter.max_reduction_db(), want_db);
+        }
+    }
+}
+
+// At or below full scale with the transparent ceiling the limiter is exactly its delay.
+static void test_limiter_transparent() {
+    PeakLimiter limiter;
+    const size_t frames = 48000;
+    std::vector<float> in(frames * 2), v;
+    srand(2);
+    for (size_t i = 0; i < frames * 2; ++i) {
+        in[i] = (float)(rand() % 65536 - 32768);
+    }
+    in[1000] = -32768.0f;
+    in[1002] = 32767.0f;
+    v = in;
+    run_limiter(&limiter, v, LIMITER_TRANSPARENT_CEILING, 100);
+    const size_t delay = PeakLimiter::latency_frames();
+    size_t differ = 0;
+    for (size_t i = 0; i < frames * 2; ++i) {
+        float want = i < delay * 2 ? 0.0f : in[i - delay * 2];
+        differ += v[i] != want;
+    }
+    CHECK(differ == 0, "%zu samples are not the input delayed by %zu frames", differ, delay);
+    CHECK(limiter.max_reduction_db() == 0.0f, "reduced by %.2f dB", limiter.max_reduction_db());
+}
+
+// Stereo sine at `dbfs` (peak, as EBU Tech 3341 states its levels) in 16-bit PCM, from
+// frame `start` on; `channels` 1 puts it on the left channel only.
+static std::vector<int16_t> sine(float freq, float dbfs, size_t frames, size_t start = 0, int channels = 2) {
+    std::vector<int16_t> v(frames * 2);
+    double amplitude = 32768.0 * pow(10.0, dbfs / 20.0);
+    for (size_t i = 0; i < frames; ++i) {
+        int16_t s = (int16_t) lrint(amplitude * sin(2 * M_PI * freq * (double)(start + i) / SAMPLE_RATE));
+        v[i * 2] = s;
+        v[i * 2 + 1] = channels == 2 ? s : 0;
+    }
+    return v;
+}
+
+// Reads the meter once it has been fed all of `in` in blocks of `block` frames.
+static float meter_lufs(const std::vector<int16_t> &in, size_t block) {
+    LoudnessMeter meter;
+    meter.init(SAMPLE_RATE);
+    for (size_t i = 0; i < in.size() / 2; i += block) {
+        meter.process(&in[i * 2], std::min(block, in.size() / 2 - i));
+    }
+    return meter.short_term_lufs();
+}
+
+// BS.1770 at the full rate with the spec's 48 kHz coefficients, in double: the short-term
+// loudness of the last 3 s of `in`.
+static double reference_lufs(const std::vector<int16_t> &in) {
+    static const double shelf_b[3] = { 1.53512485958697, -2.69169618940638, 1.19839281085285 };
+    static const double shelf_a[3] = { 1.0, -1.69065929318241, 0.73248077421585 };
+    static const double hp_b[3] = { 1.0, -2.0, 1.0 };
+    static const double hp_a[3] = { 1.0, -1.99004745483398, 0.99007225036621 };
+    size_t frames = in.size() / 2, window = (size_t)(3 * SAMPLE_RATE);
+    double sum = 0;
+    for (int c = 0; c < 2; ++c) {
+        double x1 = 0, x2 = 0, y1 = 0, y2 = 0, u1 = 0, u2 = 0;
+        for (size_t i = 0; i < frames; ++i) {
+            double x = in[i * 2 + c] / 32768.0;
+            double y = shelf_b[0] * x + shelf_b[1] * x1 + shelf_b[2] * x2 - shelf_a[1] * y1 - shelf_a[2] * y2;
+            double u = hp_b[0] * y + hp_b[1] * y1 + hp_b[2] * y2 - hp_a[1] * u1 - hp_a[2] * u2;
+            x2 = x1; x1 = x; u2 = u1; u1 = u;
+            y2 = y1; y1 = y;
+            if (i + window >= frames) sum += u * u;
+        }
+    }
+    return -0.691 + 10 * log10(sum / window);
+}
+
+// EBU Tech 3341's short-term cases: a stereo 1 kHz sine at -23 and -33 dBFS reads -23.0 and
+// -33.0 LUFS, and 1.34 s at -20 dBFS alternating with 1.66 s at -30 dBFS holds -23.0 once
+// the window is full, all within the +-0.1 LU the spec allows. One channel of the -23 dBFS
+// sine is 3 dB less: the channels' powers add.
+static void test_loudness_ebu() {
+    const size_t frames = (size_t)(20 * SAMPLE_RATE);
+    float lufs = meter_lufs(sine(1000, -23, frames), 480);
+    CHECK(fabsf(lufs + 23.0f) <= 0.1f, "-23 dBFS sine reads %.2f LUFS", lufs);
+    lufs = meter_lufs(sine(1000, -33, frames), 480);
+    CHECK(fabsf(lufs + 33.0f) <= 0.1f, "-33 dBFS sine reads %.2f LUFS", lufs);
+    lufs = meter_lufs(sine(1000, -23, frames, 0, 1), 480);
+    CHECK(fabsf(lufs + 26.0f) <= 0.1f, "-23 dBFS sine on one channel reads %.2f LUFS", lufs);
+
+    const size_t loud = (size_t)(1.34 * SAMPLE_RATE), period = (size_t)(3 * SAMPLE_RATE);
+    std::vector<int16_t> in;
+    for (size_t start = 0; start < frames; start += period) {
+        std::vector<int16_t> a = sine(1000, -20, loud, start), b = sine(1000, -30, period - loud, start + loud);
+        in.insert(in.end(), a.begin(), a.end());
+        in.insert(in.end(), b.begin(), b.end());
+    }
+    LoudnessMeter meter;
+    meter.init(SAMPLE_RATE);
+    float lo = 0, hi = -100;
+    for (size_t i = 0; i < in.size() / 2; i += 480) {
+        if (meter.process(&in[i * 2], 480) && i >= period) {
+            lo = fminf(lo, meter.short_term_lufs());
+            hi = fmaxf(hi, meter.short_term_lufs());
+        }
+    }
+    CHECK(lo >= -23.1f && hi <= -22.9f, "alternating -20/-30 dBFS reads %.2f to %.2f LUFS", lo, hi);
+}
+
+// The decimate-by-2 path against BS.1770 run at the full rate: averaging frame pairs costs
+// 20 log10(cos(pi f / fs)), 2 dB at 10 kHz, and the K-weighting at half rate adds nothing
+// beyond 0.1 dB to it up to there. Odd block sizes, which leave a frame of a pair pending
+// across calls, read exactly what one call does.
+static void test_loudness_decimation() {
+    const size_t frames = (size_t)(4 * SAMPLE_RATE);
+    const float freqs[] = { 25, 50, 100, 500, 1000, 2000, 4000, 6000, 8000, 10000 };
+    for (float f : freqs) {
+        std::vector<int16_t> in = sine(f, -23, frames);
+        float lufs = meter_lufs(in, 480);
+        double want = reference_lufs(in) + 20 * log10(cos(M_PI * f / SAMPLE_RATE));
+        CHECK(fabs(lufs - want) <= 0.1, "%.0f Hz: %.2f LUFS, expected %.2f", f, lufs, want);
+    }
+    std::vector<int16_t> in = sine(997, -23, frames);
+    float whole = meter_lufs(in, frames);
+    for (size_t block : { 1, 7, 127, 481 }) {
+        float lufs = meter_lufs(in, block);
+        CHECK(lufs == whole, "blocks of %zu read %.4f LUFS, one call %.4f", block, lufs, whole);
+    }
+}
+
+// Random full-scale stereo noise, the extremes included.
+static std::vector<int16_t> noise(size_t frames, unsigned seed) {
+    std::vector<int16_t> v(frames * 2);
+    srand(seed);
+    for (size_t i = 0; i < v.size(); ++i) {
+        v[i] = (int16_t)(rand() % 65536 - 32768);
+    }
+    v[0] = v[1] = -32768;
+    v[2] = v[3] = 32767;
+    v[4] = -32768;
+    v[5] = 32767;
+    return v;
+}
+
+static std::vector<int16_t> run_mix(channel_mode_t mode, const std::vector<int16_t> &in, size_t block) {
+    channel_mix_state_t state;
+    channel_mix_init(&state, SAMPLE_RATE);
+    std::vector<int16_t> out = in;
+    channel_kernel_fn kernel = channel_kernel(mode);
+    for (size_t i = 0; kernel && i < out.size() / 2; i += block) {
+        kernel(&out[i * 2], std::min(block, out.size() / 2 - i), &state);
+    }
+    return out;
+}
+
+// Level of the right channel against the left, by projection on a tone at `freq`.
+static float right_to_left_db(const std::vector<int16_t> &v, float freq) {
+    double p[2][2] = {};
+    size_t frames = v.size() / 2, skip = frames / 4;    // past the low-pass settling
+    for (size_t i = skip; i < frames; ++i) {
+        double w = 2 * M_PI * freq * i / SAMPLE_RATE;
+        for (int c = 0; c < 2; ++c) {
+            p[c][0] += v[i * 2 + c] * sin(w);
+            p[c][1] += v[i * 2 + c] * cos(w);
+        }
+    }
+    return (float)(10 * log10((p[1][0] * p[1][0] + p[1][1] * p[1][1]) / (p[0][0] * p[0][0] + p[0][1] * p[0][1])));
+}
+
+// Every channel mode on full-scale noise against what it is defined to do: stereo has no
+// kernel at all, the routing modes are exact, mono is the floor of the mean, and crossfeed
+// is the one-pole low-passed opposite channel at CROSSFEED_LEVEL_DB, normalized, within the
+// truncation to 16 bits and never wrapping. Block sizes change nothing.
+static void test_channel_modes() {
+    CHECK(channel_kernel(CHANNEL_STEREO) == nullptr, "stereo has a kernel");
+    CHECK(channel_kernel(CHANNEL_MODE_COUNT) == nullptr, "a mode past the table has a kernel");
+    const size_t frames = 48000;
+    std::vector<int16_t> in = noise(frames, 3);
+    const float k = 1.0f - expf(-2.0f * (float) M_PI * CROSSFEED_CUTOFF_HZ / SAMPLE_RATE);
+    const float feed = powf(10.0f, CROSSFEED_LEVEL_DB / 20.0f), norm = 1.0f / (1.0f + feed);
+    for (int m = 0; m < CHANNEL_MODE_COUNT; ++m) {
+        channel_mode_t mode = (channel_mode_t) m;
+        std::vector<int16_t> out = run_mix(mode, in, 128);
+        size_t wrong = 0;
+        double lp_l = 0, lp_r = 0;
+        for (size_t i = 0; i < frames; ++i) {
+            int l = in[i * 2], r = in[i * 2 + 1];
+            double want_l, want_r;
+            switch (mode) {
+                case CHANNEL_SWAP:  want_l = r; want_r = l; break;
+                case CHANNEL_MONO:  want_l = want_r = floor((l + r) / 2.0); break;
+                case CHANNEL_LEFT:  want_l = want_r = l; break;
+                case CHANNEL_RIGHT: want_l = want_r = r; break;
+                case CHANNEL_CROSSFEED:
+                    lp_l += k * (l - lp_l);
+                    lp_r += k * (r - lp_r);
+                    want_l = (l + feed * lp_r) * norm;
+                    want_r = (r + feed * lp_l) * norm;
+                    break;
+                default:            want_l = l; want_r = r; break;
+            }
+            // Crossfeed truncates a float: up to one step off, plus float against double rounding.
+            double tolerance = mode == CHANNEL_CROSSFEED ? 1.01 : 0.0;
+            wrong += fabs(out[i * 2] - want_l) > tolerance || fabs(out[i * 2 + 1] - want_r) > tolerance;
+        }
+        CHECK(wrong == 0, "%s: %zu frames differ from the definition", channel_mode_name(mode), wrong);
+        for (size_t block : { 1, 7, 1000 }) {
+            CHECK(run_mix(mode, in, block) == out, "%s: blocks of %zu differ", channel_mode_name(mode), block);
+        }
+    }
+
+    // Crossfeed from the left channel alone: CROSSFEED_LEVEL_DB into the right at low
+    // frequencies, where the low-pass passes it, and mostly shadowed at 5 kHz.
+    std::vector<int16_t> low = run_mix(CHANNEL_CROSSFEED, sine(100, -6, frames, 0, 1), 128);
+    std::vector<int16_t> high = run_mix(CHANNEL_CROSSFEED, sine(5000, -6, frames, 0, 1), 128);
+    float low_db = right_to_left_db(low, 100), high_db = right_to_left_db(high, 5000);
+    CHECK(fabsf(low_db - CROSSFEED_LEVEL_DB) < 0.2f, "100 Hz crossfed at %.2f dB", low_db);
+    CHECK(high_db < CROSSFEED_LEVEL_DB - 15.0f, "5 kHz crossfed at %.2f dB", high_db);
+}
+
+// Cost of each mode's kernel in Bluetooth-sized blocks, the fastest of five passes so a
+// preemption does not count. Stereo costs nothing: it has no kernel to call.
+static void bench_channel_modes() {
+    const size_t frames = 480000, block = 128;
+    std::vector<int16_t> in = noise(frames, 4), work;
+    printf("channel mix ns/frame:");
+    for (int m = 1; m < CHANNEL_MODE_COUNT; ++m) {
+        channel_mix_state_t state;
+        channel_mix_init(&state, SAMPLE_RATE);
+        channel_kernel_fn kernel = channel_kernel((channel_mode_t) m);
+        double best = 1e9;
+        for (int pass = 0; pass < 5; ++pass) {
+            work = in;
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < frames; i += block) {
+                kernel(&work[i * 2], block, &state);
+            }
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            best = fmin(best, ns / frames);
+        }
+        printf(" %s %.2f", channel_mode_name((channel_mode_t) m), best);
+        CHECK(best < 20.0, "%s: %.2f ns/frame", channel_mode_name((channel_mode_t) m), best);
+    }
+    printf("\n");
+}
+
+// Runs `cue` over `frames` of a constant `level` on both channels, in blocks of `block`.
+static std::vector<int16_t> run_cue(cue_id_t cue, int16_t level, size_t frames, size_t block) {
+    CueMixer mixer;
+    mixer.init((uint32_t) SAMPLE_RATE);
+    mixer.trigger(cue);
+    std::vector<int16_t> v(frames * 2, level);
+    for (size_t i = 0; i < frames; i += block) {
+        mixer.mix(&v[i * 2], std::min(block, frames - i));
+    }
+    CHECK(!mixer.active(), "%s: still active %zu ms later", CueMixer::cue_name(cue), frames * 1000 / (size_t) SAMPLE_RATE);
+    return v;
+}
+
+// Amplitude and phase of the left channel's `freq` component over [from, to), fitted by
+// projection, and the RMS of what is left once it is taken out.
+static void fit_tone(const std::vector<int16_t> &v, size_t from, size_t to, float freq,
+                     double *amplitude, double *residual) {
+    double s = 0, c = 0;
+    for (size_t i = from; i < to; ++i) {
+        double w = 2 * M_PI * freq * i / SAMPLE_RATE;
+        s += v[i * 2] * sin(w);
+        c += v[i * 2] * cos(w);
+    }
+    s *= 2.0 / (to - from);
+    c *= 2.0 / (to - from);
+    *amplitude = sqrt(s * s + c * c);
+    double sum = 0;
+    for (size_t i = from; i < to; ++i) {
+        double w = 2 * M_PI * freq * i / SAMPLE_RATE;
+        double e = v[i * 2] - s * sin(w) - c * cos(w);
+        sum += e * e;
+    }
+    *residual = sqrt(sum / (to - from));
+}
+
+// A cue over silence is its tones and nothing else: each at CUE_LEVEL_DB, pure to the table
+// lookup's precision, for its stated length with the gaps silent, and faded in and out so
+// that no sample steps further than the tone itself does. Over a constant stream the stream
+// ducks to CUE_DUCK_DB within CUE_DUCK_RAMP_MS, sits there through the cue (the gaps show
+// it bare), and comes back to exactly where it was. With nothing playing, mix() is never
+// needed and would change nothing.
+static void test_cue_mix() {
+    const size_t ms = (size_t) SAMPLE_RATE / 1000, frames = 400 * ms;
+    const double peak = 32767 * pow(10.0, CUE_LEVEL_DB / 20.0);
+    const double tone_step = 2 * M_PI * 1320 / SAMPLE_RATE * peak;
+    std::vector<int16_t> v = run_cue(CUE_CONNECTED, 0, frames, 128);
+    struct { size_t from, to; float freq; } tones[] = { { 0, 90 * ms, 880 }, { 120 * ms, 240 * ms, 1320 } };
+    for (auto &t : tones) {
+        double amplitude, residual;
+        size_t fade = CUE_FADE_MS * ms;
+        fit_tone(v, t.from + fade, t.to - fade, t.freq, &amplitude, &residual);
+        CHECK(fabs(20 * log10(amplitude / 32768) - CUE_LEVEL_DB) < 0.1, "%.0f Hz at %.2f dBFS", t.freq,
+              20 * log10(amplitude / 32768));
+        CHECK(20 * log10(residual / amplitude) < -60, "%.0f Hz: residual %.1f dB", t.freq, 20 * log10(residual / amplitude));
+    }
+    int max_step = 0, in_gap = 0;
+    size_t last = 0;
+    for (size_t i = 1; i < frames; ++i) {
+        max_step = std::max(max_step, abs(v[i * 2] - v[i * 2 - 2]));
+        in_gap += i >= 90 * ms && i < 120 * ms && v[i * 2] != 0;
+        if (v[i * 2] != 0) last = i;
+    }
+    CHECK(max_step <= tone_step + 2, "a %d step, the 1320 Hz tone steps %.0f", max_step, tone_step);
+    CHECK(in_gap == 0, "%d samples in the gap", in_gap);
+    CHECK(last < 240 * ms && last > 239 * ms, "the cue ends after %.2f ms, expected 240", last / (double) ms);
+    CHECK(v == run_cue(CUE_CONNECTED, 0, frames, 7), "a cue over silence depends on the block size");
+
+    // Ducking, seen bare in CUE_PROFILE_CHANGE's 60 ms gap.
+    const int16_t level = 10000;
+    const int16_t ducked = (int16_t)(level * powf(10.0f, CUE_DUCK_DB / 20.0f));
+    v = run_cue(CUE_PROFILE_CHANGE, level, frames, 128);
+    for (size_t i = 60 * ms; i < 120 * ms; ++i) {
+        if (abs(v[i * 2] - ducked) > 1) {
+            CHECK(false, "%zu ms into the cue the stream is at %d, expected %d", i / ms, v[i * 2], ducked);
+            break;
+        }
+    }
+    size_t ramp = CUE_DUCK_RAMP_MS * ms;
+    int overlay_peak = 0;
+    for (size_t i = ramp; i < 50 * ms; ++i) overlay_peak = std::max(overlay_peak, abs(v[i * 2] - ducked));
+    CHECK(fabs(overlay_peak - peak) < peak * 0.02, "the cue over the ducked stream peaks %d from it, expected %.0f",
+          overlay_peak, peak);
+    size_t restored = 0;
+    while (restored < frames && v[(frames - 1 - restored) * 2] == level) restored++;
+    CHECK(frames - restored <= 180 * ms + 128 + ramp, "the stream is back at %d only after %zu ms", level,
+          (frames - restored) / ms);
+
+    CueMixer idle;
+    idle.init((uint32_t) SAMPLE_RATE);
+    std::vector<int16_t> in = noise(1024, 5), out = in;
+    CHECK(!idle.active(), "a mixer with nothing triggered is active");
+    idle.mix(&out[0], 1024);
+    CHECK(out == in, "mixing with nothing playing changed the stream");
+}
+
+// Cost of mixing a playing cue, per frame, the fastest of five passes; with nothing playing
+// the consumer only tests active().
+static void bench_cue_mix() {
+    const size_t frames = 48000 / 10, block = 128;      // CUE_LOW_BUFFER is 80 ms
+    std::vector<int16_t> in = noise(frames, 6), work;
+    double best = 1e9;
+    for (int pass = 0; pass < 5; ++pass) {
+        CueMixer mixer;
+        mixer.init((uint32_t) SAMPLE_RATE);
+        work = in;
+        mixer.trigger(CUE_LOW_BUFFER);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i + block <= frames && mixer.active(); i += block) {
+            mixer.mix(&work[i * 2], block);
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        best = fmin(best, ns / (frames - frames % block));
+    }
+    printf("cue mix: %.2f ns/frame while a cue plays\n", best);
+    CHECK(best < 50.0, "%.2f ns/frame", best);
+}
+
+// Tones with a whole number of periods in every ANALYSIS_FRAMES window, so that projection on
+// each one's sine and cosine is an exact least-squares fit wherever the window starts.
+#define ANALYSIS_FRAMES     1024
+#define BIN_HZ              (SAMPLE_RATE / ANALYSIS_FRAMES)
+#define FAR_BINS            43      // 2 kHz
+
+// Sum of tones at bins `bins` (multiples of BIN_HZ), each at `dbfs`, on both channels.
+static std::vector<int16_t> tones(const std::vector<int> &bins, float dbfs, size_t frames) {
+    std::vector<int16_t> v(frames * 2);
+    double amplitude = 32768.0 * pow(10.0, dbfs / 20.0);
+    for (size_t i = 0; i < frames; ++i) {
+        double s = 0;
+        for (size_t k = 0; k < bins.size(); ++k) {
+            s += amplitude * sin(2 * M_PI * bins[k] * i / ANALYSIS_FRAMES + k);
+        }
+        v[i * 2] = v[i * 2 + 1] = (int16_t) lrint(s);
+    }
+    return v;
+}
+
+// Spectral splatter of the left channel in the Hann-windowed ANALYSIS_FRAMES at `from`: the
+// power more than `guard` bins (by default the window's main lobe) from every tone in
+// `bins`, in dB against the whole. Clicks, splices and distortion all spread power there; a tone whose phase moves
+// smoothly does not.
+static double splatter_db(const std::vector<int16_t> &v, size_t from, const std::vector<int> &bins, int guard = 2) {
+    static double window[ANALYSIS_FRAMES], sin_table[ANALYSIS_FRAMES], cos_table[ANALYSIS_FRAMES];
+    if (window[1] == 0) {
+        for (size_t i = 0; i < ANALYSIS_FRAMES; ++i) {
+            window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / ANALYSIS_FRAMES);
+            sin_table[i] = sin(2 * M_PI * i / ANALYSIS_FRAMES);
+            cos_table[i] = cos(2 * M_PI * i / ANALYSIS_FRAMES);
+        }
+    }
+    double x[ANALYSIS_FRAMES], out = 0, total = 0;
+    for (size_t i = 0; i < ANALYSIS_FRAMES; ++i) x[i] = v[(from + i) * 2] * window[i];
+    for (int k = 1; k < ANALYSIS_FRAMES / 2; ++k) {
+        double s = 0, c = 0;
+        for (size_t i = 0; i < ANALYSIS_FRAMES; ++i) {
+            size_t phase = (size_t) k * i % ANALYSIS_FRAMES;
+            s += x[i] * sin_table[phase];
+            c += x[i] * cos_table[phase];
+        }
+        double power = s * s + c * c;
+        bool near = false;
+        for (int bin : bins) near |= abs(k - bin) <= guard;
+        total += power;
+        if (!near) out += power;
+    }
+    return 10 * log10(out / total + 1e-12);
+}
+
+// Worst and median splatter over half-overlapping windows from `from` on.
+static void splatter_stats(const std::vector<int16_t> &v, size_t from, const std::vector<int> &bins,
+                           double *worst, double *median) {
+    std::vector<double> r;
+    for (size_t at = from; at + ANALYSIS_FRAMES <= v.size() / 2; at += ANALYSIS_FRAMES / 2) {
+        r.push_back(splatter_db(v, at, bins));
+    }
+    std::sort(r.begin(), r.end());
+    *worst = r.back();
+    *median = r[r.size() / 2];
+}
+
+struct pull_t {
+    const std::vector<int16_t> *in;
+    size_t pos;
+};
+
+static void pull_input(void *ctx, int16_t *dst, size_t frames) {
+    pull_t *p = (pull_t*) ctx;
+    for (size_t i = 0; i < frames; ++i, ++p->pos) {
+        dst[i * 2] = p->in->at(p->pos * 2);
+        dst[i * 2 + 1] = p->in->at(p->pos * 2 + 1);
+    }
+}
+
+// Zero crossings of the left channel from `from` on, as a frequency.
+static double crossing_hz(const std::vector<int16_t> &v, size_t from) {
+    size_t crossings = 0, first = 0, last = 0;
+    for (size_t i = from + 1; i < v.size() / 2; ++i) {
+        if ((v[i * 2 - 2] < 0) != (v[i * 2] < 0)) {
+            if (!crossings++) first = i;
+            last = i;
+        }
+    }
+    return (crossings - 1) / 2.0 * SAMPLE_RATE / (last - first);
+}
+
+// Catching up WSOLA_MAX_RATE of the stream, both ways: the time-stretch at its full rate, and
+// what the ring does without it, dropping a USB packet (48 frames) whenever that much has
+// built up and crossfading over the gap. Both catch up the same amount. The stretch keeps
+// the pitch and splatters far less: on a tone 30 dB less at the worst moment; on several
+// tones, which leave WSOLA no segment that lines up for all of them, 6 dB less at the worst
+// and 10 dB less typically.
+static void test_stretch_against_splice() {
+    const size_t frames = 2 * (size_t) SAMPLE_RATE, block = 128, drop = 48, settle = 4096;
+    const std::vector<int> one = { 22 }, several = { 5, 13, 22, 37, 61 };
+    for (const std::vector<int> *bins : { &one, &several }) {
+        const char *name = bins->size() == 1 ? "tone" : "several tones";
+        std::vector<int16_t> in = tones(*bins, bins->size() == 1 ? -6 : -20, frames * 2);
+        std::vector<int16_t> stretched(frames * 2), spliced(frames * 2);
+
+        TimeStretch stretch;
+        stretch.set_rate(1.0f + WSOLA_MAX_RATE);
+        pull_t p = { &in, 0 };
+        for (size_t i = 0; i < frames; i += block) {
+            stretch.read(&stretched[i * 2], block, pull_input, &p);
+        }
+        size_t gained = p.pos - stretch.buffered_frames() - frames;
+
+        Splicer splicer;
+        splicer.init();
+        size_t pos = 0;
+        double owed = 0;
+        for (size_t i = 0; i < frames; i += block) {
+            memcpy(&spliced[i * 2], &in[pos * 2], block * 4);
+            splicer.audio(&spliced[i * 2], block);
+            pos += block;
+            for (owed += (double) block * gained / frames; owed >= drop; owed -= drop) {
+                pos += drop;
+                splicer.discontinuity();
+            }
+        }
+
+        double stretch_worst, stretch_median, splice_worst, splice_median;
+        splatter_stats(stretched, settle, *bins, &stretch_worst, &stretch_median);
+        splatter_stats(spliced, settle, *bins, &splice_worst, &splice_median);
+        printf("catching up %zu frames of %s: time-stretch splatter %.1f dB worst, %.1f median; "
+               "%u splices %.1f dB worst, %.1f median\n", gained, name, stretch_worst, stretch_median,
+               (unsigned) splicer.splices, splice_worst, splice_median);
+        CHECK(fabs((double) gained / frames - WSOLA_MAX_RATE) < 0.01, "%s: the stretch caught up %zu frames", name, gained);
+        CHECK(pos - frames <= gained && pos - frames + drop > gained, "%s: the splices caught up %zu frames, the stretch %zu",
+              name, pos - frames, gained);
+        double margin = bins->size() == 1 ? 30 : 6;
+        CHECK(stretch_worst < splice_worst - margin, "%s: worst stretch %.1f dB, splices %.1f dB", name,
+              stretch_worst, splice_worst);
+        CHECK(stretch_median < splice_median - 10, "%s: median stretch %.1f dB, splices %.1f dB", name,
+              stretch_median, splice_median);
+        if (bins->size() == 1) {
+            double hz = crossing_hz(stretched, settle), want = one[0] * BIN_HZ;
+            CHECK(fabs(hz / want - 1) < 0.002, "stretched tone at %.1f Hz, expected %.1f", hz, want);
+        }
+    }
+}
+
+// Drops and pads in a tone, hard and through Splicer, each in the middle of an analysis
+// window. A hard cut steps the waveform and splatters across the spectrum; the splice
+// crossfades from the predicted continuation instead. Splatter here is what lands more than
+// 2 kHz from the tone: close in, any 1.3 ms crossfade between two phases of a tone is an
+// amplitude dip, which widens the tone's skirt whichever way it is done. Over drops and
+// gaps of several lengths at several phases of the tone the splice keeps that below -45 dB
+// every time, and 15 dB under the hard cuts on average. (A hard cut that happens to land a
+// whole period on can do better than the splice, so there is no per-case comparison.)
+static void test_splice_splatter() {
+    const std::vector<int> bins = { 22 };
+    const size_t block = 128, frames = 8 * ANALYSIS_FRAMES, at = 4 * ANALYSIS_FRAMES;
+    std::vector<int16_t> in = tones(bins, -6, frames * 2);
+    double hard_sum = 0, splice_sum = 0, worst = -1e9;
+    int cases = 0;
+    for (int pad = 0; pad < 2; ++pad) {
+        for (size_t gap : { 17, 48, 128, 300 }) {
+            for (size_t shift : { 0, 11, 23 }) {
+                // Output: `at` frames of the tone, then the gap (dropped input or padded output).
+                std::vector<int16_t> hard(frames * 2), spliced(frames * 2);
+                Splicer splicer;
+                splicer.init();
+                size_t pos = shift;
+                for (size_t i = 0; i < frames; i += block) {
+                    size_t n = std::min(block, frames - i);
+                    if (i == at && pad) {
+                        size_t padded = std::min(gap, frames - i);
+                        memset(&hard[i * 2], 0, padded * 4);
+                        splicer.pad(&spliced[i * 2], padded);
+                        i += padded;
+                        n = std::min(block, frames - i);
+                        if (n == 0) break;
+                    } else if (i == at) {
+                        pos += gap;
+                        splicer.discontinuity();
+                    }
+                    memcpy(&hard[i * 2], &in[pos * 2], n * 4);
+                    memcpy(&spliced[i * 2], &in[pos * 2], n * 4);
+                    splicer.audio(&spliced[i * 2], n);
+                    pos += n;
+                }
+                double h = splatter_db(hard, at - ANALYSIS_FRAMES / 2, bins, FAR_BINS);
+                double s = splatter_db(spliced, at - ANALYSIS_FRAMES / 2, bins, FAR_BINS);
+                CHECK(s < -45, "%s of %zu frames at phase %zu: splice splatter %.1f dB", pad ? "pad" : "drop",
+                      gap, shift, s);
+                hard_sum += h;
+                splice_sum += s;
+                worst = fmax(worst, s);
+                cases++;
+            }
+        }
+    }
+    printf("splice splatter beyond 2 kHz of the tone: %.1f dB average, %.1f dB worst; hard cuts %.1f dB average\n",
+           splice_sum / cases, worst, hard_sum / cases);
+    CHECK(splice_sum / cases < hard_sum / cases - 15, "splices %.1f dB, hard cuts %.1f dB on average",
+          splice_sum / cases, hard_sum / cases);
+}
+
+int main() {
+    test_eq_analytic();
+    test_eq_filter_matches_response();
+    test_eq_update_mid_stream();
+    test_eq_limits();
+    test_limiter_square_wave();
+    test_limiter_transparent();
+    test_loudness_ebu();
+    test_loudness_decimation();
+    test_channel_modes();
+    bench_channel_modes();
+    test_cue_mix();
+    bench_cue_mix();
+    test_stretch_against_splice();
+    test_splice_splatter();
+    printf("dsp_test: %d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "esp_a2dp_api.h"
+#include "esp_bt_defs.h"
+
+// The ESP32-A2DP library's source as far as firmware/src uses it. It keeps the callbacks
+// for a simulator, which plays the sink: it waits for a page in host_a2dp_pages and answers
+// it through host_a2dp_connection_cb. start() takes host_a2dp_start_ms, standing in for the
+// controller and Bluedroid coming up.
+
+typedef void (*host_a2dp_connection_cb_t)(esp_a2d_connection_state_t state, void *obj);
+typedef void (*host_a2dp_audio_cb_t)(esp_a2d_audio_state_t state, void *obj);
+
+inline host_a2dp_connection_cb_t host_a2dp_connection_cb = nullptr;
+inline void *host_a2dp_connection_obj = nullptr;
+inline host_a2dp_audio_cb_t host_a2dp_audio_cb = nullptr;
+inline void *host_a2dp_audio_obj = nullptr;
+inline int32_t (*host_a2dp_data_cb)(uint8_t *data, int32_t len) = nullptr;
+inline int host_a2dp_start_ms = 0;
+inline std::atomic<bool> host_a2dp_started{false};
+inline std::atomic<int> host_a2dp_pages{0};     // connect_to() calls
+inline esp_bd_addr_t host_a2dp_paged = {};      // the last sink paged, written before the count
+inline esp_bd_addr_t host_a2dp_peer = {};       // set by the simulator before it reports a connection
+inline uint8_t host_a2dp_volume = 0;
+
+class BluetoothA2DPSource {
+public:
+    void set_auto_reconnect(bool) {}
+    void set_ssid_callback(bool (*)(const char *name, esp_bd_addr_t bda, int rssi)) {}
+    void set_stream_reader(void *, bool) {}
+    void set_data_callback(int32_t (*cb)(uint8_t *data, int32_t len)) { host_a2dp_data_cb = cb; }
+    void set_avrc_passthru_command_callback(void (*)(uint8_t key, bool released)) {}
+
+    void set_on_connection_state_changed(host_a2dp_connection_cb_t cb, void *obj = nullptr) {
+        host_a2dp_connection_cb = cb;
+        host_a2dp_connection_obj = obj;
+    }
+
+    void set_on_audio_state_changed(host_a2dp_audio_cb_t cb, void *obj = nullptr) {
+        host_a2dp_audio_cb = cb;
+        host_a2dp_audio_obj = obj;
+    }
+
+    void start() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(host_a2dp_start_ms));
+        host_a2dp_started = true;
+    }
+
+    bool connect_to(esp_bd_addr_t bda) {
+        memcpy(host_a2dp_paged, bda, sizeof(host_a2dp_paged));
+        host_a2dp_pages++;
+        return true;
+    }
+
+    esp_bd_addr_t *get_last_peer_address() { return &host_a2dp_peer; }
+    void set_volume(uint8_t volume) { host_a2dp_volume = volume; }
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "esp_err.h"
+
+typedef enum {
+    ESP_A2D_CONNECTION_STATE_DISCONNECTED,
+    ESP_A2D_CONNECTION_STATE_CONNECTING,
+    ESP_A2D_CONNECTION_STATE_CONNECTED,
+    ESP_A2D_CONNECTION_STATE_DISCONNECTING,
+} esp_a2d_connection_state_t;
+
+typedef enum {
+    ESP_A2D_AUDIO_STATE_REMOTE_SUSPEND,
+    ESP_A2D_AUDIO_STATE_STOPPED,
+    ESP_A2D_AUDIO_STATE_STARTED,
+} esp_a2d_audio_state_t;
+
+typedef enum {
+    ESP_A2D_MEDIA_CTRL_NONE,
+    ESP_A2D_MEDIA_CTRL_CHECK_SRC_RDY,
+    ESP_A2D_MEDIA_CTRL_START,
+    ESP_A2D_MEDIA_CTRL_STOP,
+    ESP_A2D_MEDIA_CTRL_SUSPEND,
+} esp_a2d_media_ctrl_t;
+
+inline esp_a2d_media_ctrl_t host_a2d_media_ctrl = ESP_A2D_MEDIA_CTRL_NONE;     // the last one sent
+
+static inline esp_err_t esp_a2d_media_ctrl(esp_a2d_media_ctrl_t ctrl) {
+    host_a2d_media_ctrl = ctrl;
+    return ESP_OK;
+}
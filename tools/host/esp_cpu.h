@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+#include <x86intrin.h>
+
+static inline uint32_t esp_cpu_get_cycle_count() {
+    return (uint32_t) __rdtsc();
+}
+
+static inline int esp_cpu_get_core_id() {
+    return 0;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+// Host stand-ins for the ESP-IDF headers firmware/src includes, for the host builds in
+// tools/: only what the firmware modules use, single-threaded unless noted.
+
+typedef int esp_err_t;
+
+#define ESP_OK      0
+#define ESP_FAIL    -1
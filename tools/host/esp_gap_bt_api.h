@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include "esp_err.h"
+#include "esp_bt_defs.h"
+
+// Classic Bluetooth GAP as far as firmware/src uses it: the calls are only counted.
+typedef enum {
+    ESP_BT_INQ_MODE_GENERAL_INQUIRY,
+    ESP_BT_INQ_MODE_LIMITED_INQUIRY,
+} esp_bt_inq_mode_t;
+
+inline std::atomic<int> host_gap_discoveries{0};    // start_discovery() calls
+inline uint16_t host_gap_page_timeout = 0x2000;     // slots, the controller's default
+
+static inline esp_err_t esp_bt_gap_start_discovery(esp_bt_inq_mode_t, uint8_t, uint8_t) {
+    host_gap_discoveries++;
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_bt_gap_cancel_discovery() {
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_bt_gap_set_page_timeout(uint16_t slots) {
+    host_gap_page_timeout = slots;
+    return ESP_OK;
+}
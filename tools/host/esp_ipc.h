@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+// One core on the host: the call runs right here.
+typedef void (*esp_ipc_func_t)(void *arg);
+
+static inline esp_err_t esp_ipc_call_blocking(uint32_t, esp_ipc_func_t func, void *arg) {
+    func(arg);
+    return ESP_OK;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdint.h>
+
+// Only the CPU clock, for the event trace's cycle counts (the TSC stands in for the cycle counter).
+static inline uint32_t esp_rom_get_cpu_ticks_per_us() {
+    return 240;
+}
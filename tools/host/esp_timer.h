@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+#include "esp_err.h"
+
+// Simulated time: the test or simulator sets it before each call into the firmware. A
+// simulator whose firmware runs in threads sets host_wall_clock instead, and the time is
+// then the real time since the process started, as on the device since power-on.
+inline int64_t host_time_us = 0;
+inline bool host_wall_clock = false;
+inline const std::chrono::steady_clock::time_point host_power_on = std::chrono::steady_clock::now();
+
+static inline int64_t esp_timer_get_time() {
+    if (host_wall_clock) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - host_power_on).count();
+    }
+    return host_time_us;
+}
+
+// Timers do not run by themselves: host_run_timers() fires the ones that are due.
+typedef struct {
+    void (*callback)(void *arg);
+    void *arg;
+    const char *name;
+} esp_timer_create_args_t;
+
+struct host_timer_t {
+    esp_timer_create_args_t args;
+    uint64_t period_us;
+    int64_t next_us;
+    bool running;
+};
+typedef host_timer_t *esp_timer_handle_t;
+
+inline std::vector<host_timer_t*> host_timers;
+
+static inline esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out) {
+    *out = new host_timer_t{*args, 0, 0, false};
+    host_timers.push_back(*out);
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+    if (timer->running) return ESP_FAIL;    // ESP_ERR_INVALID_STATE on the device
+    timer->period_us = period_us;
+    timer->next_us = host_time_us + (int64_t) period_us;
+    timer->running = true;
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    if (!timer->running) return ESP_FAIL;
+    timer->running = false;
+    return ESP_OK;
+}
+
+static inline void host_run_timers() {
+    for (host_timer_t *t : host_timers) {
+        while (t->running && t->next_us <= host_time_us) {
+            t->next_us += (int64_t) t->period_us;
+            t->args.callback(t->args.arg);
+        }
+    }
+}
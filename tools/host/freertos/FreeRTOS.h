@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+#include "esp_err.h"
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE      1
+#define pdFALSE     0
+#define pdPASS      pdTRUE
+
+// One tick per millisecond, as configured for the firmware.
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+#define portMAX_DELAY       ((TickType_t) 0xffffffffu)
+
+// Critical sections are a real lock, so the threaded host tests see the same exclusion.
+typedef struct {
+    std::mutex lock;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {}
+#define portENTER_CRITICAL(mux)     (mux)->lock.lock()
+#define portEXIT_CRITICAL(mux)      (mux)->lock.unlock()
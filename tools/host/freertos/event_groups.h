@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include "freertos/FreeRTOS.h"
+
+// Event groups on a mutex and a condition variable. Only the static creation is provided.
+typedef uint32_t EventBits_t;
+
+struct StaticEventGroup_t {
+    std::mutex lock;
+    std::condition_variable changed;
+    EventBits_t bits = 0;
+};
+typedef StaticEventGroup_t *EventGroupHandle_t;
+
+static inline EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t *storage) {
+    storage->bits = 0;
+    return storage;
+}
+
+static inline EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+    std::lock_guard<std::mutex> hold(group->lock);
+    return group->bits;
+}
+
+static inline EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    std::lock_guard<std::mutex> hold(group->lock);
+    group->bits |= bits;
+    group->changed.notify_all();
+    return group->bits;
+}
+
+static inline EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear,
+                                              BaseType_t all, TickType_t ticks) {
+    std::unique_lock<std::mutex> hold(group->lock);
+    auto done = [&] { return all ? (group->bits & bits) == bits : (group->bits & bits) != 0; };
+    if (ticks == portMAX_DELAY) {
+        group->changed.wait(hold, done);
+    } else {
+        group->changed.wait_for(hold, std::chrono::milliseconds(ticks), done);
+    }
+    EventBits_t value = group->bits;
+    if (clear && done()) group->bits &= ~bits;
+    return value;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+
+// Byte buffer only, never blocks, and at most one item out at a time (as AudioBridge uses it).
+typedef enum { RINGBUF_TYPE_NOSPLIT, RINGBUF_TYPE_ALLOWSPLIT, RINGBUF_TYPE_BYTEBUF } RingbufferType_t;
+
+typedef struct {
+    uint8_t *storage;
+    size_t size;
+    size_t read;            // oldest byte
+    size_t fill;            // bytes queued, including any item out
+    size_t out;             // bytes of the item out, 0 if none
+} StaticRingbuffer_t;
+
+typedef StaticRingbuffer_t *RingbufHandle_t;
+
+static inline RingbufHandle_t xRingbufferCreateStatic(size_t size, RingbufferType_t type, uint8_t *storage,
+                                                      StaticRingbuffer_t *rb) {
+    if (type != RINGBUF_TYPE_BYTEBUF) {
+        return NULL;
+    }
+    *rb = { storage, size, 0, 0, 0 };
+    return rb;
+}
+
+static inline BaseType_t xRingbufferSend(RingbufHandle_t rb, const void *data, size_t len, TickType_t) {
+    if (len > rb->size - rb->fill) {
+        return pdFALSE;
+    }
+    size_t write = (rb->read + rb->fill) % rb->size;
+    size_t first = len < rb->size - write ? len : rb->size - write;
+    memcpy(rb->storage + write, data, first);
+    memcpy(rb->storage, (const uint8_t*) data + first, len - first);
+    rb->fill += len;
+    return pdTRUE;
+}
+
+static inline void *xRingbufferReceiveUpTo(RingbufHandle_t rb, size_t *len, TickType_t, size_t max) {
+    size_t avail = rb->fill - rb->out;
+    if (rb->out != 0 || avail == 0 || max == 0) {
+        return NULL;
+    }
+    size_t n = rb->size - rb->read;             // up to the wrap, like the real one
+    if (n > avail) n = avail;
+    if (n > max) n = max;
+    rb->out = n;
+    *len = n;
+    return rb->storage + rb->read;
+}
+
+static inline void vRingbufferReturnItem(RingbufHandle_t rb, void *) {
+    rb->read = (rb->read + rb->out) % rb->size;
+    rb->fill -= rb->out;
+    rb->out = 0;
+}
+
+static inline size_t xRingbufferGetCurFreeSize(RingbufHandle_t rb) {
+    return rb->size - rb->fill;
+}
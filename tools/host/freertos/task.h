@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "freertos/FreeRTOS.h"
+
+// Tasks are threads, as far as firmware/src uses them: created, deleting themselves, named,
+// and woken by direct-to-task notifications (a counting semaphore). Priorities and stack
+// sizes are ignored. The thread that calls app_main() is the task "main".
+
+typedef void (*TaskFunction_t)(void *arg);
+
+struct host_task_t {
+    const char *name;
+    std::mutex lock;
+    std::condition_variable wake;
+    uint32_t notified = 0;
+};
+typedef host_task_t *TaskHandle_t;
+
+inline thread_local host_task_t *host_task_self = nullptr;
+
+static inline TaskHandle_t xTaskGetCurrentTaskHandle() {
+    if (host_task_self == nullptr) {
+        host_task_self = new host_task_t;
+        host_task_self->name = "main";
+    }
+    return host_task_self;
+}
+
+static inline char *pcTaskGetName(TaskHandle_t task) {
+    return (char*)(task != nullptr ? task : xTaskGetCurrentTaskHandle())->name;
+}
+
+static inline BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t, void *arg, UBaseType_t,
+                                     TaskHandle_t *out) {
+    host_task_t *task = new host_task_t;
+    task->name = name;
+    if (out != nullptr) *out = task;
+    std::thread([=] {
+        host_task_self = task;
+        fn(arg);
+    }).detach();
+    return pdPASS;
+}
+
+// A deleted task's thread stays parked until the process exits: only self-deletion is used.
+static inline void vTaskDelete(TaskHandle_t) {
+    for (;;) std::this_thread::sleep_for(std::chrono::hours(1));
+}
+
+static inline void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+static inline void xTaskNotifyGive(TaskHandle_t task) {
+    std::lock_guard<std::mutex> hold(task->lock);
+    task->notified++;
+    task->wake.notify_one();
+}
+
+static inline uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+    host_task_t *self = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> hold(self->lock);
+    auto pending = [self] { return self->notified != 0; };
+    if (ticks == portMAX_DELAY) {
+        self->wake.wait(hold, pending);
+    } else {
+        self->wake.wait_for(hold, std::chrono::milliseconds(ticks), pending);
+    }
+    uint32_t value = self->notified;
+    if (value != 0) self->notified = clear ? 0 : value - 1;
+    return value;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "esp_err.h"
+
+// Flash contents, kept in memory for the life of the process: a test "reboots" by starting
+// over with new objects on top of it. Keys are "namespace/key".
+inline std::map<std::string, std::vector<uint8_t>> host_nvs;
+inline std::vector<std::string> host_nvs_handles;   // namespace of each open handle
+inline int host_nvs_commits = 0;
+
+#define ESP_ERR_NVS_NOT_FOUND           0x1102
+#define ESP_ERR_NVS_INVALID_HANDLE      0x1107
+#define ESP_ERR_NVS_READ_ONLY           0x1108
+#define ESP_ERR_NVS_INVALID_LENGTH      0x110c
+#define ESP_ERR_NVS_NO_FREE_PAGES       0x110d
+#define ESP_ERR_NVS_NEW_VERSION_FOUND   0x1110
+
+typedef uint32_t nvs_handle_t;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+
+// Read-only opens of a namespace with nothing in it fail, as on the device. The mode is
+// kept in the top bit of the handle.
+static inline esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *out) {
+    std::string prefix = std::string(name) + "/";
+    if (mode == NVS_READONLY) {
+        auto it = host_nvs.lower_bound(prefix);
+        if (it == host_nvs.end() || it->first.compare(0, prefix.size(), prefix) != 0) {
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+    }
+    host_nvs_handles.push_back(prefix);
+    *out = (nvs_handle_t)(host_nvs_handles.size() - 1) | (mode == NVS_READONLY ? 0x80000000u : 0);
+    return ESP_OK;
+}
+
+static inline void nvs_close(nvs_handle_t) {}
+
+static inline esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out, size_t *length) {
+    uint32_t index = handle & 0x7fffffffu;
+    if (index >= host_nvs_handles.size()) return ESP_ERR_NVS_INVALID_HANDLE;
+    auto it = host_nvs.find(host_nvs_handles[index] + key);
+    if (it == host_nvs.end()) return ESP_ERR_NVS_NOT_FOUND;
+    if (out == nullptr) {
+        *length = it->second.size();
+        return ESP_OK;
+    }
+    if (*length < it->second.size()) return ESP_ERR_NVS_INVALID_LENGTH;
+    memcpy(out, it->second.data(), it->second.size());
+    *length = it->second.size();
+    return ESP_OK;
+}
+
+static inline esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length) {
+    uint32_t index = handle & 0x7fffffffu;
+    if (index >= host_nvs_handles.size()) return ESP_ERR_NVS_INVALID_HANDLE;
+    if (handle & 0x80000000u) return ESP_ERR_NVS_READ_ONLY;
+    const uint8_t *p = (const uint8_t*) value;
+    host_nvs[host_nvs_handles[index] + key].assign(p, p + length);
+    return ESP_OK;
+}
+
+static inline esp_err_t nvs_commit(nvs_handle_t) {
+    host_nvs_commits++;
+    return ESP_OK;
+}
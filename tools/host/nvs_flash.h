@@ -0,0 +1,12 @@
+#pragma once
+
+#include "nvs.h"
+
+static inline esp_err_t nvs_flash_init() {
+    return ESP_OK;
+}
+
+static inline esp_err_t nvs_flash_erase() {
+    host_nvs.clear();
+    return ESP_OK;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+// TinyUSB device as far as firmware/src uses it. A simulator plays the USB host: it sets
+// host_usb_mounted when it has configured the device, and calls tud_sof_cb() every frame
+// while host_usb_sof is set.
+
+typedef struct {
+    struct {
+        uint8_t recipient : 5;
+        uint8_t type : 2;
+        uint8_t direction : 1;
+    } bmRequestType_bit;
+    uint8_t bRequest;
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint16_t wLength;
+} tusb_control_request_t;
+
+enum { CONTROL_STAGE_IDLE, CONTROL_STAGE_SETUP, CONTROL_STAGE_DATA, CONTROL_STAGE_ACK };
+
+inline std::atomic<bool> host_usb_mounted{false};
+inline std::atomic<bool> host_usb_sof{false};
+
+extern "C" void tud_sof_cb(uint32_t frame_count);
+
+static inline bool tud_mounted() {
+    return host_usb_mounted;
+}
+
+static inline void tud_sof_cb_enable(bool enable) {
+    host_usb_sof = enable;
+}
+
+static inline bool tud_control_xfer(uint8_t, tusb_control_request_t const *, void *, uint16_t) {
+    return true;
+}
+
+static inline bool tud_control_status(uint8_t, tusb_control_request_t const *) {
+    return true;
+}
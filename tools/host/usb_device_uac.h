@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "esp_err.h"
+
+// The esp usb_device_uac component. Init takes host_uac_init_ms, standing in for the
+// TinyUSB driver and its task coming up, then keeps the callbacks for a simulator and sets
+// host_uac_ready: from then on the device is on the bus and the host can enumerate it.
+
+typedef esp_err_t (*uac_output_cb_t)(uint8_t *buf, size_t len, void *cb_ctx);
+typedef esp_err_t (*uac_input_cb_t)(uint8_t *buf, size_t len, size_t *bytes_read, void *cb_ctx);
+typedef void (*uac_set_mute_cb_t)(uint32_t mute, void *cb_ctx);
+typedef void (*uac_set_volume_cb_t)(uint32_t volume, void *cb_ctx);
+
+typedef struct {
+    uac_output_cb_t output_cb;
+    uac_input_cb_t input_cb;
+    uac_set_mute_cb_t set_mute_cb;
+    uac_set_volume_cb_t set_volume_cb;
+    void *cb_ctx;
+} uac_device_config_t;
+
+inline uac_device_config_t host_uac_config = {};
+inline int host_uac_init_ms = 0;
+inline std::atomic<bool> host_uac_ready{false};
+
+static inline esp_err_t uac_device_init(uac_device_config_t *config) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(host_uac_init_ms));
+    host_uac_config = *config;
+    host_uac_ready = true;
+    return ESP_OK;
+}
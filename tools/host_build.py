@@ -0,0 +1,41 @@
+"""Builds the host programs in tools/ against firmware/src and the ESP-IDF stand-ins in
+tools/host. Each build lands in the temp directory under a name that includes its flags,
+and is only redone when a source or header is newer.
+"""
+import hashlib
+import os
+import subprocess
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SRC = os.path.join(HERE, "..", "firmware", "src")
+SHIMS = os.path.join(HERE, "host")
+
+# AudioBridge and everything it links, without the event trace and timing log.
+BRIDGE_SOURCES = ["audio_bridge.cpp", "channel_mix.cpp", "clock_estimator.cpp", "cue_mixer.cpp",
+                  "jitter_meter.cpp", "loudness.cpp", "parametric_eq.cpp", "peak_limiter.cpp",
+                  "profile.cpp", "rate_feedback.cpp", "splice.cpp", "time_stretch.cpp"]
+BRIDGE_FLAGS = ["-DAUDIO_TRACE=0", "-DTIMING_LOG=0"]
+
+
+def headers():
+    for d in (SRC, SHIMS, os.path.join(SHIMS, "freertos")):
+        for f in os.listdir(d):
+            if f.endswith(".h"):
+                yield os.path.join(d, f)
+
+
+def build(name, sources, flags=()):
+    """Compiles tools/<name>.cpp with firmware `sources`; returns the executable's path."""
+    tag = hashlib.sha1(" ".join(flags).encode()).hexdigest()[:8]
+    exe = os.path.join(tempfile.gettempdir(), f"uaca2dp_{name}_{tag}")
+    paths = [os.path.join(HERE, name + ".cpp")] + [os.path.join(SRC, s) for s in sources]
+    if os.path.exists(exe) and os.path.getmtime(exe) > max(os.path.getmtime(f) for f in paths + list(headers())):
+        return exe
+    # Built under a private name and moved into place, so parallel callers never see half an executable.
+    tmp = f"{exe}.{os.getpid()}"
+    cmd = [os.environ.get("CXX", "g++"), "-O2", "-g", "-std=gnu++17", "-Wall", "-I", SHIMS, "-I", SRC,
+           "-o", tmp] + list(flags) + paths + ["-lm", "-pthread"]
+    subprocess.run(cmd, check=True)
+    os.replace(tmp, exe)
+    return exe
@@ -0,0 +1,208 @@
+#!/usr/bin/env python3
+"""Host tests of the firmware modules.
+
+Each test is a program in tools/ built against firmware/src with the ESP-IDF stand-ins in
+tools/host (see host_build.py). It prints what it checks and exits non-zero on a failure;
+the output is only shown for failing tests unless -v is given. The sim_ checks run the
+whole pipeline over simulated timelines through pipeline_sim.py, or the bring-up through
+boot_sim, and report the same way.
+
+    python3 tools/host_tests.py [-v] [bridge_test ...]
+"""
+import argparse
+import re
+import subprocess
+import sys
+
+from buffer_sizing import PROFILES, timeline
+from host_build import BRIDGE_FLAGS, BRIDGE_SOURCES, build
+from pipeline_sim import BT, CONNECT, DISCONNECT, SILENCE, USB, simulate
+
+SILENCE_HOLD_MS = 2000      # audio_bridge.h: silence before the media is suspended
+SIM_SEED = 1
+
+# Stand-in times for boot_sim, in ms: the parts of the boot the host cannot run.
+BOOT_UAC_INIT_MS = 25       # uac_device_init(): TinyUSB driver and task
+BOOT_ENUMERATE_MS = 150     # the USB host configuring the device
+BOOT_BT_START_MS = 700      # controller, Bluedroid, A2DP and AVRCP
+BOOT_PAGE_MS = 1150         # as connection_test: half a page scan interval, ACL and profile setup
+BOOT_SLACK_MS = 50          # thread scheduling on the host
+BOOT_SOURCES = BRIDGE_SOURCES + ["boot_trace.cpp", "connection_manager.cpp", "hfp_uplink.cpp", "learned_store.cpp",
+                                 "timing_log.cpp", "trace.cpp", "uaca2dp.cpp"]
+# A line of boot_trace_print().
+BOOT_LINE = re.compile(r"^\s+(?P<start>\d+) us  (?P<name>.+?)\s+(?P<state>milestone|running|(?P<dur>\d+) us)"
+                       r"\s+\[(?P<task>[^\]]+)\]$")
+BOOT_ENTRIES = ["app_main", "audio bridge", "usb uac device", "nvs + learned state", "bluetooth a2dp",
+                "bluetooth hfp", "usb enumerated", "a2dp connected"]
+
+# name: (firmware sources, compiler flags)
+TESTS = {
+    "bridge_test": (BRIDGE_SOURCES + ["hfp_uplink.cpp"], BRIDGE_FLAGS),
+    "clock_test": (["clock_estimator.cpp", "rate_feedback.cpp"], []),
+    "connection_test": (["connection_manager.cpp"], []),
+    "dsp_test": (["channel_mix.cpp", "cue_mixer.cpp", "loudness.cpp", "parametric_eq.cpp", "peak_limiter.cpp",
+                  "splice.cpp", "time_stretch.cpp"], []),
+    "learned_test": (BRIDGE_SOURCES + ["learned_store.cpp"], BRIDGE_FLAGS),
+    "seqlock_test": ([], ["-fsanitize=thread"]),
+}
+
+
+def sim_timeline(silent=(), away=(), stalled=()):
+    """Ten seconds of the typical profile as (t_us, side, frames). The USB packets in the
+    `silent` (start_s, end_s) windows are digital silence, the sink is disconnected during
+    the `away` ones and makes no requests during the `stalled` ones."""
+    def inside(t_us, windows):
+        return any(a * 1e6 <= t_us < b * 1e6 for a, b in windows)
+
+    events = []
+    for t_us, side, frames in timeline(PROFILES["typical"], 10, SIM_SEED):
+        if side == USB and inside(t_us, silent):
+            side = SILENCE
+        if side == BT and inside(t_us, stalled):
+            continue
+        events.append((t_us, side, frames))
+    for a, b in away:
+        events += [(int(a * 1e6), DISCONNECT, 0), (int(b * 1e6), CONNECT, 0)]
+    return sorted(events, key=lambda e: e[0])
+
+
+def sim_suspend(out):
+    """Four seconds of host silence: the media is suspended after the hold, the sink's
+    requests (and so its encoding and airtime) stop, and the resume is primed."""
+    r = simulate(sim_timeline(silent=[(2, 6)]))
+    out.append(f"suspended {r.suspended_ms:.0f} ms, {r.airtime_saved():.1%} of the sink's requests "
+               f"and airtime saved, {r.bt_skipped * r.bt_read_ns / 1e6:.2f} ms of bridge CPU "
+               f"({r.bt_read_ns:.0f} ns per request, the SBC encoder on top)")
+    expect_ms = 4000 - SILENCE_HOLD_MS
+    failures = []
+    if r.suspends != 1:
+        failures.append(f"{r.suspends} suspends")
+    if abs(r.suspended_ms - expect_ms) > 20:
+        failures.append(f"suspended {r.suspended_ms:.0f} ms, expected {expect_ms}")
+    if abs(r.airtime_saved() - expect_ms / 10000) > 0.01:
+        failures.append(f"{r.airtime_saved():.1%} of requests skipped, expected {expect_ms / 10000:.0%}")
+    if r.underruns:
+        failures.append(f"{r.underruns} underruns")
+    return failures
+
+
+def sim_reconnect(out):
+    """The sink drops twice: each (re)connect primes to the jitter depth before the stream
+    comes out, with no underruns after it."""
+    r = simulate(sim_timeline(away=[(3, 4), (6, 6.5)]))
+    out.append("time to first audio: " + ", ".join(f"{ms:.1f} ms" for ms in r.first_audio_ms)
+               + " (start, then each reconnect)")
+    failures = []
+    if len(r.first_audio_ms) != 3:
+        failures.append(f"{len(r.first_audio_ms)} connects reached audio, expected 3")
+    failures += [f"first audio after {ms:.1f} ms" for ms in r.first_audio_ms if not 5 <= ms <= 40]
+    if r.underruns:
+        failures.append(f"{r.underruns} underruns")
+    return failures
+
+
+def sim_packet_cost(out):
+    """Host CPU per USB packet on each producer path, the fastest of three runs. With no
+    sink the packet is only counted; a stalled sink fills the ring and every packet then
+    takes the overflow path, which is what the no-sink packets would cost without the gate."""
+    events = sim_timeline(silent=[(2, 5)], away=[(6, 7)], stalled=[(8, 9)])
+    runs = [simulate(events) for _ in range(3)]
+    ns = {path: min(r.usb_packet_ns[path] for r in runs) for path in runs[0].usb_packet_ns}
+    counts = runs[0].usb_packets
+    out.append("ns per packet: " + ", ".join(f"{path} {ns[path]:.0f} ({counts[path]} packets)" for path in ns))
+    failures = []
+    if counts["no_sink"] != 1000:
+        failures.append(f"{counts['no_sink']} packets without a sink, expected 1000")
+    if counts["suspended"] != 3000 - SILENCE_HOLD_MS:
+        failures.append(f"{counts['suspended']} packets suspended, expected {3000 - SILENCE_HOLD_MS}")
+    if counts["overflow"] == 0:
+        failures.append("the stalled sink never filled the ring")
+    if ns["no_sink"] >= ns["overflow"]:
+        failures.append(f"no-sink packets cost {ns['no_sink']:.0f} ns, the overflow path {ns['overflow']:.0f} ns")
+    return failures
+
+
+def sim_boot(out):
+    """The firmware's own bring-up, app_main() on threads in real time with stand-in times
+    for the stacks: each phase of its boot trace, with USB enumerated while Bluetooth is still
+    starting (not after it) and the known sink connected as soon as Bluetooth can page it."""
+    exe = build("boot_sim", BOOT_SOURCES, BRIDGE_FLAGS)
+    args = [BOOT_UAC_INIT_MS, BOOT_ENUMERATE_MS, BOOT_BT_START_MS, BOOT_PAGE_MS]
+    run = subprocess.run([exe] + [str(a) for a in args], stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                         text=True, timeout=30)
+    entries = {}
+    for line in run.stdout.splitlines():
+        m = BOOT_LINE.match(line)
+        if m:
+            entries[m["name"]] = m
+            took = "running" if m["state"] == "running" else "" if m["dur"] is None else f"{int(m['dur']) / 1000:.1f} ms"
+            out.append(f"{m['name']:<20} at {int(m['start']) / 1000:7.1f} ms  {took:>10}  [{m['task']}]")
+    failures = []
+    if run.returncode != 0:
+        failures.append("boot did not finish: " + (run.stdout.splitlines() or ["no output"])[-1])
+    failures += [f"no {name} in the boot trace" for name in BOOT_ENTRIES if name not in entries]
+    failures += [f"{m['name']} never ended" for m in entries.values() if m["state"] == "running"]
+    if failures:
+        return failures
+
+    def at_ms(name):
+        return (int(entries[name]["start"]) - int(entries["app_main"]["start"])) / 1000
+
+    bt_up_ms = at_ms("bluetooth a2dp") + int(entries["bluetooth a2dp"]["dur"]) / 1000
+    usb_ms, sink_ms = at_ms("usb enumerated"), at_ms("a2dp connected")
+    usb_expect_ms = BOOT_UAC_INIT_MS + BOOT_ENUMERATE_MS
+    sink_expect_ms = BOOT_BT_START_MS + BOOT_PAGE_MS
+    out.append(f"from app_main: usb enumerated {usb_ms:.0f} ms (stand-ins {usb_expect_ms}), bluetooth up "
+               f"{bt_up_ms:.0f} ms, a2dp connected {sink_ms:.0f} ms (stand-ins {sink_expect_ms}); "
+               f"one after the other {usb_expect_ms + sink_expect_ms} ms")
+    if usb_ms > usb_expect_ms + BOOT_SLACK_MS:
+        failures.append(f"usb enumerated {usb_ms:.0f} ms after app_main, expected {usb_expect_ms}")
+    if usb_ms >= bt_up_ms:
+        failures.append("usb enumeration waited for bluetooth")
+    if sink_ms > sink_expect_ms + BOOT_SLACK_MS:
+        failures.append(f"a2dp connected {sink_ms:.0f} ms after app_main, expected {sink_expect_ms}")
+    return failures
+
+
+SIM_CHECKS = {
+    "sim_suspend": sim_suspend,
+    "sim_reconnect": sim_reconnect,
+    "sim_packet_cost": sim_packet_cost,
+    "sim_boot": sim_boot,
+}
+
+
+def run_test(name):
+    """(passed, output) of one test or sim check."""
+    if name in SIM_CHECKS:
+        out = []
+        failures = SIM_CHECKS[name](out)
+        out += [f"FAIL {f}" for f in failures]
+        return not failures, "".join(line + "\n" for line in out)
+    sources, flags = TESTS[name]
+    exe = build(name, sources, flags)
+    run = subprocess.run([exe], stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    return run.returncode == 0, run.stdout
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("tests", nargs="*", help="from: " + ", ".join(list(TESTS) + list(SIM_CHECKS)))
+    ap.add_argument("-v", "--verbose", action="store_true")
+    args = ap.parse_args()
+
+    failed = []
+    for name in args.tests or list(TESTS) + list(SIM_CHECKS):
+        if name not in TESTS and name not in SIM_CHECKS:
+            sys.exit(f"unknown test {name}")
+        passed, output = run_test(name)
+        if not passed or args.verbose:
+            print(output, end="")
+        print(f"{name}: {'ok' if passed else 'FAILED'}")
+        if not passed:
+            failed.append(name)
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,208 @@
+// Host test of the learned state: LearnedStore against the in-memory NVS in tools/host
+// (rate limit, record versions), a restore across a simulated reboot into a fresh
+// AudioBridge, and the EQ kept per sink.
+//
+// Built and run by tools/host_tests.py.
+
+#include <stdio.h>
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include "audio_bridge.h"
+#include "learned_store.h"
+
+#define PACKET_FRAMES       48
+#define BLOCK_FRAMES        SBC_FRAME_SAMPLES
+#define BLOCK_US            (BLOCK_FRAMES * 1e6 / AUDIO_SAMPLE_RATE)
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        failures++; \
+    } \
+} while (0)
+
+static const uint8_t SINK_A[6] = { 0x00, 0x1b, 0x66, 0x01, 0x02, 0x03 };
+static const uint8_t SINK_B[6] = { 0x00, 0x1b, 0x66, 0x0a, 0x0b, 0x0c };
+
+// Host streaming into `bridge` and a sink pulling blocks on time, for `ms`.
+static void stream_ms(AudioBridge *bridge, int ms) {
+    static double next_block_us = 0;
+    if (next_block_us < host_time_us) next_block_us = (double) host_time_us;
+    for (int t = 0; t < ms; ++t) {
+        host_time_us += 1000;
+        int16_t packet[PACKET_FRAMES * 2];
+        for (int i = 0; i < PACKET_FRAMES * 2; ++i) packet[i] = 1000;
+        bridge->on_usb_packet((const uint8_t*) packet, sizeof(packet));
+        while (next_block_us <= host_time_us) {
+            int16_t block[BLOCK_FRAMES * 2];
+            bridge->read((uint8_t*) block, sizeof(block));
+            next_block_us += BLOCK_US;
+        }
+    }
+}
+
+static uint32_t depth_ms(const AudioBridge &bridge) {
+    audio_stats_t s;
+    bridge.get_stats(&s);
+    return s.depth_ms;
+}
+
+// Writes only on a real change, at most every LEARNED_SAVE_INTERVAL_S unless forced.
+static void test_rate_limit() {
+    nvs_flash_erase();
+    LearnedStore store;
+    CHECK(store.init(), "init");
+    sink_learned_t rec = { 0, 14, 6000, 10.0f };
+    sink_learned_t got;
+    CHECK(!store.load_sink(SINK_A, &got), "a sink never saved loaded");
+
+    int64_t t = 1000000;
+    CHECK(store.save_sink(SINK_A, rec, t), "first save refused");
+    CHECK(!store.save_sink(SINK_A, rec, t + 1000000), "unchanged record rewritten");
+    rec.consumer_ppm = 10.0f + LEARNED_PPM_STEP / 2;
+    CHECK(!store.save_sink(SINK_A, rec, t + 1000000, true), "a move under LEARNED_PPM_STEP written");
+    rec.consumer_ppm = 12.0f;
+    CHECK(!store.save_sink(SINK_A, rec, t + 1000000), "written again within the interval");
+    CHECK(store.save_sink(SINK_A, rec, t + 1000000, true), "forced save of a real change refused");
+    rec.consumer_ppm = 14.0f;
+    CHECK(store.save_sink(SINK_A, rec, t + (LEARNED_SAVE_INTERVAL_S + 2) * 1000000ll), "save after the interval refused");
+    CHECK(store.writes == 3, "%u writes", (unsigned) store.writes);
+
+    CHECK(store.load_sink(SINK_A, &got) && got.consumer_ppm == 14.0f && got.depth_ms == 14,
+          "loaded %.1f ppm, %u ms", got.consumer_ppm, (unsigned) got.depth_ms);
+    CHECK(!store.load_sink(SINK_B, &got), "another sink's record loaded");
+
+    host_learned_t host = { 0, -35.0f }, host_got;
+    CHECK(!store.load_host(&host_got), "a host never saved loaded");
+    CHECK(store.save_host(host, t), "host save refused");
+    CHECK(!store.save_host(host, t + 1000000, true), "unchanged host record rewritten");
+    CHECK(store.load_host(&host_got) && host_got.host_ppm == -35.0f, "host %.1f ppm", host_got.host_ppm);
+}
+
+// Records written with another layout version are ignored, not misread.
+static void test_old_version_ignored() {
+    nvs_flash_erase();
+    LearnedStore store;
+    store.init();
+    sink_learned_t rec = { 0, 14, 6000, 10.0f };
+    CHECK(store.save_sink(SINK_A, rec, 1000000), "save refused");
+    for (auto &entry : host_nvs) {
+        entry.second[0] = LEARNED_VERSION + 1;      // the version is each record's first byte
+    }
+    LearnedStore rebooted;
+    rebooted.init();
+    sink_learned_t got;
+    CHECK(!rebooted.load_sink(SINK_A, &got), "record of another version loaded");
+}
+
+// What one session converged on comes back after a reboot, into a bridge that has measured
+// nothing yet; a different sink still starts from the defaults.
+static void test_restore_after_reboot() {
+    nvs_flash_erase();
+    sink_learned_t rec;
+    {
+        static AudioBridge bridge;
+        LearnedStore store;
+        store.init();
+        bridge.init();
+        bridge.on_connection_state(ESP_A2D_CONNECTION_STATE_CONNECTED);
+        bridge.restore_sink(store.load_sink(SINK_A, &rec) ? &rec : nullptr);
+        stream_ms(&bridge, 8000);
+        CHECK(bridge.learned_sink(&rec), "nothing learned after 8 s");
+        CHECK(store.save_sink(SINK_A, rec, host_time_us, true), "save refused");
+        // Sink B connects and is restored before the consumer's next block: what is there
+        // to save still belongs to A.
+        bridge.restore_sink(nullptr);
+        sink_learned_t other;
+        CHECK(!bridge.learned_sink(&other), "sink A's state offered for saving while B's restore is pending");
+    }
+    // The converged depth differs from the default, or the check below proves nothing.
+    CHECK(rec.depth_ms != STREAM_PRIME_MS, "learned depth %u ms is the default", (unsigned) rec.depth_ms);
+
+    static AudioBridge bridge;
+    LearnedStore store;
+    store.init();
+    bridge.init();
+    bridge.on_connection_state(ESP_A2D_CONNECTION_STATE_CONNECTED);
+    sink_learned_t got;
+    CHECK(store.load_sink(SINK_A, &got) && got.depth_ms == rec.depth_ms && got.jitter_us == rec.jitter_us &&
+          got.consumer_ppm == rec.consumer_ppm, "record changed in flash");
+    bridge.restore_sink(&got);
+    sink_learned_t now;
+    stream_ms(&bridge, 100);
+    CHECK(depth_ms(bridge) == rec.depth_ms, "primed to %u ms, %u ms restored", (unsigned) depth_ms(bridge),
+          (unsigned) rec.depth_ms);
+    CHECK(!bridge.learned_sink(&now), "learned after 100 ms");
+
+    // Another sink connects: nothing stored for it, back to the defaults.
+    bridge.on_connection_state(ESP_A2D_CONNECTION_STATE_DISCONNECTED);
+    bridge.on_connection_state(ESP_A2D_CONNECTION_STATE_CONNECTED);
+    CHECK(!store.load_sink(SINK_B, &got), "record for a sink never seen");
+    bridge.restore_sink(nullptr);
+    stream_ms(&bridge, 100);
+    CHECK(depth_ms(bridge) == STREAM_PRIME_MS, "primed to %u ms", (unsigned) depth_ms(bridge));
+}
+
+static eq_band_t peak(float freq, float gain_db) {
+    eq_band_t b = {};
+    b.type = EQ_PEAK;
+    b.channels = 3;
+    b.freq = freq;
+    b.gain_db = gain_db;
+    b.q = 1.0f;
+    return b;
+}
+
+// Each sink gets its own EQ back on connect; one never set is flat, and saving bands that
+// did not change writes nothing.
+static void test_eq_per_sink() {
+    nvs_flash_erase();
+    static AudioBridge bridge;
+    LearnedStore store;
+    store.init();
+    bridge.init();
+    sink_eq_t eq;
+    CHECK(!store.load_eq(SINK_A, &eq), "EQ for a sink never set");
+
+    CHECK(bridge.set_eq_band(0, peak(100, 4)) && bridge.set_eq_band(1, peak(3000, -5)), "bands refused");
+    bridge.get_eq(&eq);
+    CHECK(store.save_eq(SINK_A, eq), "sink A's EQ not saved");
+    uint32_t writes = store.writes;
+    CHECK(!store.save_eq(SINK_A, eq) && store.writes == writes, "unchanged EQ rewritten");
+
+    // Sink B: nothing stored, flat.
+    bridge.restore_eq(store.load_eq(SINK_B, &eq) ? &eq : nullptr);
+    bridge.get_eq(&eq);
+    CHECK(eq.band_count == 0, "sink B got %u bands", (unsigned) eq.band_count);
+    bridge.set_eq_band(0, peak(8000, 2));
+    bridge.get_eq(&eq);
+    CHECK(store.save_eq(SINK_B, eq), "sink B's EQ not saved");
+
+    // Sink A again.
+    sink_eq_t got;
+    bridge.restore_eq(store.load_eq(SINK_A, &got) ? &got : nullptr);
+    bridge.get_eq(&eq);
+    CHECK(eq.band_count == 2 && eq.bands[0].freq == 100 && eq.bands[0].gain_db == 4 &&
+          eq.bands[1].freq == 3000 && eq.bands[1].gain_db == -5, "sink A restored with %u bands, %g Hz %g dB first",
+          (unsigned) eq.band_count, eq.bands[0].freq, eq.bands[0].gain_db);
+
+    // A record with a band outside the limits is not applied.
+    got.bands[1].freq = 30000;
+    bridge.restore_eq(&got);
+    bridge.get_eq(&eq);
+    CHECK(eq.band_count == 0, "invalid record applied with %u bands", (unsigned) eq.band_count);
+}
+
+int main() {
+    host_time_us = 1000000;
+    test_rate_limit();
+    test_old_version_ignored();
+    test_restore_after_reboot();
+    test_eq_per_sink();
+    printf("learned_test: %d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,204 @@
+#!/usr/bin/env python3
+"""Performance regression gate: host benchmarks and the pipeline simulator against a baseline.
+
+Measures, and compares with tools/perf_baseline.json:
+
+    bench/<chain>/<stage>/ns_per_frame   dsp_host --bench stage profiles (the firmware's
+                                         StageProfile probes on the TSC), per chain below
+    bench/<chain>/eq/ns_per_band_frame   the EQ's cost divided by the chain's band count
+    bench/<chain>/callback_max_us        slowest whole block, i.e. the longest the encoder
+                                         waits on get_bt_audio_data()
+    sim/<profile>/underruns, overflows   the firmware's AudioBridge (pipeline_sim) at its
+                                         defaults over fixed-seed buffer_sizing timelines,
+                                         with the feedback on where the profile's host follows it
+
+Timings are taken --runs times and the spread between runs is the noise. ns/frame
+compares the median run; the callback time compares the fastest run's slowest block,
+which keeps a preemption in one run from counting as the code's worst case. A timing
+regresses when it is slower than the baseline by more than its relative tolerance
+(scaled by --slack; shared CI runners want 2 or so) and by more than three times the combined noise.
+The simulator is deterministic and reruns with the baseline's trial settings, so any
+increase in its counts is a regression. The table is printed for
+review (--markdown also writes it to a file) and the exit status is 1 on a regression.
+
+    python3 tools/perf_gate.py [--runs 5] [--quality] [--markdown summary.md] [--update]
+
+Timings only compare on the machine the baseline was taken on; the gate warns when the
+CPU differs. --quality also runs audio_quality.py and fails with it.
+"""
+import argparse
+import json
+import os
+import platform
+import statistics
+import subprocess
+import sys
+
+import audio_quality
+from buffer_sizing import PROFILES, timeline
+from pipeline_sim import Config, simulate
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+BASELINE = os.path.join(HERE, "perf_baseline.json")
+
+# Bench chains as dsp_host arguments: everything on, and with the time-stretch engaged.
+BENCHES = {
+    "full": ["--mode", "crossfeed", "--eq", "lowshelf:100:0.7:4", "--eq", "peak:1000:1.4:-6",
+             "--eq", "peak:3000:2:2", "--eq", "highshelf:8000:0.7:3", "--eq", "highpass:20:0.7",
+             "--boost-db", "3", "--loudness", "-18"],
+    "stretch": ["--stretch", "1.02"],
+}
+
+# kind: (relative tolerance, absolute floor)
+TIMING_TOLERANCES = {
+    "ns_per_frame": (0.15, 0.5),
+    "ns_per_band_frame": (0.15, 0.1),
+    "callback_max_us": (0.50, 20.0),
+}
+
+
+def cpu_name():
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("model name"):
+                    return line.split(":", 1)[1].strip()
+    except OSError:
+        pass
+    return platform.processor() or platform.machine()
+
+
+def bench(exe, runs, seconds):
+    """{metric: [value per run]} for every bench chain."""
+    samples = {}
+    # Chains take turns, so a slow spell on the machine hits them all alike; the first
+    # round only warms up.
+    for run in range(runs + 1):
+        for chain, args in BENCHES.items():
+            out = subprocess.run([exe, "--bench", str(seconds)] + args, stdout=subprocess.PIPE,
+                                 stderr=subprocess.PIPE, check=True, text=True).stdout
+            if run == 0:
+                continue
+            result = json.loads(out)
+            ticks_per_ns = result["ticks_per_ns"]
+            for stage, s in result["stages"].items():
+                ns = s["avg_cycles"] * s["count"] / max(s["frames"], 1) / ticks_per_ns
+                samples.setdefault(f"bench/{chain}/{stage}/ns_per_frame", []).append(ns)
+                if stage == "eq":
+                    samples.setdefault(f"bench/{chain}/eq/ns_per_band_frame", []).append(ns / args.count("--eq"))
+            worst = result["stages"]["bt read"]["max_cycles"] / ticks_per_ns / 1000
+            samples.setdefault(f"bench/{chain}/callback_max_us", []).append(worst)
+    return samples
+
+
+def sim(trials, duration_s):
+    """{metric: count} for every buffer_sizing profile at the firmware defaults."""
+    counts = {}
+    for name in PROFILES:
+        cfg = Config(feedback=PROFILES[name].feedback)
+        under = over = 0
+        for i in range(trials):
+            r = simulate(timeline(PROFILES[name], duration_s, 1000003 + i), cfg)
+            under += r.underruns
+            over += r.overflows
+        counts[f"sim/{name}/underruns"] = under
+        counts[f"sim/{name}/overflows"] = over
+    return counts
+
+
+def spread(values):
+    """Noise of repeated runs: the median absolute deviation, scaled to a standard deviation."""
+    if len(values) < 2:
+        return 0.0
+    m = statistics.median(values)
+    return 1.4826 * statistics.median(abs(v - m) for v in values)
+
+
+def summarize(metric, values):
+    best = min(values) if metric.endswith("callback_max_us") else statistics.median(values)
+    return {"median": round(best, 3), "spread": round(spread(values), 3)}
+
+
+def judge(metric, now, base, slack):
+    """Returns (status, change) for one metric."""
+    if base is None:
+        return "new", ""
+    if metric.startswith("sim/"):
+        if now > base:
+            return "REGRESSION", f"+{now - base}"
+        return ("better" if now < base else "ok"), (f"{now - base:+d}" if now != base else "")
+    rel, floor = TIMING_TOLERANCES[metric.rsplit("/", 1)[1]]
+    delta = now["median"] - base["median"]
+    margin = max(rel * slack * base["median"], floor, 3 * (base["spread"] ** 2 + now["spread"] ** 2) ** 0.5)
+    change = f"{delta / base['median'] * 100:+.1f}%" if base["median"] else ""
+    if delta > margin:
+        return "REGRESSION", change
+    if -delta > margin:
+        return "better", change
+    return "ok", change
+
+
+def show(value):
+    if isinstance(value, dict):
+        return f"{value['median']:.2f} ± {value['spread']:.2f}"
+    return "-" if value is None else str(value)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("--runs", type=int, default=5, help="bench repetitions per chain")
+    ap.add_argument("--bench-s", type=float, default=10.0, help="audio processed per bench run")
+    ap.add_argument("--sim-trials", type=int, default=50, help="simulated timelines per profile (--update)")
+    ap.add_argument("--sim-duration-s", type=float, default=10.0, help="(--update)")
+    ap.add_argument("--slack", type=float, default=1.0, help="scales the relative timing tolerances")
+    ap.add_argument("--baseline", default=BASELINE)
+    ap.add_argument("--markdown", help="also write the summary table here")
+    ap.add_argument("--quality", action="store_true", help="also run audio_quality.py")
+    ap.add_argument("--update", action="store_true", help="store the results as the baseline")
+    args = ap.parse_args()
+
+    baseline = {"machine": None, "metrics": {}}
+    if os.path.exists(args.baseline) and not args.update:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+    sim_settings = baseline.get("sim", {"trials": args.sim_trials, "duration_s": args.sim_duration_s})
+
+    exe = audio_quality.build()
+    current = {m: summarize(m, v) for m, v in bench(exe, args.runs, args.bench_s).items()}
+    current.update(sim(sim_settings["trials"], sim_settings["duration_s"]))
+    machine = cpu_name()
+
+    if args.update:
+        with open(args.baseline, "w") as f:
+            json.dump({"machine": machine, "sim": sim_settings, "metrics": current}, f, indent=1, sort_keys=True)
+            f.write("\n")
+        print(f"baseline written to {os.path.relpath(args.baseline)}")
+        return
+    lines = ["| metric | baseline | current | change | |", "|---|---:|---:|---:|---|"]
+    regressions = 0
+    for metric in sorted(current):
+        base = baseline["metrics"].get(metric)
+        status, change = judge(metric, current[metric], base, args.slack)
+        regressions += status == "REGRESSION"
+        lines.append(f"| {metric} | {show(base)} | {show(current[metric])} | {change} | {status} |")
+    for metric in sorted(set(baseline["metrics"]) - set(current)):
+        lines.append(f"| {metric} | {show(baseline['metrics'][metric])} | - | | gone |")
+    notes = []
+    if baseline["machine"] and baseline["machine"] != machine:
+        notes.append(f"Baseline taken on {baseline['machine']}, running on {machine}: timings are not comparable.")
+    notes.append(f"{regressions} regression(s)." if regressions else "No regressions.")
+    summary = "\n".join(lines + [""] + notes)
+    print(summary)
+    if args.markdown:
+        with open(args.markdown, "w") as f:
+            f.write(summary + "\n")
+
+    failed = regressions > 0
+    if args.quality:
+        print()
+        failed |= subprocess.run([sys.executable, os.path.join(HERE, "audio_quality.py")]).returncode != 0
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,122 @@
+"""Replays USB packet and Bluetooth request timelines through the firmware's AudioBridge.
+
+Each (t_us, side, frames) event is handed to the real on_usb_packet(), read() or
+on_connection_state() in simulated time by tools/bridge_sim.cpp, built against
+firmware/src like the host tests, so the ring, priming, the jitter depth, the host-stop
+timeout, the silence suspend, the flush and pre-roll on (re)connect, the time-stretch
+controller (including its wait for a saturated feedback) and the splices are the
+firmware's own. The sink skips the requests that fall while the media is suspended or it
+is disconnected; those are the encoder and radio work saved. Settings other than the
+firmware's are compiled in: each Config gets its own executable, built once and cached
+(see host_build.py). Used by timing_replay.py to replay logs recorded on the device, by
+buffer_sizing.py and perf_gate.py, and by the sim checks in host_tests.py.
+
+Not modeled: the host reacting to the feedback (packet sizes are taken as given, so a
+timeline from a host that follows it already carries only the residual drift), and the
+delay between a media start or a page and the sink's first request (the timeline's next
+request is taken).
+"""
+import json
+import subprocess
+from dataclasses import dataclass, field, fields
+
+from host_build import BRIDGE_FLAGS, BRIDGE_SOURCES, build as host_build
+
+SAMPLE_RATE = 48000
+FRAME_BYTES = 4
+USB, BT = "usb", "bt"
+SILENCE = "silence"                     # a USB packet of digital silence
+CONNECT, DISCONNECT = "connect", "disconnect"
+
+
+@dataclass(frozen=True)
+class Config:
+    """Pipeline settings; None is the firmware's value."""
+    ring_bytes: int = None              # RINGBUF_SIZE
+    depth_ms: int = None                # pins the jitter depth; None: STREAM_PRIME_MS, then learned
+    usb_timeout_ms: int = None          # USB_STREAM_TIMEOUT_MS
+    stretch: bool = True                # False: the time-stretch never engages
+    feedback: bool = False              # a feedback callback: stretch waits for it to saturate
+    stretch_engage_ms: int = None       # STRETCH_ENGAGE_MS
+    stretch_release_ms: int = None      # STRETCH_RELEASE_MS
+    stretch_full_ms: int = None         # STRETCH_FULL_MS
+    stretch_max_rate: float = None      # WSOLA_MAX_RATE
+
+    def label(self):
+        """The settings that differ from the defaults, e.g. "ring_bytes=16384 depth_ms=10"."""
+        default = Config()
+        diff = [f"{f.name}={getattr(self, f.name)}" for f in fields(self)
+                if getattr(self, f.name) != getattr(default, f.name)]
+        return " ".join(diff) or "defaults"
+
+    def defines(self):
+        """Compiler flags that build the bridge with these settings."""
+        flags = []
+        if self.ring_bytes is not None:
+            flags.append(f"-DRINGBUF_SIZE={self.ring_bytes}")
+        if self.depth_ms is not None:
+            flags += [f"-D{name}={self.depth_ms}"
+                      for name in ("STREAM_PRIME_MS", "JITTER_DEPTH_MIN_MS", "JITTER_DEPTH_MAX_MS")]
+        if self.usb_timeout_ms is not None:
+            flags.append(f"-DUSB_STREAM_TIMEOUT_MS={self.usb_timeout_ms}")
+        if not self.stretch:
+            flags.append("-DSTRETCH_ENGAGE_MS=100000")
+        elif self.stretch_engage_ms is not None:
+            flags.append(f"-DSTRETCH_ENGAGE_MS={self.stretch_engage_ms}")
+        if self.stretch_release_ms is not None:
+            flags.append(f"-DSTRETCH_RELEASE_MS={self.stretch_release_ms}")
+        if self.stretch_full_ms is not None:
+            flags.append(f"-DSTRETCH_FULL_MS={self.stretch_full_ms}")
+        if self.stretch_max_rate is not None:
+            flags.append(f"-DWSOLA_MAX_RATE={self.stretch_max_rate}f")
+        return flags
+
+
+@dataclass
+class Result:
+    underruns: int = 0          # requests that ran dry while streaming
+    overflows: int = 0          # packets that pushed old audio out of the ring
+    splices: int = 0            # drops and pads crossfaded
+    host_starts: int = 0
+    host_stops: int = 0
+    stretch_ms: float = 0.0     # time spent at a rate other than 1.0
+    duration_ms: float = 0.0
+    suspends: int = 0           # silence suspends
+    suspended_ms: float = 0.0   # time with the media suspended
+    bt_requests: int = 0        # requests the sink made
+    bt_skipped: int = 0         # requests it did not make: media suspended or no connection
+    bt_read_ns: float = 0.0     # host CPU per request made
+    usb_packets: dict = field(default_factory=dict)     # per producer path: no_sink, suspended, queued, overflow
+    usb_packet_ns: dict = field(default_factory=dict)   # host CPU per packet on each path
+    first_audio_ms: list = field(default_factory=list)  # each connect (the first at the start) to audio
+    latency_ms: list = field(default_factory=list, repr=False)  # ring fill after each streaming request
+
+    def airtime_saved(self):
+        """Fraction of the sink's requests, and so of the encoding and airtime, not made."""
+        total = self.bt_requests + self.bt_skipped
+        return self.bt_skipped / total if total else 0.0
+
+    def latency_percentile(self, fraction):
+        if not self.latency_ms:
+            return 0.0
+        ordered = sorted(self.latency_ms)
+        return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))]
+
+    def latency_mean(self):
+        return sum(self.latency_ms) / len(self.latency_ms) if self.latency_ms else 0.0
+
+
+def build(cfg=Config()):
+    """Path of the simulator built with `cfg`'s settings; callers running many configs in
+    parallel build them up front so the workers don't all compile the same one."""
+    return host_build("bridge_sim", BRIDGE_SOURCES, BRIDGE_FLAGS + cfg.defines())
+
+
+def simulate(events, cfg=Config()):
+    """Runs `events`, an iterable of (t_us, side, frames) in time order, through the bridge."""
+    args = [build(cfg)] + (["--feedback"] if cfg.feedback else [])
+    text = "".join(f"{t_us} {side} {frames}\n" for t_us, side, frames in events)
+    out = subprocess.run(args, input=text, stdout=subprocess.PIPE, check=True, text=True).stdout
+    counts = json.loads(out.splitlines()[-1])
+    latency_us = counts.pop("latency_us")
+    return Result(latency_ms=[v / 1000 for v in latency_us], **counts)
@@ -0,0 +1,100 @@
+// Torture test of SeqLock (control_params.h): writer threads publish control_params_t
+// values whose every field is derived from one counter, reader threads snapshot them as
+// fast as they can and check that no snapshot mixes two writes. Built with
+// ThreadSanitizer, which also fails the run on any data race.
+//
+// Built and run by tools/host_tests.py.
+
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include "control_params.h"
+
+#define WRITERS             2
+#define READERS             3
+#define WRITES_PER_WRITER   50000
+
+static SeqLock<control_params_t> params;
+static std::atomic<int> writers_done{0};
+static std::atomic<int> failures{0};
+static uint32_t counter = 0;        // under the writer lock
+
+// Every field from `n`, so a torn snapshot cannot look whole.
+static void fill(control_params_t &p, uint32_t n) {
+    p.volume = n;
+    p.mute = n & 1;
+    p.gain = (float) n;
+    p.boost_db = (float) n;
+    p.ramp_ms = (uint16_t) n;
+    p.channel_mode = (channel_mode_t)(n % CHANNEL_MODE_COUNT);
+    p.eq.band_count = (uint8_t)(n % (EQ_MAX_BANDS + 1));
+    for (int b = 0; b < EQ_MAX_BANDS; ++b) {
+        p.eq.bands[b].freq = (float) n;
+        p.eq.coeffs[0][b].b0 = (float) n;
+        p.eq.coeffs[1][b].a2 = (float) n;
+    }
+    p.eq.version = n;
+    p.limiter_ceiling = (float) n;
+    p.loudness_target_lufs = (float) n;
+}
+
+static bool whole(const control_params_t &p) {
+    control_params_t expect;
+    fill(expect, p.volume);
+    if (p.mute != expect.mute || p.gain != expect.gain || p.boost_db != expect.boost_db ||
+        p.ramp_ms != expect.ramp_ms || p.channel_mode != expect.channel_mode ||
+        p.eq.band_count != expect.eq.band_count || p.eq.version != expect.eq.version ||
+        p.limiter_ceiling != expect.limiter_ceiling || p.loudness_target_lufs != expect.loudness_target_lufs) {
+        return false;
+    }
+    for (int b = 0; b < EQ_MAX_BANDS; ++b) {
+        if (p.eq.bands[b].freq != expect.eq.bands[b].freq || p.eq.coeffs[0][b].b0 != expect.eq.coeffs[0][b].b0 ||
+            p.eq.coeffs[1][b].a2 != expect.eq.coeffs[1][b].a2) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void writer() {
+    for (int i = 0; i < WRITES_PER_WRITER; ++i) {
+        params.update([](control_params_t &p) { fill(p, ++counter); });
+    }
+    writers_done++;
+}
+
+static void reader(int id) {
+    uint32_t last = 0, reads = 0, torn = 0, backwards = 0;
+    while (writers_done.load() < WRITERS) {
+        const control_params_t p = params.read();
+        reads++;
+        if (p.volume == 100 && p.gain == 1.0f) {
+            continue;   // the initial value, before any write
+        }
+        if (!whole(p)) torn++;
+        if (p.volume < last) backwards++;
+        last = p.volume;
+    }
+    printf("reader %d: %u snapshots, %u torn, %u went backwards\n", id, (unsigned) reads, (unsigned) torn,
+           (unsigned) backwards);
+    if (torn || backwards) failures++;
+}
+
+int main() {
+    std::thread threads[WRITERS + READERS];
+    for (int i = 0; i < READERS; ++i) threads[i] = std::thread(reader, i);
+    for (int i = 0; i < WRITERS; ++i) threads[READERS + i] = std::thread(writer);
+    for (std::thread &t : threads) t.join();
+
+    const control_params_t p = params.read();
+    if (p.volume != WRITERS * WRITES_PER_WRITER || !whole(p)) {
+        printf("FAIL final value %u\n", (unsigned) p.volume);
+        failures++;
+    }
+    if (params.version() != 2u * WRITERS * WRITES_PER_WRITER) {
+        printf("FAIL version %u\n", (unsigned) params.version());
+        failures++;
+    }
+    printf("seqlock_test: %d failures\n", failures.load());
+    return failures ? 1 : 0;
+}
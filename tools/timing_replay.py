@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+"""Replay a timing log recorded on the device against other pipeline settings.
+
+Start the log with vendor request 0x08 (wValue 1 to run until stopped, 2 to freeze one
+second after the first underrun or overflow) and capture the console. A frozen log dumps
+itself; wValue 0 stops and dumps by hand. The dump sits between "--- timing begin ---"
+and "--- timing end ---"; anything around it in the log is ignored.
+
+Every combination of the given settings is run through the firmware's AudioBridge
+(pipeline_sim) and compared on underruns, overflows, splices and ring latency:
+
+    python3 tools/timing_replay.py console.log --ring-kb 8,16 --depth-ms 10,20,32 --stretch on,off
+
+--csv writes the decoded events as "t_us,side,frames" for other tools, and a .csv file
+is accepted as input in place of a console log. The replay starts cold, so the first
+depth's worth of audio is primed afresh rather than picked up mid-stream.
+"""
+import argparse
+import itertools
+import sys
+
+from pipeline_sim import BT, USB, Config, simulate
+
+FRAMES_BITS = 11    # TIMING_FRAMES_BITS
+DELTA_BITS = 19     # TIMING_DELTA_BITS
+# timing_kind_t: bit 0 is the side.
+KIND_PACKET, KIND_REQUEST, KIND_OVERFLOW, KIND_UNDERRUN = range(4)
+SIDES = (USB, BT)
+
+
+def parse_dump(lines):
+    """Returns (events, glitches) from the first dump in `lines`.
+
+    events: (t_us, side, frames) in time order. glitches: {"overflow": [t_us...],
+    "underrun": [t_us...]} as seen by the device."""
+    inside = False
+    last, words = {}, []
+    for line in lines:
+        line = line.strip()
+        if line == "--- timing begin ---":
+            inside = True
+            continue
+        if not inside:
+            continue
+        if line == "--- timing end ---":
+            break
+        fields = line.split()
+        if not fields:
+            continue
+        if fields[0] == "last":
+            last = {0: int(fields[1]), 1: int(fields[2])}
+        elif fields[0] in ("started", "records"):
+            pass
+        else:
+            words += [int(line[i:i + 8], 16) for i in range(0, len(line), 8)]
+    if not inside:
+        raise ValueError("no timing dump found")
+    # Each side's deltas chain back from its last timestamp.
+    now = dict(last)
+    decoded = []
+    for index in range(len(words) - 1, -1, -1):
+        word = words[index]
+        kind = word >> 30
+        frames = (word >> DELTA_BITS) & ((1 << FRAMES_BITS) - 1)
+        delta = word & ((1 << DELTA_BITS) - 1)
+        side = kind & 1
+        decoded.append((now[side], index, kind, frames))
+        now[side] -= delta
+    decoded.sort()
+    events, glitches = [], {"overflow": [], "underrun": []}
+    for t_us, _, kind, frames in decoded:
+        if kind == KIND_OVERFLOW:
+            glitches["overflow"].append(t_us)
+        elif kind == KIND_UNDERRUN:
+            glitches["underrun"].append(t_us)
+        elif frames > 0:    # zero frames: a time filler
+            events.append((t_us, SIDES[kind], frames))
+    return events, glitches
+
+
+def read_csv(lines):
+    events = []
+    for line in lines:
+        line = line.strip()
+        if not line or line.startswith("t_us"):
+            continue
+        t_us, side, frames = line.split(",")
+        events.append((int(t_us), side, int(frames)))
+    return events
+
+
+def parse_list(text, convert):
+    return [convert(v) for v in text.split(",")]
+
+
+def on_off(text):
+    if text not in ("on", "off"):
+        raise argparse.ArgumentTypeError("expected on or off")
+    return text == "on"
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("input", help="console log with a timing dump, or a t_us,side,frames CSV")
+    ap.add_argument("--ring-kb", type=lambda s: parse_list(s, float), help="ring sizes, e.g. 8,16")
+    ap.add_argument("--depth-ms", type=lambda s: parse_list(s, int), help="pinned jitter depths, e.g. 10,20,32")
+    ap.add_argument("--stretch", type=lambda s: parse_list(s, on_off), help="time-stretch on,off")
+    ap.add_argument("--feedback", type=lambda s: parse_list(s, on_off), help="asynchronous feedback on,off")
+    ap.add_argument("--usb-timeout-ms", type=lambda s: parse_list(s, int), help="host-stop timeouts")
+    ap.add_argument("--csv", help="write the decoded events here")
+    args = ap.parse_args()
+
+    with open(args.input) as f:
+        lines = f.readlines()
+    glitches = None
+    if args.input.endswith(".csv"):
+        events = read_csv(lines)
+    else:
+        events, glitches = parse_dump(lines)
+    if not events:
+        sys.exit("no events in the log")
+    if args.csv:
+        with open(args.csv, "w") as f:
+            f.write("t_us,side,frames\n")
+            for t_us, side, frames in events:
+                f.write(f"{t_us},{side},{frames}\n")
+
+    usb = [e for e in events if e[1] == USB]
+    bt = [e for e in events if e[1] == BT]
+    span_s = (events[-1][0] - events[0][0]) / 1e6
+    print(f"{span_s:.2f} s: {len(usb)} USB packets ({sum(e[2] for e in usb)} frames), "
+          f"{len(bt)} Bluetooth requests ({sum(e[2] for e in bt)} frames)")
+    if glitches is not None:
+        print(f"on the device: {len(glitches['underrun'])} underruns, {len(glitches['overflow'])} overflows")
+
+    default = Config()
+    grid = {
+        "ring_bytes": [int(kb * 1024) for kb in args.ring_kb] if args.ring_kb else [default.ring_bytes],
+        "depth_ms": args.depth_ms or [default.depth_ms],
+        "stretch": args.stretch or [default.stretch],
+        "feedback": args.feedback or [default.feedback],
+        "usb_timeout_ms": args.usb_timeout_ms or [default.usb_timeout_ms],
+    }
+    print(f"{'underruns':>9} {'overflows':>9} {'splices':>7} {'stretch':>8} "
+          f"{'lat mean':>8} {'p99':>6} {'max':>6}  settings")
+    for values in itertools.product(*grid.values()):
+        cfg = Config(**dict(zip(grid.keys(), values)))
+        r = simulate(events, cfg)
+        print(f"{r.underruns:9d} {r.overflows:9d} {r.splices:7d} {r.stretch_ms:6.0f}ms "
+              f"{r.latency_mean():6.1f}ms {r.latency_percentile(0.99):4.1f}ms "
+              f"{r.latency_percentile(1.0):4.1f}ms  {cfg.label()}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""Convert an audio-path event trace dumped by the firmware into Chrome trace JSON.
+
+Start a trace with vendor request 0x07 (wValue 1), stop and dump it with wValue 0, and
+capture the console. The dump sits between "--- trace begin ---" and "--- trace end ---";
+anything around it in the log is ignored. Open the result in Perfetto (ui.perfetto.dev)
+or chrome://tracing.
+
+    python3 tools/trace2chrome.py console.log -o trace.json
+"""
+import argparse
+import json
+import struct
+import sys
+
+EVENT = struct.Struct("<IBBBBi")    # trace_event_t
+KINDS = {0: "B", 1: "E", 2: "C", 3: "i"}
+PID = 1
+
+
+def parse_dump(lines):
+    """Returns (cpu_hz, sync, names, events) from the first dump in `lines`."""
+    inside = False
+    cpu_hz, sync, names, raw = 0, {}, {}, []
+    for line in lines:
+        line = line.strip()
+        if line == "--- trace begin ---":
+            inside = True
+            continue
+        if not inside:
+            continue
+        if line == "--- trace end ---":
+            break
+        fields = line.split()
+        if not fields:
+            continue
+        if fields[0] == "cpu_hz":
+            cpu_hz = int(fields[1])
+        elif fields[0] == "sync":
+            sync[int(fields[1])] = (int(fields[2]), int(fields[3]))
+        elif fields[0] == "name":
+            names[int(fields[1])] = (fields[2], None if fields[3] == "-" else fields[3])
+        elif fields[0] == "events":
+            pass
+        else:
+            raw.append(bytes.fromhex(line))
+    if not inside:
+        raise ValueError("no trace dump found")
+    data = b"".join(raw)
+    events = [EVENT.unpack_from(data, off) for off in range(0, len(data) - EVENT.size + 1, EVENT.size)]
+    return cpu_hz, sync, names, events
+
+
+def timestamps(cpu_hz, sync, events):
+    """Microseconds on the esp_timer clock for every event. The cycle counters are per core
+    and wrap every ~18 s, so each core is walked backwards from its sync point (taken when
+    the trace stopped) in signed 32-bit steps."""
+    ticks_per_us = cpu_hz / 1e6
+    stamps = [0.0] * len(events)
+    prev, offset = {}, {}
+    for i in range(len(events) - 1, -1, -1):
+        cycles, core = events[i][0], events[i][3]
+        sync_cycles, sync_us = sync.get(core, (cycles, 0))
+        step = (prev.get(core, sync_cycles) - cycles) & 0xFFFFFFFF
+        if step >= 1 << 31:
+            step -= 1 << 32     # recorded slightly out of order (preempted between index and stamp)
+        offset[core] = offset.get(core, 0) + step
+        prev[core] = cycles
+        stamps[i] = sync_us - offset[core] / ticks_per_us
+    return stamps
+
+
+def to_chrome(cpu_hz, sync, names, events):
+    """Chrome trace events, timestamps in microseconds from the first event."""
+    out = []
+    tracks = sorted({track for _, track in names.values() if track})
+    tids = {track: i + 1 for i, track in enumerate(tracks)}
+    for track, tid in tids.items():
+        out.append({"ph": "M", "pid": PID, "tid": tid, "name": "thread_name", "args": {"name": track}})
+    out.append({"ph": "M", "pid": PID, "name": "process_name", "args": {"name": "uaca2dp"}})
+    stamps = timestamps(cpu_hz, sync, events)
+    origin = min(stamps) if stamps else 0.0
+    for (cycles, ident, kind, core, _, value), ts in zip(events, stamps):
+        name, track = names.get(ident, ("event%d" % ident, None))
+        ev = {"name": name, "ph": KINDS.get(kind, "i"), "ts": round(ts - origin, 3), "pid": PID}
+        if kind == 2:
+            ev["args"] = {name: value}
+        else:
+            ev["tid"] = tids.get(track, 0)
+            ev["args"] = {"core": core}
+            if kind == 3:
+                ev["s"] = "t"
+        out.append(ev)
+    return {"traceEvents": out, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", nargs="?", help="console capture (default: stdin)")
+    parser.add_argument("-o", "--output", help="JSON output (default: stdout)")
+    args = parser.parse_args()
+    with (open(args.log, errors="replace") if args.log else sys.stdin) as f:
+        cpu_hz, sync, names, events = parse_dump(f)
+    trace = to_chrome(cpu_hz, sync, names, events)
+    with (open(args.output, "w") if args.output else sys.stdout) as f:
+        json.dump(trace, f)
+    spans = sum(1 for e in events if e[2] == 0)
+    print("%d events (%d spans) -> %s" % (len(events), spans, args.output or "stdout"), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()